@@ -38,7 +38,8 @@ module fifo
   input  wire [DATA_BITS-1:0] wr_data,  // Data to be written on wr_en
   output wire [DATA_BITS-1:0] rd_data,  // Current front of fifo data
   output wire                 full,     // FIFO is full (writes invalid)
-  output wire                 empty     // FIFO is empty (reads invalid)
+  output wire                 empty,    // FIFO is empty (reads invalid)
+  output wire [ADDR_BITS:0]   count     // Number of entries currently in the FIFO
 );
 
 reg  [ADDR_BITS-1:0] q_rd_ptr;
@@ -106,6 +107,7 @@ assign d_full  = ((q_full && !rd_en_prot) ||
 assign rd_data = q_data_array[q_rd_ptr];
 assign full    = q_full;
 assign empty   = q_empty;
+assign count   = { q_full, q_wr_ptr - q_rd_ptr };  // pointers are equal when full
 
 endmodule
 
@@ -34,24 +34,29 @@
 
 module uart
 #(
-  parameter SYS_CLK_FREQ = 50000000,
-  parameter BAUD_RATE    = 19200,
-  parameter DATA_BITS    = 8,
-  parameter STOP_BITS    = 1,
-  parameter PARITY_MODE  = 0  // 0 = none, 1 = odd, 2 = even
+  parameter BAUD_INC_BITS     = 24,
+  parameter DATA_BITS         = 8,
+  parameter STOP_BITS         = 1,
+  parameter PARITY_MODE       = 0, // 0 = none, 1 = odd, 2 = even
+  parameter RX_FIFO_ADDR_BITS = 3, // log2 of RX FIFO depth
+  parameter TX_FIFO_ADDR_BITS = 3  // log2 of TX FIFO depth
 )
 (
-  input  wire                 clk,        // System clk
-  input  wire                 reset,      // Reset signal
-  input  wire                 rx,         // RS-232 rx pin
-  input  wire [DATA_BITS-1:0] tx_data,    // Data to be transmitted when wr_en is 1
-  input  wire                 rd_en,      // Pops current read FIFO front off the queue
-  input  wire                 wr_en,      // Write tx_data over serial connection
-  output wire                 tx,         // RS-232 tx pin
-  output wire [DATA_BITS-1:0] rx_data,    // Data currently at front of read FIFO
-  output wire                 rx_empty,   // 1 if there is no more read data available
-  output wire                 tx_full,    // 1 if the transmit FIFO cannot accept more requests
-  output wire                 parity_err  // 1 if a parity error has been detected
+  input  wire                       clk,        // System clk
+  input  wire                       reset,      // Reset signal
+  input  wire                       rx,         // RS-232 rx pin
+  input  wire [BAUD_INC_BITS-1:0]   baud_inc,   // baud clk phase increment (see uart_baud_clk)
+  input  wire [DATA_BITS-1:0]       tx_data,    // Data to be transmitted when wr_en is 1
+  input  wire                       rd_en,      // Pops current read FIFO front off the queue
+  input  wire                       wr_en,      // Write tx_data over serial connection
+  output wire                       tx,         // RS-232 tx pin
+  output wire [DATA_BITS-1:0]       rx_data,    // Data currently at front of read FIFO
+  output wire                       rx_empty,   // 1 if there is no more read data available
+  output wire                       tx_full,    // 1 if the transmit FIFO cannot accept more data
+  output wire                       tx_idle,    // 1 if all transmit data has been shifted out
+  output wire [RX_FIFO_ADDR_BITS:0] rx_free,    // Number of free entries in the read FIFO
+  output wire [TX_FIFO_ADDR_BITS:0] tx_free,    // Number of free entries in the transmit FIFO
+  output wire                       parity_err  // 1 if a parity error has been detected
 );
 
 localparam BAUD_CLK_OVERSAMPLE_RATE = 16;
@@ -65,6 +70,10 @@ wire                 rx_parity_err;
 wire [DATA_BITS-1:0] tx_fifo_rd_data;
 wire                 tx_done_tick;
 wire                 tx_fifo_empty;
+wire                 tx_blk_idle;
+
+wire [RX_FIFO_ADDR_BITS:0] rx_fifo_count;
+wire [TX_FIFO_ADDR_BITS:0] tx_fifo_count;
 
 // Store parity error in a flip flop as persistent state.
 reg  q_rx_parity_err;
@@ -82,12 +91,11 @@ assign parity_err      = q_rx_parity_err;
 assign d_rx_parity_err = q_rx_parity_err || rx_parity_err;
 
 // BAUD clock module
-uart_baud_clk #(.SYS_CLK_FREQ(SYS_CLK_FREQ),
-                .BAUD(BAUD_RATE),
-                .BAUD_CLK_OVERSAMPLE_RATE(BAUD_CLK_OVERSAMPLE_RATE)) uart_baud_clk_blk
+uart_baud_clk #(.ACC_BITS(BAUD_INC_BITS)) uart_baud_clk_blk
 (
   .clk(clk),
   .reset(reset),
+  .baud_inc(baud_inc),
   .baud_clk_tick(baud_clk_tick)
 );
 
@@ -118,12 +126,15 @@ uart_tx #(.DATA_BITS(DATA_BITS),
   .tx_start(~tx_fifo_empty),
   .tx_data(tx_fifo_rd_data),
   .tx_done_tick(tx_done_tick),
-  .tx(tx)
+  .tx(tx),
+  .idle(tx_blk_idle)
 );
 
+assign tx_idle = tx_fifo_empty && tx_blk_idle;
+
 // RX FIFO
 fifo #(.DATA_BITS(DATA_BITS),
-       .ADDR_BITS(3)) uart_rx_fifo
+       .ADDR_BITS(RX_FIFO_ADDR_BITS)) uart_rx_fifo
 (
   .clk(clk),
   .reset(reset),
@@ -132,12 +143,13 @@ fifo #(.DATA_BITS(DATA_BITS),
   .wr_data(rx_fifo_wr_data),
   .rd_data(rx_data),
   .empty(rx_empty),
-  .full()
+  .full(),
+  .count(rx_fifo_count)
 );
 
 // TX FIFO
 fifo #(.DATA_BITS(DATA_BITS),
-       .ADDR_BITS(3)) uart_tx_fifo
+       .ADDR_BITS(TX_FIFO_ADDR_BITS)) uart_tx_fifo
 (
   .clk(clk),
   .reset(reset),
@@ -146,8 +158,12 @@ fifo #(.DATA_BITS(DATA_BITS),
   .wr_data(tx_data),
   .rd_data(tx_fifo_rd_data),
   .empty(tx_fifo_empty),
-  .full(tx_full)
+  .full(tx_full),
+  .count(tx_fifo_count)
 );
 
+assign rx_free = (1 << RX_FIFO_ADDR_BITS) - rx_fifo_count;
+assign tx_free = (1 << TX_FIFO_ADDR_BITS) - tx_fifo_count;
+
 endmodule
 
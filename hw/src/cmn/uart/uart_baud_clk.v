@@ -24,36 +24,38 @@
 *
 *  Generates a tick signal at OVERSAMPLE_RATE times the baud rate.  Should be fed to the uart_rx
 *  and uart_tx blocks.
+*
+*  The tick is the carry out of a phase accumulator that advances by baud_inc every clk, so the baud
+*  rate can be changed at runtime and rates that are not an integer divisor of the system clock
+*  (e.g., 3Mbaud at 100MHz) are still generated with negligible average error:
+*
+*    baud_inc = (BAUD * BAUD_CLK_OVERSAMPLE_RATE * 2^ACC_BITS) / SYS_CLK_FREQ
 ***************************************************************************************************/
 
 module uart_baud_clk
 #(
-  parameter SYS_CLK_FREQ             = 50000000,
-  parameter BAUD                     = 19200,
-  parameter BAUD_CLK_OVERSAMPLE_RATE = 16
+  parameter ACC_BITS = 24
 )
 (
-  input  wire clk,
-  input  wire reset,
-  output wire baud_clk_tick
+  input  wire                clk,
+  input  wire                reset,
+  input  wire [ACC_BITS-1:0] baud_inc,  // phase increment per clk (see above)
+  output wire                baud_clk_tick
 );
 
-localparam [15:0] CLKS_PER_OVERSAMPLE_TICK = (SYS_CLK_FREQ / BAUD) / BAUD_CLK_OVERSAMPLE_RATE;
-
 // Registers
-reg  [15:0] q_cnt;
-wire [15:0] d_cnt;
+reg  [ACC_BITS-1:0] q_acc;
+wire [ACC_BITS:0]   d_acc;
 
 always @(posedge clk, posedge reset)
   begin
     if (reset)
-      q_cnt <= 0;
+      q_acc <= 0;
     else
-      q_cnt <= d_cnt;
+      q_acc <= d_acc[ACC_BITS-1:0];
   end
 
-assign d_cnt         = (q_cnt == (CLKS_PER_OVERSAMPLE_TICK - 1)) ? 16'h0000 : (q_cnt + 16'h0001);
-assign baud_clk_tick = (q_cnt == (CLKS_PER_OVERSAMPLE_TICK - 1)) ? 1'b1     : 1'b0;
+assign d_acc         = { 1'b0, q_acc } + { 1'b0, baud_inc };
+assign baud_clk_tick = d_acc[ACC_BITS];
 
 endmodule
-
@@ -39,7 +39,8 @@ module uart_tx
   input  wire                 tx_start,       // Signal requesting trasmission start
   input  wire [DATA_BITS-1:0] tx_data,        // Data to be transmitted
   output wire                 tx_done_tick,   // Transfer done signal
-  output wire                 tx              // TX transmission wire
+  output wire                 tx,             // TX transmission wire
+  output wire                 idle            // No transfer in progress
 );
 
 localparam [5:0] STOP_OVERSAMPLE_TICKS = STOP_BITS * BAUD_CLK_OVERSAMPLE_RATE;
@@ -174,6 +175,7 @@ end
 
 assign tx           = q_tx;
 assign tx_done_tick = q_tx_done_tick;
+assign idle         = (q_state == S_IDLE);
 
 endmodule
 
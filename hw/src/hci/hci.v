@@ -35,6 +35,10 @@ module hci
   input  wire [ 7:0] cpu_din,          // cpu data bus (D) [input]
   input  wire [ 7:0] cpu_dbgreg_in,    // cpu debug register read bus
   input  wire [ 7:0] ppu_vram_din,     // ppu data bus [input]
+  input  wire [15:0] cpu_snoop_a,      // cpu A bus, as driven by the cpu (for OP_WAIT)
+  input  wire        cpu_snoop_r_nw,   // cpu R/!W pin, as driven by the cpu (for OP_WAIT)
+  input  wire [ 7:0] cpu_snoop_dout,   // cpu data bus [output], as driven by the cpu (for OP_WAIT)
+  input  wire        vblank,           // ppu vertical blank signal (for OP_WAIT)
   output wire        tx,               // rs-232 tx signal
   output wire        active,           // dbg block is active (disable CPU)
   output reg         cpu_r_nw,         // cpu R/!W pin
@@ -50,7 +54,8 @@ module hci
   output wire        cart_cfg_upd      // pulse on cart_cfg update so cart can reset
 );
 
-// Debug packet opcodes.
+// Debug packet opcodes.  Packet layouts are described by DBG_OPCODE_TABLE in sw/src/dbgopcodes.h,
+// which these values, and the decode logic below, must match.
 localparam [7:0] OP_ECHO                 = 8'h00,
                  OP_CPU_MEM_RD           = 8'h01,
                  OP_CPU_MEM_WR           = 8'h02,
@@ -63,51 +68,268 @@ localparam [7:0] OP_ECHO                 = 8'h00,
                  OP_PPU_MEM_RD           = 8'h09,
                  OP_PPU_MEM_WR           = 8'h0A,
                  OP_PPU_DISABLE          = 8'h0B,
-                 OP_CART_SET_CFG         = 8'h0C;
+                 OP_CART_SET_CFG         = 8'h0C,
+                 OP_SET_BAUD             = 8'h0D,
+                 OP_QUERY_CREDITS        = 8'h0E,
+                 OP_SET_FRAMED           = 8'h0F,
+                 OP_MULTI_RD             = 8'h10,
+                 OP_MEM_FILL             = 8'h11,
+                 OP_MEM_CRC              = 8'h12,
+                 OP_MEM_CMP              = 8'h13,
+                 OP_CPU_REGS_RD          = 8'h14,
+                 OP_CPU_REGS_WR          = 8'h15,
+                 OP_WAIT                 = 8'h16,
+                 OP_PROG_WR              = 8'h17,
+                 OP_PROG_RUN             = 8'h18,
+                 OP_MEM_WR_LZ            = 8'h19;
+
+// log2 of the uart RX/TX fifo depths.  The host learns the depths through OP_QUERY_CREDITS, and
+// sizes its transmit window so the RX fifo can't overflow while the hci is stalled on a full TX
+// fifo.
+localparam UART_FIFO_ADDR_BITS = 10;
+
+// Baud rates selectable through OP_SET_BAUD, as uart_baud_clk phase increments for the 100MHz
+// system clock: (baud * 16 * 2^24) / 100000000.  BAUD_SEL_38400 is the reset/fallback rate.
+localparam [2:0] BAUD_SEL_38400          = 3'h0,
+                 BAUD_SEL_115200         = 3'h1,
+                 BAUD_SEL_230400         = 3'h2,
+                 BAUD_SEL_460800         = 3'h3,
+                 BAUD_SEL_921600         = 3'h4,
+                 BAUD_SEL_1000000        = 3'h5,
+                 BAUD_SEL_2000000        = 3'h6,
+                 BAUD_SEL_3000000        = 3'h7;
+
+localparam [23:0] BAUD_INC_38400         = 24'd103079,
+                  BAUD_INC_115200        = 24'd309238,
+                  BAUD_INC_230400        = 24'd618475,
+                  BAUD_INC_460800        = 24'd1236951,
+                  BAUD_INC_921600        = 24'd2473901,
+                  BAUD_INC_1000000       = 24'd2684355,
+                  BAUD_INC_2000000       = 24'd5368709,
+                  BAUD_INC_3000000       = 24'd8053064;
+
+// OP_SET_BAUD confirmation byte, and how long to wait for it at the new rate (250ms) before
+// reverting to BAUD_SEL_38400.
+localparam [ 7:0] BAUD_CONFIRM           = 8'hA5;
+localparam [24:0] BAUD_CONFIRM_TIMEOUT   = 25'd25000000;
+
+// Framed mode (see OP_SET_FRAMED).  Each host packet is wrapped as:
+//   SOF, SEQ, LEN_LO, LEN_HI, PAYLOAD[LEN], CRC_LO, CRC_HI
+// and each response as:
+//   SOF, SEQ, STATUS, DATA, CRC_LO, CRC_HI
+// where the CRCs are CRC-16/CCITT (poly 0x1021, init 0xFFFF) over everything between SOF and the
+// CRC.  The payload is buffered and only executed once its CRC checks out, and its SEQ is the
+// next one expected.  A bad frame, or one ahead of the expected SEQ (a frame was lost outright), is
+// dropped and answered with a NAK carrying the expected SEQ, so the host only has to retransmit
+// from the lost frame on.  ACK frames are kept in the replay buffer (rp_mem), and a resend of a
+// frame already executed is answered by sending its ACK frame again, without executing it again.
+// Entering framed mode starts the SEQs over at 0.  OP_SET_BAUD is not supported inside frames.
+localparam [ 7:0] FRAME_SOF              = 8'h7E,
+                  FRAME_ACK              = 8'h06,
+                  FRAME_NAK              = 8'h15;
+localparam [15:0] FRAME_CRC_INIT         = 16'hFFFF;
+
+// log2 of the frame buffer depth, which limits the frame payload size.
+localparam FRAME_BUF_ADDR_BITS = 11;
+
+// log2 of the replay buffer depth.  The host keeps no more unacknowledged frame and response bytes
+// than this, so any response it asks for again is still kept.  Responses are kept for the last
+// 2^REPLAY_SEQ_BITS SEQs.
+localparam REPLAY_ADDR_BITS = 13;
+localparam REPLAY_SEQ_BITS  = 7;
 
 // Error code bit positions.
 localparam DBG_UART_PARITY_ERR = 0,
            DBG_UNKNOWN_OPCODE  = 1;
 
 // Symbolic state representations.
-localparam [4:0] S_DISABLED             = 5'h00,
-                 S_DECODE               = 5'h01,
-                 S_ECHO_STG_0           = 5'h02,
-                 S_ECHO_STG_1           = 5'h03,
-                 S_CPU_MEM_RD_STG_0     = 5'h04,
-                 S_CPU_MEM_RD_STG_1     = 5'h05,
-                 S_CPU_MEM_WR_STG_0     = 5'h06,
-                 S_CPU_MEM_WR_STG_1     = 5'h07,
-                 S_CPU_REG_RD           = 5'h08,
-                 S_CPU_REG_WR_STG_0     = 5'h09,
-                 S_CPU_REG_WR_STG_1     = 5'h0A,
-                 S_QUERY_ERR_CODE       = 5'h0B,
-                 S_PPU_MEM_RD_STG_0     = 5'h0C,
-                 S_PPU_MEM_RD_STG_1     = 5'h0D,
-                 S_PPU_MEM_WR_STG_0     = 5'h0E,
-                 S_PPU_MEM_WR_STG_1     = 5'h0F,
-                 S_PPU_DISABLE          = 5'h10,
-                 S_CART_SET_CFG_STG_0   = 5'h11,
-                 S_CART_SET_CFG_STG_1   = 5'h12;
-
-reg [ 4:0] q_state,            d_state;
+localparam [5:0] S_DISABLED             = 6'h00,
+                 S_DECODE               = 6'h01,
+                 S_ECHO_STG_0           = 6'h02,
+                 S_ECHO_STG_1           = 6'h03,
+                 S_CPU_MEM_RD_STG_0     = 6'h04,
+                 S_CPU_MEM_RD_STG_1     = 6'h05,
+                 S_CPU_MEM_WR_STG_0     = 6'h06,
+                 S_CPU_MEM_WR_STG_1     = 6'h07,
+                 S_CPU_REG_RD           = 6'h08,
+                 S_CPU_REG_WR_STG_0     = 6'h09,
+                 S_CPU_REG_WR_STG_1     = 6'h0A,
+                 S_QUERY_ERR_CODE       = 6'h0B,
+                 S_PPU_MEM_RD_STG_0     = 6'h0C,
+                 S_PPU_MEM_RD_STG_1     = 6'h0D,
+                 S_PPU_MEM_WR_STG_0     = 6'h0E,
+                 S_PPU_MEM_WR_STG_1     = 6'h0F,
+                 S_PPU_DISABLE          = 6'h10,
+                 S_CART_SET_CFG_STG_0   = 6'h11,
+                 S_CART_SET_CFG_STG_1   = 6'h12,
+                 S_SET_BAUD_STG_0       = 6'h13,
+                 S_SET_BAUD_STG_1       = 6'h14,
+                 S_SET_BAUD_STG_2       = 6'h15,
+                 S_QUERY_CREDITS        = 6'h16,
+                 S_SET_FRAMED           = 6'h17,
+                 S_MULTI_RD_STG_0       = 6'h18,
+                 S_MULTI_RD_STG_1       = 6'h19,
+                 S_MULTI_RD_STG_2       = 6'h1A,
+                 S_MEM_FILL_STG_0       = 6'h1B,
+                 S_MEM_FILL_STG_1       = 6'h1C,
+                 S_MEM_FILL_STG_2       = 6'h1D,
+                 S_MEM_CRC_STG_0        = 6'h1E,
+                 S_MEM_CRC_STG_1        = 6'h1F,
+                 S_MEM_CRC_STG_2        = 6'h20,
+                 S_MEM_CMP_STG_0        = 6'h21,
+                 S_MEM_CMP_STG_1        = 6'h22,
+                 S_MEM_CMP_STG_2        = 6'h23,
+                 S_MEM_CMP_STG_3        = 6'h24,
+                 S_CPU_REGS_RD          = 6'h25,
+                 S_CPU_REGS_WR          = 6'h26,
+                 S_WAIT_STG_0           = 6'h27,
+                 S_WAIT_STG_1           = 6'h28,
+                 S_WAIT_STG_2           = 6'h29,
+                 S_PROG_WR_STG_0        = 6'h2A,
+                 S_PROG_WR_STG_1        = 6'h2B,
+                 S_PROG_RUN_STG_0       = 6'h2C,
+                 S_PROG_RUN_STG_1       = 6'h2D,
+                 S_MEM_WR_LZ_STG_0      = 6'h2E,
+                 S_MEM_WR_LZ_STG_1      = 6'h2F,
+                 S_MEM_WR_LZ_STG_2      = 6'h30,
+                 S_MEM_WR_LZ_STG_3      = 6'h31,
+                 S_MEM_WR_LZ_STG_4      = 6'h32;
+
+// Longest OP_MEM_FILL pattern, in bytes.
+localparam MEM_FILL_PAT_MAX = 8;
+
+// Number of CPU registers, REG_SEL 0 (PCL) to 6 (S).  OP_CPU_REGS_RD/WR transfer them all.
+localparam CPU_REG_CNT = 7;
+
+// OP_MEM_CRC CRC-32 initial value.  The response is the final CRC inverted, as zlib computes it.
+localparam [31:0] MEM_CRC_INIT = 32'hFFFFFFFF;
+
+// OP_WAIT conditions and response status codes, and the OP_WAIT timeout tick (1ms at 100MHz).
+localparam [1:0] WAIT_COND_HALTED       = 2'h0,
+                 WAIT_COND_MEM          = 2'h1,
+                 WAIT_COND_FRAMES       = 2'h2;
+localparam [1:0] WAIT_STATUS_TIMEOUT    = 2'h0,
+                 WAIT_STATUS_MET        = 2'h1,
+                 WAIT_STATUS_HALTED     = 2'h2;
+localparam [16:0] WAIT_TICK_CYCLES      = 17'd100000;
+
+// log2 of the stored program (OP_PROG_WR) size, in bytes.
+localparam PROG_ADDR_BITS = 9;
+
+// OP_PROG_RUN MODE bits.
+localparam PROG_MODE_VBLANK = 0;
+
+// Frame receive/transmit states, which wrap the decode/execute states above in framed mode.
+localparam [3:0] FR_SOF                 = 4'h0,
+                 FR_SEQ                 = 4'h1,
+                 FR_LEN_LO              = 4'h2,
+                 FR_LEN_HI              = 4'h3,
+                 FR_PAYLOAD             = 4'h4,
+                 FR_CRC_LO              = 4'h5,
+                 FR_CRC_HI              = 4'h6,
+                 FR_ACK                 = 4'h7,
+                 FR_EXEC                = 4'h8,
+                 FR_RSP_CRC             = 4'h9,
+                 FR_NAK                 = 4'hA,
+                 FR_REPLAY              = 4'hB;
+
+reg [ 5:0] q_state,            d_state;
 reg [ 2:0] q_decode_cnt,       d_decode_cnt;
 reg [16:0] q_execute_cnt,      d_execute_cnt;
 reg [15:0] q_addr,             d_addr;
+reg [15:0] q_list_cnt,         d_list_cnt;
+reg        q_ppu_space,        d_ppu_space;
+reg [63:0] q_fill_pat,         d_fill_pat;
+reg [ 3:0] q_fill_len,         d_fill_len;
+reg [ 2:0] q_fill_idx,         d_fill_idx;
+reg [31:0] q_mem_crc,          d_mem_crc;
+reg [15:0] q_cmp_cnt,          d_cmp_cnt;
+reg [ 7:0] q_cmp_data,         d_cmp_data;
+reg [15:0] q_lz_src,           d_lz_src;
+reg [ 7:0] q_lz_data,          d_lz_data;
+reg [ 1:0] q_wait_cond,        d_wait_cond;
+reg [ 7:0] q_wait_mask,        d_wait_mask;
+reg [ 7:0] q_wait_value,       d_wait_value;
+reg [15:0] q_wait_ms,          d_wait_ms;
+reg [ 1:0] q_wait_status,      d_wait_status;
+reg        q_wait_run,         d_wait_run;
+reg        q_vblank;
+reg        q_prog_active,      d_prog_active;
+reg        q_prog_vblank,      d_prog_vblank;
+reg [15:0] q_prog_runs,        d_prog_runs;
+reg [PROG_ADDR_BITS:0] q_prog_len,  d_prog_len;
+reg [PROG_ADDR_BITS:0] q_prog_idx,  d_prog_idx;
 reg [ 1:0] q_err_code,         d_err_code;
 reg [39:0] q_cart_cfg,         d_cart_cfg;
 reg        q_cart_cfg_upd,     d_cart_cfg_upd;
+reg [ 2:0] q_baud_sel,         d_baud_sel;
+reg [24:0] q_baud_timeout,     d_baud_timeout;
+reg        q_framed,           d_framed;
+reg        q_unframe,          d_unframe;
+reg [ 3:0] q_fr_state,         d_fr_state;
+reg [ 7:0] q_fr_seq,           d_fr_seq;
+reg [ 7:0] q_fr_expected_seq,  d_fr_expected_seq;
+reg        q_fr_discard,       d_fr_discard;
+reg [15:0] q_fr_len,           d_fr_len;
+reg [15:0] q_fr_cnt,           d_fr_cnt;
+reg [15:0] q_fr_rx_crc,        d_fr_rx_crc;
+reg [15:0] q_fr_tx_crc,        d_fr_tx_crc;
+reg [ 7:0] q_rp_cnt,           d_rp_cnt;
+reg [REPLAY_ADDR_BITS:0] q_rp_wr_addr,  d_rp_wr_addr;
+reg [REPLAY_ADDR_BITS:0] q_rp_rd_addr,  d_rp_rd_addr;
+reg [REPLAY_ADDR_BITS:0] q_rp_end,      d_rp_end;
 
-// UART output buffer FFs.
+// UART output buffer FFs.  q_tx_keep marks bytes of ACK frames, which are kept for replay.
 reg  [7:0] q_tx_data, d_tx_data;
 reg        q_wr_en,   d_wr_en;
+reg        q_tx_keep, d_tx_keep;
 
-// UART input signals.
+// Packet byte source signals.  Bytes come straight from the uart, or from the frame buffer in
+// framed mode.
 reg        rd_en;
 wire [7:0] rd_data;
 wire       rx_empty;
+
+// UART input signals.
+reg        fr_rd_en;
+wire       uart_rd_en;
+wire [7:0] uart_rd_data;
+wire       uart_rx_empty;
 wire       tx_full;
+wire       tx_idle;
+wire [UART_FIFO_ADDR_BITS:0] rx_free;
+wire [UART_FIFO_ADDR_BITS:0] tx_free;
 wire       parity_err;
+reg [23:0] baud_inc;
+
+// Frame buffer signals.
+reg        fbuf_wr_en;
+reg        fbuf_clr;
+wire [7:0] fbuf_rd_data;
+wire       fbuf_empty;
+wire [7:0] fr_seq_diff;
+
+// Replay buffer signals.
+wire [REPLAY_ADDR_BITS:0] rp_seq_start;
+wire [REPLAY_ADDR_BITS:0] rp_seq_end;
+wire [REPLAY_ADDR_BITS:0] rp_seq_age;
+wire                      rp_seq_kept;
+
+// MEM_FILL pattern byte for the current address.
+wire [7:0] fill_data;
+
+// MEM_CRC response.
+wire [31:0] mem_crc_rsp;
+
+// Byte read from the current address, in the space selected by q_ppu_space.
+wire [7:0] mem_din;
+
+// MEM_WR_LZ copy is reading its source address rather than writing q_addr.
+wire       lz_rd;
+
+// OP_WAIT condition state.
+wire       vblank_start;
+reg        wait_met;
 
 // Update FF state.
 always @(posedge clk)
@@ -118,11 +340,50 @@ always @(posedge clk)
         q_decode_cnt       <= 0;
         q_execute_cnt      <= 0;
         q_addr             <= 16'h0000;
+        q_list_cnt         <= 16'h0000;
+        q_ppu_space        <= 1'b0;
+        q_fill_pat         <= 64'h0000000000000000;
+        q_fill_len         <= 4'h0;
+        q_fill_idx         <= 3'h0;
+        q_mem_crc          <= MEM_CRC_INIT;
+        q_cmp_cnt          <= 16'h0000;
+        q_cmp_data         <= 8'h00;
+        q_lz_src           <= 16'h0000;
+        q_lz_data          <= 8'h00;
+        q_wait_cond        <= WAIT_COND_HALTED;
+        q_wait_mask        <= 8'h00;
+        q_wait_value       <= 8'h00;
+        q_wait_ms          <= 16'h0000;
+        q_wait_status      <= WAIT_STATUS_TIMEOUT;
+        q_wait_run         <= 1'b0;
+        q_vblank           <= 1'b0;
+        q_prog_active      <= 1'b0;
+        q_prog_vblank      <= 1'b0;
+        q_prog_runs        <= 16'h0000;
+        q_prog_len         <= 0;
+        q_prog_idx         <= 0;
         q_err_code         <= 0;
         q_cart_cfg         <= 40'h0000000000;
         q_cart_cfg_upd     <= 1'b0;
+        q_baud_sel         <= BAUD_SEL_38400;
+        q_baud_timeout     <= 0;
+        q_framed           <= 1'b0;
+        q_unframe          <= 1'b0;
+        q_fr_state         <= FR_SOF;
+        q_fr_seq           <= 8'h00;
+        q_fr_expected_seq  <= 8'h00;
+        q_fr_discard       <= 1'b0;
+        q_fr_len           <= 16'h0000;
+        q_fr_cnt           <= 16'h0000;
+        q_fr_rx_crc        <= FRAME_CRC_INIT;
+        q_fr_tx_crc        <= FRAME_CRC_INIT;
+        q_rp_cnt           <= 8'h00;
+        q_rp_wr_addr       <= 0;
+        q_rp_rd_addr       <= 0;
+        q_rp_end           <= 0;
         q_tx_data          <= 8'h00;
         q_wr_en            <= 1'b0;
+        q_tx_keep          <= 1'b0;
       end
     else
       begin
@@ -130,34 +391,203 @@ always @(posedge clk)
         q_decode_cnt       <= d_decode_cnt;
         q_execute_cnt      <= d_execute_cnt;
         q_addr             <= d_addr;
+        q_list_cnt         <= d_list_cnt;
+        q_ppu_space        <= d_ppu_space;
+        q_fill_pat         <= d_fill_pat;
+        q_fill_len         <= d_fill_len;
+        q_fill_idx         <= d_fill_idx;
+        q_mem_crc          <= d_mem_crc;
+        q_cmp_cnt          <= d_cmp_cnt;
+        q_cmp_data         <= d_cmp_data;
+        q_lz_src           <= d_lz_src;
+        q_lz_data          <= d_lz_data;
+        q_wait_cond        <= d_wait_cond;
+        q_wait_mask        <= d_wait_mask;
+        q_wait_value       <= d_wait_value;
+        q_wait_ms          <= d_wait_ms;
+        q_wait_status      <= d_wait_status;
+        q_wait_run         <= d_wait_run;
+        q_vblank           <= vblank;
+        q_prog_active      <= d_prog_active;
+        q_prog_vblank      <= d_prog_vblank;
+        q_prog_runs        <= d_prog_runs;
+        q_prog_len         <= d_prog_len;
+        q_prog_idx         <= d_prog_idx;
         q_err_code         <= d_err_code;
         q_cart_cfg         <= d_cart_cfg;
         q_cart_cfg_upd     <= d_cart_cfg_upd;
+        q_baud_sel         <= d_baud_sel;
+        q_baud_timeout     <= d_baud_timeout;
+        q_framed           <= d_framed;
+        q_unframe          <= d_unframe;
+        q_fr_state         <= d_fr_state;
+        q_fr_seq           <= d_fr_seq;
+        q_fr_expected_seq  <= d_fr_expected_seq;
+        q_fr_discard       <= d_fr_discard;
+        q_fr_len           <= d_fr_len;
+        q_fr_cnt           <= d_fr_cnt;
+        q_fr_rx_crc        <= d_fr_rx_crc;
+        q_fr_tx_crc        <= d_fr_tx_crc;
+        q_rp_cnt           <= d_rp_cnt;
+        q_rp_wr_addr       <= d_rp_wr_addr;
+        q_rp_rd_addr       <= d_rp_rd_addr;
+        q_rp_end           <= d_rp_end;
         q_tx_data          <= d_tx_data;
         q_wr_en            <= d_wr_en;
+        q_tx_keep          <= d_tx_keep;
       end
   end
 
+// Stored program memory (OP_PROG_WR/OP_PROG_RUN).  Small enough for distributed RAM, so it can be
+// read asynchronously like the fifos.  OP_PROG_WR writes the byte being popped at q_addr.
+reg [7:0] q_prog_mem [2**PROG_ADDR_BITS-1:0];
+reg       prog_wr_en;
+
+always @(posedge clk)
+  begin
+    if (prog_wr_en)
+      q_prog_mem[q_addr[PROG_ADDR_BITS-1:0]] <= rd_data;
+  end
+
+// Replay buffer (framed mode).  rp_mem keeps the bytes of the ACK frames sent, as a ring, and
+// rp_start where the response to each of the last 2^REPLAY_SEQ_BITS SEQs starts in it.  rp_mem is
+// block RAM, read a cycle ahead at d_rp_rd_addr so rp_rd_data is the byte at q_rp_rd_addr.
+reg [7:0]                rp_mem   [2**REPLAY_ADDR_BITS-1:0];
+reg [REPLAY_ADDR_BITS:0] rp_start [2**REPLAY_SEQ_BITS-1:0];
+reg [7:0]                rp_rd_data;
+reg                      rp_start_wr;
+
+always @(posedge clk)
+  begin
+    if (q_wr_en && q_tx_keep)
+      rp_mem[q_rp_wr_addr[REPLAY_ADDR_BITS-1:0]] <= q_tx_data;
+
+    if (rp_start_wr)
+      rp_start[q_fr_seq[REPLAY_SEQ_BITS-1:0]] <= q_rp_wr_addr;
+
+    rp_rd_data <= rp_mem[d_rp_rd_addr[REPLAY_ADDR_BITS-1:0]];
+  end
+
+// Map the selected baud rate to its baud clk phase increment.
+always @*
+  begin
+    case (q_baud_sel)
+      BAUD_SEL_115200:  baud_inc = BAUD_INC_115200;
+      BAUD_SEL_230400:  baud_inc = BAUD_INC_230400;
+      BAUD_SEL_460800:  baud_inc = BAUD_INC_460800;
+      BAUD_SEL_921600:  baud_inc = BAUD_INC_921600;
+      BAUD_SEL_1000000: baud_inc = BAUD_INC_1000000;
+      BAUD_SEL_2000000: baud_inc = BAUD_INC_2000000;
+      BAUD_SEL_3000000: baud_inc = BAUD_INC_3000000;
+      default:          baud_inc = BAUD_INC_38400;
+    endcase
+  end
+
 // Instantiate the serial controller block.
-uart #(.SYS_CLK_FREQ(100000000),
-       .BAUD_RATE(38400),
+uart #(.BAUD_INC_BITS(24),
        .DATA_BITS(8),
        .STOP_BITS(1),
-       .PARITY_MODE(1)) uart_blk
+       .PARITY_MODE(1),
+       .RX_FIFO_ADDR_BITS(UART_FIFO_ADDR_BITS),
+       .TX_FIFO_ADDR_BITS(UART_FIFO_ADDR_BITS)) uart_blk
 (
   .clk(clk),
   .reset(rst),
   .rx(rx),
+  .baud_inc(baud_inc),
   .tx_data(q_tx_data),
-  .rd_en(rd_en),
+  .rd_en(uart_rd_en),
   .wr_en(q_wr_en),
   .tx(tx),
-  .rx_data(rd_data),
-  .rx_empty(rx_empty),
+  .rx_data(uart_rd_data),
+  .rx_empty(uart_rx_empty),
   .tx_full(tx_full),
+  .tx_idle(tx_idle),
+  .rx_free(rx_free),
+  .tx_free(tx_free),
   .parity_err(parity_err)
 );
 
+// Instantiate the frame buffer.  Holds a frame's payload until its CRC has been checked.
+fifo #(.DATA_BITS(8),
+       .ADDR_BITS(FRAME_BUF_ADDR_BITS)) frame_buf
+(
+  .clk(clk),
+  .reset(rst || fbuf_clr),
+  .rd_en(q_framed && rd_en && !q_prog_active),
+  .wr_en(fbuf_wr_en),
+  .wr_data(uart_rd_data),
+  .rd_data(fbuf_rd_data),
+  .full(),
+  .empty(fbuf_empty),
+  .count()
+);
+
+// In framed mode, packet bytes are only released to the decoder once the frame has been verified.
+// While a stored program runs (see OP_PROG_RUN), packet bytes come from the program instead.
+assign rd_data    = (q_prog_active) ? q_prog_mem[q_prog_idx[PROG_ADDR_BITS-1:0]] :
+                    (q_framed)      ? fbuf_rd_data : uart_rd_data;
+assign rx_empty   = (q_prog_active) ? (q_prog_idx == q_prog_len) :
+                    (q_framed)      ? (fbuf_empty || (q_fr_state != FR_EXEC)) : uart_rx_empty;
+assign uart_rd_en = (q_framed) ? fr_rd_en : (rd_en && !q_prog_active);
+
+// Distance from the received SEQ back to the expected SEQ.  Bit 7 set means the frame is ahead of
+// the expected one, i.e., an earlier frame was lost.
+assign fr_seq_diff = q_fr_expected_seq - q_fr_seq;
+
+// Where the kept response to the received SEQ, a resend of an executed frame, starts and ends in
+// the replay buffer, and whether it's still there: not from before entering framed mode, and not
+// yet overwritten.  The next SEQ's response starts where this one ends.
+assign rp_seq_start = rp_start[q_fr_seq[REPLAY_SEQ_BITS-1:0]];
+assign rp_seq_end   = (fr_seq_diff == 8'h01) ? q_rp_wr_addr :
+                      rp_start[q_fr_seq[REPLAY_SEQ_BITS-1:0] + 1'b1];
+assign rp_seq_age   = q_rp_wr_addr - rp_seq_start;
+assign rp_seq_kept  = (fr_seq_diff <= q_rp_cnt) && (rp_seq_age <= (1 << REPLAY_ADDR_BITS));
+
+assign fill_data   = q_fill_pat[q_fill_idx*8 +: 8];
+assign mem_crc_rsp = ~q_mem_crc;
+assign mem_din     = (q_ppu_space) ? ppu_vram_din : cpu_din;
+assign lz_rd       = (q_state == S_MEM_WR_LZ_STG_4) && (q_decode_cnt != 3'h2);
+
+assign vblank_start = vblank && !q_vblank;
+
+// Evaluate the OP_WAIT condition.  Memory is watched by snooping CPU writes, so it can only change
+// while the CPU is running (q_wait_run).
+always @*
+  begin
+    case (q_wait_cond)
+      WAIT_COND_HALTED: wait_met = !q_wait_run;
+      WAIT_COND_MEM:    wait_met = q_wait_run && !cpu_snoop_r_nw && (cpu_snoop_a == q_addr) &&
+                                   ((cpu_snoop_dout & q_wait_mask) == q_wait_value);
+      WAIT_COND_FRAMES: wait_met = (q_list_cnt == 16'h0000);
+      default:          wait_met = 1'b0;
+    endcase
+  end
+
+// Advances a CRC-16/CCITT by one byte.
+function [15:0] crc16;
+  input [15:0] crc;
+  input [ 7:0] data;
+  integer      i;
+  begin
+    crc16 = crc ^ { data, 8'h00 };
+    for (i = 0; i < 8; i = i + 1)
+      crc16 = (crc16[15]) ? ({ crc16[14:0], 1'b0 } ^ 16'h1021) : { crc16[14:0], 1'b0 };
+  end
+endfunction
+
+// Advances a CRC-32 (reflected, polynomial 0x04C11DB7) by one byte.
+function [31:0] crc32;
+  input [31:0] crc;
+  input [ 7:0] data;
+  integer      i;
+  begin
+    crc32 = crc ^ { 24'h000000, data };
+    for (i = 0; i < 8; i = i + 1)
+      crc32 = (crc32[0]) ? ({ 1'b0, crc32[31:1] } ^ 32'hEDB88320) : { 1'b0, crc32[31:1] };
+  end
+endfunction
+
 always @*
   begin
     // Setup default FF updates.
@@ -165,13 +595,58 @@ always @*
     d_decode_cnt   = q_decode_cnt;
     d_execute_cnt  = q_execute_cnt;
     d_addr         = q_addr;
+    d_list_cnt     = q_list_cnt;
+    d_ppu_space    = q_ppu_space;
+    d_fill_pat     = q_fill_pat;
+    d_fill_len     = q_fill_len;
+    d_fill_idx     = q_fill_idx;
+    d_mem_crc      = q_mem_crc;
+    d_cmp_cnt      = q_cmp_cnt;
+    d_cmp_data     = q_cmp_data;
+    d_lz_src       = q_lz_src;
+    d_lz_data      = q_lz_data;
+    d_wait_cond    = q_wait_cond;
+    d_wait_mask    = q_wait_mask;
+    d_wait_value   = q_wait_value;
+    d_wait_ms      = q_wait_ms;
+    d_wait_status  = q_wait_status;
+    d_wait_run     = q_wait_run;
+    d_prog_active  = q_prog_active;
+    d_prog_vblank  = q_prog_vblank;
+    d_prog_runs    = q_prog_runs;
+    d_prog_len     = q_prog_len;
+    d_prog_idx     = q_prog_idx;
     d_err_code     = q_err_code;
     d_cart_cfg     = q_cart_cfg;
     d_cart_cfg_upd = 1'b0;
+    d_baud_sel     = q_baud_sel;
+    d_baud_timeout = q_baud_timeout;
+    d_framed       = q_framed;
+    d_unframe      = q_unframe;
+
+    d_fr_state        = q_fr_state;
+    d_fr_seq          = q_fr_seq;
+    d_fr_expected_seq = q_fr_expected_seq;
+    d_fr_discard      = q_fr_discard;
+    d_fr_len          = q_fr_len;
+    d_fr_cnt          = q_fr_cnt;
+    d_fr_rx_crc       = q_fr_rx_crc;
+    d_fr_tx_crc       = q_fr_tx_crc;
+    d_rp_cnt          = q_rp_cnt;
+    d_rp_wr_addr      = (q_wr_en && q_tx_keep) ? q_rp_wr_addr + 1'b1 : q_rp_wr_addr;
+    d_rp_rd_addr      = q_rp_rd_addr;
+    d_rp_end          = q_rp_end;
+
+    fr_rd_en      = 1'b0;
+    fbuf_wr_en    = 1'b0;
+    fbuf_clr      = 1'b0;
+    rp_start_wr   = 1'b0;
 
     rd_en         = 1'b0;
+    prog_wr_en    = 1'b0;
     d_tx_data     = 8'h00;
     d_wr_en       = 1'b0;
+    d_tx_keep     = 1'b0;
 
     // Setup default output regs.
     cpu_r_nw       = 1'b1;
@@ -184,6 +659,11 @@ always @*
     if (parity_err)
       d_err_code[DBG_UART_PARITY_ERR] = 1'b1;
 
+    // A CPU initiated break during an OP_WAIT issued while the CPU was running.  Take over the bus
+    // (see active) to hold the CPU.
+    if (q_wait_run && brk)
+      d_wait_run = 1'b0;
+
     case (q_state)
       S_DISABLED:
         begin
@@ -205,6 +685,31 @@ always @*
                   d_tx_data = 8'h00;  // Write "0" over UART to indicate we are not in a debug break
                   d_wr_en   = 1'b1;
                 end
+              else if (rd_data == OP_WAIT)
+                begin
+                  // Wait without disturbing the CPU.
+                  d_decode_cnt = 0;
+                  d_wait_run   = 1'b1;
+                  d_state      = S_WAIT_STG_0;
+                end
+              else if ((rd_data == OP_PROG_RUN) && !q_prog_active)
+                begin
+                  // Leave the CPU running until the program itself halts it.
+                  d_decode_cnt = 0;
+                  d_wait_run   = 1'b1;
+                  d_state      = S_PROG_RUN_STG_0;
+                end
+              else if (rd_data == OP_SET_BAUD)
+                begin
+                  // Let the host restore the link settings without halting the CPU.
+                  d_wait_run = 1'b1;
+                  d_state    = S_SET_BAUD_STG_0;
+                end
+              else if (rd_data == OP_SET_FRAMED)
+                begin
+                  d_wait_run = 1'b1;
+                  d_state    = S_SET_FRAMED;
+                end
             end
         end
       S_DECODE:
@@ -227,6 +732,39 @@ always @*
                 OP_PPU_MEM_WR:           d_state = S_PPU_MEM_WR_STG_0;
                 OP_PPU_DISABLE:          d_state = S_PPU_DISABLE;
                 OP_CART_SET_CFG:         d_state = S_CART_SET_CFG_STG_0;
+                OP_SET_BAUD:             d_state = S_SET_BAUD_STG_0;
+                OP_SET_FRAMED:           d_state = S_SET_FRAMED;
+                OP_MULTI_RD:             d_state = S_MULTI_RD_STG_0;
+                OP_MEM_FILL:             d_state = S_MEM_FILL_STG_0;
+                OP_MEM_CRC:              d_state = S_MEM_CRC_STG_0;
+                OP_MEM_CMP:              d_state = S_MEM_CMP_STG_0;
+                OP_CPU_REGS_RD:          d_state = S_CPU_REGS_RD;
+                OP_CPU_REGS_WR:          d_state = S_CPU_REGS_WR;
+                OP_WAIT:                 d_state = S_WAIT_STG_0;
+                OP_MEM_WR_LZ:            d_state = S_MEM_WR_LZ_STG_0;
+                OP_PROG_WR:
+                  begin
+                    // A program can't rewrite or run programs.
+                    if (q_prog_active)
+                      d_err_code[DBG_UNKNOWN_OPCODE] = 1'b1;
+                    else
+                      d_state = S_PROG_WR_STG_0;
+                  end
+                OP_PROG_RUN:
+                  begin
+                    if (q_prog_active)
+                      d_err_code[DBG_UNKNOWN_OPCODE] = 1'b1;
+                    else
+                      d_state = S_PROG_RUN_STG_0;
+                  end
+                OP_QUERY_CREDITS:
+                  begin
+                    // Snapshot the fifo credits.  The opcode still occupies one RX slot this cycle,
+                    // so the RX count is conservative by one.
+                    d_addr        = rx_free;
+                    d_execute_cnt = tx_free;
+                    d_state       = S_QUERY_CREDITS;
+                  end
                 OP_DBG_RUN:
                   begin
                     d_state = S_DISABLED;
@@ -441,6 +979,43 @@ always @*
             end
         end
 
+      // --- CPU_REGS_RD ---
+      //   OP_CODE
+      //
+      //   Responds with all CPU_REG_CNT registers, in REG_SEL order.
+      S_CPU_REGS_RD:
+        begin
+          // Writes reach the TX fifo a cycle late, so leave room for the previous byte.
+          if (tx_free > 1)
+            begin
+              cpu_dbgreg_sel = q_decode_cnt;   // select CPU reg based on decode count
+              d_tx_data      = cpu_dbgreg_in;  // send reg read results to uart
+              d_wr_en        = 1'b1;           // request uart write
+              d_decode_cnt   = q_decode_cnt + 3'h1;
+
+              if (q_decode_cnt == CPU_REG_CNT - 1)
+                d_state = S_DECODE;
+            end
+        end
+
+      // --- CPU_REGS_WR ---
+      //   OP_CODE
+      //   DATA (x CPU_REG_CNT, in REG_SEL order)
+      S_CPU_REGS_WR:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en          = 1'b1;
+              cpu_dbgreg_sel = q_decode_cnt;
+              cpu_dbgreg_wr  = 1'b1;
+              cpu_dbgreg_out = rd_data;
+              d_decode_cnt   = q_decode_cnt + 3'h1;
+
+              if (q_decode_cnt == CPU_REG_CNT - 1)
+                d_state = S_DECODE;
+            end
+        end
+
       // --- QUERY_ERR_CODE ---
       //   OP_CODE
       S_QUERY_ERR_CODE:
@@ -643,13 +1218,1085 @@ always @*
                 end
             end
         end
-    endcase
+
+      // --- QUERY_CREDITS ---
+      //   OP_CODE
+      //
+      //   Responds with the number of free RX fifo entries (lo, hi), then the number of free TX
+      //   fifo entries (lo, hi).
+      S_QUERY_CREDITS:
+        begin
+          // Writes reach the TX fifo a cycle late, so leave room for the previous byte.
+          if (tx_free > 1)
+            begin
+              d_decode_cnt = q_decode_cnt + 3'h1;
+              d_wr_en      = 1'b1;
+
+              case (q_decode_cnt)
+                3'h0:    d_tx_data = q_addr[7:0];
+                3'h1:    d_tx_data = q_addr[15:8];
+                3'h2:    d_tx_data = q_execute_cnt[7:0];
+                default:
+                  begin
+                    d_tx_data = q_execute_cnt[15:8];
+                    d_state   = S_DECODE;
+                  end
+              endcase
+            end
+        end
+
+      // --- SET_BAUD ---
+      //   OP_CODE
+      //   BAUD_SEL
+      //
+      //   BAUD_SEL is acknowledged at the current rate, then the uart switches to the new rate.
+      //   Every byte received at the new rate is echoed back so the host can test the link, until
+      //   the host sends BAUD_CONFIRM to complete the switch.  If BAUD_CONFIRM does not arrive
+      //   within BAUD_CONFIRM_TIMEOUT, the uart reverts to BAUD_SEL_38400.
+      //
+      //   OP_SET_BAUD is also accepted while the CPU is running (S_DISABLED), and leaves it running.
+      S_SET_BAUD_STG_0:
+        begin
+          if (!rx_empty && !tx_full)
+            begin
+              rd_en        = 1'b1;     // pop BAUD_SEL byte off uart fifo
+              d_addr       = rd_data;  // hold new baud select until the ack is sent
+              d_tx_data    = rd_data;  // acknowledge at the current rate
+              d_wr_en      = 1'b1;
+              d_decode_cnt = 0;
+              d_state      = S_SET_BAUD_STG_1;
+            end
+        end
+      S_SET_BAUD_STG_1:
+        begin
+          // Dummy cycle.  Allow the ack write to reach the uart tx fifo before checking tx_idle.
+          d_decode_cnt = 3'h1;
+
+          if ((q_decode_cnt != 0) && tx_idle)
+            begin
+              // Ack has been fully shifted out.  Switch rates and wait for confirmation.
+              d_baud_sel     = q_addr[2:0];
+              d_baud_timeout = BAUD_CONFIRM_TIMEOUT;
+              d_state        = S_SET_BAUD_STG_2;
+            end
+        end
+      S_SET_BAUD_STG_2:
+        begin
+          if (!rx_empty && !tx_full)
+            begin
+              rd_en     = 1'b1;     // pop packet byte off uart fifo
+              d_tx_data = rd_data;  // echo it at the new rate
+              d_wr_en   = 1'b1;
+
+              if (rd_data == BAUD_CONFIRM)
+                begin
+                  d_wait_run = 1'b0;
+                  d_state    = (q_wait_run && !brk) ? S_DISABLED : S_DECODE;
+                end
+            end
+          else if (q_baud_timeout == 0)
+            begin
+              // Host never confirmed.  Fall back to the reset rate.
+              d_baud_sel = BAUD_SEL_38400;
+              d_wait_run = 1'b0;
+              d_state    = (q_wait_run && !brk) ? S_DISABLED : S_DECODE;
+            end
+          else
+            begin
+              d_baud_timeout = q_baud_timeout - 25'h0000001;
+            end
+        end
+
+      // --- SET_FRAMED ---
+      //   OP_CODE
+      //   ENABLE
+      //
+      //   ENABLE is acknowledged in the current mode.  Entering framed mode takes effect
+      //   immediately; leaving it takes effect once the response frame has been sent.
+      //
+      //   OP_SET_FRAMED is also accepted while the CPU is running (S_DISABLED), and leaves it
+      //   running.
+      S_SET_FRAMED:
+        begin
+          if (!rx_empty && !tx_full)
+            begin
+              rd_en      = 1'b1;     // pop ENABLE byte off uart fifo
+              d_tx_data  = rd_data;  // acknowledge
+              d_wr_en    = 1'b1;
+              d_wait_run = 1'b0;
+              d_state    = (q_wait_run && !brk) ? S_DISABLED : S_DECODE;
+
+              if (!q_framed && rd_data[0])
+                begin
+                  d_framed          = 1'b1;
+                  d_fr_state        = FR_SOF;
+                  d_fr_discard      = 1'b0;
+                  d_fr_expected_seq = 8'h00;
+                  d_rp_cnt          = 8'h00;
+                end
+              else if (q_framed && !rd_data[0])
+                begin
+                  d_unframe = 1'b1;
+                end
+            end
+        end
+
+      // --- MULTI_RD ---
+      //   OP_CODE
+      //   LIST_CNT_LO
+      //   LIST_CNT_HI
+      //   RSP_CNT_LO
+      //   RSP_CNT_HI
+      //   LIST
+      //
+      //   LIST is LIST_CNT bytes of 5-byte ranges (SPACE, ADDR_LO, ADDR_HI, CNT_LO, CNT_HI).
+      //   Responds with the contents of each range in turn, read from PPU memory if SPACE bit 0 is
+      //   set and CPU memory otherwise.  RSP_CNT, the total, is only for the host's benefit.
+      S_MULTI_RD_STG_0:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en        = 1'b1;                 // pop packet byte off uart fifo
+              d_decode_cnt = q_decode_cnt + 3'h1;  // advance to next decode stage
+              if (q_decode_cnt == 0)
+                begin
+                  // Read LIST_CNT_LO into low bits of multi count.
+                  d_list_cnt = rd_data;
+                end
+              else if (q_decode_cnt == 1)
+                begin
+                  // Read LIST_CNT_HI into high bits of multi count.
+                  d_list_cnt = { rd_data, q_list_cnt[7:0] };
+                end
+              else if (q_decode_cnt == 3)
+                begin
+                  // Skip RSP_CNT, and start on the first range.
+                  d_decode_cnt = 0;
+                  d_state      = (q_list_cnt) ? S_MULTI_RD_STG_1 : S_DECODE;
+                end
+            end
+        end
+      S_MULTI_RD_STG_1:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en        = 1'b1;                    // pop packet byte off uart fifo
+              d_decode_cnt = q_decode_cnt + 3'h1;     // advance to next decode stage
+              d_list_cnt   = q_list_cnt - 16'h0001;   // one less LIST byte to go
+
+              case (q_decode_cnt)
+                3'h0:    d_ppu_space   = rd_data[0];
+                3'h1:    d_addr        = rd_data;
+                3'h2:    d_addr        = { rd_data, q_addr[7:0] };
+                3'h3:    d_execute_cnt = rd_data;
+                default:
+                  begin
+                    // Read CNT_HI into high bits of execute count.  Execute count is shifted by 1:
+                    // use 2 clock cycles per byte read.
+                    d_decode_cnt  = 0;
+                    d_execute_cnt = { rd_data, q_execute_cnt[7:0], 1'b0 };
+
+                    if (d_execute_cnt)
+                      d_state = S_MULTI_RD_STG_2;
+                    else if (d_list_cnt == 0)
+                      d_state = S_DECODE;
+                  end
+              endcase
+            end
+        end
+      S_MULTI_RD_STG_2:
+        begin
+          if (~q_execute_cnt[0])
+            begin
+              // Dummy cycle.  Allow memory read 1 cycle to return result, and allow uart tx fifo
+              // 1 cycle to update tx_full setting.
+              d_execute_cnt = q_execute_cnt - 17'h00001;
+            end
+          else
+            begin
+              if (!tx_full)
+                begin
+                  d_execute_cnt = q_execute_cnt - 17'h00001;  // advance to next execute stage
+                  d_tx_data     = (q_ppu_space) ? ppu_vram_din : cpu_din;
+                  d_wr_en       = 1'b1;                       // request uart write
+
+                  d_addr = q_addr + 16'h0001;                 // advance to next byte
+
+                  // After the last byte of the range, move on to the next one.
+                  if (d_execute_cnt == 0)
+                    d_state = (q_list_cnt) ? S_MULTI_RD_STG_1 : S_DECODE;
+                end
+            end
+        end
+
+      // --- MEM_FILL ---
+      //   OP_CODE
+      //   SPACE
+      //   ADDR_LO
+      //   ADDR_HI
+      //   CNT_LO
+      //   CNT_HI
+      //   PAT_CNT_LO
+      //   PAT_CNT_HI
+      //   PATTERN
+      //
+      //   Fills CNT bytes of PPU memory if SPACE bit 0 is set, CPU memory otherwise, by repeating
+      //   PATTERN.  Only the first MEM_FILL_PAT_MAX bytes of PATTERN are used.
+      S_MEM_FILL_STG_0:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en        = 1'b1;                 // pop packet byte off uart fifo
+              d_decode_cnt = q_decode_cnt + 3'h1;  // advance to next decode stage
+
+              case (q_decode_cnt)
+                3'h0:    d_ppu_space   = rd_data[0];
+                3'h1:    d_addr        = rd_data;
+                3'h2:    d_addr        = { rd_data, q_addr[7:0] };
+                3'h3:    d_execute_cnt = rd_data;
+                3'h4:    d_execute_cnt = { rd_data, q_execute_cnt[7:0] };
+                3'h5:    d_list_cnt    = rd_data;
+                default:
+                  begin
+                    d_list_cnt = { rd_data, q_list_cnt[7:0] };
+                    d_fill_len = 4'h0;
+                    d_state    = (d_list_cnt) ? S_MEM_FILL_STG_1 : S_DECODE;
+                  end
+              endcase
+            end
+        end
+      S_MEM_FILL_STG_1:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en      = 1'b1;                    // pop PATTERN byte off uart fifo
+              d_list_cnt = q_list_cnt - 16'h0001;
+
+              if (q_fill_len != MEM_FILL_PAT_MAX)
+                begin
+                  d_fill_pat[q_fill_len[2:0]*8 +: 8] = rd_data;
+                  d_fill_len                         = q_fill_len + 4'h1;
+                end
+
+              if (d_list_cnt == 0)
+                begin
+                  d_fill_idx = 3'h0;
+                  d_state    = (q_execute_cnt) ? S_MEM_FILL_STG_2 : S_DECODE;
+                end
+            end
+        end
+      S_MEM_FILL_STG_2:
+        begin
+          // Write one byte per cycle.
+          if (q_ppu_space)
+            begin
+              ppu_vram_wr = 1'b1;
+            end
+          else
+            begin
+              cpu_r_nw = 1'b0;
+              cpu_dout = fill_data;
+            end
+
+          d_execute_cnt = q_execute_cnt - 17'h00001;  // advance to next execute stage
+          d_addr        = q_addr + 16'h0001;          // advance to next byte
+          d_fill_idx    = ({ 1'b0, q_fill_idx } == q_fill_len - 4'h1) ? 3'h0 : q_fill_idx + 3'h1;
+
+          // After last byte is written to memory, return to decode stage.
+          if (d_execute_cnt == 0)
+            d_state = S_DECODE;
+        end
+
+      // --- MEM_CRC ---
+      //   OP_CODE
+      //   SPACE
+      //   ADDR_LO
+      //   ADDR_HI
+      //   CNT_LO
+      //   CNT_HI
+      //
+      //   Responds with the CRC-32 of CNT bytes of PPU memory if SPACE bit 0 is set, CPU memory
+      //   otherwise, least significant byte first.
+      S_MEM_CRC_STG_0:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en        = 1'b1;                 // pop packet byte off uart fifo
+              d_decode_cnt = q_decode_cnt + 3'h1;  // advance to next decode stage
+
+              case (q_decode_cnt)
+                3'h0:    d_ppu_space   = rd_data[0];
+                3'h1:    d_addr        = rd_data;
+                3'h2:    d_addr        = { rd_data, q_addr[7:0] };
+                3'h3:    d_execute_cnt = rd_data;
+                default:
+                  begin
+                    // Read CNT_HI into high bits of execute count.  Execute count is shifted by 1:
+                    // use 2 clock cycles per byte read.
+                    d_decode_cnt  = 0;
+                    d_execute_cnt = { rd_data, q_execute_cnt[7:0], 1'b0 };
+                    d_mem_crc     = MEM_CRC_INIT;
+                    d_state       = (d_execute_cnt) ? S_MEM_CRC_STG_1 : S_MEM_CRC_STG_2;
+                  end
+              endcase
+            end
+        end
+      S_MEM_CRC_STG_1:
+        begin
+          // Dummy cycle on even counts to allow the memory read 1 cycle to return its result.
+          d_execute_cnt = q_execute_cnt - 17'h00001;
+
+          if (q_execute_cnt[0])
+            begin
+              d_mem_crc = crc32(q_mem_crc, mem_din);
+              d_addr    = q_addr + 16'h0001;  // advance to next byte
+
+              if (d_execute_cnt == 0)
+                d_state = S_MEM_CRC_STG_2;
+            end
+        end
+      S_MEM_CRC_STG_2:
+        begin
+          // Send the CRC, using decode count as the byte index.  Writes reach the TX fifo a cycle
+          // late, so leave room for the previous byte.
+          if (tx_free > 1)
+            begin
+              d_decode_cnt = q_decode_cnt + 3'h1;
+              d_tx_data    = mem_crc_rsp[q_decode_cnt[1:0]*8 +: 8];
+              d_wr_en      = 1'b1;
+
+              if (q_decode_cnt == 3'h3)
+                d_state = S_DECODE;
+            end
+        end
+
+      // --- MEM_CMP ---
+      //   OP_CODE
+      //   SPACE
+      //   ADDR_LO
+      //   ADDR_HI
+      //   CNT_LO
+      //   CNT_HI
+      //   RPT_CNT_LO
+      //   RPT_CNT_HI
+      //   EXPECTED
+      //
+      //   Compares CNT bytes of PPU memory if SPACE bit 0 is set, CPU memory otherwise, with
+      //   EXPECTED.  Responds with RPT_CNT bytes of mismatch report, then the mismatch count
+      //   (MISMATCH_CNT_LO, MISMATCH_CNT_HI).  Each mismatch is reported as ADDR_LO, ADDR_HI,
+      //   ACTUAL as it is found, while a whole entry still fits in the report; the rest of the
+      //   report is padded with zeros.
+      S_MEM_CMP_STG_0:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en        = 1'b1;                 // pop packet byte off uart fifo
+              d_decode_cnt = q_decode_cnt + 3'h1;  // advance to next decode stage
+
+              case (q_decode_cnt)
+                3'h0:    d_ppu_space   = rd_data[0];
+                3'h1:    d_addr        = rd_data;
+                3'h2:    d_addr        = { rd_data, q_addr[7:0] };
+                3'h3:    d_execute_cnt = rd_data;
+                // Read CNT_HI into high bits of execute count.  Execute count is shifted by 1: use
+                // 2 clock cycles per byte read.
+                3'h4:    d_execute_cnt = { rd_data, q_execute_cnt[7:0], 1'b0 };
+                3'h5:    d_list_cnt    = rd_data;
+                default:
+                  begin
+                    d_list_cnt     = { rd_data, q_list_cnt[7:0] };
+                    d_decode_cnt   = 0;
+                    d_cmp_cnt      = 16'h0000;
+                    d_state        = (q_execute_cnt) ? S_MEM_CMP_STG_1 : S_MEM_CMP_STG_3;
+                  end
+              endcase
+            end
+        end
+      S_MEM_CMP_STG_1:
+        begin
+          if (~q_execute_cnt[0])
+            begin
+              // Dummy cycle.  Allow memory read 1 cycle to return result.
+              d_execute_cnt = q_execute_cnt - 17'h00001;
+            end
+          else if (!rx_empty)
+            begin
+              rd_en         = 1'b1;                       // pop EXPECTED byte off uart fifo
+              d_execute_cnt = q_execute_cnt - 17'h00001;  // advance to next execute stage
+
+              if ((rd_data != mem_din) && (q_list_cnt >= 16'h0003))
+                begin
+                  // Report this mismatch before moving on.
+                  d_cmp_cnt  = q_cmp_cnt + 16'h0001;
+                  d_cmp_data = mem_din;
+                  d_state    = S_MEM_CMP_STG_2;
+                end
+              else
+                begin
+                  if (rd_data != mem_din)
+                    d_cmp_cnt = q_cmp_cnt + 16'h0001;
+
+                  d_addr = q_addr + 16'h0001;  // advance to next byte
+
+                  if (d_execute_cnt == 0)
+                    d_state = S_MEM_CMP_STG_3;
+                end
+            end
+        end
+      S_MEM_CMP_STG_2:
+        begin
+          // Send the mismatch report entry, using decode count as the byte index.  Writes reach
+          // the TX fifo a cycle late, so leave room for the previous byte.
+          if (tx_free > 1)
+            begin
+              d_decode_cnt = q_decode_cnt + 3'h1;
+              d_wr_en      = 1'b1;
+
+              case (q_decode_cnt)
+                3'h0:    d_tx_data = q_addr[7:0];
+                3'h1:    d_tx_data = q_addr[15:8];
+                default:
+                  begin
+                    d_tx_data    = q_cmp_data;
+                    d_decode_cnt = 0;
+                    d_list_cnt   = q_list_cnt - 16'h0003;
+                    d_addr       = q_addr + 16'h0001;  // advance to next byte
+                    d_state      = (q_execute_cnt) ? S_MEM_CMP_STG_1 : S_MEM_CMP_STG_3;
+                  end
+              endcase
+            end
+        end
+      S_MEM_CMP_STG_3:
+        begin
+          // Pad out the mismatch report, then send the mismatch count.
+          if (tx_free > 1)
+            begin
+              d_wr_en = 1'b1;
+
+              if (q_list_cnt)
+                begin
+                  d_tx_data  = 8'h00;
+                  d_list_cnt = q_list_cnt - 16'h0001;
+                end
+              else if (q_decode_cnt == 0)
+                begin
+                  d_tx_data    = q_cmp_cnt[7:0];
+                  d_decode_cnt = 3'h1;
+                end
+              else
+                begin
+                  d_tx_data = q_cmp_cnt[15:8];
+                  d_state   = S_DECODE;
+                end
+            end
+        end
+
+      // --- WAIT ---
+      //   OP_CODE
+      //   COND
+      //   ADDR_LO
+      //   ADDR_HI
+      //   MASK
+      //   VALUE
+      //   TIMEOUT_LO
+      //   TIMEOUT_HI
+      //
+      //   Waits until COND holds, or for TIMEOUT milliseconds, then responds with a status byte:
+      //   WAIT_STATUS_MET, WAIT_STATUS_TIMEOUT, or WAIT_STATUS_HALTED if the CPU halted first.
+      //     WAIT_COND_HALTED: the CPU is halted.
+      //     WAIT_COND_MEM:    the CPU writes a value to ADDR with (value & MASK) == VALUE.
+      //     WAIT_COND_FRAMES: ADDR vblanks have started.
+      //   OP_WAIT is also accepted while the CPU is running (S_DISABLED), and leaves it running;
+      //   the CPU is only held if it breaks during the wait.
+      S_WAIT_STG_0:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en        = 1'b1;                 // pop packet byte off uart fifo
+              d_decode_cnt = q_decode_cnt + 3'h1;  // advance to next decode stage
+
+              case (q_decode_cnt)
+                3'h0:    d_wait_cond  = rd_data[1:0];
+                3'h1:    d_addr       = rd_data;
+                3'h2:    d_addr       = { rd_data, q_addr[7:0] };
+                3'h3:    d_wait_mask  = rd_data;
+                3'h4:    d_wait_value = rd_data;
+                3'h5:    d_wait_ms    = rd_data;
+                default:
+                  begin
+                    d_wait_ms     = { rd_data, q_wait_ms[7:0] };
+                    d_list_cnt    = q_addr;  // frame count
+                    d_execute_cnt = WAIT_TICK_CYCLES - 17'h00001;
+                    d_state       = S_WAIT_STG_1;
+                  end
+              endcase
+            end
+        end
+      S_WAIT_STG_1:
+        begin
+          if ((q_wait_cond == WAIT_COND_FRAMES) && vblank_start && q_list_cnt)
+            d_list_cnt = q_list_cnt - 16'h0001;
+
+          if (wait_met)
+            begin
+              d_wait_status = WAIT_STATUS_MET;
+              d_state       = S_WAIT_STG_2;
+            end
+          else if (!q_wait_run)
+            begin
+              d_wait_status = WAIT_STATUS_HALTED;
+              d_state       = S_WAIT_STG_2;
+            end
+          else if (q_wait_ms == 0)
+            begin
+              d_wait_status = WAIT_STATUS_TIMEOUT;
+              d_state       = S_WAIT_STG_2;
+            end
+          else if (q_execute_cnt == 0)
+            begin
+              // Another millisecond has passed.
+              d_wait_ms     = q_wait_ms - 16'h0001;
+              d_execute_cnt = WAIT_TICK_CYCLES - 17'h00001;
+            end
+          else
+            begin
+              d_execute_cnt = q_execute_cnt - 17'h00001;
+            end
+        end
+      S_WAIT_STG_2:
+        begin
+          if (!tx_full)
+            begin
+              d_tx_data  = q_wait_status;
+              d_wr_en    = 1'b1;
+              d_wait_run = 1'b0;
+
+              // Carry on as before the wait, unless the CPU broke in the meantime.
+              d_state = (q_wait_run && !brk) ? S_DISABLED : S_DECODE;
+            end
+        end
+
+      // --- PROG_WR ---
+      //   OP_CODE
+      //   CNT_LO
+      //   CNT_HI
+      //   PROGRAM
+      //
+      //   Stores PROGRAM, a sequence of debug packets, for OP_PROG_RUN.  Only the first
+      //   2^PROG_ADDR_BITS bytes are kept.
+      S_PROG_WR_STG_0:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en        = 1'b1;                 // pop packet byte off uart fifo
+              d_decode_cnt = q_decode_cnt + 3'h1;  // advance to next decode stage
+              if (q_decode_cnt == 0)
+                begin
+                  // Read CNT_LO into low bits of execute count.
+                  d_execute_cnt = rd_data;
+                end
+              else
+                begin
+                  // Read CNT_HI into high bits of execute count.
+                  d_execute_cnt = { rd_data, q_execute_cnt[7:0] };
+                  d_addr        = 16'h0000;
+                  d_prog_len    = (d_execute_cnt > (1 << PROG_ADDR_BITS)) ? (1 << PROG_ADDR_BITS)
+                                                                          : d_execute_cnt;
+                  d_state       = (d_execute_cnt) ? S_PROG_WR_STG_1 : S_DECODE;
+                end
+            end
+        end
+      S_PROG_WR_STG_1:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en         = 1'b1;                       // pop packet byte off uart fifo
+              d_execute_cnt = q_execute_cnt - 17'h00001;  // advance to next execute stage
+              d_addr        = q_addr + 16'h0001;          // advance to next byte
+
+              prog_wr_en    = (q_addr < (1 << PROG_ADDR_BITS));
+
+              // After last byte of packet, return to decode stage.
+              if (d_execute_cnt == 0)
+                d_state = S_DECODE;
+            end
+        end
+
+      // --- PROG_RUN ---
+      //   OP_CODE
+      //   MODE
+      //   RUN_CNT_LO
+      //   RUN_CNT_HI
+      //   RSP_CNT_LO
+      //   RSP_CNT_HI
+      //
+      //   Executes the stored program RUN_CNT times, as if its packets had arrived from the host,
+      //   so the response is the program's responses, RUN_CNT times over.  If MODE bit
+      //   PROG_MODE_VBLANK is set, each run waits for the start of a vblank.  RSP_CNT, the total
+      //   response size, is only for the host's benefit.  OP_PROG_RUN is also accepted while the
+      //   CPU is running (S_DISABLED); the program may halt and restart the CPU itself, and the
+      //   CPU is left running while waiting for a vblank if it was.
+      S_PROG_RUN_STG_0:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en        = 1'b1;                 // pop packet byte off uart fifo
+              d_decode_cnt = q_decode_cnt + 3'h1;  // advance to next decode stage
+
+              case (q_decode_cnt)
+                3'h0:    d_prog_vblank = rd_data[PROG_MODE_VBLANK];
+                3'h1:    d_prog_runs   = rd_data;
+                3'h2:    d_prog_runs   = { rd_data, q_prog_runs[7:0] };
+                3'h3:    ;
+                default:
+                  begin
+                    // Skip RSP_CNT, and start on the first run.
+                    if (q_prog_runs)
+                      begin
+                        d_prog_active = 1'b1;
+                        d_state       = S_PROG_RUN_STG_1;
+                      end
+                    else
+                      begin
+                        d_wait_run = 1'b0;
+                        d_state    = (q_wait_run && !brk) ? S_DISABLED : S_DECODE;
+                      end
+                  end
+              endcase
+            end
+        end
+      S_PROG_RUN_STG_1:
+        begin
+          if (!q_prog_vblank || vblank_start)
+            begin
+              // Start the run in the state the CPU was left in.
+              d_prog_idx = 0;
+              d_wait_run = 1'b0;
+              d_state    = (q_wait_run && !brk) ? S_DISABLED : S_DECODE;
+            end
+        end
+
+      // --- MEM_WR_LZ ---
+      //   OP_CODE
+      //   SPACE
+      //   ADDR_LO
+      //   ADDR_HI
+      //   CNT_LO
+      //   CNT_HI
+      //   TOKENS
+      //
+      //   Writes PPU memory if SPACE bit 0 is set, CPU memory otherwise, starting at ADDR, from CNT
+      //   bytes of LZ tokens:
+      //
+      //     0LLLLLLL              - literal: the next L + 1 bytes of TOKENS
+      //     10LLLLLL DIST         - copy L + 3 bytes from DIST + 1 bytes back
+      //     11LLLLLL DIST_LO/HI   - copy L + 4 bytes from DIST + 1 bytes back
+      //
+      //   Copies read back memory already written (by this packet or earlier ones), so no history
+      //   buffer is needed, and a copy may overlap its own output.  A token cut off by the end of
+      //   TOKENS is dropped.
+      S_MEM_WR_LZ_STG_0:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en        = 1'b1;                 // pop packet byte off uart fifo
+              d_decode_cnt = q_decode_cnt + 3'h1;  // advance to next decode stage
+
+              case (q_decode_cnt)
+                3'h0:    d_ppu_space = rd_data[0];
+                3'h1:    d_addr      = rd_data;
+                3'h2:    d_addr      = { rd_data, q_addr[7:0] };
+                3'h3:    d_list_cnt  = rd_data;
+                default:
+                  begin
+                    // List count holds the TOKENS bytes remaining.
+                    d_list_cnt = { rd_data, q_list_cnt[7:0] };
+                    d_state    = (d_list_cnt) ? S_MEM_WR_LZ_STG_1 : S_DECODE;
+                  end
+              endcase
+            end
+        end
+      S_MEM_WR_LZ_STG_1:
+        begin
+          // Decode a token.  Execute count holds the bytes it writes.
+          if (!rx_empty)
+            begin
+              rd_en      = 1'b1;                    // pop token byte off uart fifo
+              d_list_cnt = q_list_cnt - 16'h0001;
+
+              if (!rd_data[7])
+                begin
+                  d_execute_cnt = rd_data[6:0] + 17'h00001;
+                  d_state       = S_MEM_WR_LZ_STG_2;
+                end
+              else
+                begin
+                  // Decode count 1 means DIST_LO of a two byte DIST is next.
+                  d_execute_cnt = rd_data[5:0] + ((rd_data[6]) ? 17'h00004 : 17'h00003);
+                  d_decode_cnt  = (rd_data[6]) ? 3'h1 : 3'h0;
+                  d_state       = S_MEM_WR_LZ_STG_3;
+                end
+
+              if (d_list_cnt == 0)
+                d_state = S_DECODE;
+            end
+        end
+      S_MEM_WR_LZ_STG_2:
+        begin
+          // Write one literal byte per cycle.
+          if (!rx_empty)
+            begin
+              rd_en         = 1'b1;                       // pop literal byte off uart fifo
+              d_list_cnt    = q_list_cnt - 16'h0001;
+              d_execute_cnt = q_execute_cnt - 17'h00001;
+              d_addr        = q_addr + 16'h0001;          // advance to next byte
+
+              if (q_ppu_space)
+                begin
+                  ppu_vram_wr = 1'b1;
+                end
+              else
+                begin
+                  cpu_r_nw = 1'b0;
+                end
+
+              if (d_list_cnt == 0)
+                d_state = S_DECODE;
+              else if (d_execute_cnt == 0)
+                d_state = S_MEM_WR_LZ_STG_1;
+            end
+        end
+      S_MEM_WR_LZ_STG_3:
+        begin
+          if (!rx_empty)
+            begin
+              rd_en        = 1'b1;                    // pop DIST byte off uart fifo
+              d_list_cnt   = q_list_cnt - 16'h0001;
+              d_decode_cnt = 3'h0;
+
+              case (q_decode_cnt)
+                3'h1:
+                  begin
+                    // Hold DIST_LO until DIST_HI arrives.
+                    d_lz_src     = rd_data;
+                    d_decode_cnt = 3'h2;
+                  end
+                3'h2:    d_lz_src = q_addr - { rd_data, q_lz_src[7:0] } - 16'h0001;
+                default: d_lz_src = q_addr - { 8'h00, rd_data } - 16'h0001;
+              endcase
+
+              if (d_decode_cnt != 0)
+                d_state = (d_list_cnt) ? S_MEM_WR_LZ_STG_3 : S_DECODE;
+              else
+                d_state = S_MEM_WR_LZ_STG_4;
+            end
+        end
+      S_MEM_WR_LZ_STG_4:
+        begin
+          // Copy one byte every 3 cycles, using decode count as the phase: present the source
+          // address (see lz_rd), capture the byte read a cycle later, then write it to q_addr.
+          d_decode_cnt = q_decode_cnt + 3'h1;
+
+          if (q_decode_cnt == 3'h1)
+            begin
+              d_lz_data = mem_din;
+            end
+          else if (q_decode_cnt == 3'h2)
+            begin
+              if (q_ppu_space)
+                begin
+                  ppu_vram_wr = 1'b1;
+                end
+              else
+                begin
+                  cpu_r_nw = 1'b0;
+                  cpu_dout = q_lz_data;
+                end
+
+              d_decode_cnt  = 3'h0;
+              d_execute_cnt = q_execute_cnt - 17'h00001;
+              d_addr        = q_addr + 16'h0001;          // advance to next byte
+              d_lz_src      = q_lz_src + 16'h0001;
+
+              if (d_execute_cnt == 0)
+                d_state = (q_list_cnt) ? S_MEM_WR_LZ_STG_1 : S_DECODE;
+            end
+        end
+    endcase
+
+    // Stored program.  Once a run has been consumed and its last packet has finished executing,
+    // start the next run, or go back to the host's packets.
+    if (q_prog_active && rd_en)
+      d_prog_idx = q_prog_idx + 1'h1;
+
+    if (q_prog_active && (q_prog_idx == q_prog_len) &&
+        ((q_state == S_DECODE) || (q_state == S_DISABLED)))
+      begin
+        d_prog_runs = q_prog_runs - 16'h0001;
+
+        if (q_prog_runs == 16'h0001)
+          begin
+            d_prog_active = 1'b0;
+          end
+        else
+          begin
+            d_wait_run = (q_state == S_DISABLED) && !brk;
+            d_state    = S_PROG_RUN_STG_1;
+          end
+      end
+
+    // Framed mode.  Receive frames from the uart into the frame buffer, and release verified ones
+    // to the decode/execute states above.
+    if (q_framed)
+      begin
+        case (q_fr_state)
+          FR_SOF:
+            begin
+              // Hunt for the start of the next frame.
+              if (!uart_rx_empty)
+                begin
+                  fr_rd_en = 1'b1;
+                  if (uart_rd_data == FRAME_SOF)
+                    d_fr_state = FR_SEQ;
+                end
+            end
+          FR_SEQ:
+            begin
+              if (!uart_rx_empty)
+                begin
+                  fr_rd_en    = 1'b1;
+                  d_fr_seq    = uart_rd_data;
+                  d_fr_rx_crc = crc16(FRAME_CRC_INIT, uart_rd_data);
+                  d_fr_state  = FR_LEN_LO;
+                end
+            end
+          FR_LEN_LO:
+            begin
+              if (!uart_rx_empty)
+                begin
+                  fr_rd_en    = 1'b1;
+                  d_fr_len    = uart_rd_data;
+                  d_fr_rx_crc = crc16(q_fr_rx_crc, uart_rd_data);
+                  d_fr_state  = FR_LEN_HI;
+                end
+            end
+          FR_LEN_HI:
+            begin
+              if (!uart_rx_empty)
+                begin
+                  fr_rd_en    = 1'b1;
+                  d_fr_len    = { uart_rd_data, q_fr_len[7:0] };
+                  d_fr_rx_crc = crc16(q_fr_rx_crc, uart_rd_data);
+                  d_fr_cnt    = 16'h0000;
+
+                  // A length the frame buffer can't hold means the header was corrupted.
+                  if ((d_fr_len == 0) || (d_fr_len > (1 << FRAME_BUF_ADDR_BITS)))
+                    begin
+                      d_fr_discard = 1'b1;
+                      d_fr_state   = FR_NAK;
+                    end
+                  else
+                    begin
+                      d_fr_state   = FR_PAYLOAD;
+                    end
+                end
+            end
+          FR_PAYLOAD:
+            begin
+              if (!uart_rx_empty)
+                begin
+                  fr_rd_en    = 1'b1;
+                  fbuf_wr_en  = 1'b1;
+                  d_fr_rx_crc = crc16(q_fr_rx_crc, uart_rd_data);
+                  d_fr_cnt    = q_fr_cnt + 16'h0001;
+
+                  if (d_fr_cnt == q_fr_len)
+                    d_fr_state = FR_CRC_LO;
+                end
+            end
+          FR_CRC_LO:
+            begin
+              if (!uart_rx_empty)
+                begin
+                  fr_rd_en   = 1'b1;
+                  d_fr_len   = uart_rd_data;  // payload length no longer needed
+                  d_fr_state = FR_CRC_HI;
+                end
+            end
+          FR_CRC_HI:
+            begin
+              if (!uart_rx_empty)
+                begin
+                  fr_rd_en = 1'b1;
+                  d_fr_cnt = 16'h0000;
+
+                  if ({ uart_rd_data, q_fr_len[7:0] } != q_fr_rx_crc)
+                    begin
+                      // Corrupted frame.  Ask for it again, and drop everything after it until it
+                      // arrives.
+                      fbuf_clr     = 1'b1;
+                      d_fr_discard = 1'b1;
+                      d_fr_state   = FR_NAK;
+                    end
+                  else if (fr_seq_diff[7])
+                    begin
+                      // Ahead of the expected frame, so a frame before it was lost.  Ask for the
+                      // expected one again, and drop everything after it until it arrives.
+                      fbuf_clr     = 1'b1;
+                      d_fr_discard = 1'b1;
+                      d_fr_state   = FR_NAK;
+                    end
+                  else if (fr_seq_diff == 8'h00)
+                    begin
+                      // The expected frame.  Execute it, keeping its response for replay.
+                      rp_start_wr       = 1'b1;
+                      d_rp_cnt          = (q_rp_cnt[REPLAY_SEQ_BITS]) ? q_rp_cnt :
+                                                                        q_rp_cnt + 8'h01;
+                      d_fr_discard      = 1'b0;
+                      d_fr_expected_seq = q_fr_seq + 8'h01;
+                      d_fr_tx_crc       = FRAME_CRC_INIT;
+                      d_fr_state        = FR_ACK;
+                    end
+                  else
+                    begin
+                      // A resend of a frame already executed, whose response the host lost.  Send
+                      // the response again rather than executing the frame again, or drop the
+                      // frame if the response is no longer kept.
+                      fbuf_clr     = 1'b1;
+                      d_rp_rd_addr = rp_seq_start;
+                      d_rp_end     = rp_seq_end;
+                      d_fr_state   = (rp_seq_kept) ? FR_REPLAY : FR_SOF;
+                    end
+                end
+            end
+          FR_ACK:
+            begin
+              // Send the response header, then execute the payload.  Writes reach the TX fifo a
+              // cycle late, so leave room for the previous byte.
+              if (tx_free > 1)
+                begin
+                  d_fr_cnt = q_fr_cnt + 16'h0001;
+                  d_wr_en  = 1'b1;
+
+                  if (q_fr_cnt == 0)
+                    begin
+                      d_tx_data = FRAME_SOF;
+                    end
+                  else if (q_fr_cnt == 1)
+                    begin
+                      d_tx_data   = q_fr_seq;
+                      d_fr_tx_crc = crc16(q_fr_tx_crc, q_fr_seq);
+                    end
+                  else
+                    begin
+                      d_tx_data   = FRAME_ACK;
+                      d_fr_tx_crc = crc16(q_fr_tx_crc, FRAME_ACK);
+                      d_fr_state  = FR_EXEC;
+                    end
+                end
+            end
+          FR_EXEC:
+            begin
+              // Accumulate the response CRC over whatever the decode/execute states send.
+              if (d_wr_en)
+                d_fr_tx_crc = crc16(q_fr_tx_crc, d_tx_data);
+
+              // Done once the payload is consumed and the last packet (and any program it ran) has
+              // finished executing.
+              if (fbuf_empty && !q_prog_active &&
+                  ((q_state == S_DECODE) || (q_state == S_DISABLED)))
+                begin
+                  d_fr_cnt   = 16'h0000;
+                  d_fr_state = FR_RSP_CRC;
+                end
+            end
+          FR_RSP_CRC:
+            begin
+              if (tx_free > 1)
+                begin
+                  d_fr_cnt = q_fr_cnt + 16'h0001;
+                  d_wr_en  = 1'b1;
+
+                  if (q_fr_cnt == 0)
+                    begin
+                      d_tx_data = q_fr_tx_crc[7:0];
+                    end
+                  else
+                    begin
+                      d_tx_data  = q_fr_tx_crc[15:8];
+                      d_fr_state = FR_SOF;
+
+                      // Apply a pending SET_FRAMED now that its response is complete.
+                      if (q_unframe)
+                        begin
+                          d_framed  = 1'b0;
+                          d_unframe = 1'b0;
+                        end
+                    end
+                end
+            end
+          FR_NAK:
+            begin
+              if (tx_free > 1)
+                begin
+                  d_fr_cnt = q_fr_cnt + 16'h0001;
+                  d_wr_en  = 1'b1;
+
+                  case (q_fr_cnt[2:0])
+                    3'h0:
+                      begin
+                        d_tx_data   = FRAME_SOF;
+                        d_fr_tx_crc = FRAME_CRC_INIT;
+                      end
+                    3'h1:
+                      begin
+                        d_tx_data   = q_fr_expected_seq;
+                        d_fr_tx_crc = crc16(q_fr_tx_crc, q_fr_expected_seq);
+                      end
+                    3'h2:
+                      begin
+                        d_tx_data   = FRAME_NAK;
+                        d_fr_tx_crc = crc16(q_fr_tx_crc, FRAME_NAK);
+                      end
+                    3'h3:
+                      begin
+                        d_tx_data   = q_fr_tx_crc[7:0];
+                      end
+                    default:
+                      begin
+                        d_tx_data   = q_fr_tx_crc[15:8];
+                        d_fr_state  = FR_SOF;
+                      end
+                  endcase
+                end
+            end
+          FR_REPLAY:
+            begin
+              // Send a kept ACK frame again, from q_rp_rd_addr up to q_rp_end.
+              if (q_rp_rd_addr == q_rp_end)
+                begin
+                  d_fr_state = FR_SOF;
+                end
+              else if (tx_free > 1)
+                begin
+                  d_tx_data    = rp_rd_data;
+                  d_wr_en      = 1'b1;
+                  d_rp_rd_addr = q_rp_rd_addr + 1'b1;
+                end
+            end
+        endcase
+
+        // Keep the bytes of ACK frames for replay.
+        d_tx_keep = d_wr_en && ((q_fr_state == FR_ACK) || (q_fr_state == FR_EXEC) ||
+                                (q_fr_state == FR_RSP_CRC));
+      end
   end
 
-assign cpu_a            = q_addr;
-assign active           = (q_state != S_DISABLED);
-assign ppu_vram_a       = q_addr;
-assign ppu_vram_dout    = rd_data;
+assign cpu_a            = (lz_rd) ? q_lz_src : q_addr;
+assign active           = (q_state != S_DISABLED) && !q_wait_run;
+assign ppu_vram_a       = (lz_rd) ? q_lz_src : q_addr;
+assign ppu_vram_dout    = (q_state == S_MEM_FILL_STG_2)  ? fill_data :
+                          (q_state == S_MEM_WR_LZ_STG_4) ? q_lz_data : rd_data;
 assign cart_cfg         = q_cart_cfg;
 assign cart_cfg_upd     = q_cart_cfg_upd;
 
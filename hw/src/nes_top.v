@@ -171,6 +171,7 @@ wire [ 7:0] ppu_vram_din;   // ppu video ram data bus (input)
 wire [ 7:0] ppu_vram_dout;  // ppu video ram data bus (output)
 
 wire        ppu_nvbl;       // ppu /VBL signal.
+wire        ppu_vblank;     // ppu vertical blank signal.
 
 // PPU snoops the CPU address bus for register reads/writes.  Addresses 0x2000-0x2007
 // are mapped to the PPU register space, with every 8 bytes mirrored through 0x3FFF.
@@ -194,6 +195,7 @@ ppu ppu_blk(
   .b_out(VGA_BLUE),
   .ri_d_out(ppu_ri_dout),
   .nvbl_out(ppu_nvbl),
+  .vblank_out(ppu_vblank),
   .vram_a_out(ppu_vram_a),
   .vram_d_out(ppu_vram_dout),
   .vram_wr_out(ppu_vram_wr)
@@ -222,6 +224,10 @@ hci hci_blk(
   .cpu_din(hci_cpu_din),
   .cpu_dbgreg_in(rp2a03_dbgreg_dout),
   .ppu_vram_din(hci_ppu_vram_din),
+  .cpu_snoop_a(rp2a03_a),
+  .cpu_snoop_r_nw(rp2a03_r_nw),
+  .cpu_snoop_dout(rp2a03_dout),
+  .vblank(ppu_vblank),
   .tx(TXD),
   .active(hci_active),
   .cpu_r_nw(hci_cpu_r_nw),
@@ -41,6 +41,7 @@ module ppu
   output wire [ 1:0] b_out,         // vga blue signal
   output wire [ 7:0] ri_d_out,      // register interface data out
   output wire        nvbl_out,      // /VBL (low during vertical blank)
+  output wire        vblank_out,    // high during vertical blank, regardless of NMI enable
   output wire [13:0] vram_a_out,    // video memory address bus
   output wire [ 7:0] vram_d_out,    // video memory data bus (output)
   output wire        vram_wr_out    // video memory read/write select
@@ -295,7 +296,8 @@ assign ri_spr_pri_col = q_pri_obj_col;
 //
 // Assign miscellaneous output signals.
 //
-assign nvbl_out = ~(ri_vblank & ri_nvbl_en);
+assign nvbl_out   = ~(ri_vblank & ri_nvbl_en);
+assign vblank_out = vga_vblank;
 
 endmodule
 
@@ -0,0 +1,249 @@
+/***************************************************************************************************
+** fpga_nes/hw/tb/uart_baud_clk_tb.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  Verilator testbench for uart_baud_clk.  Runs the block at each rate hci.v can select, and at a
+*  rate change partway through a run, against a model of the phase accumulator, and checks:
+*
+*    - every tick comes on the clk the model predicts, so the average rate is exactly what the
+*      phase increment gives;
+*    - ticks are never more than one clk off the ideal spacing;
+*    - the hci.v phase increments round the uart_baud_clk formula, and land within
+*      MaxRateErrorPpm of the nominal rate;
+*    - reset restarts the accumulator.
+*
+*  Returns the number of failed checks.
+***************************************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "Vuart_baud_clk.h"
+#include "verilated.h"
+
+static const uint64_t SysClkFreq      = 100000000;  // hci.v system clock, in Hz
+static const uint64_t OversampleRate  = 16;         // uart BAUD_CLK_OVERSAMPLE_RATE
+static const uint32_t AccBits         = 24;         // uart_baud_clk ACC_BITS, as hci.v sets it
+static const uint32_t RunClks         = 1000000;    // clks run at each rate (10ms)
+static const double   MaxRateErrorPpm = 10.0;       // worst phase increment rounding allowed
+
+// Rates selectable through OP_SET_BAUD, with their hci.v BAUD_INC_* phase increments.
+static const struct
+{
+    uint32_t baud;     // baud rate
+    uint32_t baudInc;  // phase increment per clk
+} Rates[] =
+{
+    {   38400,  103079 },
+    {  115200,  309238 },
+    {  230400,  618475 },
+    {  460800, 1236951 },
+    {  921600, 2473901 },
+    { 1000000, 2684355 },
+    { 2000000, 5368709 },
+    { 3000000, 8053064 },
+};
+
+static const uint32_t RateCnt = sizeof(Rates) / sizeof(Rates[0]);
+
+/***************************************************************************************************
+** % Class:       BaudClkTest
+*  % Description: Drives a uart_baud_clk alongside a model of its phase accumulator, and counts
+*                 the checks that fail.
+***************************************************************************************************/
+class BaudClkTest
+{
+public:
+    BaudClkTest() : m_acc(0), m_tickCnt(0), m_lastTickClk(0), m_clkCnt(0), m_failCnt(0) {}
+
+    void     Reset(uint32_t baudInc);
+    void     Run(uint32_t baudInc, uint32_t numClks);
+    bool     Check(bool cond, const char* pWhat, uint32_t baud);
+    uint32_t GetFailCnt() const { return m_failCnt; }
+
+private:
+    Vuart_baud_clk m_dut;          // block under test
+    uint32_t       m_acc;          // modelled accumulator
+    uint64_t       m_tickCnt;      // ticks since the last Run() started
+    uint64_t       m_lastTickClk;  // clk of the last tick (0 if none yet)
+    uint64_t       m_clkCnt;       // clks since the last Run() started
+    uint32_t       m_failCnt;      // failed checks
+};
+
+/***************************************************************************************************
+** % Method:      BaudClkTest::Reset()
+*  % Description: Pulses the asynchronous reset, which restarts the accumulator.
+*  % Returns:     N/A
+***************************************************************************************************/
+void BaudClkTest::Reset(
+    uint32_t baudInc)  // phase increment to hold through reset
+{
+    m_dut.baud_inc = baudInc;
+    m_dut.clk      = 0;
+    m_dut.reset    = 1;
+    m_dut.eval();
+    m_dut.reset    = 0;
+    m_dut.eval();
+
+    m_acc = 0;
+}
+
+/***************************************************************************************************
+** % Method:      BaudClkTest::Run()
+*  % Description: Clocks the block numClks times at baudInc, checking each tick against the model
+*                 and the spacing between ticks.  The accumulator carries on from where the last
+*                 run left it, as it does when hci.v switches rates.
+*  % Returns:     N/A
+***************************************************************************************************/
+void BaudClkTest::Run(
+    uint32_t baudInc,  // phase increment per clk
+    uint32_t numClks)  // clks to run
+{
+    const uint32_t accMask = (1u << AccBits) - 1;
+    const uint32_t minGap  = (1u << AccBits) / baudInc;
+    const uint32_t maxGap  = minGap + (((1u << AccBits) % baudInc) ? 1 : 0);
+
+    m_dut.baud_inc = baudInc;
+    m_dut.eval();
+
+    m_tickCnt     = 0;
+    m_lastTickClk = 0;
+    m_clkCnt      = 0;
+
+    for (uint32_t i = 0; i < numClks; i++)
+    {
+        // The tick is the accumulator's carry into the coming clk edge.
+        const uint32_t sum  = m_acc + baudInc;
+        const bool     tick = (m_dut.baud_clk_tick != 0);
+
+        m_acc = sum & accMask;
+
+        m_dut.clk = 1;
+        m_dut.eval();
+        m_dut.clk = 0;
+        m_dut.eval();
+
+        m_clkCnt++;
+
+        if (tick != ((sum >> AccBits) != 0))
+        {
+            printf("  baud_inc %u: %s at clk %llu\n",
+                   baudInc,
+                   (tick) ? "unexpected tick" : "missing tick",
+                   static_cast<unsigned long long>(m_clkCnt));
+            m_failCnt++;
+            return;
+        }
+
+        if (tick)
+        {
+            const uint64_t gap = m_clkCnt - m_lastTickClk;
+
+            if (m_lastTickClk && ((gap < minGap) || (gap > maxGap)))
+            {
+                printf("  baud_inc %u: %llu clks between ticks, expected %u to %u\n",
+                       baudInc,
+                       static_cast<unsigned long long>(gap),
+                       minGap,
+                       maxGap);
+                m_failCnt++;
+                return;
+            }
+
+            m_tickCnt++;
+            m_lastTickClk = m_clkCnt;
+        }
+    }
+}
+
+/***************************************************************************************************
+** % Method:      BaudClkTest::Check()
+*  % Description: Records the result of a check, printing a message if it failed.
+*  % Returns:     cond.
+***************************************************************************************************/
+bool BaudClkTest::Check(
+    bool        cond,   // true if the check passed
+    const char* pWhat,  // what was checked, for messages
+    uint32_t    baud)   // baud rate being checked
+{
+    if (!cond)
+    {
+        printf("  %u baud: check failed: %s\n", baud, pWhat);
+        m_failCnt++;
+    }
+
+    return cond;
+}
+
+/***************************************************************************************************
+** % Function:    main()
+*  % Description: uart_baud_clk testbench entry point.
+*  % Returns:     Number of failed checks.
+***************************************************************************************************/
+int main(
+    int   argc,    // number of command line arguments
+    char* argv[])  // command line arguments
+{
+    Verilated::commandArgs(argc, argv);
+
+    BaudClkTest test;
+
+    for (uint32_t i = 0; i < RateCnt; i++)
+    {
+        const uint32_t baud    = Rates[i].baud;
+        const uint32_t baudInc = Rates[i].baudInc;
+        const uint32_t failCnt = test.GetFailCnt();
+
+        // baud_inc = (BAUD * BAUD_CLK_OVERSAMPLE_RATE * 2^ACC_BITS) / SYS_CLK_FREQ, rounded.
+        const uint64_t scaledRate = (static_cast<uint64_t>(baud) * OversampleRate) << AccBits;
+
+        test.Check(baudInc == (scaledRate + SysClkFreq / 2) / SysClkFreq, "phase increment", baud);
+
+        const double incRate  = static_cast<double>(baudInc) * SysClkFreq /
+                                (static_cast<double>(OversampleRate) * (1u << AccBits));
+        const double errorPpm = (incRate - baud) * 1000000.0 / baud;
+
+        test.Check((errorPpm <= MaxRateErrorPpm) && (errorPpm >= -MaxRateErrorPpm),
+                   "phase increment rate error",
+                   baud);
+
+        // From reset, the run's ticks are exactly those of the ideal accumulator.
+        test.Reset(baudInc);
+        test.Run(baudInc, RunClks);
+
+        printf("%s %u baud\n", (test.GetFailCnt() == failCnt) ? "PASS" : "FAIL", baud);
+    }
+
+    // A switch from the slowest rate to the fastest takes effect on the next clk, with the
+    // accumulator's phase carried over, and back again.
+    const uint32_t failCnt = test.GetFailCnt();
+
+    test.Reset(Rates[0].baudInc);
+    test.Run(Rates[0].baudInc, 1000);
+    test.Run(Rates[RateCnt - 1].baudInc, 1000);
+    test.Run(Rates[0].baudInc, 1000);
+
+    printf("%s rate switch\n", (test.GetFailCnt() == failCnt) ? "PASS" : "FAIL");
+
+    return static_cast<int>(test.GetFailCnt());
+}
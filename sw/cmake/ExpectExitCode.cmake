@@ -0,0 +1,24 @@
+# Runs a command and fails unless it exits with EXPECTED_EXIT_CODE, for testing programs whose exit
+# code says why they failed:
+#
+#   cmake -DEXPECTED_EXIT_CODE=<code> -P ExpectExitCode.cmake -- <command> [args ...]
+
+set(cmd)
+set(in_cmd FALSE)
+
+math(EXPR last_arg "${CMAKE_ARGC} - 1")
+
+foreach(i RANGE ${last_arg})
+  if(in_cmd)
+    list(APPEND cmd "${CMAKE_ARGV${i}}")
+  elseif(CMAKE_ARGV${i} STREQUAL "--")
+    set(in_cmd TRUE)
+  endif()
+endforeach()
+
+execute_process(COMMAND ${cmd} RESULT_VARIABLE exit_code)
+
+if(NOT exit_code STREQUAL EXPECTED_EXIT_CODE)
+  string(REPLACE ";" " " cmd_line "${cmd}")
+  message(FATAL_ERROR "${cmd_line} exited with ${exit_code}, expected ${EXPECTED_EXIT_CODE}.")
+endif()
@@ -0,0 +1,152 @@
+----------------------------------------------------------------------------------------------------
+-- Script:      dbg_mem_ops.lua
+-- Description: Tests dbg block's memory range packets (fill, CRC, compare, multi-read), wait and
+--              stored programs.  Uses only CPU PRG RAM and PPU pattern tables, which have no
+--              mirrors, so it also runs against the HCI simulator.
+----------------------------------------------------------------------------------------------------
+
+dofile("../scripts/inc/nesdbg.lua")
+
+local results = {}
+
+-- RandomData: Returns an array of numBytes random bytes.
+function RandomData(numBytes)
+  local data = {}
+  for i = 1, numBytes do
+    data[i] = math.random(0, 255)
+  end
+  return data
+end
+
+-- PatternData: Returns an array of numBytes repeating pattern.
+function PatternData(numBytes, pattern)
+  local data = {}
+  for i = 1, numBytes do
+    data[i] = pattern[((i - 1) % #pattern) + 1]
+  end
+  return data
+end
+
+-- MemWr: Writes data to addr in the specified space.
+function MemWr(space, addr, data)
+  if space == MemSpace.CPU then
+    nesdbg.CpuMemWr(addr, #data, data)
+  else
+    nesdbg.PpuMemWr(addr, #data, data)
+  end
+end
+
+-- MemRd: Reads numBytes from addr in the specified space.
+function MemRd(space, addr, numBytes)
+  if space == MemSpace.CPU then
+    return nesdbg.CpuMemRd(addr, numBytes)
+  else
+    return nesdbg.PpuMemRd(addr, numBytes)
+  end
+end
+
+local subTests =
+{
+  -- Fill: patterns of 1-8 bytes, read back.
+  function()
+    local result = ScriptResult.Pass
+    for patternSize = 1, 8 do
+      local pattern = RandomData(patternSize)
+      nesdbg.Fill(MemSpace.CPU, 0x6001, 0x155, pattern)
+      nesdbg.Fill(MemSpace.PPU, 0x0801, 0x155, pattern)
+      if not CompareArrayData(MemRd(MemSpace.CPU, 0x6001, 0x155), PatternData(0x155, pattern)) or
+         not CompareArrayData(MemRd(MemSpace.PPU, 0x0801, 0x155), PatternData(0x155, pattern)) then
+        result = ScriptResult.Fail
+      end
+    end
+    return result
+  end,
+
+  -- MemCrc: matches data just written, not data that differs by a bit.
+  function()
+    local data = RandomData(0x1000)
+    MemWr(MemSpace.PPU, 0x1000, data)
+    local match = nesdbg.MemCrc(MemSpace.PPU, 0x1000, data)
+    data[0x800] = (data[0x800] + 1) % 256
+    local mismatch = nesdbg.MemCrc(MemSpace.PPU, 0x1000, data)
+    if match and not mismatch then
+      return ScriptResult.Pass
+    end
+    return ScriptResult.Fail
+  end,
+
+  -- MemCompare: finds planted mismatches, across more than one frame-sized piece.
+  function()
+    local data = RandomData(0x1800)
+    MemWr(MemSpace.CPU, 0x6800, data)
+    local cnt = nesdbg.MemCompare(MemSpace.CPU, 0x6800, data)
+    local actual = data[0x101]
+    data[0x101] = (data[0x101] + 0x40) % 256
+    data[0x900] = (data[0x900] + 0x02) % 256
+    data[0x17FF] = (data[0x17FF] + 0x01) % 256
+    local badCnt, mismatches = nesdbg.MemCompare(MemSpace.CPU, 0x6800, data)
+    if cnt == 0 and badCnt == 3 and #mismatches == 3 and
+       mismatches[1][1] == 0x6900 and mismatches[1][2] == actual and
+       mismatches[2][1] == 0x70FF and mismatches[3][1] == 0x7FFE then
+      return ScriptResult.Pass
+    end
+    return ScriptResult.Fail
+  end,
+
+  -- MultiRd: several ranges in each space, returned in order.
+  function()
+    local cpuData = RandomData(0x40)
+    local ppuData = RandomData(0x40)
+    MemWr(MemSpace.CPU, 0x6800, cpuData)
+    MemWr(MemSpace.PPU, 0x0400, ppuData)
+    local rd = nesdbg.MultiRd({ { MemSpace.PPU, 0x0400, 0x40 },
+                                { MemSpace.CPU, 0x6800, 0x40 },
+                                { MemSpace.CPU, 0x6810, 0x01 } })
+    if CompareArrayData(rd[1], ppuData) and CompareArrayData(rd[2], cpuData) and
+       rd[3][1] == cpuData[0x11] then
+      return ScriptResult.Pass
+    end
+    return ScriptResult.Fail
+  end,
+
+  -- Wait: met at once while halted; frames pass; a memory write that never comes times out.
+  function()
+    local halted = nesdbg.Wait(WaitCond.Halted, 0, 0, 0, 0)
+    local frames = nesdbg.Wait(WaitCond.Frames, 2, 0, 0, 1000)
+    nesdbg.DbgRun()
+    local mem = nesdbg.Wait(WaitCond.Mem, 0x6000, 0xFF, 0x5A, 20)
+    nesdbg.DbgHlt()
+    if halted == WaitStatus.Met and frames == WaitStatus.Met and mem == WaitStatus.Timeout then
+      return ScriptResult.Pass
+    end
+    return ScriptResult.Fail
+  end,
+
+  -- ProgWr/ProgRun: a stored program runs as many times as asked.
+  function()
+    local data = RandomData(0x10)
+    MemWr(MemSpace.CPU, 0x6200, data)
+    local stored = nesdbg.ProgWr({ { ProgCmd.CpuRegWr, CpuReg.AC, 0x3C },
+                                   { ProgCmd.CpuMemRd, 0x6200, 0x10 } })
+    SetAc(0)
+    local rd = nesdbg.ProgRun(3, false)
+    local expected = {}
+    for i = 1, 3 do
+      for j = 1, #data do
+        expected[#expected + 1] = data[j]
+      end
+    end
+    if stored and GetAc() == 0x3C and CompareArrayData(rd, expected) then
+      return ScriptResult.Pass
+    end
+    return ScriptResult.Fail
+  end,
+}
+
+for subTestIdx = 1, #subTests do
+  results[subTestIdx] = subTests[subTestIdx]()
+
+  ReportSubTestResult(subTestIdx, results[subTestIdx])
+end
+
+return ComputeOverallResult(results)
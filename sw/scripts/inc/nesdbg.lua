@@ -11,7 +11,8 @@ ScriptResult =
   Error = 2   -- SCRIPT_RESULT_ERROR
 }
 
--- CpuReg: Values used to select CPU register for CpuRegRd/CpuRegWr commands.
+-- CpuReg: Values used to select CPU register for CpuRegRd/CpuRegWr commands, and to index the
+--         tables used by CpuRegsRd/CpuRegsWr.
 CpuReg =
 {
   PCL = 0, -- PCL: Program Counter Low Register
@@ -23,6 +24,42 @@ CpuReg =
   S   = 6, -- S:   Stack Pointer Register
 }
 
+-- MemSpace: Values used to select the address space for nesdbg.MultiRd, nesdbg.Fill,
+--           nesdbg.MemCrc and nesdbg.MemCompare.
+MemSpace =
+{
+  CPU = 0, -- MemSpaceCpu
+  PPU = 1, -- MemSpacePpu
+}
+
+-- WaitCond: Conditions for nesdbg.Wait.
+WaitCond =
+{
+  Halted = 0, -- WaitPacket::CondHalted: the CPU is halted
+  Mem    = 1, -- WaitPacket::CondMem:    the CPU writes data to addr with (data & mask) == value
+  Frames = 2, -- WaitPacket::CondFrames: addr vblanks have started
+}
+
+-- WaitStatus: Values returned by nesdbg.Wait.
+WaitStatus =
+{
+  Timeout = 0, -- WaitPacket::StatusTimeout
+  Met     = 1, -- WaitPacket::StatusMet
+  Halted  = 2, -- WaitPacket::StatusHalted: the CPU halted before the condition was met
+}
+
+-- ProgCmd: Commands for nesdbg.ProgWr programs (debug packet opcodes), and their arguments.
+ProgCmd =
+{
+  CpuMemRd  = 0x01, -- { ProgCmd.CpuMemRd, addr, numBytes }
+  DbgHlt    = 0x03, -- { ProgCmd.DbgHlt }
+  DbgRun    = 0x04, -- { ProgCmd.DbgRun }
+  CpuRegWr  = 0x06, -- { ProgCmd.CpuRegWr, reg [CpuReg], val }
+  PpuMemRd  = 0x09, -- { ProgCmd.PpuMemRd, addr, numBytes }
+  MemCrc    = 0x12, -- { ProgCmd.MemCrc, space [MemSpace], addr, numBytes }
+  CpuRegsRd = 0x14, -- { ProgCmd.CpuRegsRd }
+}
+
 -- Ops: 6502 Opcodes
 Ops =
 {
@@ -228,10 +265,9 @@ end
 
 -- GetPc: Return the current program counter
 function GetPc()
-  local pcl = nesdbg.CpuRegRd(CpuReg.PCL)
-  local pch = nesdbg.CpuRegRd(CpuReg.PCH)
+  local regs = nesdbg.CpuRegsRd()
 
-  return (pch * 256) + pcl
+  return (regs[CpuReg.PCH] * 256) + regs[CpuReg.PCL]
 end
 
 -- SetPc: Sets the current program counter
@@ -0,0 +1,97 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/allocstats.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  Heap allocation statistics implementation.  Replaces the global operator new/delete with versions
+*  that count allocations, so hot paths can be checked for per-packet heap use (see nesbench).
+***************************************************************************************************/
+
+#include <new>
+#include <stdlib.h>
+
+#include "allocstats.h"
+
+static volatile LONG s_allocCnt = 0;  // operator new/new[] calls since startup
+
+/***************************************************************************************************
+** % Function:    operator new()
+*  % Description: Counting replacement for the global allocator.
+*  % Returns:     Allocated memory.  Throws std::bad_alloc on failure.
+***************************************************************************************************/
+VOID* operator new(
+    size_t size)  // bytes to allocate
+{
+    AtomicIncrement(&s_allocCnt);
+
+    VOID* pMem = malloc((size) ? size : 1);
+
+    if (!pMem)
+    {
+        throw std::bad_alloc();
+    }
+
+    return pMem;
+}
+
+/***************************************************************************************************
+** % Function:    operator new[]()
+*  % Description: Counting replacement for the global array allocator.
+*  % Returns:     Allocated memory.  Throws std::bad_alloc on failure.
+***************************************************************************************************/
+VOID* operator new[](
+    size_t size)  // bytes to allocate
+{
+    return operator new(size);
+}
+
+/***************************************************************************************************
+** % Function:    operator delete()
+*  % Description: Releases memory from operator new().
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID operator delete(
+    VOID* pMem)  // memory to release (may be NULL)
+{
+    free(pMem);
+}
+
+/***************************************************************************************************
+** % Function:    operator delete[]()
+*  % Description: Releases memory from operator new[]().
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID operator delete[](
+    VOID* pMem)  // memory to release (may be NULL)
+{
+    free(pMem);
+}
+
+/***************************************************************************************************
+** % Function:    GetAllocCnt()
+*  % Description: Returns the number of heap allocations made through operator new/new[] since
+*                 startup.  Compare two readings to count the allocations made in between.
+***************************************************************************************************/
+LONG GetAllocCnt()
+{
+    return AtomicLoad(&s_allocCnt);
+}
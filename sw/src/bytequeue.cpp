@@ -0,0 +1,154 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/bytequeue.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  ByteQueue class implementation.
+***************************************************************************************************/
+
+#include "bytequeue.h"
+
+/***************************************************************************************************
+** % Method:      ByteQueue::ByteQueue()
+*  % Description: ByteQueue constructor.
+***************************************************************************************************/
+ByteQueue::ByteQueue()
+    :
+    m_pData(NULL),
+    m_capacity(0),
+    m_head(0),
+    m_tail(0)
+{
+}
+
+/***************************************************************************************************
+** % Method:      ByteQueue::~ByteQueue()
+*  % Description: ByteQueue destructor.
+***************************************************************************************************/
+ByteQueue::~ByteQueue()
+{
+    delete [] m_pData;
+}
+
+/***************************************************************************************************
+** % Method:      ByteQueue::Push()
+*  % Description: Appends numBytes bytes to the back of the queue.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID ByteQueue::Push(
+    const BYTE* pData,     // data to append
+    UINT        numBytes)  // number of bytes in pData
+{
+    Reserve(numBytes);
+
+    memcpy(m_pData + m_tail, pData, numBytes);
+    m_tail += numBytes;
+}
+
+/***************************************************************************************************
+** % Method:      ByteQueue::Push()
+*  % Description: Appends a single byte to the back of the queue.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID ByteQueue::Push(
+    BYTE data)  // byte to append
+{
+    Reserve(1);
+
+    m_pData[m_tail++] = data;
+}
+
+/***************************************************************************************************
+** % Method:      ByteQueue::Pop()
+*  % Description: Removes numBytes bytes from the front of the queue.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID ByteQueue::Pop(
+    UINT numBytes)  // number of bytes to remove
+{
+    assert(numBytes <= Size());
+
+    m_head += numBytes;
+
+    if (m_head == m_tail)
+    {
+        m_head = 0;
+        m_tail = 0;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      ByteQueue::Clear()
+*  % Description: Removes all bytes from the queue.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID ByteQueue::Clear()
+{
+    m_head = 0;
+    m_tail = 0;
+}
+
+/***************************************************************************************************
+** % Method:      ByteQueue::Reserve()
+*  % Description: Ensures there is space for numBytes more bytes at the back of the queue, first by
+*                 reclaiming space already popped from the front, then by growing the storage.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID ByteQueue::Reserve(
+    UINT numBytes)  // number of bytes about to be pushed
+{
+    if (m_tail + numBytes <= m_capacity)
+    {
+        return;
+    }
+
+    const UINT size = Size();
+
+    if (size + numBytes <= m_capacity / 2)
+    {
+        memmove(m_pData, m_pData + m_head, size);
+    }
+    else
+    {
+        // Always at least double, or a queue that stays over half full would be reallocated at
+        // the same size on every push.
+        UINT newCapacity = (m_capacity) ? (m_capacity * 2) : 0x1000;
+        while (newCapacity < size + numBytes)
+        {
+            newCapacity *= 2;
+        }
+
+        BYTE* pNewData = new BYTE[newCapacity];
+        if (size)
+        {
+            memcpy(pNewData, m_pData + m_head, size);
+        }
+
+        delete [] m_pData;
+        m_pData    = pNewData;
+        m_capacity = newCapacity;
+    }
+
+    m_head = 0;
+    m_tail = size;
+}
+
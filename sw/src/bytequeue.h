@@ -0,0 +1,65 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/bytequeue.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  ByteQueue class header.
+***************************************************************************************************/
+
+#ifndef BYTEQUEUE_H
+#define BYTEQUEUE_H
+
+#include "util.h"
+
+/***************************************************************************************************
+** % Class:       ByteQueue
+*  % Description: Growable FIFO of bytes.  Queued bytes are always contiguous, so Data() can be
+*                 passed directly to a Transport write.
+***************************************************************************************************/
+class ByteQueue
+{
+public:
+    ByteQueue();
+    ~ByteQueue();
+
+    VOID Push(const BYTE* pData, UINT numBytes);
+    VOID Push(BYTE data);
+    VOID Pop(UINT numBytes);
+    VOID Clear();
+
+    const BYTE* Data() const { return m_pData + m_head; }
+    UINT        Size() const { return m_tail - m_head; }
+
+private:
+    ByteQueue& operator=(const ByteQueue&);
+    ByteQueue(const ByteQueue&);
+
+    VOID Reserve(UINT numBytes);
+
+    BYTE* m_pData;     // queue storage
+    UINT  m_capacity;  // allocated size of m_pData
+    UINT  m_head;      // index of the oldest queued byte
+    UINT  m_tail;      // index one past the newest queued byte
+};
+
+#endif // BYTEQUEUE_H
+
@@ -0,0 +1,169 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/dbgopcodes.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  Debug packet opcode schema.  DBG_OPCODE_TABLE is the one description of the debug protocol: the
+*  opcode enum, the compile-time DbgOpSchema<> traits the packet encoders are checked against, and
+*  the DbgOpInfos table used by the raw packet parser and HciSim are all generated from it.
+*  hw/src/hci/hci.v must be kept in step by hand.
+***************************************************************************************************/
+
+#ifndef DBGOPCODES_H
+#define DBGOPCODES_H
+
+#include "util.h"
+
+// One entry per opcode, in opcode order with no gaps:
+//
+//   name    - DbgPacketOpCode<name>
+//   op      - opcode byte
+//   hdr     - header size in bytes, including the opcode
+//   pay     - header offset of the 16-bit payload size, or 0 if no payload follows the header
+//   rsp     - fixed number of response bytes
+//   rspLen  - header offset of the 16-bit count of response bytes that follow the fixed ones, or 0
+//
+// 16-bit header fields are little-endian.
+#define DBG_OPCODE_TABLE(X)                                                                        \
+    /* name         op    hdr pay rsp rspLen */                                                    \
+    X(Echo,         0x00, 3,  1,  0,  1)  /* echo packet body back to debugger */                  \
+    X(CpuMemRd,     0x01, 5,  0,  0,  3)  /* read CPU memory */                                    \
+    X(CpuMemWr,     0x02, 5,  3,  0,  0)  /* write CPU memory */                                   \
+    X(DbgHlt,       0x03, 1,  0,  0,  0)  /* debugger break (stop execution) */                    \
+    X(DbgRun,       0x04, 1,  0,  0,  0)  /* debugger run (resume execution) */                    \
+    X(CpuRegRd,     0x05, 2,  0,  1,  0)  /* read CPU register */                                  \
+    X(CpuRegWr,     0x06, 3,  0,  0,  0)  /* write CPU register */                                 \
+    X(QueryHlt,     0x07, 1,  0,  1,  0)  /* query if the cpu is currently halted */               \
+    X(QueryErrCode, 0x08, 1,  0,  1,  0)  /* query NES error code */                               \
+    X(PpuMemRd,     0x09, 5,  0,  0,  3)  /* read PPU memory */                                    \
+    X(PpuMemWr,     0x0A, 5,  3,  0,  0)  /* write PPU memory */                                   \
+    X(PpuDisable,   0x0B, 1,  0,  0,  0)  /* disable PPU */                                        \
+    X(CartSetCfg,   0x0C, 6,  0,  0,  0)  /* set cartridge config from iNES header */              \
+    X(SetBaud,      0x0D, 2,  0,  1,  0)  /* switch the serial link baud rate */                   \
+    X(QueryCredits, 0x0E, 1,  0,  4,  0)  /* query free space in the uart fifos */                 \
+    X(SetFramed,    0x0F, 2,  0,  1,  0)  /* enter/leave framed (CRC-checked) mode */              \
+    X(MultiRd,      0x10, 5,  1,  0,  3)  /* read a list of CPU/PPU memory ranges */               \
+    X(MemFill,      0x11, 8,  6,  0,  0)  /* fill CPU/PPU memory with a pattern */                 \
+    X(MemCrc,       0x12, 6,  0,  4,  0)  /* CRC-32 of a CPU/PPU memory range */                   \
+    X(MemCmp,       0x13, 8,  4,  2,  6)  /* compare CPU/PPU memory with expected data */          \
+    X(CpuRegsRd,    0x14, 1,  0,  7,  0)  /* read all CPU registers */                             \
+    X(CpuRegsWr,    0x15, 8,  0,  0,  0)  /* write all CPU registers */                            \
+    X(Wait,         0x16, 8,  0,  1,  0)  /* wait on the NES for a condition */                    \
+    X(ProgWr,       0x17, 3,  1,  0,  0)  /* store a program of debug packets */                   \
+    X(ProgRun,      0x18, 6,  0,  0,  4)  /* run the stored program */                             \
+    X(MemWrLz,      0x19, 6,  4,  0,  0)  /* write CPU/PPU memory from LZ tokens */
+
+static const UINT DbgOpMaxHeaderSize = 8;  // largest hdr in DBG_OPCODE_TABLE
+
+#define DBG_OPCODE_ENUM(name, op, hdr, pay, rsp, rspLen) DbgPacketOpCode##name = op,
+
+enum DbgPacketOpCode
+{
+    DBG_OPCODE_TABLE(DBG_OPCODE_ENUM)
+};
+
+#undef DBG_OPCODE_ENUM
+
+// Table position of each opcode, used to check the table has no gaps.
+#define DBG_OPCODE_INDEX(name, op, hdr, pay, rsp, rspLen) DbgOpIndex##name,
+
+enum DbgOpIndex
+{
+    DBG_OPCODE_TABLE(DBG_OPCODE_INDEX)
+    DbgPacketOpCodeCnt
+};
+
+#undef DBG_OPCODE_INDEX
+
+// Checks a 16-bit header field offset (0 = no field) fits in a header of the specified size.
+#define DBG_OPCODE_FIELD_OK(offset, hdr) (((offset) == 0) || ((offset) + 2 <= (hdr)))
+
+/***************************************************************************************************
+** % Class:       DbgOpSchema
+*  % Description: Compile-time description of an opcode's packet layout, from DBG_OPCODE_TABLE.
+*                 Instantiating an entry also checks it: opcodes must be in order, and headers must
+*                 fit in DbgOpMaxHeaderSize along with their 16-bit fields.
+***************************************************************************************************/
+template <DbgPacketOpCode op> struct DbgOpSchema;
+
+#define DBG_OPCODE_SCHEMA(name, op, hdr, pay, rsp, rspLen)                                         \
+    template <> struct DbgOpSchema<DbgPacketOpCode##name>                                          \
+    {                                                                                              \
+        static const UINT HeaderSize       = hdr;                                                  \
+        static const UINT PayloadLenOffset = pay;                                                  \
+        static const UINT RspSize          = rsp;                                                  \
+        static const UINT RspLenOffset     = rspLen;                                               \
+                                                                                                   \
+        enum                                                                                       \
+        {                                                                                          \
+            OrderCheck  = sizeof(StaticAssertion<(op) == DbgOpIndex##name>),                       \
+            HeaderCheck = sizeof(StaticAssertion<((hdr) >= 1) && ((hdr) <= DbgOpMaxHeaderSize)>),  \
+            FieldCheck  = sizeof(StaticAssertion<DBG_OPCODE_FIELD_OK(pay, hdr) &&                  \
+                                                 DBG_OPCODE_FIELD_OK(rspLen, hdr)>)                \
+        };                                                                                         \
+    };
+
+DBG_OPCODE_TABLE(DBG_OPCODE_SCHEMA)
+
+#undef DBG_OPCODE_SCHEMA
+#undef DBG_OPCODE_FIELD_OK
+
+/***************************************************************************************************
+** % Class:       DbgOpInfo
+*  % Description: Run-time description of an opcode's packet layout, for code that only learns the
+*                 opcode from the data (see GetDbgOpInfo()).
+***************************************************************************************************/
+struct DbgOpInfo
+{
+    const CHAR* pName;             // opcode name
+    UINT        headerSize;        // header size in bytes, including the opcode
+    UINT        payloadLenOffset;  // header offset of the payload size, or 0 if there is none
+    UINT        rspSize;           // fixed number of response bytes
+    UINT        rspLenOffset;      // header offset of the variable response size, or 0
+};
+
+extern const DbgOpInfo DbgOpInfos[DbgPacketOpCodeCnt];
+
+/***************************************************************************************************
+** % Function:    GetDbgOpInfo
+*  % Description: Looks up an opcode's layout.
+*  % Returns:     Opcode layout, or NULL if opCode is not a valid opcode.
+***************************************************************************************************/
+static inline const DbgOpInfo* GetDbgOpInfo(
+    BYTE opCode)  // opcode byte
+{
+    return (opCode < DbgPacketOpCodeCnt) ? &DbgOpInfos[opCode] : NULL;
+}
+
+/***************************************************************************************************
+** % Function:    GetDbgOpField16
+*  % Description: Reads a 16-bit field from a complete packet header.
+*  % Returns:     Field value, or 0 if offset is 0 (the opcode has no such field).
+***************************************************************************************************/
+static inline UINT GetDbgOpField16(
+    const BYTE* pHeader,  // packet header
+    UINT        offset)   // offset of the field's low byte, from DbgOpInfo
+{
+    return (offset) ? (pHeader[offset] | (pHeader[offset + 1] << 8)) : 0;
+}
+
+#endif // DBGOPCODES_H
@@ -26,13 +26,44 @@
 ***************************************************************************************************/
 
 #include "dbgpacket.h"
-#include "nesdbg.h"
+
+#define DBG_OPCODE_INFO(name, op, hdr, pay, rsp, rspLen) { #name, hdr, pay, rsp, rspLen },
+
+const DbgOpInfo DbgOpInfos[DbgPacketOpCodeCnt] =
+{
+    DBG_OPCODE_TABLE(DBG_OPCODE_INFO)
+};
+
+#undef DBG_OPCODE_INFO
+
+/***************************************************************************************************
+** % Class:       RawPacket
+*  % Description: Packet built from already encoded data, by CreateObjFromString().
+***************************************************************************************************/
+class RawPacket : public DbgPacket
+{
+public:
+    RawPacket(const DbgOpInfo& info, const BYTE* pRawPacket) { EncodeRaw(info, pRawPacket); }
+    virtual ~RawPacket() {};
+
+private:
+    RawPacket();
+    RawPacket& operator=(const RawPacket&);
+    RawPacket(const RawPacket&);
+};
 
 /***************************************************************************************************
 ** % Method:      DbgPacket::DbgPacket()
 *  % Description: DbgPacket constructor.
 ***************************************************************************************************/
 DbgPacket::DbgPacket()
+    :
+    m_headerSize(0),
+    m_pPayload(NULL),
+    m_payloadSize(0),
+    m_rspSize(0),
+    m_execTimeoutMs(0),
+    m_pOwnedData(NULL)
 {
 }
 
@@ -42,13 +73,14 @@ DbgPacket::DbgPacket()
 ***************************************************************************************************/
 DbgPacket::~DbgPacket()
 {
-    delete [] m_pData;
+    delete [] m_pOwnedData;
 }
 
 /***************************************************************************************************
 ** % Method:      DbgPacket::CreateObjFromString()
 *  % Description: Factory method for a DbgPacket using a text string as input, as from the raw
-*                 debug interface.
+*                 debug interface.  The packet owns the decoded data, so unlike other packets it
+*                 must be released with Destroy().
 ***************************************************************************************************/
 DbgPacket* DbgPacket::CreateObjFromString(
     TCHAR* pString)  // packet content string
@@ -59,7 +91,7 @@ DbgPacket* DbgPacket::CreateObjFromString(
     UINT stringLen = _tcslen(pString);
     UINT nibbleIdx = 0;
 
-    BYTE* pRawData = new BYTE [stringLen / 2];
+    BYTE* pRawData = new BYTE [stringLen / 2 + 1];
 
     // Convert text string (e.g., "00 0F 13 12") to raw data.
     for (UINT i = 0; i < stringLen; i++)
@@ -95,44 +127,33 @@ DbgPacket* DbgPacket::CreateObjFromString(
         nibbleIdx++;
     }
 
-    if (nibbleIdx & 1)
+    if ((nibbleIdx & 1) || (nibbleIdx == 0))
     {
         success = FALSE;
     }
 
-    if (success)
+    const UINT rawDataSize = nibbleIdx / 2;
+
+    // Check the data is a complete packet, as described by the opcode table.
+    const DbgOpInfo* pInfo = (success) ? GetDbgOpInfo(pRawData[0]) : NULL;
+
+    if (pInfo && (rawDataSize >= pInfo->headerSize))
     {
-        switch (pRawData[0])
+        const UINT payloadSize = GetDbgOpField16(pRawData, pInfo->payloadLenOffset);
+
+        if (rawDataSize >= pInfo->headerSize + payloadSize)
         {
-            case DbgPacketOpCodeEcho:
-            {
-                const BYTE* pEchoData    = &pRawData[3];
-                USHORT      numEchoBytes = *reinterpret_cast<USHORT*>(&pRawData[1]);
-                pDbgPacket = new EchoPacket(pEchoData, numEchoBytes);
-                break;
-            }
-            case DbgPacketOpCodeCpuMemRd:
-            {
-                USHORT addr     = *reinterpret_cast<USHORT*>(&pRawData[1]);
-                USHORT numBytes = *reinterpret_cast<USHORT*>(&pRawData[3]);
-                pDbgPacket = new CpuMemRdPacket(addr, numBytes);
-                break;
-            }
-            case DbgPacketOpCodeCpuMemWr:
-            {
-                const BYTE* pData    = &pRawData[5];
-                USHORT      addr     = *reinterpret_cast<USHORT*>(&pRawData[1]);
-                USHORT      numBytes = *reinterpret_cast<USHORT*>(&pRawData[3]);
-                pDbgPacket = new CpuMemWrPacket(addr, numBytes, pData);
-                break;
-            }
-            default:
-            {
-                success = FALSE;
-                break;
-            }
+            pDbgPacket = new RawPacket(*pInfo, pRawData);
         }
+    }
 
+    // The packet's payload points into the raw data, so hand it over.
+    if (pDbgPacket)
+    {
+        pDbgPacket->m_pOwnedData = pRawData;
+    }
+    else
+    {
         delete [] pRawData;
     }
 
@@ -140,116 +161,154 @@ DbgPacket* DbgPacket::CreateObjFromString(
 }
 
 /***************************************************************************************************
-** % Method:      EchoPacket::EchoPacket()
-*  % Description: EchoPacket constructor.
+** % Method:      DbgPacket::Encode()
+*  % Description: Serializes the packet (header and payload) into a caller-supplied buffer, which
+*                 must hold at least SizeInBytes() bytes.
+*  % Returns:     Number of bytes written.
 ***************************************************************************************************/
-EchoPacket::EchoPacket(
-    const BYTE* pEchoData,  // data to be echoed
-    USHORT      numBytes)   // number of bytes to echo
+UINT DbgPacket::Encode(
+    BYTE* pBuf)  // receives the packet
+    const
 {
-    m_pData = new BYTE [1 + 2 + numBytes];
-
-    m_pData[0] = DbgPacketOpCodeEcho;
+    memcpy(pBuf, &m_header[0], m_headerSize);
 
-    for (UINT i = 0; i < numBytes; i++)
+    if (m_payloadSize)
     {
-        m_pData[3 + i] = pEchoData[i];
+        memcpy(pBuf + m_headerSize, m_pPayload, m_payloadSize);
     }
 
-    *reinterpret_cast<USHORT*>(&m_pData[1]) = numBytes;
+    return m_headerSize + m_payloadSize;
 }
 
 /***************************************************************************************************
-** % Method:      EchoPacket::SizeInBytes()
-*  % Description: Returns total packet size, in bytes.
+** % Method:      DbgPacket::EncodeRaw()
+*  % Description: Sets up the packet from already encoded data, with the layout looked up at run
+*                 time.  The payload is referenced, not copied.
+*  % Returns:     N/A
 ***************************************************************************************************/
-UINT EchoPacket::SizeInBytes() const
+VOID DbgPacket::EncodeRaw(
+    const DbgOpInfo& info,        // layout of the packet's opcode
+    const BYTE*      pRawPacket)  // encoded packet, header and payload
 {
-    return sizeof(BYTE) + sizeof(USHORT) + *reinterpret_cast<USHORT*>(&m_pData[1]);
+    for (UINT i = 0; i < info.headerSize; i++)
+    {
+        AppendHeader(pRawPacket[i]);
+    }
+
+    SetPayload(pRawPacket + info.headerSize, GetDbgOpField16(pRawPacket, info.payloadLenOffset));
+    SetRspSize(info.rspSize, info.rspLenOffset);
+
+    // Packets that take a while to execute.
+    if (pRawPacket[0] == DbgPacketOpCodeWait)
+    {
+        SetExecTimeout(GetHeader16(WaitPacket::TimeoutOffset));
+    }
+    else if (pRawPacket[0] == DbgPacketOpCodeProgRun)
+    {
+        SetExecTimeout(ProgRunPacket::GetExecTimeoutMs(pRawPacket[1],
+                                                       GetHeader16(ProgRunPacket::RunCntOffset)));
+    }
 }
 
 /***************************************************************************************************
-** % Method:      EchoPacket::ReturnBytesExpected()
-*  % Description: Returns how many bytes we expect to receive from the NES in response to this
-*                 packet.
+** % Method:      DbgPacket::AppendHeader()
+*  % Description: Adds a byte to the end of the packet header.
+*  % Returns:     N/A
 ***************************************************************************************************/
-UINT EchoPacket::ReturnBytesExpected() const
+VOID DbgPacket::AppendHeader(
+    BYTE data)  // header byte
 {
-    return *reinterpret_cast<USHORT*>(&m_pData[1]);
+    assert(m_headerSize < MaxHeaderSize);
+
+    m_header[m_headerSize++] = data;
 }
 
 /***************************************************************************************************
-** % Method:      CpuMemRdPacket::CpuMemRdPacket()
-*  % Description: CpuMemRdPacket constructor.
+** % Method:      DbgPacket::AppendHeader16()
+*  % Description: Adds a 16-bit value to the end of the packet header, low byte first.
+*  % Returns:     N/A
 ***************************************************************************************************/
-CpuMemRdPacket::CpuMemRdPacket(
-    USHORT addr,      // memory address to read
-    USHORT numBytes)  // number of bytes to read
+VOID DbgPacket::AppendHeader16(
+    USHORT data)  // header value
 {
-    m_pData = new BYTE [1 + 2 + 2];
-
-    m_pData[0] = DbgPacketOpCodeCpuMemRd;
-    *reinterpret_cast<USHORT*>(&m_pData[1]) = addr;
-    *reinterpret_cast<USHORT*>(&m_pData[3]) = numBytes;
+    AppendHeader(static_cast<BYTE>(data & 0xFF));
+    AppendHeader(static_cast<BYTE>(data >> 8));
 }
 
 /***************************************************************************************************
-** % Method:      CpuMemRdPacket::SizeInBytes()
-*  % Description: Returns total packet size, in bytes.
+** % Method:      DbgPacket::SetPayload()
+*  % Description: Sets the data that follows the header.  The data is referenced, not copied.
+*  % Returns:     N/A
 ***************************************************************************************************/
-UINT CpuMemRdPacket::SizeInBytes() const
+VOID DbgPacket::SetPayload(
+    const BYTE* pPayload,     // payload data, valid until the packet is submitted
+    UINT        payloadSize)  // size of pPayload, in bytes
 {
-    return sizeof(BYTE) + sizeof(USHORT) + sizeof(USHORT);
+    m_pPayload    = pPayload;
+    m_payloadSize = payloadSize;
 }
 
 /***************************************************************************************************
-** % Method:      CpuMemRdPacket::ReturnBytesExpected()
-*  % Description: Returns how many bytes we expect to receive from the NES in response to this
-*                 packet.
+** % Method:      DbgPacket::GetHeader16()
+*  % Description: Reads back a 16-bit value stored with AppendHeader16().
+*  % Returns:     Header value.
 ***************************************************************************************************/
-UINT CpuMemRdPacket::ReturnBytesExpected() const
+USHORT DbgPacket::GetHeader16(
+    UINT offset)  // offset of the value's low byte within the header
+    const
 {
-    return *reinterpret_cast<USHORT*>(&m_pData[3]);
+    assert(offset + 1 < m_headerSize);
+
+    return static_cast<USHORT>(m_header[offset] | (m_header[offset + 1] << 8));
 }
 
 /***************************************************************************************************
-** % Method:      CpuMemWrPacket::CpuMemWrPacket()
-*  % Description: CpuMemWrPacket constructor.
+** % Method:      DbgPacket::SetRspSize()
+*  % Description: Works out how many bytes the NES will send in response to the packet, from the
+*                 opcode's layout and the complete header.
+*  % Returns:     N/A
 ***************************************************************************************************/
-CpuMemWrPacket::CpuMemWrPacket(
-    USHORT      addr,      // memory address to write
-    USHORT      numBytes,  // number of bytes to write
-    const BYTE* pData)     // data to write
+VOID DbgPacket::SetRspSize(
+    UINT rspSize,       // fixed number of response bytes
+    UINT rspLenOffset)  // header offset of the variable response size, or 0 if there is none
 {
-    m_pData = new BYTE [1 + 2 + 2 + numBytes];
-
-    m_pData[0] = DbgPacketOpCodeCpuMemWr;
-    *reinterpret_cast<USHORT*>(&m_pData[1]) = addr;
-    *reinterpret_cast<USHORT*>(&m_pData[3]) = numBytes;
+    m_rspSize = rspSize + GetDbgOpField16(&m_header[0], rspLenOffset);
+}
 
-    for (UINT i = 0; i < numBytes; i++)
-    {
-        m_pData[5 + i] = pData[i];
-    }
+/***************************************************************************************************
+** % Method:      EchoPacket::EchoPacket()
+*  % Description: EchoPacket constructor.
+***************************************************************************************************/
+EchoPacket::EchoPacket(
+    const BYTE* pEchoData,  // data to be echoed
+    USHORT      numBytes)   // number of bytes to echo
+{
+    EncodeHeader16<DbgPacketOpCodeEcho>(numBytes);
+    EncodePayload<DbgPacketOpCodeEcho>(pEchoData);
 }
 
 /***************************************************************************************************
-** % Method:      CpuMemWrPacket::SizeInBytes()
-*  % Description: Returns total packet size, in bytes.
+** % Method:      CpuMemRdPacket::CpuMemRdPacket()
+*  % Description: CpuMemRdPacket constructor.
 ***************************************************************************************************/
-UINT CpuMemWrPacket::SizeInBytes() const
+CpuMemRdPacket::CpuMemRdPacket(
+    USHORT addr,      // memory address to read
+    USHORT numBytes)  // number of bytes to read
 {
-    return sizeof(BYTE) + sizeof(USHORT) + sizeof(USHORT) + *reinterpret_cast<USHORT*>(&m_pData[3]);
+    EncodeHeader16<DbgPacketOpCodeCpuMemRd>(addr, numBytes);
 }
 
 /***************************************************************************************************
-** % Method:      CpuMemWrPacket::ReturnBytesExpected()
-*  % Description: Returns how many bytes we expect to receive from the NES in response to this
-*                 packet.
+** % Method:      CpuMemWrPacket::CpuMemWrPacket()
+*  % Description: CpuMemWrPacket constructor.
 ***************************************************************************************************/
-UINT CpuMemWrPacket::ReturnBytesExpected() const
+CpuMemWrPacket::CpuMemWrPacket(
+    USHORT      addr,      // memory address to write
+    USHORT      numBytes,  // number of bytes to write
+    const BYTE* pData)     // data to write
 {
-    return 0;
+    EncodeHeader16<DbgPacketOpCodeCpuMemWr>(addr, numBytes);
+    EncodePayload<DbgPacketOpCodeCpuMemWr>(pData);
 }
 
 /***************************************************************************************************
@@ -258,8 +317,7 @@ UINT CpuMemWrPacket::ReturnBytesExpected() const
 ***************************************************************************************************/
 DbgHltPacket::DbgHltPacket()
 {
-    m_pData    = new BYTE [1];
-    m_pData[0] = DbgPacketOpCodeDbgHlt;
+    EncodeHeader<DbgPacketOpCodeDbgHlt>();
 }
 
 /***************************************************************************************************
@@ -268,8 +326,7 @@ DbgHltPacket::DbgHltPacket()
 ***************************************************************************************************/
 DbgRunPacket::DbgRunPacket()
 {
-    m_pData    = new BYTE [1];
-    m_pData[0] = DbgPacketOpCodeDbgRun;
+    EncodeHeader<DbgPacketOpCodeDbgRun>();
 }
 
 /***************************************************************************************************
@@ -279,201 +336,523 @@ DbgRunPacket::DbgRunPacket()
 CpuRegRdPacket::CpuRegRdPacket(
     CpuReg reg)  // select which register to read
 {
-    m_pData = new BYTE [1 + 1];
+    EncodeHeader<DbgPacketOpCodeCpuRegRd>(static_cast<BYTE>(reg));
+}
 
-    m_pData[0] = DbgPacketOpCodeCpuRegRd;
-    m_pData[1] = static_cast<BYTE>(reg);
+/***************************************************************************************************
+** % Method:      CpuRegWrPacket::CpuRegWrPacket()
+*  % Description: CpuRegWrPacket constructor.
+***************************************************************************************************/
+CpuRegWrPacket::CpuRegWrPacket(
+    CpuReg reg,  // select which register to write
+    BYTE   val)  // value to write
+{
+    EncodeHeader<DbgPacketOpCodeCpuRegWr>(static_cast<BYTE>(reg), val);
 }
 
 /***************************************************************************************************
-** % Method:      CpuRegRdPacket::SizeInBytes()
-*  % Description: Returns total packet size, in bytes.
+** % Method:      QueryHltPacket::QueryHltPacket()
+*  % Description: QueryHltPacket constructor.
 ***************************************************************************************************/
-UINT CpuRegRdPacket::SizeInBytes() const
+QueryHltPacket::QueryHltPacket()
 {
-    return sizeof(BYTE) + sizeof(BYTE);
+    EncodeHeader<DbgPacketOpCodeQueryHlt>();
 }
 
 /***************************************************************************************************
-** % Method:      CpuRegRdPacket::ReturnBytesExpected()
-*  % Description: Returns how many bytes we expect to receive from the NES in response to this
-*                 packet.
+** % Method:      QueryErrCodePacket::QueryErrCodePacket()
+*  % Description: QueryErrCodePacket constructor.
 ***************************************************************************************************/
-UINT CpuRegRdPacket::ReturnBytesExpected() const
+QueryErrCodePacket::QueryErrCodePacket()
 {
-    return 1;
+    EncodeHeader<DbgPacketOpCodeQueryErrCode>();
 }
 
 /***************************************************************************************************
-** % Method:      CpuRegWrPacket::CpuRegWrPacket()
-*  % Description: CpuRegWrPacket constructor.
+** % Method:      PpuMemRdPacket::PpuMemRdPacket()
+*  % Description: PpuMemRdPacket constructor.
 ***************************************************************************************************/
-CpuRegWrPacket::CpuRegWrPacket(
-    CpuReg reg,  // select which register to write
-    BYTE   val)  // value to write
+PpuMemRdPacket::PpuMemRdPacket(
+    USHORT addr,      // memory address to read
+    USHORT numBytes)  // number of bytes to read
 {
-    m_pData = new BYTE [1 + 1 + 1];
+    EncodeHeader16<DbgPacketOpCodePpuMemRd>(addr, numBytes);
+}
 
-    m_pData[0] = DbgPacketOpCodeCpuRegWr;
-    m_pData[1] = static_cast<BYTE>(reg);
-    m_pData[2] = val;
+/***************************************************************************************************
+** % Method:      PpuMemWrPacket::PpuMemWrPacket()
+*  % Description: PpuMemWrPacket constructor.
+***************************************************************************************************/
+PpuMemWrPacket::PpuMemWrPacket(
+    USHORT      addr,      // memory address to write
+    USHORT      numBytes,  // number of bytes to write
+    const BYTE* pData)     // data to write
+{
+    EncodeHeader16<DbgPacketOpCodePpuMemWr>(addr, numBytes);
+    EncodePayload<DbgPacketOpCodePpuMemWr>(pData);
 }
 
 /***************************************************************************************************
-** % Method:      CpuRegWrPacket::SizeInBytes()
-*  % Description: Returns total packet size, in bytes.
+** % Method:      PpuDisablePacket::PpuDisablePacket()
+*  % Description: PpuDisablePacket constructor.
 ***************************************************************************************************/
-UINT CpuRegWrPacket::SizeInBytes() const
+PpuDisablePacket::PpuDisablePacket()
 {
-    return sizeof(BYTE) + sizeof(BYTE) + sizeof(BYTE);
+    EncodeHeader<DbgPacketOpCodePpuDisable>();
 }
 
 /***************************************************************************************************
-** % Method:      CpuRegWrPacket::ReturnBytesExpected()
-*  % Description: Returns how many bytes we expect to receive from the NES in response to this
-*                 packet.
+** % Method:      CartSetCfgPacket::CartSetCfgPacket()
+*  % Description: CartSetCfgPacket constructor.
 ***************************************************************************************************/
-UINT CpuRegWrPacket::ReturnBytesExpected() const
+CartSetCfgPacket::CartSetCfgPacket(
+    const BYTE* pINesHeader)  // iNES header pointer (should point at byte 0)
 {
-    return 0;
+    // iNES header bytes 4-8.
+    EncodeHeaderBytes<DbgPacketOpCodeCartSetCfg>(&pINesHeader[4]);
 }
 
 /***************************************************************************************************
-** % Method:      QueryHltPacket::QueryHltPacket()
-*  % Description: QueryHltPacket constructor.
+** % Method:      QueryCreditsPacket::QueryCreditsPacket()
+*  % Description: QueryCreditsPacket constructor.
 ***************************************************************************************************/
-QueryHltPacket::QueryHltPacket()
+QueryCreditsPacket::QueryCreditsPacket()
 {
-    m_pData = new BYTE [1];
+    EncodeHeader<DbgPacketOpCodeQueryCredits>();
+}
+
+// Baud rates selectable with SetBaudPacket, indexed by baud select (hci.v BAUD_SEL_*).
+static const UINT BaudRates[SetBaudPacket::BaudSelCnt] =
+{
+    38400, 115200, 230400, 460800, 921600, 1000000, 2000000, 3000000
+};
+
+/***************************************************************************************************
+** % Method:      SetBaudPacket::SetBaudPacket()
+*  % Description: SetBaudPacket constructor.
+***************************************************************************************************/
+SetBaudPacket::SetBaudPacket(
+    BYTE baudSel)  // baud select, see GetBaudSel()
+{
+    assert(baudSel < BaudSelCnt);
+
+    EncodeHeader<DbgPacketOpCodeSetBaud>(baudSel);
+}
 
-    m_pData[0] = DbgPacketOpCodeQueryHlt;
+/***************************************************************************************************
+** % Method:      SetBaudPacket::GetBaudRate()
+*  % Description: Converts a baud select value to its baud rate.
+*  % Returns:     Baud rate, or 0 if baudSel is invalid.
+***************************************************************************************************/
+UINT SetBaudPacket::GetBaudRate(
+    BYTE baudSel)  // baud select
+{
+    return (baudSel < BaudSelCnt) ? BaudRates[baudSel] : 0;
 }
 
 /***************************************************************************************************
-** % Method:      QueryHltPacket::SizeInBytes()
-*  % Description: Returns total packet size, in bytes.
+** % Method:      SetBaudPacket::GetBaudSel()
+*  % Description: Converts a baud rate to the baud select value that chooses it.
+*  % Returns:     TRUE if the NES supports baudRate, FALSE otherwise.
 ***************************************************************************************************/
-UINT QueryHltPacket::SizeInBytes() const
+BOOL SetBaudPacket::GetBaudSel(
+    UINT  baudRate,  // baud rate
+    BYTE* pBaudSel)  // receives the baud select value
 {
-    return sizeof(BYTE);
+    BOOL ret = FALSE;
+
+    for (BYTE baudSel = 0; baudSel < BaudSelCnt; baudSel++)
+    {
+        if (BaudRates[baudSel] == baudRate)
+        {
+            *pBaudSel = baudSel;
+            ret       = TRUE;
+            break;
+        }
+    }
+
+    return ret;
 }
 
 /***************************************************************************************************
-** % Method:      QueryHltPacket::ReturnBytesExpected()
-*  % Description: Returns how many bytes we expect to receive from the NES in response to this
-*                 packet.
+** % Method:      SetFramedPacket::SetFramedPacket()
+*  % Description: SetFramedPacket constructor.
 ***************************************************************************************************/
-UINT QueryHltPacket::ReturnBytesExpected() const
+SetFramedPacket::SetFramedPacket(
+    BOOL enable)  // TRUE to enter framed mode, FALSE to leave it
 {
-    return 1;
+    EncodeHeader<DbgPacketOpCodeSetFramed>((enable) ? 0x01 : 0x00);
 }
 
 /***************************************************************************************************
-** % Method:      PpuMemRdPacket::PpuMemRdPacket()
-*  % Description: PpuMemRdPacket constructor.
+** % Method:      SetFramedPacket::UpdateCrc()
+*  % Description: Advances a frame CRC (CRC-16/CCITT, as computed by hci.v's crc16 function) over
+*                 the specified data.  Start from CrcInit.
+*  % Returns:     Updated CRC.
 ***************************************************************************************************/
-PpuMemRdPacket::PpuMemRdPacket(
-    USHORT addr,      // memory address to read
-    USHORT numBytes)  // number of bytes to read
+USHORT SetFramedPacket::UpdateCrc(
+    USHORT      crc,       // CRC so far
+    const BYTE* pData,     // data to add to the CRC
+    UINT        numBytes)  // number of bytes in pData
 {
-    m_pData = new BYTE [1 + 2 + 2];
+    for (UINT i = 0; i < numBytes; i++)
+    {
+        crc ^= static_cast<USHORT>(pData[i] << 8);
+
+        for (UINT bit = 0; bit < 8; bit++)
+        {
+            crc = static_cast<USHORT>((crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1));
+        }
+    }
 
-    m_pData[0] = DbgPacketOpCodePpuMemRd;
-    *reinterpret_cast<USHORT*>(&m_pData[1]) = addr;
-    *reinterpret_cast<USHORT*>(&m_pData[3]) = numBytes;
+    return crc;
 }
 
 /***************************************************************************************************
-** % Method:      PpuMemRdPacket::SizeInBytes()
-*  % Description: Returns total packet size, in bytes.
+** % Method:      MultiReadPacket::MultiReadPacket()
+*  % Description: MultiReadPacket constructor.  The ranges may total at most 0xFFFF bytes.
 ***************************************************************************************************/
-UINT PpuMemRdPacket::SizeInBytes() const
+MultiReadPacket::MultiReadPacket(
+    const MemRange* pRanges,    // ranges to read
+    UINT            numRanges)  // number of ranges, at most MaxRanges
 {
-    return sizeof(BYTE) + sizeof(USHORT) + sizeof(USHORT);
+    assert(numRanges <= MaxRanges);
+
+    BYTE* pRange   = &m_rangeList[0];
+    UINT  rspBytes = 0;
+
+    for (UINT i = 0; i < numRanges; i++)
+    {
+        *pRange++ = static_cast<BYTE>(pRanges[i].space);
+        *pRange++ = static_cast<BYTE>(pRanges[i].addr & 0xFF);
+        *pRange++ = static_cast<BYTE>(pRanges[i].addr >> 8);
+        *pRange++ = static_cast<BYTE>(pRanges[i].numBytes & 0xFF);
+        *pRange++ = static_cast<BYTE>(pRanges[i].numBytes >> 8);
+
+        rspBytes += pRanges[i].numBytes;
+    }
+
+    assert(rspBytes <= 0xFFFF);
+
+    EncodeHeader16<DbgPacketOpCodeMultiRd>(static_cast<USHORT>(numRanges * RangeSize),
+                                           static_cast<USHORT>(rspBytes));
+    EncodePayload<DbgPacketOpCodeMultiRd>(&m_rangeList[0]);
 }
 
 /***************************************************************************************************
-** % Method:      PpuMemRdPacket::ReturnBytesExpected()
-*  % Description: Returns how many bytes we expect to receive from the NES in response to this
-*                 packet.
+** % Method:      MemFillPacket::MemFillPacket()
+*  % Description: MemFillPacket constructor.
 ***************************************************************************************************/
-UINT PpuMemRdPacket::ReturnBytesExpected() const
+MemFillPacket::MemFillPacket(
+    MemSpace    space,        // address space
+    USHORT      addr,         // first address to fill
+    USHORT      numBytes,     // number of bytes to fill
+    const BYTE* pPattern,     // pattern to repeat
+    UINT        patternSize)  // size of pPattern, 1 to MaxPatternSize bytes
 {
-    return *reinterpret_cast<USHORT*>(&m_pData[3]);
+    assert((patternSize > 0) && (patternSize <= MaxPatternSize));
+
+    memcpy(&m_pattern[0], pPattern, patternSize);
+
+    EncodeHeader16<DbgPacketOpCodeMemFill>(static_cast<BYTE>(space),
+                                           addr,
+                                           numBytes,
+                                           static_cast<USHORT>(patternSize));
+    EncodePayload<DbgPacketOpCodeMemFill>(&m_pattern[0]);
 }
 
 /***************************************************************************************************
-** % Method:      PpuMemWrPacket::PpuMemWrPacket()
-*  % Description: PpuMemWrPacket constructor.
+** % Method:      MemCrcPacket::MemCrcPacket()
+*  % Description: MemCrcPacket constructor.
 ***************************************************************************************************/
-PpuMemWrPacket::PpuMemWrPacket(
-    USHORT      addr,      // memory address to write
-    USHORT      numBytes,  // number of bytes to write
-    const BYTE* pData)     // data to write
+MemCrcPacket::MemCrcPacket(
+    MemSpace space,     // address space
+    USHORT   addr,      // first address
+    USHORT   numBytes)  // number of bytes to include in the CRC
 {
-    m_pData = new BYTE [1 + 2 + 2 + numBytes];
+    STATIC_ASSERT(DbgOpSchema<DbgPacketOpCodeMemCrc>::RspSize == RspSize);
+
+    EncodeHeader16<DbgPacketOpCodeMemCrc>(static_cast<BYTE>(space), addr, numBytes);
+}
 
-    m_pData[0] = DbgPacketOpCodePpuMemWr;
-    *reinterpret_cast<USHORT*>(&m_pData[1]) = addr;
-    *reinterpret_cast<USHORT*>(&m_pData[3]) = numBytes;
+/***************************************************************************************************
+** % Method:      MemCrcPacket::UpdateCrc()
+*  % Description: Advances a CRC-32 (the zlib/Ethernet CRC, as computed by hci.v's crc32 function)
+*                 over the specified data.  Start from 0; the result is the finished CRC of
+*                 everything passed in so far, so calls can be chained.
+*  % Returns:     Updated CRC.
+***************************************************************************************************/
+UINT MemCrcPacket::UpdateCrc(
+    UINT        crc,       // CRC so far, or 0
+    const BYTE* pData,     // data to add to the CRC
+    UINT        numBytes)  // number of bytes in pData
+{
+    crc = ~crc;
 
     for (UINT i = 0; i < numBytes; i++)
     {
-        m_pData[5 + i] = pData[i];
+        crc ^= pData[i];
+
+        for (UINT bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+        }
     }
+
+    return ~crc;
 }
 
 /***************************************************************************************************
-** % Method:      PpuMemWrPacket::SizeInBytes()
-*  % Description: Returns total packet size, in bytes.
+** % Method:      MemCrcPacket::GetRspCrc()
+*  % Description: Decodes the CRC from a MemCrcPacket response.
+*  % Returns:     CRC computed by the NES.
 ***************************************************************************************************/
-UINT PpuMemWrPacket::SizeInBytes() const
+UINT MemCrcPacket::GetRspCrc(
+    const BYTE* pRsp)  // response, RspSize bytes
 {
-    return sizeof(BYTE) + sizeof(USHORT) + sizeof(USHORT) + *reinterpret_cast<USHORT*>(&m_pData[3]);
+    return pRsp[0] | (pRsp[1] << 8) | (pRsp[2] << 16) | (static_cast<UINT>(pRsp[3]) << 24);
 }
 
 /***************************************************************************************************
-** % Method:      PpuMemWrPacket::ReturnBytesExpected()
-*  % Description: Returns how many bytes we expect to receive from the NES in response to this
-*                 packet.
+** % Method:      MemCrcPacket::RspMatches()
+*  % Description: Checks a MemCrcPacket response against the data the range is expected to hold.
+*  % Returns:     TRUE if the CRCs match, FALSE otherwise.
 ***************************************************************************************************/
-UINT PpuMemWrPacket::ReturnBytesExpected() const
+BOOL MemCrcPacket::RspMatches(
+    const BYTE* pRsp,      // response, RspSize bytes
+    const BYTE* pData,     // expected contents of the range
+    UINT        numBytes)  // size of pData, in bytes
 {
-    return 0;
+    return (GetRspCrc(pRsp) == UpdateCrc(0, pData, numBytes));
 }
 
 /***************************************************************************************************
-** % Method:      PpuDisablePacket::PpuDisablePacket()
-*  % Description: PpuDisablePacket constructor.
+** % Method:      MemComparePacket::MemComparePacket()
+*  % Description: MemComparePacket constructor.
 ***************************************************************************************************/
-PpuDisablePacket::PpuDisablePacket()
+MemComparePacket::MemComparePacket(
+    MemSpace    space,          // address space
+    USHORT      addr,           // first address to compare
+    USHORT      numBytes,       // number of bytes to compare
+    const BYTE* pExpected,      // expected data, valid until the packet is submitted
+    UINT        maxMismatches)  // mismatches to report, at most MaxMismatches
+    :
+    m_maxMismatches(maxMismatches)
 {
-    m_pData    = new BYTE [1];
-    m_pData[0] = DbgPacketOpCodePpuDisable;
+    assert(maxMismatches <= MaxMismatches);
+
+    EncodeHeader16<DbgPacketOpCodeMemCmp>(static_cast<BYTE>(space),
+                                          addr,
+                                          numBytes,
+                                          static_cast<USHORT>(maxMismatches * MismatchSize));
+    EncodePayload<DbgPacketOpCodeMemCmp>(pExpected);
 }
 
 /***************************************************************************************************
-** % Method:      CartSetCfgPacket::CartSetCfgPacket()
-*  % Description: CartSetCfgPacket constructor.
+** % Method:      MemComparePacket::GetMismatchCnt()
+*  % Description: Decodes the total mismatch count from a MemComparePacket response.
+*  % Returns:     Number of bytes that did not match, which may exceed the number reported.
 ***************************************************************************************************/
-CartSetCfgPacket::CartSetCfgPacket(
-    const BYTE* pINesHeader)  // iNES header pointer (should point at byte 0)
+UINT MemComparePacket::GetMismatchCnt(
+    const BYTE* pRsp)  // response, ReturnBytesExpected() bytes
+    const
+{
+    const BYTE* pCnt = &pRsp[m_maxMismatches * MismatchSize];
+
+    return pCnt[0] | (pCnt[1] << 8);
+}
+
+/***************************************************************************************************
+** % Method:      MemComparePacket::GetMismatch()
+*  % Description: Decodes one reported mismatch from a MemComparePacket response.  Mismatches are
+*                 reported in address order.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID MemComparePacket::GetMismatch(
+    const BYTE* pRsp,     // response, ReturnBytesExpected() bytes
+    UINT        idx,      // mismatch to decode, less than GetMismatchCnt() and maxMismatches
+    USHORT*     pAddr,    // receives the mismatching address
+    BYTE*       pActual)  // receives the value found there
+    const
 {
-    m_pData = new BYTE [1 + 5];
+    assert(idx < m_maxMismatches);
 
-    m_pData[0] = DbgPacketOpCodeCartSetCfg;
-    m_pData[1] = pINesHeader[4];
-    m_pData[2] = pINesHeader[5];
-    m_pData[3] = pINesHeader[6];
-    m_pData[4] = pINesHeader[7];
-    m_pData[5] = pINesHeader[8];
+    const BYTE* pMismatch = &pRsp[idx * MismatchSize];
+
+    *pAddr   = static_cast<USHORT>(pMismatch[0] | (pMismatch[1] << 8));
+    *pActual = pMismatch[2];
+}
+
+/***************************************************************************************************
+** % Method:      CpuRegsRdPacket::CpuRegsRdPacket()
+*  % Description: CpuRegsRdPacket constructor.
+***************************************************************************************************/
+CpuRegsRdPacket::CpuRegsRdPacket()
+{
+    STATIC_ASSERT(DbgOpSchema<DbgPacketOpCodeCpuRegsRd>::RspSize == CpuRegCnt);
+
+    EncodeHeader<DbgPacketOpCodeCpuRegsRd>();
+}
+
+/***************************************************************************************************
+** % Method:      CpuRegsWrPacket::CpuRegsWrPacket()
+*  % Description: CpuRegsWrPacket constructor.
+***************************************************************************************************/
+CpuRegsWrPacket::CpuRegsWrPacket(
+    const BYTE* pRegs)  // new register values, CpuRegCnt bytes indexed by CpuReg
+{
+    STATIC_ASSERT(DbgOpSchema<DbgPacketOpCodeCpuRegsWr>::HeaderSize == 1 + CpuRegCnt);
+
+    EncodeHeaderBytes<DbgPacketOpCodeCpuRegsWr>(pRegs);
+}
+
+/***************************************************************************************************
+** % Method:      WaitPacket::WaitPacket()
+*  % Description: WaitPacket constructor.
+***************************************************************************************************/
+WaitPacket::WaitPacket(
+    BYTE   cond,       // condition to wait for (Cond*)
+    USHORT addr,       // address (CondMem) or frame count (CondFrames)
+    BYTE   mask,       // bits of the written value to compare (CondMem)
+    BYTE   value,      // value the masked bits must match (CondMem)
+    USHORT timeoutMs)  // time to give up after, in milliseconds
+{
+    const BYTE args[] =
+    {
+        cond,
+        static_cast<BYTE>(addr & 0xFF),
+        static_cast<BYTE>(addr >> 8),
+        mask,
+        value,
+        static_cast<BYTE>(timeoutMs & 0xFF),
+        static_cast<BYTE>(timeoutMs >> 8)
+    };
+
+    STATIC_ASSERT(DbgOpSchema<DbgPacketOpCodeWait>::HeaderSize == 1 + sizeof(args));
+    STATIC_ASSERT(DbgOpSchema<DbgPacketOpCodeWait>::RspSize == 1);
+
+    EncodeHeaderBytes<DbgPacketOpCodeWait>(&args[0]);
+    SetExecTimeout(timeoutMs);
+}
+
+/***************************************************************************************************
+** % Method:      DbgProgram::DbgProgram()
+*  % Description: DbgProgram constructor.
+***************************************************************************************************/
+DbgProgram::DbgProgram()
+    :
+    m_size(0),
+    m_rspSize(0)
+{
+}
+
+/***************************************************************************************************
+** % Method:      DbgProgram::~DbgProgram()
+*  % Description: DbgProgram destructor.
+***************************************************************************************************/
+DbgProgram::~DbgProgram()
+{
+}
+
+/***************************************************************************************************
+** % Method:      DbgProgram::Append()
+*  % Description: Adds a packet to the end of the program.
+*  % Returns:     TRUE if the packet was added, FALSE if it doesn't fit or can't be stored.
+***************************************************************************************************/
+BOOL DbgProgram::Append(
+    const DbgPacket& packet)  // packet to add
+{
+    BOOL ret = FALSE;
+
+    switch (packet.HeaderData()[0])
+    {
+        case DbgPacketOpCodeSetBaud:
+        case DbgPacketOpCodeSetFramed:
+        case DbgPacketOpCodeWait:
+        case DbgPacketOpCodeProgWr:
+        case DbgPacketOpCodeProgRun:
+            break;
+
+        default:
+            if (packet.SizeInBytes() <= MaxSize - m_size)
+            {
+                m_size    += packet.Encode(&m_data[m_size]);
+                m_rspSize += packet.ReturnBytesExpected();
+                ret        = TRUE;
+            }
+            break;
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      DbgProgram::Clear()
+*  % Description: Removes all packets from the program.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID DbgProgram::Clear()
+{
+    m_size    = 0;
+    m_rspSize = 0;
+}
+
+/***************************************************************************************************
+** % Method:      ProgWrPacket::ProgWrPacket()
+*  % Description: ProgWrPacket constructor.  The program's data is referenced, not copied.
+***************************************************************************************************/
+ProgWrPacket::ProgWrPacket(
+    const DbgProgram& program)  // program to store
+{
+    EncodeHeader16<DbgPacketOpCodeProgWr>(static_cast<USHORT>(program.Size()));
+    EncodePayload<DbgPacketOpCodeProgWr>(program.Data());
+}
+
+/***************************************************************************************************
+** % Method:      ProgRunPacket::ProgRunPacket()
+*  % Description: ProgRunPacket constructor.  program must be the one last stored with a
+*                 ProgWrPacket; it is only used to work out the response size.
+***************************************************************************************************/
+ProgRunPacket::ProgRunPacket(
+    const DbgProgram& program,  // stored program
+    USHORT            runCnt,   // number of times to run it
+    BOOL              vblank)   // wait for a vblank before each run
+{
+    const BYTE mode = (vblank) ? ModeVblank : 0x00;
+
+    assert(program.RspSize() * runCnt <= 0xFFFF);
+
+    EncodeHeader16<DbgPacketOpCodeProgRun>(mode,
+                                           runCnt,
+                                           static_cast<USHORT>(program.RspSize() * runCnt));
+    SetExecTimeout(GetExecTimeoutMs(mode, runCnt));
+}
+
+/***************************************************************************************************
+** % Method:      ProgRunPacket::GetExecTimeoutMs()
+*  % Description: Works out how long a program run may take on the NES, beyond the time taken to
+*                 send its responses: a frame per run in vblank mode.  The hci stops reading the
+*                 uart while it waits for each vblank, so SerialComm treats a ProgRun with an
+*                 execution time as a stall point (see SerialComm::CanStart()).
+*  % Returns:     Execution time, in milliseconds.
+***************************************************************************************************/
+UINT ProgRunPacket::GetExecTimeoutMs(
+    BYTE   mode,    // MODE header byte
+    USHORT runCnt)  // RUN_CNT header field
+{
+    return (mode & ModeVblank) ? runCnt * ((1000 / WaitPacket::FrameRate) + 1) : 0;
 }
 
 /***************************************************************************************************
-** % Method:      CartSetCfgPacket::SizeInBytes()
-*  % Description: Returns total packet size, in bytes.
+** % Method:      MemWrLzPacket::MemWrLzPacket()
+*  % Description: MemWrLzPacket constructor.
 ***************************************************************************************************/
-UINT CartSetCfgPacket::SizeInBytes() const
+MemWrLzPacket::MemWrLzPacket(
+    MemSpace    space,       // address space
+    USHORT      addr,        // first address to write
+    const BYTE* pTokens,     // tokens from LzEncoder::Encode(), valid until the packet is submitted
+    USHORT      tokenBytes)  // size of pTokens, in bytes
 {
-    return sizeof(BYTE) + (5 * sizeof(BYTE));
+    EncodeHeader16<DbgPacketOpCodeMemWrLz>(static_cast<BYTE>(space), addr, tokenBytes);
+    EncodePayload<DbgPacketOpCodeMemWrLz>(pTokens);
 }
@@ -28,24 +28,7 @@
 #ifndef DBGPACKET_H
 #define DBGPACKET_H
 
-#include <windows.h>
-
-enum DbgPacketOpCode
-{
-    DbgPacketOpCodeEcho              = 0x00, // echo packet body back to debugger
-    DbgPacketOpCodeCpuMemRd          = 0x01, // read CPU memory
-    DbgPacketOpCodeCpuMemWr          = 0x02, // write CPU memory
-    DbgPacketOpCodeDbgHlt            = 0x03, // debugger break (stop execution)
-    DbgPacketOpCodeDbgRun            = 0x04, // debugger run (resume execution)
-    DbgPacketOpCodeCpuRegRd          = 0x05, // read CPU register
-    DbgPacketOpCodeCpuRegWr          = 0x06, // read CPU register
-    DbgPacketOpCodeQueryHlt          = 0x07, // query if the cpu is currently halted
-    DbgPacketOpCodeQueryErrCode      = 0x08, // query NES error code
-    DbgPacketOpCodePpuMemRd          = 0x09, // read PPU memory
-    DbgPacketOpCodePpuMemWr          = 0x0A, // write PPU memory
-    DbgPacketOpCodePpuDisable        = 0x0B, // disable PPU
-    DbgPacketOpCodeCartSetCfg        = 0x0C, // set cartridge config from iNES header
-};
+#include "dbgopcodes.h"
 
 enum CpuReg
 {
@@ -56,11 +39,37 @@ enum CpuReg
     CpuRegY   = 0x04, // Y:   Y index reg
     CpuRegP   = 0x05, // P:   Processor Status reg
     CpuRegS   = 0x06, // S:   Stack Pointer reg
+    CpuRegCnt = 0x07  // number of CPU registers
+};
+
+enum MemSpace
+{
+    MemSpaceCpu = 0x00, // CPU address space
+    MemSpacePpu = 0x01, // PPU address space
+};
+
+/***************************************************************************************************
+** % Class:       MemRange
+*  % Description: A run of bytes in the CPU or PPU address space.
+***************************************************************************************************/
+struct MemRange
+{
+    MemSpace space;     // address space
+    USHORT   addr;      // first address
+    USHORT   numBytes;  // number of bytes
 };
 
 /***************************************************************************************************
 ** % Class:       DbgPacket
-*  % Description: Represents messages sent to and received from the NES FPGA.
+*  % Description: Represents messages sent to and received from the NES FPGA.  A packet is a short
+*                 header, encoded in place by the constructor, followed by an optional payload
+*                 that is referenced rather than copied.  Packets never touch the heap, so hot paths
+*                 can build them on the stack; the payload only has to stay valid until the packet
+*                 has been submitted (SerialComm copies it straight into its TX buffer).
+*
+*                 Subclasses encode themselves with the EncodeHeader*() and EncodePayload() helpers,
+*                 which check the layout against the opcode's DBG_OPCODE_TABLE entry at compile time
+*                 and work out ReturnBytesExpected() from it.
 ***************************************************************************************************/
 class DbgPacket
 {
@@ -70,20 +79,232 @@ public:
 
     virtual ~DbgPacket();
 
-    virtual const BYTE* PacketData() const { return m_pData; }
-    virtual UINT SizeInBytes() const = 0;
-    virtual UINT ReturnBytesExpected() const = 0;
+    const BYTE* HeaderData() const { return &m_header[0]; }
+    UINT        HeaderSize() const { return m_headerSize; }
+    const BYTE* PayloadData() const { return m_pPayload; }
+    UINT        PayloadSize() const { return m_payloadSize; }
+    UINT        SizeInBytes() const { return m_headerSize + m_payloadSize; }
+    UINT        Encode(BYTE* pBuf) const;
+    UINT        ReturnBytesExpected() const { return m_rspSize; }
+    UINT        ExecTimeoutMs() const { return m_execTimeoutMs; }
+
+    static const UINT MaxHeaderSize = DbgOpMaxHeaderSize;
 
 protected:
     DbgPacket();
 
-    BYTE* m_pData;
+    template <DbgPacketOpCode op> VOID EncodeHeader();
+    template <DbgPacketOpCode op> VOID EncodeHeader(BYTE arg0);
+    template <DbgPacketOpCode op> VOID EncodeHeader(BYTE arg0, BYTE arg1);
+    template <DbgPacketOpCode op> VOID EncodeHeaderBytes(const BYTE* pArgs);
+    template <DbgPacketOpCode op> VOID EncodeHeader16(USHORT arg0);
+    template <DbgPacketOpCode op> VOID EncodeHeader16(USHORT arg0, USHORT arg1);
+    template <DbgPacketOpCode op> VOID EncodeHeader16(BYTE arg0, USHORT arg1, USHORT arg2);
+    template <DbgPacketOpCode op> VOID EncodeHeader16(BYTE arg0, USHORT arg1, USHORT arg2,
+                                                      USHORT arg3);
+    template <DbgPacketOpCode op> VOID EncodePayload(const BYTE* pPayload);
+    VOID EncodeRaw(const DbgOpInfo& info, const BYTE* pRawPacket);
+    VOID SetExecTimeout(UINT execTimeoutMs) { m_execTimeoutMs = execTimeoutMs; }
 
 private:
     DbgPacket& operator=(const DbgPacket&);
     DbgPacket(const DbgPacket&);
+
+    template <DbgPacketOpCode op> VOID FinishHeader();
+
+    VOID   AppendHeader(BYTE data);
+    VOID   AppendHeader16(USHORT data);
+    VOID   SetPayload(const BYTE* pPayload, UINT payloadSize);
+    USHORT GetHeader16(UINT offset) const;
+    VOID   SetRspSize(UINT rspSize, UINT rspLenOffset);
+
+    BYTE        m_header[MaxHeaderSize];  // opcode and arguments
+    UINT        m_headerSize;             // bytes of m_header in use
+    const BYTE* m_pPayload;               // packet data following the header (not owned)
+    UINT        m_payloadSize;            // size of m_pPayload, in bytes
+    UINT        m_rspSize;                // response bytes expected from the NES
+    UINT        m_execTimeoutMs;          // time the NES may spend executing the packet
+    BYTE*       m_pOwnedData;             // freed with the packet (CreateObjFromString() only)
 };
 
+/***************************************************************************************************
+** % Method:      DbgPacket::EncodeHeader()
+*  % Description: Encodes the header of a packet with no arguments.  The opcode's DBG_OPCODE_TABLE
+*                 entry is checked at compile time.
+*  % Returns:     N/A
+***************************************************************************************************/
+template <DbgPacketOpCode op>
+VOID DbgPacket::EncodeHeader()
+{
+    STATIC_ASSERT(DbgOpSchema<op>::HeaderSize == 1);
+
+    AppendHeader(static_cast<BYTE>(op));
+    FinishHeader<op>();
+}
+
+/***************************************************************************************************
+** % Method:      DbgPacket::EncodeHeader()
+*  % Description: Encodes the header of a packet with one byte argument.
+*  % Returns:     N/A
+***************************************************************************************************/
+template <DbgPacketOpCode op>
+VOID DbgPacket::EncodeHeader(
+    BYTE arg0)  // argument
+{
+    STATIC_ASSERT(DbgOpSchema<op>::HeaderSize == 2);
+
+    AppendHeader(static_cast<BYTE>(op));
+    AppendHeader(arg0);
+    FinishHeader<op>();
+}
+
+/***************************************************************************************************
+** % Method:      DbgPacket::EncodeHeader()
+*  % Description: Encodes the header of a packet with two byte arguments.
+*  % Returns:     N/A
+***************************************************************************************************/
+template <DbgPacketOpCode op>
+VOID DbgPacket::EncodeHeader(
+    BYTE arg0,  // first argument
+    BYTE arg1)  // second argument
+{
+    STATIC_ASSERT((DbgOpSchema<op>::HeaderSize == 3) &&
+                  (DbgOpSchema<op>::PayloadLenOffset == 0) &&
+                  (DbgOpSchema<op>::RspLenOffset == 0));
+
+    AppendHeader(static_cast<BYTE>(op));
+    AppendHeader(arg0);
+    AppendHeader(arg1);
+    FinishHeader<op>();
+}
+
+/***************************************************************************************************
+** % Method:      DbgPacket::EncodeHeaderBytes()
+*  % Description: Encodes the header of a packet whose arguments are a run of bytes, as many as the
+*                 opcode's DBG_OPCODE_TABLE entry calls for.
+*  % Returns:     N/A
+***************************************************************************************************/
+template <DbgPacketOpCode op>
+VOID DbgPacket::EncodeHeaderBytes(
+    const BYTE* pArgs)  // arguments, DbgOpSchema<op>::HeaderSize - 1 bytes
+{
+    STATIC_ASSERT((DbgOpSchema<op>::PayloadLenOffset == 0) && (DbgOpSchema<op>::RspLenOffset == 0));
+
+    AppendHeader(static_cast<BYTE>(op));
+
+    for (UINT i = 1; i < DbgOpSchema<op>::HeaderSize; i++)
+    {
+        AppendHeader(*pArgs++);
+    }
+
+    FinishHeader<op>();
+}
+
+/***************************************************************************************************
+** % Method:      DbgPacket::EncodeHeader16()
+*  % Description: Encodes the header of a packet with one 16-bit argument.
+*  % Returns:     N/A
+***************************************************************************************************/
+template <DbgPacketOpCode op>
+VOID DbgPacket::EncodeHeader16(
+    USHORT arg0)  // argument
+{
+    STATIC_ASSERT(DbgOpSchema<op>::HeaderSize == 3);
+
+    AppendHeader(static_cast<BYTE>(op));
+    AppendHeader16(arg0);
+    FinishHeader<op>();
+}
+
+/***************************************************************************************************
+** % Method:      DbgPacket::EncodeHeader16()
+*  % Description: Encodes the header of a packet with two 16-bit arguments.
+*  % Returns:     N/A
+***************************************************************************************************/
+template <DbgPacketOpCode op>
+VOID DbgPacket::EncodeHeader16(
+    USHORT arg0,  // first argument
+    USHORT arg1)  // second argument
+{
+    STATIC_ASSERT(DbgOpSchema<op>::HeaderSize == 5);
+
+    AppendHeader(static_cast<BYTE>(op));
+    AppendHeader16(arg0);
+    AppendHeader16(arg1);
+    FinishHeader<op>();
+}
+
+/***************************************************************************************************
+** % Method:      DbgPacket::EncodeHeader16()
+*  % Description: Encodes the header of a packet with a byte argument followed by two 16-bit
+*                 arguments.
+*  % Returns:     N/A
+***************************************************************************************************/
+template <DbgPacketOpCode op>
+VOID DbgPacket::EncodeHeader16(
+    BYTE   arg0,  // first argument
+    USHORT arg1,  // second argument
+    USHORT arg2)  // third argument
+{
+    STATIC_ASSERT(DbgOpSchema<op>::HeaderSize == 6);
+
+    AppendHeader(static_cast<BYTE>(op));
+    AppendHeader(arg0);
+    AppendHeader16(arg1);
+    AppendHeader16(arg2);
+    FinishHeader<op>();
+}
+
+/***************************************************************************************************
+** % Method:      DbgPacket::EncodeHeader16()
+*  % Description: Encodes the header of a packet with a byte argument followed by three 16-bit
+*                 arguments.
+*  % Returns:     N/A
+***************************************************************************************************/
+template <DbgPacketOpCode op>
+VOID DbgPacket::EncodeHeader16(
+    BYTE   arg0,  // first argument
+    USHORT arg1,  // second argument
+    USHORT arg2,  // third argument
+    USHORT arg3)  // fourth argument
+{
+    STATIC_ASSERT(DbgOpSchema<op>::HeaderSize == 8);
+
+    AppendHeader(static_cast<BYTE>(op));
+    AppendHeader(arg0);
+    AppendHeader16(arg1);
+    AppendHeader16(arg2);
+    AppendHeader16(arg3);
+    FinishHeader<op>();
+}
+
+/***************************************************************************************************
+** % Method:      DbgPacket::EncodePayload()
+*  % Description: Attaches the data that follows the header; its size is the header's payload size
+*                 field.  The data is referenced, not copied.
+*  % Returns:     N/A
+***************************************************************************************************/
+template <DbgPacketOpCode op>
+VOID DbgPacket::EncodePayload(
+    const BYTE* pPayload)  // payload data, valid until the packet is submitted
+{
+    STATIC_ASSERT(DbgOpSchema<op>::PayloadLenOffset != 0);
+    assert(m_headerSize == DbgOpSchema<op>::HeaderSize);
+
+    SetPayload(pPayload, GetHeader16(DbgOpSchema<op>::PayloadLenOffset));
+}
+
+/***************************************************************************************************
+** % Method:      DbgPacket::FinishHeader()
+*  % Description: Works out the response size once the header is complete.
+*  % Returns:     N/A
+***************************************************************************************************/
+template <DbgPacketOpCode op>
+VOID DbgPacket::FinishHeader()
+{
+    SetRspSize(DbgOpSchema<op>::RspSize, DbgOpSchema<op>::RspLenOffset);
+}
+
 /***************************************************************************************************
 ** % Class:       EchoPacket
 *  % Description: Echo debug packet.
@@ -94,9 +315,6 @@ public:
     EchoPacket(const BYTE* pEchoData, USHORT numBytes);
     virtual ~EchoPacket() {};
 
-    virtual UINT SizeInBytes() const;
-    virtual UINT ReturnBytesExpected() const;
-
 private:
     EchoPacket();
     EchoPacket& operator=(const EchoPacket&);
@@ -113,9 +331,6 @@ public:
     CpuMemRdPacket(USHORT addr, USHORT numBytes);
     virtual ~CpuMemRdPacket() {};
 
-    virtual UINT SizeInBytes() const;
-    virtual UINT ReturnBytesExpected() const;
-
 private:
     CpuMemRdPacket();
     CpuMemRdPacket& operator=(const CpuMemRdPacket&);
@@ -132,9 +347,6 @@ public:
     CpuMemWrPacket(USHORT addr, USHORT numBytes, const BYTE* pData);
     virtual ~CpuMemWrPacket() {};
 
-    virtual UINT SizeInBytes() const;
-    virtual UINT ReturnBytesExpected() const;
-
 private:
     CpuMemWrPacket();
     CpuMemWrPacket& operator=(const CpuMemRdPacket&);
@@ -151,9 +363,6 @@ public:
     DbgHltPacket();
     virtual ~DbgHltPacket() {};
 
-    virtual UINT SizeInBytes() const { return 1; }
-    virtual UINT ReturnBytesExpected() const { return 0; }
-
 private:
     DbgHltPacket& operator=(const DbgHltPacket&);
     DbgHltPacket(const DbgHltPacket&);
@@ -169,9 +378,6 @@ public:
     DbgRunPacket();
     virtual ~DbgRunPacket() {};
 
-    virtual UINT SizeInBytes() const { return 1; }
-    virtual UINT ReturnBytesExpected() const { return 0; }
-
 private:
     DbgRunPacket& operator=(const DbgRunPacket&);
     DbgRunPacket(const DbgRunPacket&);
@@ -187,9 +393,6 @@ public:
     CpuRegRdPacket(CpuReg reg);
     virtual ~CpuRegRdPacket() {};
 
-    virtual UINT SizeInBytes() const;
-    virtual UINT ReturnBytesExpected() const;
-
 private:
     CpuRegRdPacket();
     CpuRegRdPacket& operator=(const CpuRegRdPacket&);
@@ -206,9 +409,6 @@ public:
     CpuRegWrPacket(CpuReg reg, BYTE val);
     virtual ~CpuRegWrPacket() {};
 
-    virtual UINT SizeInBytes() const;
-    virtual UINT ReturnBytesExpected() const;
-
 private:
     CpuRegWrPacket();
     CpuRegWrPacket& operator=(const CpuRegRdPacket&);
@@ -225,14 +425,30 @@ public:
     QueryHltPacket();
     virtual ~QueryHltPacket() {};
 
-    virtual UINT SizeInBytes() const;
-    virtual UINT ReturnBytesExpected() const;
-
 private:
     QueryHltPacket& operator=(const QueryHltPacket&);
     QueryHltPacket(const QueryHltPacket&);
 };
 
+/***************************************************************************************************
+** % Class:       QueryErrCodePacket
+*  % Description: Debug packet to query the NES error code.  Each bit is a sticky error flag (see
+*                 the ErrCode* constants).
+***************************************************************************************************/
+class QueryErrCodePacket : public DbgPacket
+{
+public:
+    QueryErrCodePacket();
+    virtual ~QueryErrCodePacket() {};
+
+    static const BYTE ErrCodeUartParityErr = 0x01;  // hci.v DBG_UART_PARITY_ERR
+    static const BYTE ErrCodeUnknownOpCode = 0x02;  // hci.v DBG_UNKNOWN_OPCODE
+
+private:
+    QueryErrCodePacket& operator=(const QueryErrCodePacket&);
+    QueryErrCodePacket(const QueryErrCodePacket&);
+};
+
 /***************************************************************************************************
 ** % Class:       PpuMemRdPacket
 *  % Description: PPU memory read debug packet.
@@ -243,9 +459,6 @@ public:
     PpuMemRdPacket(USHORT addr, USHORT numBytes);
     virtual ~PpuMemRdPacket() {};
 
-    virtual UINT SizeInBytes() const;
-    virtual UINT ReturnBytesExpected() const;
-
 private:
     PpuMemRdPacket();
     PpuMemRdPacket& operator=(const PpuMemRdPacket&);
@@ -262,9 +475,6 @@ public:
     PpuMemWrPacket(USHORT addr, USHORT numBytes, const BYTE* pData);
     virtual ~PpuMemWrPacket() {};
 
-    virtual UINT SizeInBytes() const;
-    virtual UINT ReturnBytesExpected() const;
-
 private:
     PpuMemWrPacket();
     PpuMemWrPacket& operator=(const PpuMemRdPacket&);
@@ -281,9 +491,6 @@ public:
     PpuDisablePacket();
     virtual ~PpuDisablePacket() {};
 
-    virtual UINT SizeInBytes() const { return 1; }
-    virtual UINT ReturnBytesExpected() const { return 0; }
-
 private:
     PpuDisablePacket& operator=(const PpuDisablePacket&);
     PpuDisablePacket(const PpuDisablePacket&);
@@ -299,13 +506,348 @@ public:
     CartSetCfgPacket(const BYTE* pINesHeader);
     virtual ~CartSetCfgPacket() {};
 
-    virtual UINT SizeInBytes() const;
-    virtual UINT ReturnBytesExpected() const { return 0; }
-
 private:
     CartSetCfgPacket();
     CartSetCfgPacket& operator=(const CartSetCfgPacket&);
     CartSetCfgPacket(const CartSetCfgPacket&);
 };
 
+/***************************************************************************************************
+** % Class:       QueryCreditsPacket
+*  % Description: Debug packet to query the free space in the NES uart fifos.  The response is the
+*                 number of free RX fifo entries followed by the number of free TX fifo entries,
+*                 each a little-endian USHORT.
+***************************************************************************************************/
+class QueryCreditsPacket : public DbgPacket
+{
+public:
+    QueryCreditsPacket();
+    virtual ~QueryCreditsPacket() {};
+
+private:
+    QueryCreditsPacket& operator=(const QueryCreditsPacket&);
+    QueryCreditsPacket(const QueryCreditsPacket&);
+};
+
+/***************************************************************************************************
+** % Class:       SetBaudPacket
+*  % Description: Switch the serial link to a new baud rate.  The NES acknowledges with the baud
+*                 select byte at the current rate and then switches.  Bytes sent at the new rate are
+*                 echoed back until ConfirmByte is sent; if it does not arrive within
+*                 ConfirmTimeoutMs the NES reverts to BaudSelDefault.
+***************************************************************************************************/
+class SetBaudPacket : public DbgPacket
+{
+public:
+    SetBaudPacket(BYTE baudSel);
+    virtual ~SetBaudPacket() {};
+
+    static UINT GetBaudRate(BYTE baudSel);
+    static BOOL GetBaudSel(UINT baudRate, BYTE* pBaudSel);
+
+    static const BYTE BaudSelDefault   = 0x00;  // hci.v BAUD_SEL_38400, the reset/fallback rate
+    static const BYTE BaudSelCnt       = 8;     // number of selectable rates (hci.v BAUD_SEL_*)
+    static const BYTE ConfirmByte      = 0xA5;  // hci.v BAUD_CONFIRM
+    static const UINT ConfirmTimeoutMs = 250;   // hci.v BAUD_CONFIRM_TIMEOUT
+
+private:
+    SetBaudPacket();
+    SetBaudPacket& operator=(const SetBaudPacket&);
+    SetBaudPacket(const SetBaudPacket&);
+};
+
+/***************************************************************************************************
+** % Class:       SetFramedPacket
+*  % Description: Enter or leave framed mode.  The NES acknowledges with the enable byte in the mode
+*                 it received the packet in.  In framed mode every packet is sent as
+*
+*                   FrameSof, SEQ, LEN_LO, LEN_HI, packet, CRC_LO, CRC_HI
+*
+*                 and the NES only executes it once the CRC checks out.  It responds with
+*
+*                   FrameSof, SEQ, FrameAck, response, CRC_LO, CRC_HI
+*
+*                 or, if the frame was corrupted or is ahead of the SEQ expected next, with
+*                 FrameSof, expected SEQ, FrameNak, CRC_LO, CRC_HI, and then keeps dropping frames
+*                 ahead of the expected one until it is resent.  The NES keeps its last ReplaySize
+*                 bytes of ACK frames, and answers a resend of a frame it already executed by
+*                 sending the frame's response again, without executing it again.  A resend whose
+*                 response is no longer kept is dropped.  Entering framed mode starts the SEQs
+*                 over at 0.  CRCs cover everything between FrameSof and the CRC (see
+*                 UpdateCrc()).  SetBaudPacket is not supported in framed mode.
+***************************************************************************************************/
+class SetFramedPacket : public DbgPacket
+{
+public:
+    SetFramedPacket(BOOL enable);
+    virtual ~SetFramedPacket() {};
+
+    static USHORT UpdateCrc(USHORT crc, const BYTE* pData, UINT numBytes);
+
+    static const BYTE   FrameSof        = 0x7E;    // hci.v FRAME_SOF
+    static const BYTE   FrameAck        = 0x06;    // hci.v FRAME_ACK
+    static const BYTE   FrameNak        = 0x15;    // hci.v FRAME_NAK
+    static const USHORT CrcInit         = 0xFFFF;  // hci.v FRAME_CRC_INIT
+    static const UINT   MaxPayloadSize  = 0x800;   // hci.v frame buffer depth
+    static const UINT   ReplaySize      = 0x2000;  // hci.v response replay buffer depth
+    static const UINT   ReplaySeqCnt    = 0x80;    // most recent SEQs whose responses are kept
+    static const UINT   TxHeaderSize    = 4;       // SOF, SEQ, LEN_LO, LEN_HI
+    static const UINT   RxHeaderSize    = 3;       // SOF, SEQ, STATUS
+    static const UINT   CrcSize         = 2;       // CRC_LO, CRC_HI
+
+private:
+    SetFramedPacket();
+    SetFramedPacket& operator=(const SetFramedPacket&);
+    SetFramedPacket(const SetFramedPacket&);
+};
+
+/***************************************************************************************************
+** % Class:       MultiReadPacket
+*  % Description: Reads a list of CPU and PPU memory ranges in one packet.  The response is the
+*                 contents of each range in turn.  The ranges are encoded into the packet, so the
+*                 caller's list need not outlive the constructor.
+***************************************************************************************************/
+class MultiReadPacket : public DbgPacket
+{
+public:
+    MultiReadPacket(const MemRange* pRanges, UINT numRanges);
+    virtual ~MultiReadPacket() {};
+
+    static const UINT RangeSize = 5;   // SPACE, ADDR_LO, ADDR_HI, CNT_LO, CNT_HI
+    static const UINT MaxRanges = 64;  // most ranges in one packet
+
+private:
+    MultiReadPacket();
+    MultiReadPacket& operator=(const MultiReadPacket&);
+    MultiReadPacket(const MultiReadPacket&);
+
+    BYTE m_rangeList[MaxRanges * RangeSize];  // encoded ranges (the payload)
+};
+
+/***************************************************************************************************
+** % Class:       MemFillPacket
+*  % Description: Fills a CPU or PPU memory range on the NES by repeating a short pattern, so only
+*                 the pattern crosses the link.  The pattern is copied into the packet.
+***************************************************************************************************/
+class MemFillPacket : public DbgPacket
+{
+public:
+    MemFillPacket(MemSpace space, USHORT addr, USHORT numBytes, const BYTE* pPattern,
+                  UINT patternSize);
+    virtual ~MemFillPacket() {};
+
+    static const UINT MaxPatternSize = 8;  // hci.v MEM_FILL_PAT_MAX
+
+private:
+    MemFillPacket();
+    MemFillPacket& operator=(const MemFillPacket&);
+    MemFillPacket(const MemFillPacket&);
+
+    BYTE m_pattern[MaxPatternSize];  // fill pattern (the payload)
+};
+
+/***************************************************************************************************
+** % Class:       MemCrcPacket
+*  % Description: Computes the CRC-32 of a CPU or PPU memory range on the NES, so a range can be
+*                 checked without reading it back.  The response is the CRC, least significant
+*                 byte first; compare it with UpdateCrc() over the expected data, or use
+*                 RspMatches().
+***************************************************************************************************/
+class MemCrcPacket : public DbgPacket
+{
+public:
+    MemCrcPacket(MemSpace space, USHORT addr, USHORT numBytes);
+    virtual ~MemCrcPacket() {};
+
+    static UINT UpdateCrc(UINT crc, const BYTE* pData, UINT numBytes);
+    static UINT GetRspCrc(const BYTE* pRsp);
+    static BOOL RspMatches(const BYTE* pRsp, const BYTE* pData, UINT numBytes);
+
+    static const UINT RspSize = 4;  // CRC_0 .. CRC_3
+
+private:
+    MemCrcPacket();
+    MemCrcPacket& operator=(const MemCrcPacket&);
+    MemCrcPacket(const MemCrcPacket&);
+};
+
+/***************************************************************************************************
+** % Class:       MemComparePacket
+*  % Description: Compares a CPU or PPU memory range on the NES with expected data, which is sent as
+*                 the payload.  The response reports the first maxMismatches mismatching bytes
+*                 (address and actual value), padded with zeros, followed by the total mismatch
+*                 count; decode it with GetMismatchCnt() and GetMismatch().
+***************************************************************************************************/
+class MemComparePacket : public DbgPacket
+{
+public:
+    MemComparePacket(MemSpace space, USHORT addr, USHORT numBytes, const BYTE* pExpected,
+                     UINT maxMismatches);
+    virtual ~MemComparePacket() {};
+
+    UINT GetMismatchCnt(const BYTE* pRsp) const;
+    VOID GetMismatch(const BYTE* pRsp, UINT idx, USHORT* pAddr, BYTE* pActual) const;
+
+    static const UINT MismatchSize  = 3;                      // ADDR_LO, ADDR_HI, ACTUAL
+    static const UINT MaxMismatches = 0xFFFF / MismatchSize;  // most mismatches reported
+
+private:
+    MemComparePacket();
+    MemComparePacket& operator=(const MemComparePacket&);
+    MemComparePacket(const MemComparePacket&);
+
+    UINT m_maxMismatches;  // mismatches reported in the response
+};
+
+/***************************************************************************************************
+** % Class:       CpuRegsRdPacket
+*  % Description: Reads all CPU registers in one packet.  The response is CpuRegCnt bytes, indexed
+*                 by CpuReg.
+***************************************************************************************************/
+class CpuRegsRdPacket : public DbgPacket
+{
+public:
+    CpuRegsRdPacket();
+    virtual ~CpuRegsRdPacket() {};
+
+private:
+    CpuRegsRdPacket& operator=(const CpuRegsRdPacket&);
+    CpuRegsRdPacket(const CpuRegsRdPacket&);
+};
+
+/***************************************************************************************************
+** % Class:       CpuRegsWrPacket
+*  % Description: Writes all CPU registers in one packet.
+***************************************************************************************************/
+class CpuRegsWrPacket : public DbgPacket
+{
+public:
+    CpuRegsWrPacket(const BYTE* pRegs);
+    virtual ~CpuRegsWrPacket() {};
+
+private:
+    CpuRegsWrPacket();
+    CpuRegsWrPacket& operator=(const CpuRegsWrPacket&);
+    CpuRegsWrPacket(const CpuRegsWrPacket&);
+};
+
+/***************************************************************************************************
+** % Class:       WaitPacket
+*  % Description: Has the NES wait until a condition holds, then respond with a single status byte
+*                 (StatusMet, StatusTimeout, or StatusHalted if the CPU halted first).  Unlike
+*                 other packets it is also accepted while the CPU is running, and leaves it
+*                 running.  The conditions are:
+*                   CondHalted: the CPU is halted.
+*                   CondMem:    the CPU writes data to addr with (data & mask) == value.  Only
+*                               writes are seen, not what is already in memory.
+*                   CondFrames: addr vblanks have started.
+*                 The NES gives up after timeoutMs (0 just checks the condition once).
+***************************************************************************************************/
+class WaitPacket : public DbgPacket
+{
+public:
+    WaitPacket(BYTE cond, USHORT addr, BYTE mask, BYTE value, USHORT timeoutMs);
+    virtual ~WaitPacket() {};
+
+    static const BYTE CondHalted    = 0x00;  // hci.v WAIT_COND_HALTED
+    static const BYTE CondMem       = 0x01;  // hci.v WAIT_COND_MEM
+    static const BYTE CondFrames    = 0x02;  // hci.v WAIT_COND_FRAMES
+    static const BYTE StatusTimeout = 0x00;  // hci.v WAIT_STATUS_TIMEOUT
+    static const BYTE StatusMet     = 0x01;  // hci.v WAIT_STATUS_MET
+    static const BYTE StatusHalted  = 0x02;  // hci.v WAIT_STATUS_HALTED
+    static const UINT TimeoutOffset = 6;     // header offset of TIMEOUT_LO
+    static const UINT FrameRate     = 60;    // vblanks per second
+
+private:
+    WaitPacket();
+    WaitPacket& operator=(const WaitPacket&);
+    WaitPacket(const WaitPacket&);
+};
+
+/***************************************************************************************************
+** % Class:       DbgProgram
+*  % Description: Builds a program for ProgWrPacket: a sequence of encoded debug packets that the
+*                 NES stores and then executes on its own, as if they had arrived from the host,
+*                 each time a ProgRunPacket is sent.  Packets that change the link or wait on the
+*                 NES can't be stored.
+***************************************************************************************************/
+class DbgProgram
+{
+public:
+    DbgProgram();
+    ~DbgProgram();
+
+    BOOL        Append(const DbgPacket& packet);
+    VOID        Clear();
+    const BYTE* Data() const { return &m_data[0]; }
+    UINT        Size() const { return m_size; }
+    UINT        RspSize() const { return m_rspSize; }
+
+    static const UINT MaxSize = 0x200;  // hci.v stored program size (2^PROG_ADDR_BITS)
+
+private:
+    DbgProgram& operator=(const DbgProgram&);
+    DbgProgram(const DbgProgram&);
+
+    BYTE m_data[MaxSize];  // encoded packets
+    UINT m_size;           // bytes of m_data in use
+    UINT m_rspSize;        // response bytes one run of the program produces
+};
+
+/***************************************************************************************************
+** % Class:       ProgWrPacket
+*  % Description: Stored program write debug packet.
+***************************************************************************************************/
+class ProgWrPacket : public DbgPacket
+{
+public:
+    ProgWrPacket(const DbgProgram& program);
+    virtual ~ProgWrPacket() {};
+
+private:
+    ProgWrPacket();
+    ProgWrPacket& operator=(const ProgWrPacket&);
+    ProgWrPacket(const ProgWrPacket&);
+};
+
+/***************************************************************************************************
+** % Class:       ProgRunPacket
+*  % Description: Stored program run debug packet.  The response is the program's responses, once
+*                 per run.
+***************************************************************************************************/
+class ProgRunPacket : public DbgPacket
+{
+public:
+    ProgRunPacket(const DbgProgram& program, USHORT runCnt, BOOL vblank);
+    virtual ~ProgRunPacket() {};
+
+    static UINT GetExecTimeoutMs(BYTE mode, USHORT runCnt);
+
+    static const BYTE ModeVblank   = 0x01;  // wait for a vblank before each run (PROG_MODE_VBLANK)
+    static const UINT RunCntOffset = 2;     // header offset of RUN_CNT_LO
+
+private:
+    ProgRunPacket();
+    ProgRunPacket& operator=(const ProgRunPacket&);
+    ProgRunPacket(const ProgRunPacket&);
+};
+
+/***************************************************************************************************
+** % Class:       MemWrLzPacket
+*  % Description: Writes a CPU or PPU memory range on the NES from LZ tokens, which the hci expands
+*                 as they arrive (see LzEncoder for the token format).  The payload is the tokens;
+*                 they are referenced, not copied.
+***************************************************************************************************/
+class MemWrLzPacket : public DbgPacket
+{
+public:
+    MemWrLzPacket(MemSpace space, USHORT addr, const BYTE* pTokens, USHORT tokenBytes);
+    virtual ~MemWrLzPacket() {};
+
+private:
+    MemWrLzPacket();
+    MemWrLzPacket& operator=(const MemWrLzPacket&);
+    MemWrLzPacket(const MemWrLzPacket&);
+};
+
 #endif // DBGPACKET_H
@@ -0,0 +1,1412 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/hcisim.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  HciSim class implementation.
+***************************************************************************************************/
+
+#include "dbgpacket.h"
+#include "hcisim.h"
+#include "lzencoder.h"
+
+/***************************************************************************************************
+** % Method:      HciSim::HciSim()
+*  % Description: HciSim constructor.
+***************************************************************************************************/
+HciSim::HciSim()
+    :
+    m_state(S_DECODE),
+    m_decodeCnt(0),
+    m_executeCnt(0),
+    m_addr(0),
+    m_mismatchCnt(0),
+    m_reportLeft(0),
+    m_waitRun(FALSE),
+    m_waitMet(FALSE),
+    m_waitEvent(),
+    m_progLen(0),
+    m_progActive(FALSE),
+    m_lzAddr(0),
+    m_lzLiteralLeft(0),
+    m_lzCopyLen(0),
+    m_lzDistLeft(0),
+    m_lzDist(0),
+    m_lzDistShift(0),
+    m_errCode(0),
+    m_hostBaudRate(0),
+    m_devBaudRate(SetBaudPacket::GetBaudRate(SetBaudPacket::BaudSelDefault)),
+    m_maxBaudRate(0xFFFFFFFF),
+    m_baudSwitchMs(0),
+    m_errorInterval(0),
+    m_errorCnt(0),
+    m_errorRand(ErrorRandSeed),
+    m_framed(FALSE),
+    m_unframe(FALSE),
+    m_frameState(FR_SOF),
+    m_frameSeq(0),
+    m_frameExpectedSeq(0),
+    m_frameDiscard(FALSE),
+    m_frameLen(0),
+    m_frameRxCrc(SetFramedPacket::CrcInit),
+    m_frameCrcLo(0),
+    m_frameTxCrc(SetFramedPacket::CrcInit),
+    m_frameBuf(),
+    m_replayWrPos(0),
+    m_replayCnt(0),
+    m_replayKeep(FALSE),
+    m_rspQueue(),
+    m_rspEvent(),
+    m_lock(),
+    m_fifoModel(FALSE),
+    m_rxFifo(),
+    m_rxFifoEvent(),
+    m_txFifoEvent(),
+    m_deviceThread(),
+    m_stopDevice(FALSE),
+    m_deviceStalled(FALSE),
+    m_rxDrainEvent(),
+    m_rxOverrunCnt(0)
+{
+    memset(m_cpuMem, 0, sizeof(m_cpuMem));
+    memset(m_ppuMem, 0, sizeof(m_ppuMem));
+    memset(m_cpuRegs, 0, sizeof(m_cpuRegs));
+    memset(m_cartCfg, 0, sizeof(m_cartCfg));
+    memset(m_prog, 0, sizeof(m_prog));
+    memset(m_replayBuf, 0, sizeof(m_replayBuf));
+    memset(m_replayStart, 0, sizeof(m_replayStart));
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::~HciSim()
+*  % Description: HciSim destructor.  Stops the fifo model's device thread, if it was started.
+***************************************************************************************************/
+HciSim::~HciSim()
+{
+    m_lock.Lock();
+    m_stopDevice = TRUE;
+    m_lock.Unlock();
+
+    m_rxFifoEvent.Set();
+    m_txFifoEvent.Set();
+    m_waitEvent.Set();
+    m_rxDrainEvent.Set();
+
+    m_deviceThread.Join();
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::Open()
+*  % Description: The simulated device is always present; the port name is ignored.
+*  % Returns:     TRUE.
+***************************************************************************************************/
+BOOL HciSim::Open(
+    const TCHAR* pPortName,  // ignored
+    UINT         baudRate)   // host baud rate
+{
+    UNREFERENCED_PARAMETER(pPortName);
+
+    return SetBaudRate(baudRate);
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::Close()
+*  % Description: Nothing to release for the simulated device.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::Close()
+{
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::SetBaudRate()
+*  % Description: Changes the baud rate of the host side of the simulated link.
+*  % Returns:     TRUE.
+***************************************************************************************************/
+BOOL HciSim::SetBaudRate(
+    UINT baudRate)  // new host baud rate
+{
+    m_lock.Lock();
+    m_hostBaudRate = baudRate;
+    m_lock.Unlock();
+
+    return TRUE;
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::Write()
+*  % Description: Feeds host bytes through the hci state machine.  Any responses are generated
+*                 immediately and queued for Read().  Bytes sent while the link is down are lost
+*                 and flag a parity error, as they would on the real uart.  In the fifo model the
+*                 bytes go to the RX fifo for the device thread instead.  The real hci drains its
+*                 fifo faster than the line fills it, so this waits for room while the device is
+*                 running, and only loses bytes that don't fit while it's stalled.
+*  % Returns:     Number of bytes written (always numBytes).
+***************************************************************************************************/
+UINT HciSim::Write(
+    const BYTE* pData,      // data from the host
+    UINT        numBytes,   // number of bytes in pData
+    UINT        timeoutMs)  // ignored, writes never block
+{
+    UNREFERENCED_PARAMETER(timeoutMs);
+
+    m_lock.Lock();
+
+    CheckBaudTimeout();
+
+    for (UINT i = 0; i < numBytes; i++)
+    {
+        if (IsLinkUp())
+        {
+            BYTE data = CorruptByte(pData[i]);
+
+            if (m_fifoModel)
+            {
+                while ((m_rxFifo.Size() >= FifoSize) && !m_deviceStalled && !m_stopDevice)
+                {
+                    m_rxFifoEvent.Set();
+
+                    m_lock.Unlock();
+                    m_rxDrainEvent.Wait(DevicePollMs);
+                    m_lock.Lock();
+                }
+
+                if (m_rxFifo.Size() < FifoSize)
+                {
+                    m_rxFifo.Push(data);
+                }
+                else
+                {
+                    m_rxOverrunCnt++;
+                }
+            }
+            else if (m_framed)
+            {
+                ProcessFrameByte(data);
+            }
+            else
+            {
+                ProcessByte(data);
+            }
+        }
+        else
+        {
+            m_errCode |= 1 << DBG_UART_PARITY_ERR;
+        }
+    }
+
+    BOOL rspQueued = (m_rspQueue.Size() > 0);
+
+    m_lock.Unlock();
+
+    if (rspQueued)
+    {
+        m_rspEvent.Set();
+    }
+
+    m_rxFifoEvent.Set();
+
+    return numBytes;
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::Read()
+*  % Description: Returns queued response bytes, waiting at most timeoutMs for numBytes of them.
+*                 Responses are produced by Write() or the fifo model's device thread, so a wait
+*                 can only be satisfied by another thread.
+*  % Returns:     Number of bytes read.
+***************************************************************************************************/
+UINT HciSim::Read(
+    BYTE* pData,      // where to store response data
+    UINT  numBytes,   // maximum number of bytes to read
+    UINT  timeoutMs)  // maximum time to wait for the data
+{
+    const DWORD startMs   = GetTimeMs();
+    UINT        bytesRead = 0;
+
+    while (bytesRead < numBytes)
+    {
+        m_lock.Lock();
+
+        UINT chunkSize = m_rspQueue.Size();
+        if (chunkSize > numBytes - bytesRead)
+        {
+            chunkSize = numBytes - bytesRead;
+        }
+
+        memcpy(pData + bytesRead, m_rspQueue.Data(), chunkSize);
+        m_rspQueue.Pop(chunkSize);
+
+        m_lock.Unlock();
+
+        if (chunkSize > 0)
+        {
+            m_txFifoEvent.Set();
+        }
+
+        bytesRead += chunkSize;
+
+        if (bytesRead < numBytes)
+        {
+            UINT remainingMs = RemainingMs(startMs, timeoutMs);
+
+            if ((remainingMs == 0) || !WaitForIo(TransportIoRead, remainingMs))
+            {
+                break;
+            }
+        }
+    }
+
+    return bytesRead;
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::WaitForIo()
+*  % Description: Writes are always accepted.  Waits for reads are satisfied once a Write() has
+*                 queued response bytes.
+*  % Returns:     TRUE if the device became ready before timeoutMs elapsed, FALSE otherwise.
+***************************************************************************************************/
+BOOL HciSim::WaitForIo(
+    UINT ioFlags,    // TransportIo conditions to wait for
+    UINT timeoutMs)  // maximum time to wait
+{
+    if (ioFlags & TransportIoWrite)
+    {
+        return TRUE;
+    }
+
+    const DWORD startMs = GetTimeMs();
+    BOOL        ret     = FALSE;
+
+    for (;;)
+    {
+        m_lock.Lock();
+        ret = (m_rspQueue.Size() > 0);
+        m_lock.Unlock();
+
+        UINT remainingMs = RemainingMs(startMs, timeoutMs);
+
+        if (ret || (remainingMs == 0) || !m_rspEvent.Wait(remainingMs))
+        {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::Purge()
+*  % Description: Discards any queued responses.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::Purge()
+{
+    m_lock.Lock();
+    m_rspQueue.Clear();
+    m_lock.Unlock();
+
+    m_txFifoEvent.Set();
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::SignalBrk()
+*  % Description: Models the CPU-initiated debug break input (hci.v brk), e.g. on a HLT opcode.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::SignalBrk()
+{
+    m_lock.Lock();
+
+    if (m_state == S_DISABLED)
+    {
+        m_state = S_DECODE;
+    }
+
+    // Holds the CPU if it broke during a WAIT issued while it was running.
+    m_waitRun = FALSE;
+
+    m_lock.Unlock();
+
+    m_waitEvent.Set();
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::SignalCpuWrite()
+*  % Description: Models the CPU writing memory while it is running, which is what a WAIT on a
+*                 memory condition snoops for.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::SignalCpuWrite(
+    USHORT addr,  // CPU address written
+    BYTE   data)  // value written
+{
+    m_lock.Lock();
+
+    m_cpuMem[addr] = data;
+
+    if (m_waitRun &&
+        (m_header[0] == DbgPacketOpCodeWait) &&
+        (m_header[1] == WaitPacket::CondMem) &&
+        (addr == (m_header[2] | (m_header[3] << 8))) &&
+        ((data & m_header[4]) == m_header[5]))
+    {
+        m_waitMet = TRUE;
+    }
+
+    m_lock.Unlock();
+
+    m_waitEvent.Set();
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::SetMaxBaudRate()
+*  % Description: Limits the rate the simulated link can carry, to model a cable or USB serial
+*                 adapter that cannot keep up.  Bytes sent at a faster rate are lost.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::SetMaxBaudRate(
+    UINT maxBaudRate)  // fastest usable baud rate
+{
+    m_lock.Lock();
+    m_maxBaudRate = maxBaudRate;
+    m_lock.Unlock();
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::SetErrorInterval()
+*  % Description: Models a noisy link by flipping a random bit in bytes that cross it, in either
+*                 direction, on average one byte in errorInterval.  The gaps between corrupted
+*                 bytes are random, so a resent frame isn't hit in the same place every time, but
+*                 the sequence is the same on every run.  0 disables corruption.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::SetErrorInterval(
+    UINT errorInterval)  // average bytes per corrupted byte, 0 for none
+{
+    m_lock.Lock();
+    m_errorInterval = errorInterval;
+    m_errorRand     = ErrorRandSeed;
+    m_errorCnt      = GetErrorGap();
+    m_lock.Unlock();
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::StartFifoModel()
+*  % Description: Moves the state machine to a device thread fed from a FifoSize RX fifo, so a host
+*                 that sends more than the fifo holds while the device is stalled loses bytes, as
+*                 it would on the real uart.  GetRxOverrunCnt() counts them.  Call while nothing is
+*                 outstanding.
+*  % Returns:     TRUE on success, FALSE if the thread couldn't be started.
+***************************************************************************************************/
+BOOL HciSim::StartFifoModel()
+{
+    m_lock.Lock();
+    m_fifoModel = TRUE;
+    m_lock.Unlock();
+
+    return m_deviceThread.Start(DeviceThreadProc, this);
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::GetPortName()
+*  % Description: Returns the port name that selects the simulated device instead of a serial port.
+***************************************************************************************************/
+const TCHAR* HciSim::GetPortName()
+{
+    static const TCHAR* pPortName = _T("sim");
+    return pPortName;
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::ProcessByte()
+*  % Description: Advances the hci state machine by one byte received from the host.  Packets are
+*                 split into header and payload as described by DBG_OPCODE_TABLE.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::ProcessByte(
+    BYTE data)  // byte received from the host
+{
+    switch (m_state)
+    {
+        case S_DISABLED:
+            if (data == DbgPacketOpCodeDbgHlt)
+            {
+                m_state = S_DECODE;
+            }
+            else if (data == DbgPacketOpCodeQueryHlt)
+            {
+                RespondByte(0x00);  // not in a debug break
+            }
+            else if (data == DbgPacketOpCodeWait)
+            {
+                // Wait without disturbing the CPU.
+                m_waitRun = TRUE;
+                Decode(data);
+            }
+            else if ((data == DbgPacketOpCodeProgRun) && !m_progActive)
+            {
+                // Leave the CPU running until the program itself halts it.
+                m_waitRun = TRUE;
+                Decode(data);
+            }
+            else if ((data == DbgPacketOpCodeSetBaud) || (data == DbgPacketOpCodeSetFramed))
+            {
+                // Let the host restore the link settings without halting the CPU.
+                m_waitRun = TRUE;
+                Decode(data);
+            }
+            break;
+
+        case S_DECODE:
+            Decode(data);
+            break;
+
+        case S_HEADER:
+            m_header[m_decodeCnt++] = data;
+            if (m_decodeCnt == DbgOpInfos[m_header[0]].headerSize)
+            {
+                Execute();
+            }
+            break;
+
+        case S_PAYLOAD:
+            switch (m_header[0])
+            {
+                case DbgPacketOpCodeEcho:      RespondByte(data);                      break;
+                case DbgPacketOpCodeCpuMemWr:  m_cpuMem[m_addr] = data;                break;
+                case DbgPacketOpCodePpuMemWr:  m_ppuMem[m_addr % PpuMemSize] = data;   break;
+
+                case DbgPacketOpCodeProgWr:
+                    // Only the first MaxSize bytes are kept.
+                    if (m_addr < DbgProgram::MaxSize)
+                    {
+                        m_prog[m_addr] = data;
+                    }
+                    break;
+
+                case DbgPacketOpCodeMultiRd:
+                    // Read each range once its last byte arrives.
+                    m_range[m_addr % MultiReadPacket::RangeSize] = data;
+                    if ((m_addr % MultiReadPacket::RangeSize) == MultiReadPacket::RangeSize - 1)
+                    {
+                        ReadMem(static_cast<MemSpace>(m_range[0] & 0x01),
+                                static_cast<USHORT>(m_range[1] | (m_range[2] << 8)),
+                                m_range[3] | (m_range[4] << 8));
+                    }
+                    break;
+
+                case DbgPacketOpCodeMemFill:
+                    // Only the first MaxPatternSize bytes are used.  Fill once the last arrives.
+                    if (m_addr < MemFillPacket::MaxPatternSize)
+                    {
+                        m_pattern[m_addr] = data;
+                    }
+                    if (m_executeCnt == 1)
+                    {
+                        FillMem(static_cast<MemSpace>(m_header[1] & 0x01),
+                                static_cast<USHORT>(m_header[2] | (m_header[3] << 8)),
+                                m_header[4] | (m_header[5] << 8),
+                                (m_addr < MemFillPacket::MaxPatternSize)
+                                ? m_addr + 1
+                                : MemFillPacket::MaxPatternSize);
+                    }
+                    break;
+
+                case DbgPacketOpCodeMemCmp:
+                    CompareMem(data);
+                    if (m_executeCnt == 1)
+                    {
+                        FinishCompare();
+                    }
+                    break;
+
+                case DbgPacketOpCodeMemWrLz:
+                    DecompressByte(data);
+                    break;
+            }
+
+            m_addr++;
+            if (--m_executeCnt == 0)
+            {
+                m_state = S_DECODE;
+            }
+            break;
+
+        // --- SET_BAUD ---
+        case S_SET_BAUD_STG_2:
+            RespondByte(data);
+            if (data == SetBaudPacket::ConfirmByte)
+            {
+                m_state   = (m_waitRun) ? S_DISABLED : S_DECODE;
+                m_waitRun = FALSE;
+            }
+            break;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::ProcessFrameByte()
+*  % Description: Advances the framed mode receive state machine by one byte received from the
+*                 host.  Verified frames are executed as soon as they are complete.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::ProcessFrameByte(
+    BYTE data)  // byte received from the host
+{
+    switch (m_frameState)
+    {
+        case FR_SOF:
+            if (data == SetFramedPacket::FrameSof)
+            {
+                m_frameState = FR_SEQ;
+            }
+            break;
+
+        case FR_SEQ:
+            m_frameSeq   = data;
+            m_frameRxCrc = SetFramedPacket::UpdateCrc(SetFramedPacket::CrcInit, &data, 1);
+            m_frameState = FR_LEN_LO;
+            break;
+
+        case FR_LEN_LO:
+            m_frameLen   = data;
+            m_frameRxCrc = SetFramedPacket::UpdateCrc(m_frameRxCrc, &data, 1);
+            m_frameState = FR_LEN_HI;
+            break;
+
+        case FR_LEN_HI:
+            m_frameLen  |= data << 8;
+            m_frameRxCrc = SetFramedPacket::UpdateCrc(m_frameRxCrc, &data, 1);
+            m_frameBuf.Clear();
+
+            // A length the frame buffer can't hold means the header was corrupted.
+            if ((m_frameLen == 0) || (m_frameLen > SetFramedPacket::MaxPayloadSize))
+            {
+                RespondNak();
+            }
+            else
+            {
+                m_frameState = FR_PAYLOAD;
+            }
+            break;
+
+        case FR_PAYLOAD:
+            m_frameBuf.Push(data);
+            m_frameRxCrc = SetFramedPacket::UpdateCrc(m_frameRxCrc, &data, 1);
+
+            if (m_frameBuf.Size() == m_frameLen)
+            {
+                m_frameState = FR_CRC_LO;
+            }
+            break;
+
+        case FR_CRC_LO:
+            m_frameCrcLo = data;
+            m_frameState = FR_CRC_HI;
+            break;
+
+        case FR_CRC_HI:
+            m_frameState = FR_SOF;
+
+            if (static_cast<USHORT>(m_frameCrcLo | (data << 8)) != m_frameRxCrc)
+            {
+                // Corrupted frame.  Ask for it again, and drop everything after it until it
+                // arrives.
+                RespondNak();
+            }
+            else if (static_cast<BYTE>(m_frameExpectedSeq - m_frameSeq) & 0x80)
+            {
+                // Ahead of the expected frame, so a frame before it was lost.  Ask for the
+                // expected one again, and drop everything after it until it arrives.
+                RespondNak();
+            }
+            else if (m_frameSeq == m_frameExpectedSeq)
+            {
+                m_frameDiscard     = FALSE;
+                m_frameExpectedSeq = static_cast<BYTE>(m_frameSeq + 1);
+
+                ExecuteFrame();
+            }
+            else
+            {
+                // A resend of a frame already executed, whose response the host lost.  Send the
+                // response again rather than executing the frame again.
+                ReplayFrame();
+            }
+            break;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::ExecuteFrame()
+*  % Description: Runs a verified frame's payload through the hci state machine, wrapping the
+*                 response in an ACK frame, which is kept for ReplayFrame().
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::ExecuteFrame()
+{
+    m_replayStart[m_frameSeq % SetFramedPacket::ReplaySeqCnt] = m_replayWrPos;
+    m_replayCnt  = (m_replayCnt < SetFramedPacket::ReplaySeqCnt) ? m_replayCnt + 1 : m_replayCnt;
+    m_replayKeep = TRUE;
+
+    RespondByte(SetFramedPacket::FrameSof);
+
+    m_frameTxCrc = SetFramedPacket::CrcInit;
+    RespondByte(m_frameSeq);
+    RespondByte(SetFramedPacket::FrameAck);
+
+    for (UINT i = 0; i < m_frameBuf.Size(); i++)
+    {
+        ProcessByte(m_frameBuf.Data()[i]);
+    }
+
+    m_frameBuf.Clear();
+
+    const USHORT crc = m_frameTxCrc;
+    RespondByte(static_cast<BYTE>(crc & 0xFF));
+    RespondByte(static_cast<BYTE>(crc >> 8));
+
+    m_replayKeep = FALSE;
+
+    // Apply a pending SET_FRAMED now that its response is complete.
+    if (m_unframe)
+    {
+        m_framed  = FALSE;
+        m_unframe = FALSE;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::ReplayFrame()
+*  % Description: Answers a resend of a frame that was already executed by sending its kept ACK
+*                 frame again.  The frame is dropped if its response is no longer kept.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::ReplayFrame()
+{
+    const UINT seqDiff = static_cast<BYTE>(m_frameExpectedSeq - m_frameSeq);
+    const UINT start   = m_replayStart[m_frameSeq % SetFramedPacket::ReplaySeqCnt];
+    const UINT end     = (seqDiff == 1) ? m_replayWrPos
+                                        : m_replayStart[(m_frameSeq + 1) %
+                                                        SetFramedPacket::ReplaySeqCnt];
+
+    m_frameBuf.Clear();
+
+    if ((seqDiff <= m_replayCnt) && (m_replayWrPos - start <= SetFramedPacket::ReplaySize))
+    {
+        for (UINT pos = start; pos != end; pos++)
+        {
+            RespondByte(m_replayBuf[pos % SetFramedPacket::ReplaySize]);
+        }
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::RespondNak()
+*  % Description: Rejects a corrupted frame: sends a NAK frame carrying the SEQ the host must
+*                 resend, and drops later frames until it arrives.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::RespondNak()
+{
+    m_frameBuf.Clear();
+    m_frameDiscard = TRUE;
+    m_frameState   = FR_SOF;
+
+    RespondByte(SetFramedPacket::FrameSof);
+
+    m_frameTxCrc = SetFramedPacket::CrcInit;
+    RespondByte(m_frameExpectedSeq);
+    RespondByte(SetFramedPacket::FrameNak);
+
+    const USHORT crc = m_frameTxCrc;
+    RespondByte(static_cast<BYTE>(crc & 0xFF));
+    RespondByte(static_cast<BYTE>(crc >> 8));
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::Decode()
+*  % Description: Handles an opcode byte received in the S_DECODE state.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::Decode(
+    BYTE opCode)  // opcode byte received from the host
+{
+    const DbgOpInfo* pInfo = GetDbgOpInfo(opCode);
+
+    // A program can't rewrite or run programs.
+    if (m_progActive && ((opCode == DbgPacketOpCodeProgWr) || (opCode == DbgPacketOpCodeProgRun)))
+    {
+        pInfo = NULL;
+    }
+
+    if (!pInfo)
+    {
+        // Invalid opcode.  Ignore, but set error code.
+        m_errCode |= 1 << DBG_UNKNOWN_OPCODE;
+    }
+    else
+    {
+        m_header[0] = opCode;
+        m_decodeCnt = 1;
+
+        if (pInfo->headerSize == 1)
+        {
+            Execute();
+        }
+        else
+        {
+            m_state = S_HEADER;
+        }
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::Execute()
+*  % Description: Executes the packet whose header has just been received.  Packets with a payload
+*                 are left in the S_PAYLOAD state to receive it.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::Execute()
+{
+    const DbgOpInfo& info = DbgOpInfos[m_header[0]];
+
+    m_state      = S_DECODE;
+    m_executeCnt = GetDbgOpField16(&m_header[0], info.payloadLenOffset);
+
+    switch (m_header[0])
+    {
+        case DbgPacketOpCodeCpuMemRd:
+        case DbgPacketOpCodePpuMemRd:
+            ReadMem((m_header[0] == DbgPacketOpCodeCpuMemRd) ? MemSpaceCpu : MemSpacePpu,
+                    static_cast<USHORT>(m_header[1] | (m_header[2] << 8)),
+                    GetDbgOpField16(&m_header[0], info.rspLenOffset));
+            break;
+
+        case DbgPacketOpCodeCpuMemWr:
+        case DbgPacketOpCodePpuMemWr:
+            m_addr = static_cast<USHORT>(m_header[1] | (m_header[2] << 8));
+            break;
+
+        case DbgPacketOpCodeDbgRun:
+            m_state = S_DISABLED;
+            break;
+
+        case DbgPacketOpCodeMultiRd:
+        case DbgPacketOpCodeMemFill:
+            m_addr = 0;  // index into the payload
+            break;
+
+        case DbgPacketOpCodeMemCmp:
+            m_addr        = 0;  // index into the payload
+            m_mismatchCnt = 0;
+            m_reportLeft  = GetDbgOpField16(&m_header[0], info.rspLenOffset);
+
+            if (m_executeCnt == 0)
+            {
+                FinishCompare();
+            }
+            break;
+
+        case DbgPacketOpCodeMemWrLz:
+            // A token cut off by the end of the payload is dropped.
+            m_lzAddr        = static_cast<USHORT>(m_header[2] | (m_header[3] << 8));
+            m_lzLiteralLeft = 0;
+            m_lzDistLeft    = 0;
+            break;
+
+        case DbgPacketOpCodeMemCrc:
+            CrcMem(static_cast<MemSpace>(m_header[1] & 0x01),
+                   static_cast<USHORT>(m_header[2] | (m_header[3] << 8)),
+                   static_cast<USHORT>(m_header[4] | (m_header[5] << 8)));
+            break;
+
+        case DbgPacketOpCodeCpuRegRd:
+            RespondByte(GetCpuReg(m_header[1] & 0xF));
+            break;
+
+        case DbgPacketOpCodeCpuRegWr:
+            if ((m_header[1] & 0xF) < CpuRegCnt)
+            {
+                m_cpuRegs[m_header[1] & 0xF] = m_header[2];
+            }
+            break;
+
+        case DbgPacketOpCodeCpuRegsRd:
+            for (UINT i = 0; i < CpuRegCnt; i++)
+            {
+                RespondByte(m_cpuRegs[i]);
+            }
+            break;
+
+        case DbgPacketOpCodeCpuRegsWr:
+            memcpy(&m_cpuRegs[0], &m_header[1], CpuRegCnt);
+            break;
+
+        case DbgPacketOpCodeWait:
+            ExecuteWait();
+            break;
+
+        case DbgPacketOpCodeProgWr:
+            m_addr    = 0;  // index into the payload
+            m_progLen = (m_executeCnt < DbgProgram::MaxSize) ? m_executeCnt : DbgProgram::MaxSize;
+            break;
+
+        case DbgPacketOpCodeProgRun:
+            ExecuteProgram();
+            break;
+
+        case DbgPacketOpCodeQueryHlt:
+            RespondByte(0x01);  // in a debug break
+            break;
+
+        case DbgPacketOpCodeQueryErrCode:
+            RespondByte(m_errCode);
+            break;
+
+        case DbgPacketOpCodePpuDisable:
+            // Write 0 to PPUCTRL and PPUMASK.
+            m_cpuMem[0x2000] = 0x00;
+            m_cpuMem[0x2001] = 0x00;
+            break;
+
+        case DbgPacketOpCodeCartSetCfg:
+            memcpy(&m_cartCfg[0], &m_header[1], CartCfgCnt);
+            break;
+
+        case DbgPacketOpCodeSetBaud:
+            // Acknowledge at the current rate, then switch.
+            RespondByte(m_header[1]);
+
+            m_devBaudRate  = SetBaudPacket::GetBaudRate(m_header[1] &
+                                                        (SetBaudPacket::BaudSelCnt - 1));
+            m_baudSwitchMs = GetTimeMs();
+            m_state        = S_SET_BAUD_STG_2;
+            break;
+
+        case DbgPacketOpCodeQueryCredits:
+            // Bytes are processed as they arrive, so the fifos are always empty except for the
+            // opcode itself.
+            RespondByte((FifoSize - 1) & 0xFF);
+            RespondByte((FifoSize - 1) >> 8);
+            RespondByte(FifoSize & 0xFF);
+            RespondByte(FifoSize >> 8);
+            break;
+
+        case DbgPacketOpCodeSetFramed:
+            RespondByte(m_header[1]);
+
+            if (!m_framed && (m_header[1] & 0x01))
+            {
+                m_framed           = TRUE;
+                m_frameState       = FR_SOF;
+                m_frameDiscard     = FALSE;
+                m_frameExpectedSeq = 0;
+                m_replayCnt        = 0;
+            }
+            else if (m_framed && !(m_header[1] & 0x01))
+            {
+                m_unframe = TRUE;
+            }
+
+            m_state   = (m_waitRun) ? S_DISABLED : S_DECODE;
+            m_waitRun = FALSE;
+            break;
+    }
+
+    if (m_executeCnt)
+    {
+        m_state = S_PAYLOAD;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::ReadMem()
+*  % Description: Responds with the contents of a CPU or PPU memory range.  Addresses wrap at the
+*                 end of the address space.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::ReadMem(
+    MemSpace space,     // address space
+    USHORT   addr,      // first address
+    UINT     numBytes)  // number of bytes
+{
+    for (; numBytes; numBytes--, addr++)
+    {
+        RespondByte((space == MemSpaceCpu) ? m_cpuMem[addr] : m_ppuMem[addr % PpuMemSize]);
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::FillMem()
+*  % Description: Fills a CPU or PPU memory range by repeating m_pattern.  Addresses wrap at the end
+*                 of the address space.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::FillMem(
+    MemSpace space,        // address space
+    USHORT   addr,         // first address
+    UINT     numBytes,     // number of bytes
+    UINT     patternSize)  // bytes of m_pattern in use
+{
+    for (UINT i = 0; i < numBytes; i++, addr++)
+    {
+        BYTE& mem = (space == MemSpaceCpu) ? m_cpuMem[addr] : m_ppuMem[addr % PpuMemSize];
+        mem = m_pattern[i % patternSize];
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::CrcMem()
+*  % Description: Responds with the CRC-32 of a CPU or PPU memory range, least significant byte
+*                 first.  Addresses wrap at the end of the address space.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::CrcMem(
+    MemSpace space,     // address space
+    USHORT   addr,      // first address
+    UINT     numBytes)  // number of bytes
+{
+    UINT crc = 0;
+
+    for (; numBytes; numBytes--, addr++)
+    {
+        const BYTE& mem = (space == MemSpaceCpu) ? m_cpuMem[addr] : m_ppuMem[addr % PpuMemSize];
+        crc = MemCrcPacket::UpdateCrc(crc, &mem, 1);
+    }
+
+    for (UINT i = 0; i < MemCrcPacket::RspSize; i++, crc >>= 8)
+    {
+        RespondByte(static_cast<BYTE>(crc & 0xFF));
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::DecompressByte()
+*  % Description: Expands the next MEM_WR_LZ payload byte (see LzEncoder for the token format).
+*                 Like hci.v, copies read back memory already written, a byte at a time, so a copy
+*                 may overlap its own output.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::DecompressByte(
+    BYTE data)  // next token byte
+{
+    const BOOL cpu = ((m_header[1] & 0x01) == MemSpaceCpu);
+
+    if (m_lzLiteralLeft)
+    {
+        BYTE& mem = cpu ? m_cpuMem[m_lzAddr] : m_ppuMem[m_lzAddr % PpuMemSize];
+        mem = data;
+
+        m_lzAddr++;
+        m_lzLiteralLeft--;
+    }
+    else if (m_lzDistLeft)
+    {
+        // DIST is least significant byte first.
+        m_lzDist      |= data << m_lzDistShift;
+        m_lzDistShift += 8;
+
+        if (--m_lzDistLeft == 0)
+        {
+            for (; m_lzCopyLen; m_lzCopyLen--, m_lzAddr++)
+            {
+                const USHORT srcAddr = static_cast<USHORT>(m_lzAddr - m_lzDist - 1);
+
+                if (cpu)
+                {
+                    m_cpuMem[m_lzAddr] = m_cpuMem[srcAddr];
+                }
+                else
+                {
+                    m_ppuMem[m_lzAddr % PpuMemSize] = m_ppuMem[srcAddr % PpuMemSize];
+                }
+            }
+        }
+    }
+    else if (!(data & 0x80))
+    {
+        m_lzLiteralLeft = (data & 0x7F) + 1;
+    }
+    else
+    {
+        const BOOL longDist = (data & 0x40) != 0;
+
+        m_lzCopyLen  = (data & 0x3F) + (longDist ? LzEncoder::MinLongCopyLen
+                                                 : LzEncoder::MinShortCopyLen);
+        m_lzDistLeft  = longDist ? 2 : 1;
+        m_lzDist      = 0;
+        m_lzDistShift = 0;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::CompareMem()
+*  % Description: Compares the next MEM_CMP payload byte with memory, and reports it if it is one of
+*                 the first mismatches.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::CompareMem(
+    BYTE expected)  // expected value at the current address
+{
+    const USHORT addr = static_cast<USHORT>((m_header[2] | (m_header[3] << 8)) + m_addr);
+    const BYTE   mem  = (m_header[1] & 0x01) ? m_ppuMem[addr % PpuMemSize] : m_cpuMem[addr];
+
+    if (mem != expected)
+    {
+        m_mismatchCnt++;
+
+        if (m_reportLeft >= MemComparePacket::MismatchSize)
+        {
+            RespondByte(static_cast<BYTE>(addr & 0xFF));
+            RespondByte(static_cast<BYTE>(addr >> 8));
+            RespondByte(mem);
+
+            m_reportLeft -= MemComparePacket::MismatchSize;
+        }
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::FinishCompare()
+*  % Description: Completes a MEM_CMP response: pads out the mismatch report and sends the count.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::FinishCompare()
+{
+    for (; m_reportLeft; m_reportLeft--)
+    {
+        RespondByte(0x00);
+    }
+
+    RespondByte(static_cast<BYTE>(m_mismatchCnt & 0xFF));
+    RespondByte(static_cast<BYTE>(m_mismatchCnt >> 8));
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::ExecuteWait()
+*  % Description: Executes a WAIT: blocks, with the device unlocked so SignalBrk() and
+*                 SignalCpuWrite() can get in, until the condition holds, the CPU halts or the
+*                 timeout passes, then sends the status.  The CPU is left running if it was.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::ExecuteWait()
+{
+    const BYTE  cond      = m_header[1];
+    const UINT  frameMs   = ((m_header[2] | (m_header[3] << 8)) * 1000) / WaitPacket::FrameRate;
+    const UINT  timeoutMs = GetDbgOpField16(&m_header[0], WaitPacket::TimeoutOffset);
+    const DWORD startMs   = GetTimeMs();
+
+    BYTE status = WaitPacket::StatusTimeout;
+
+    m_waitMet = FALSE;
+
+    // Let the host have the responses to earlier packets while this one waits.
+    if (m_rspQueue.Size() > 0)
+    {
+        m_rspEvent.Set();
+    }
+
+    for (;;)
+    {
+        const DWORD elapsedMs = GetTimeMs() - startMs;
+
+        BOOL met = FALSE;
+        switch (cond)
+        {
+            case WaitPacket::CondHalted: met = !m_waitRun;              break;
+            case WaitPacket::CondMem:    met = m_waitMet;               break;
+            case WaitPacket::CondFrames: met = (elapsedMs >= frameMs);  break;
+        }
+
+        if (met)
+        {
+            status = WaitPacket::StatusMet;
+            break;
+        }
+        else if (!m_waitRun)
+        {
+            status = WaitPacket::StatusHalted;
+            break;
+        }
+        else if ((elapsedMs >= timeoutMs) || m_stopDevice)
+        {
+            status = WaitPacket::StatusTimeout;
+            break;
+        }
+
+        UINT waitMs = RemainingMs(startMs, timeoutMs);
+        if ((cond == WaitPacket::CondFrames) && (RemainingMs(startMs, frameMs) < waitMs))
+        {
+            waitMs = RemainingMs(startMs, frameMs);
+        }
+
+        StallDevice(&m_waitEvent, waitMs);
+    }
+
+    RespondByte(status);
+
+    if (m_waitRun)
+    {
+        m_state   = S_DISABLED;
+        m_waitRun = FALSE;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::ExecuteProgram()
+*  % Description: Executes a PROG_RUN: feeds the stored program through the state machine RUN_CNT
+*                 times, waiting for a vblank before each run in vblank mode.  Each run starts with
+*                 the CPU as the previous one left it.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::ExecuteProgram()
+{
+    const BYTE mode   = m_header[1];
+    UINT       runCnt = GetDbgOpField16(&m_header[0], ProgRunPacket::RunCntOffset);
+
+    for (; (runCnt > 0) && !m_stopDevice; runCnt--)
+    {
+        if (mode & ProgRunPacket::ModeVblank)
+        {
+            WaitForVblank();
+        }
+
+        m_state      = (m_waitRun) ? S_DISABLED : S_DECODE;
+        m_waitRun    = FALSE;
+        m_progActive = TRUE;
+
+        for (UINT i = 0; i < m_progLen; i++)
+        {
+            ProcessByte(m_prog[i]);
+        }
+
+        m_progActive = FALSE;
+        m_waitRun    = (m_state == S_DISABLED);
+    }
+
+    // Carry on from where the last run left the CPU.
+    m_state   = (m_waitRun) ? S_DISABLED : m_state;
+    m_waitRun = FALSE;
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::WaitForVblank()
+*  % Description: Waits 1/WaitPacket::FrameRate seconds for the next vblank, with the device
+*                 unlocked so SignalBrk() and SignalCpuWrite() can get in.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::WaitForVblank()
+{
+    const UINT  frameMs = 1000 / WaitPacket::FrameRate;
+    const DWORD startMs = GetTimeMs();
+
+    // Let the host have the responses so far while this waits.
+    if (m_rspQueue.Size() > 0)
+    {
+        m_rspEvent.Set();
+    }
+
+    for (UINT remainingMs = frameMs;
+         (remainingMs > 0) && !m_stopDevice;
+         remainingMs = RemainingMs(startMs, frameMs))
+    {
+        StallDevice(&m_waitEvent, remainingMs);
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::RespondByte()
+*  % Description: Queues a response byte to be read by the host, and adds it to the response frame
+*                 CRC.  In the fifo model, first waits with the device unlocked while the TX fifo
+*                 is full.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::RespondByte(
+    BYTE data)  // response byte
+{
+    m_frameTxCrc = SetFramedPacket::UpdateCrc(m_frameTxCrc, &data, 1);
+
+    if (m_replayKeep)
+    {
+        m_replayBuf[m_replayWrPos % SetFramedPacket::ReplaySize] = data;
+        m_replayWrPos++;
+    }
+
+    while (m_fifoModel && (m_rspQueue.Size() >= FifoSize) && !m_stopDevice)
+    {
+        m_rspEvent.Set();
+
+        StallDevice(&m_txFifoEvent, DevicePollMs);
+    }
+
+    if (IsLinkUp())
+    {
+        m_rspQueue.Push(CorruptByte(data));
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::StallDevice()
+*  % Description: Waits on an event with the device unlocked, so the host, SignalBrk() and
+*                 SignalCpuWrite() can get in.  Meanwhile the RX fifo isn't drained (fifo model).
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::StallDevice(
+    Event* pEvent,     // event to wait on
+    UINT   timeoutMs)  // maximum time to wait
+{
+    m_deviceStalled = TRUE;
+    m_rxDrainEvent.Set();
+
+    m_lock.Unlock();
+    pEvent->Wait(timeoutMs);
+    m_lock.Lock();
+
+    m_deviceStalled = FALSE;
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::CorruptByte()
+*  % Description: Applies the SetErrorInterval() line noise to a byte crossing the link.
+*  % Returns:     The byte as received at the other end.
+***************************************************************************************************/
+BYTE HciSim::CorruptByte(
+    BYTE data)  // byte sent
+{
+    if (m_errorInterval && (--m_errorCnt == 0))
+    {
+        data       ^= static_cast<BYTE>(1 << (GetErrorRand() & 7));
+        m_errorCnt  = GetErrorGap();
+    }
+
+    return data;
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::GetErrorGap()
+*  % Description: Picks the number of bytes up to and including the next corrupted one, uniformly
+*                 from 1 to 2 * m_errorInterval - 1, so the average is m_errorInterval.
+*  % Returns:     Bytes until the next corrupted byte.
+***************************************************************************************************/
+UINT HciSim::GetErrorGap()
+{
+    return (m_errorInterval) ? 1 + (GetErrorRand() % (2 * m_errorInterval - 1)) : 0;
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::GetErrorRand()
+*  % Description: Steps the line noise random number generator (xorshift32).
+*  % Returns:     Next pseudo-random number.
+***************************************************************************************************/
+UINT HciSim::GetErrorRand()
+{
+    m_errorRand ^= m_errorRand << 13;
+    m_errorRand ^= m_errorRand >> 17;
+    m_errorRand ^= m_errorRand << 5;
+
+    return m_errorRand;
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::IsLinkUp()
+*  % Description: Checks whether bytes currently get across the simulated link intact.
+*  % Returns:     TRUE if the host and device rates match and are within the link's limit.
+***************************************************************************************************/
+BOOL HciSim::IsLinkUp() const
+{
+    return (m_hostBaudRate == m_devBaudRate) && (m_devBaudRate <= m_maxBaudRate);
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::CheckBaudTimeout()
+*  % Description: Reverts the uart to the default rate if a SET_BAUD switch has gone unconfirmed
+*                 for longer than the hci.v timeout.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::CheckBaudTimeout()
+{
+    if ((m_state == S_SET_BAUD_STG_2) &&
+        ((GetTimeMs() - m_baudSwitchMs) >= SetBaudPacket::ConfirmTimeoutMs))
+    {
+        m_devBaudRate = SetBaudPacket::GetBaudRate(SetBaudPacket::BaudSelDefault);
+        m_state       = (m_waitRun) ? S_DISABLED : S_DECODE;
+        m_waitRun     = FALSE;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::DeviceThreadProc()
+*  % Description: Device thread entry point.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::DeviceThreadProc(
+    VOID* pContext)  // HciSim object
+{
+    static_cast<HciSim*>(pContext)->DeviceThread();
+}
+
+/***************************************************************************************************
+** % Method:      HciSim::DeviceThread()
+*  % Description: Device thread body (fifo model).  Feeds the RX fifo through the state machine a
+*                 byte at a time until the HciSim is destroyed.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID HciSim::DeviceThread()
+{
+    m_lock.Lock();
+
+    while (!m_stopDevice)
+    {
+        CheckBaudTimeout();
+
+        if (m_rxFifo.Size() == 0)
+        {
+            m_lock.Unlock();
+            m_rxFifoEvent.Wait(DevicePollMs);
+            m_lock.Lock();
+            continue;
+        }
+
+        BYTE data = m_rxFifo.Data()[0];
+        m_rxFifo.Pop(1);
+
+        m_rxDrainEvent.Set();
+
+        if (m_framed)
+        {
+            ProcessFrameByte(data);
+        }
+        else
+        {
+            ProcessByte(data);
+        }
+
+        if (m_rspQueue.Size() > 0)
+        {
+            m_rspEvent.Set();
+        }
+    }
+
+    m_lock.Unlock();
+}
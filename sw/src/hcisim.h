@@ -0,0 +1,235 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/hcisim.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  HciSim class header.
+***************************************************************************************************/
+
+#ifndef HCISIM_H
+#define HCISIM_H
+
+#include "bytequeue.h"
+#include "dbgpacket.h"
+#include "thread.h"
+#include "transport.h"
+
+/***************************************************************************************************
+** % Class:       HciSim
+*  % Description: In-process model of the FPGA's host communication interface (hw/src/hci/hci.v).
+*                 Bytes written to the transport are run through the same opcode state machine as
+*                 the hardware, against flat 64KB CPU and 16KB PPU address spaces, and the
+*                 responses are queued for Read().  CPU execution is not modelled: after DBG_RUN
+*                 the device stays running until the host sends DBG_BRK or SignalBrk() is called,
+*                 and SignalCpuWrite() stands in for the CPU writing memory.  A WAIT stalls Write()
+*                 until it completes, as the hci stops draining its RX fifo; vblanks occur every
+*                 1/WaitPacket::FrameRate seconds.  A PROG_RUN replays the stored program through
+*                 the state machine, and likewise stalls Write() between vblank mode runs.  Like a
+*                 real port, it may be written from one thread while another reads.
+*
+*                 Baud rate changes are modelled: bytes only get through while the host and the
+*                 device agree on the rate, and the rate is no higher than SetMaxBaudRate() allows.
+*                 Line noise can be modelled with SetErrorInterval(), to exercise framed mode.
+*
+*                 StartFifoModel() models the hci's uart fifos instead, to check the host paces
+*                 itself: the state machine runs on a thread of its own, fed from a FifoSize RX
+*                 fifo.  It keeps up with the line except while it's stalled, on a full TX fifo or
+*                 while a WAIT or vblank mode PROG_RUN waits, and bytes that don't fit meanwhile are
+*                 lost.
+***************************************************************************************************/
+class HciSim : public Transport
+{
+public:
+    HciSim();
+    virtual ~HciSim();
+
+    virtual BOOL Open(const TCHAR* pPortName, UINT baudRate);
+    virtual VOID Close();
+    virtual BOOL SetBaudRate(UINT baudRate);
+
+    virtual UINT Write(const BYTE* pData, UINT numBytes, UINT timeoutMs);
+    virtual UINT Read(BYTE* pData, UINT numBytes, UINT timeoutMs);
+
+    virtual BOOL WaitForIo(UINT ioFlags, UINT timeoutMs);
+    virtual VOID Purge();
+
+    VOID SignalBrk();
+    VOID SignalCpuWrite(USHORT addr, BYTE data);
+    VOID SetMaxBaudRate(UINT maxBaudRate);
+    VOID SetErrorInterval(UINT errorInterval);
+    BOOL StartFifoModel();
+
+    BOOL        IsHalted() const { return (m_state != S_DISABLED) && !m_waitRun; }
+    BYTE*       GetCpuMem() { return &m_cpuMem[0]; }
+    BYTE*       GetPpuMem() { return &m_ppuMem[0]; }
+    BYTE        GetCpuReg(UINT reg) const { return (reg < CpuRegCnt) ? m_cpuRegs[reg] : 0; }
+    const BYTE* GetCartCfg() const { return &m_cartCfg[0]; }
+    BYTE        GetErrCode() const { return m_errCode; }
+    UINT        GetBaudRate() const { return m_devBaudRate; }
+    BOOL        IsFramed() const { return m_framed; }
+    UINT        GetRxOverrunCnt() const { return m_rxOverrunCnt; }
+
+    static const TCHAR* GetPortName();
+
+    static const UINT CpuMemSize = 0x10000;  // CPU address space size, in bytes
+    static const UINT PpuMemSize = 0x4000;   // PPU address space size, in bytes
+    static const UINT FifoSize   = 0x400;    // hci.v uart fifo depth (UART_FIFO_ADDR_BITS)
+
+private:
+    HciSim& operator=(const HciSim&);
+    HciSim(const HciSim&);
+
+    // Decode/execute states.  Unlike hci.v, which has states for each opcode, packets are split
+    // into header and payload generically using DBG_OPCODE_TABLE.
+    enum State
+    {
+        S_DISABLED,
+        S_DECODE,
+        S_HEADER,
+        S_PAYLOAD,
+        S_SET_BAUD_STG_2
+    };
+
+    // Mirrors the frame receive states in hci.v (FR_*).  Verified frames are executed and
+    // answered immediately, so the transmit states have no equivalent.
+    enum FrameState
+    {
+        FR_SOF,
+        FR_SEQ,
+        FR_LEN_LO,
+        FR_LEN_HI,
+        FR_PAYLOAD,
+        FR_CRC_LO,
+        FR_CRC_HI
+    };
+
+    // Error code bit positions (hci.v DBG_*).
+    enum ErrCodeBit
+    {
+        DBG_UART_PARITY_ERR = 0,
+        DBG_UNKNOWN_OPCODE  = 1
+    };
+
+    static const UINT CartCfgCnt    = 5;           // iNES header bytes 4-8
+    static const UINT ErrorRandSeed = 0x2545F491;  // line noise generator seed (any nonzero value)
+    static const UINT DevicePollMs  = 10;          // device thread poll interval (fifo model)
+
+    VOID ProcessByte(BYTE data);
+    VOID ProcessFrameByte(BYTE data);
+    VOID ExecuteFrame();
+    VOID ReplayFrame();
+    VOID RespondNak();
+    VOID Decode(BYTE opCode);
+    VOID Execute();
+    VOID ReadMem(MemSpace space, USHORT addr, UINT numBytes);
+    VOID FillMem(MemSpace space, USHORT addr, UINT numBytes, UINT patternSize);
+    VOID CrcMem(MemSpace space, USHORT addr, UINT numBytes);
+    VOID CompareMem(BYTE expected);
+    VOID DecompressByte(BYTE data);
+    VOID FinishCompare();
+    VOID ExecuteWait();
+    VOID ExecuteProgram();
+    VOID WaitForVblank();
+    VOID RespondByte(BYTE data);
+    BYTE CorruptByte(BYTE data);
+    UINT GetErrorGap();
+    UINT GetErrorRand();
+    BOOL IsLinkUp() const;
+    VOID CheckBaudTimeout();
+    VOID DeviceThread();
+    VOID StallDevice(Event* pEvent, UINT timeoutMs);
+
+    static VOID DeviceThreadProc(VOID* pContext);
+
+    State  m_state;                       // current decode/execute state
+    BYTE   m_header[DbgOpMaxHeaderSize];  // header of the current packet
+    UINT   m_decodeCnt;                   // header bytes received for the current packet
+    UINT   m_executeCnt;                  // data bytes remaining for the current packet
+    USHORT m_addr;                        // current memory address / payload byte index
+
+    BYTE   m_range[MultiReadPacket::RangeSize];       // MULTI_RD range being received
+    BYTE   m_pattern[MemFillPacket::MaxPatternSize];  // MEM_FILL pattern
+    UINT   m_mismatchCnt;                             // MEM_CMP mismatches found so far
+    UINT   m_reportLeft;                              // MEM_CMP mismatch report bytes left to send
+    BOOL   m_waitRun;                                 // WAIT issued while the CPU was running
+    BOOL   m_waitMet;                                 // WAIT condition met by SignalCpuWrite()
+    Event  m_waitEvent;                               // set when a WAIT condition may have changed
+    BYTE   m_prog[DbgProgram::MaxSize];               // PROG_WR stored program
+    UINT   m_progLen;                                 // size of m_prog in use
+    BOOL   m_progActive;                              // executing the stored program
+    USHORT m_lzAddr;                                  // MEM_WR_LZ address written next
+    UINT   m_lzLiteralLeft;                           // MEM_WR_LZ literal bytes still to come
+    UINT   m_lzCopyLen;                               // MEM_WR_LZ length of the pending copy
+    UINT   m_lzDistLeft;                              // MEM_WR_LZ DIST bytes still to come
+    UINT   m_lzDist;                                  // MEM_WR_LZ DIST received so far
+    UINT   m_lzDistShift;                             // MEM_WR_LZ shift for the next DIST byte
+
+    BYTE   m_cpuMem[CpuMemSize];   // CPU address space
+    BYTE   m_ppuMem[PpuMemSize];   // PPU address space
+    BYTE   m_cpuRegs[CpuRegCnt];   // CPU registers, indexed by CpuReg
+    BYTE   m_cartCfg[CartCfgCnt];  // cartridge config, from CART_SET_CFG
+    BYTE   m_errCode;              // sticky error code bits
+
+    UINT   m_hostBaudRate;    // rate the host side of the link is running at
+    UINT   m_devBaudRate;     // rate the simulated uart is running at
+    UINT   m_maxBaudRate;     // fastest rate the simulated link carries without corruption
+    DWORD  m_baudSwitchMs;    // time the uart switched rates, for the SET_BAUD confirm timeout
+    UINT   m_errorInterval;   // average bytes crossing the link per corrupted byte (0 = never)
+    UINT   m_errorCnt;        // bytes crossing the link until the next corrupted one
+    UINT   m_errorRand;       // line noise random number generator state
+
+    BOOL       m_framed;            // TRUE in framed mode
+    BOOL       m_unframe;           // leave framed mode once the current response is complete
+    FrameState m_frameState;        // current frame receive state
+    BYTE       m_frameSeq;          // SEQ of the frame being received
+    BYTE       m_frameExpectedSeq;  // SEQ of the frame after the last one executed
+    BOOL       m_frameDiscard;      // a NAK is outstanding for m_frameExpectedSeq
+    UINT       m_frameLen;          // payload length of the frame being received
+    USHORT     m_frameRxCrc;        // CRC of the frame being received, so far
+    BYTE       m_frameCrcLo;        // received CRC_LO of the frame being received
+    USHORT     m_frameTxCrc;        // CRC of the response frame being sent, so far
+    ByteQueue  m_frameBuf;          // payload of the frame being received
+
+    BYTE m_replayBuf[SetFramedPacket::ReplaySize];      // ACK frames sent (ring), for resends
+    UINT m_replayWrPos;                                 // bytes kept in m_replayBuf, ever
+    UINT m_replayStart[SetFramedPacket::ReplaySeqCnt];  // m_replayWrPos at each SEQ's response
+    UINT m_replayCnt;                                   // SEQs kept since entering framed mode
+    BOOL m_replayKeep;                                  // keep response bytes in m_replayBuf
+
+    ByteQueue m_rspQueue;     // response bytes not yet read by the host
+    Event     m_rspEvent;     // set when response bytes are queued
+
+    Mutex     m_lock;         // serializes host access to the device state
+
+    BOOL      m_fifoModel;      // Write() feeds m_rxFifo for the device thread
+    ByteQueue m_rxFifo;         // bytes received but not yet processed (fifo model)
+    Event     m_rxFifoEvent;    // set when bytes are added to m_rxFifo
+    Event     m_txFifoEvent;    // set when the host reads responses
+    Thread    m_deviceThread;   // runs the state machine (fifo model)
+    BOOL      m_stopDevice;     // tells the device thread to exit
+    BOOL      m_deviceStalled;  // the device thread is waiting, not draining m_rxFifo
+    Event     m_rxDrainEvent;   // set when the device thread drains m_rxFifo or stalls
+    UINT      m_rxOverrunCnt;   // bytes lost to a full m_rxFifo
+};
+
+#endif // HCISIM_H
+
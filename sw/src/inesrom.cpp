@@ -0,0 +1,293 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/inesrom.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  INesRom class implementation.
+***************************************************************************************************/
+
+#include "inesrom.h"
+
+/***************************************************************************************************
+** % Method:      INesRom::INesRom()
+*  % Description: INesRom constructor.
+***************************************************************************************************/
+INesRom::INesRom()
+    :
+    m_file()
+{
+    Reset();
+}
+
+/***************************************************************************************************
+** % Method:      INesRom::~INesRom()
+*  % Description: INesRom destructor.
+***************************************************************************************************/
+INesRom::~INesRom()
+{
+}
+
+/***************************************************************************************************
+** % Method:      INesRom::Open()
+*  % Description: Memory-maps an iNES file and parses it.
+*  % Returns:     Result of the parse.
+***************************************************************************************************/
+INesResult INesRom::Open(
+    const TCHAR* pFilePath)  // path to .nes file
+{
+    Close();
+
+    INesResult ret = (m_file.Open(pFilePath))
+                   ? Parse(m_file.Data(), m_file.Size())
+                   : INES_RESULT_OPEN_FAILED;
+
+    if (ret != INES_RESULT_SUCCESS)
+    {
+        Close();
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      INesRom::Parse()
+*  % Description: Parses an in-memory iNES image: decodes the header, then checks that the image
+*                 holds everything the header describes.  The image is not copied.  Any
+*                 previously parsed image is forgotten, though a file mapped by Open() stays open.
+*  % Returns:     Result of the parse.
+***************************************************************************************************/
+INesResult INesRom::Parse(
+    const BYTE* pData,     // iNES image, starting with the header
+    UINT        dataSize)  // size of pData, in bytes
+{
+    Reset();
+
+    if ((dataSize < HeaderSize) ||
+        (pData[0] != 'N') || (pData[1] != 'E') || (pData[2] != 'S') || (pData[3] != 0x1A))
+    {
+        return INES_RESULT_INVALID_HEADER;
+    }
+
+    m_pHeader = pData;
+
+    const BOOL validSizes = ((pData[7] & 0x0C) == 0x08) ? DecodeNes20() : DecodeINes();
+
+    if (!validSizes || (m_prgRomSize == 0))
+    {
+        Reset();
+        return INES_RESULT_INVALID_HEADER;
+    }
+
+    // Sections follow the header in order: trainer, PRG ROM, CHR ROM, miscellaneous ROM.
+    UINT offset = HeaderSize;
+
+    if (pData[6] & 0x04)
+    {
+        m_pTrainer = pData + offset;
+        offset    += TrainerDataSize;
+    }
+
+    m_pPrgRom = pData + offset;
+
+    if ((offset > dataSize) || (m_prgRomSize > dataSize - offset))
+    {
+        Reset();
+        return INES_RESULT_TRUNCATED;
+    }
+
+    offset += m_prgRomSize;
+
+    if (m_chrRomSize)
+    {
+        m_pChrRom = pData + offset;
+
+        if (m_chrRomSize > dataSize - offset)
+        {
+            Reset();
+            return INES_RESULT_TRUNCATED;
+        }
+
+        offset += m_chrRomSize;
+    }
+
+    // Miscellaneous ROMs run to the end of the image.
+    if (m_miscRomCnt && (offset < dataSize))
+    {
+        m_pMiscRom    = pData + offset;
+        m_miscRomSize = dataSize - offset;
+    }
+
+    return INES_RESULT_SUCCESS;
+}
+
+/***************************************************************************************************
+** % Method:      INesRom::Close()
+*  % Description: Forgets the parsed image, and unmaps the file mapped by Open(), if any.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID INesRom::Close()
+{
+    m_file.Close();
+    Reset();
+}
+
+/***************************************************************************************************
+** % Method:      INesRom::Reset()
+*  % Description: Forgets the parsed image.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID INesRom::Reset()
+{
+    m_pHeader         = NULL;
+    m_pTrainer        = NULL;
+    m_pPrgRom         = NULL;
+    m_prgRomSize      = 0;
+    m_pChrRom         = NULL;
+    m_chrRomSize      = 0;
+    m_pMiscRom        = NULL;
+    m_miscRomSize     = 0;
+    m_format          = INesFormatINes;
+    m_mapper          = 0;
+    m_submapper       = 0;
+    m_mirroring       = INesMirroringHorizontal;
+    m_battery         = FALSE;
+    m_consoleType     = 0;
+    m_timing          = INesTimingNtsc;
+    m_prgRamSize      = 0;
+    m_prgNvramSize    = 0;
+    m_chrRamSize      = 0;
+    m_chrNvramSize    = 0;
+    m_miscRomCnt      = 0;
+    m_expansionDevice = 0;
+}
+
+/***************************************************************************************************
+** % Method:      INesRom::DecodeINes()
+*  % Description: Decodes an iNES 1.0 header.  Headers with junk in the unused bytes 12-15 were
+*                 written by old tools that also stamped byte 7, so only byte 6 is trusted.
+*  % Returns:     TRUE (iNES sizes are always representable).
+***************************************************************************************************/
+BOOL INesRom::DecodeINes()
+{
+    const BYTE* pHeader = m_pHeader;
+
+    m_format = ((pHeader[12] | pHeader[13] | pHeader[14] | pHeader[15]) != 0)
+             ? INesFormatArchaic
+             : INesFormatINes;
+
+    const BOOL archaic = (m_format == INesFormatArchaic);
+
+    m_prgRomSize = pHeader[4] * PrgRomBankSize;
+    m_chrRomSize = pHeader[5] * ChrRomBankSize;
+    m_mirroring  = (pHeader[6] & 0x08) ? INesMirroringFourScreen
+                 : (pHeader[6] & 0x01) ? INesMirroringVertical
+                                       : INesMirroringHorizontal;
+    m_battery    = (pHeader[6] & 0x02) != 0;
+    m_mapper     = (pHeader[6] >> 4) | ((archaic) ? 0 : (pHeader[7] & 0xF0));
+
+    if (!archaic)
+    {
+        m_consoleType = (pHeader[7] & 0x01) ? 1 : (pHeader[7] & 0x02) ? 2 : 0;
+        m_timing      = (pHeader[9] & 0x01) ? INesTimingPal : INesTimingNtsc;
+    }
+
+    // iNES 1.0 has one PRG RAM size (0 meaning 8KB for compatibility), backed if the battery bit
+    // is set, and CHR RAM exactly when there is no CHR ROM.
+    const UINT prgRamSize = ((archaic || (pHeader[8] == 0)) ? 1 : pHeader[8]) * PrgRamBankSize;
+
+    m_prgRamSize   = (m_battery) ? 0 : prgRamSize;
+    m_prgNvramSize = (m_battery) ? prgRamSize : 0;
+    m_chrRamSize   = (m_chrRomSize) ? 0 : ChrRomBankSize;
+
+    return TRUE;
+}
+
+/***************************************************************************************************
+** % Method:      INesRom::DecodeNes20()
+*  % Description: Decodes a NES 2.0 header.
+*  % Returns:     TRUE if the ROM sizes are representable, FALSE otherwise.
+***************************************************************************************************/
+BOOL INesRom::DecodeNes20()
+{
+    const BYTE* pHeader = m_pHeader;
+
+    m_format          = INesFormatNes20;
+    m_mirroring       = (pHeader[6] & 0x08) ? INesMirroringFourScreen
+                      : (pHeader[6] & 0x01) ? INesMirroringVertical
+                                            : INesMirroringHorizontal;
+    m_battery         = (pHeader[6] & 0x02) != 0;
+    m_mapper          = (pHeader[6] >> 4) | (pHeader[7] & 0xF0) | ((pHeader[8] & 0x0F) << 8);
+    m_submapper       = pHeader[8] >> 4;
+    m_consoleType     = pHeader[7] & 0x03;
+    m_prgRamSize      = GetNes20RamSize(pHeader[10] & 0x0F);
+    m_prgNvramSize    = GetNes20RamSize(pHeader[10] >> 4);
+    m_chrRamSize      = GetNes20RamSize(pHeader[11] & 0x0F);
+    m_chrNvramSize    = GetNes20RamSize(pHeader[11] >> 4);
+    m_timing          = static_cast<INesTiming>(pHeader[12] & 0x03);
+    m_miscRomCnt      = pHeader[14] & 0x03;
+    m_expansionDevice = pHeader[15] & 0x3F;
+
+    return GetNes20RomSize(pHeader[4], pHeader[9] & 0x0F, PrgRomBankSize, &m_prgRomSize) &&
+           GetNes20RomSize(pHeader[5], pHeader[9] >> 4, ChrRomBankSize, &m_chrRomSize);
+}
+
+/***************************************************************************************************
+** % Method:      INesRom::GetNes20RomSize()
+*  % Description: Decodes a NES 2.0 ROM size: a 12-bit bank count, or, if the MSB nibble is 0xF,
+*                 2^E * (MM * 2 + 1) bytes with the LSB byte holding EEEEEEMM.
+*  % Returns:     TRUE if the size fits in a UINT, FALSE otherwise.
+***************************************************************************************************/
+BOOL INesRom::GetNes20RomSize(
+    UINT  lsb,       // size LSB byte
+    UINT  msb,       // size MSB nibble
+    UINT  bankSize,  // size unit of the bank count, in bytes
+    UINT* pSize)     // decoded size, in bytes
+{
+    BOOL ret = TRUE;
+
+    if (msb == 0x0F)
+    {
+        const UINT exponent   = lsb >> 2;
+        const UINT multiplier = ((lsb & 0x03) * 2) + 1;
+
+        // Anything this big can't be in the image anyway.
+        ret    = (exponent < 29);
+        *pSize = (ret) ? (1 << exponent) * multiplier : 0;
+    }
+    else
+    {
+        *pSize = ((msb << 8) | lsb) * bankSize;
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      INesRom::GetNes20RamSize()
+*  % Description: Decodes a NES 2.0 RAM size shift count.
+*  % Returns:     Size, in bytes: 0, or 64 << shift.
+***************************************************************************************************/
+UINT INesRom::GetNes20RamSize(
+    UINT shift)  // shift count nibble
+{
+    return (shift) ? (64 << shift) : 0;
+}
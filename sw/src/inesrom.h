@@ -0,0 +1,156 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/inesrom.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  INesRom class header.
+***************************************************************************************************/
+
+#ifndef INESROM_H
+#define INESROM_H
+
+#include "mappedfile.h"
+
+/***************************************************************************************************
+** % Enum:        INesResult
+*  % Description: Conveys result of opening or parsing an iNES image.
+***************************************************************************************************/
+enum INesResult
+{
+    INES_RESULT_SUCCESS,
+    INES_RESULT_OPEN_FAILED,
+    INES_RESULT_INVALID_HEADER,
+    INES_RESULT_TRUNCATED
+};
+
+// Header flavours, as told apart by INesRom::Parse().
+enum INesFormat
+{
+    INesFormatArchaic, // iNES with junk in bytes 7-15 (e.g., "DiskDude!"); byte 7 is ignored
+    INesFormatINes,    // iNES 1.0
+    INesFormatNes20,   // NES 2.0
+};
+
+// Nametable mirroring (header byte 6).
+enum INesMirroring
+{
+    INesMirroringHorizontal,
+    INesMirroringVertical,
+    INesMirroringFourScreen,
+};
+
+// CPU/PPU timing (NES 2.0 byte 12, iNES byte 9).
+enum INesTiming
+{
+    INesTimingNtsc,
+    INesTimingPal,
+    INesTimingMulti,
+    INesTimingDendy,
+};
+
+/***************************************************************************************************
+** % Class:       INesRom
+*  % Description: Parses iNES and NES 2.0 ROM images in place.  The header is decoded and checked
+*                 against the image size once, by Open() or Parse(); the header, trainer, PRG ROM,
+*                 CHR ROM and NES 2.0 miscellaneous ROM are then views into the image, not copies.
+*                 Open() memory-maps the file, so the views stay valid until Close() (or the
+*                 INesRom is destroyed).  Parse() uses the caller's buffer, which must outlive the
+*                 views.  Whether the NES FPGA can run the image is the loader's business.
+***************************************************************************************************/
+class INesRom
+{
+public:
+    INesRom();
+    ~INesRom();
+
+    INesResult Open(const TCHAR* pFilePath);
+    INesResult Parse(const BYTE* pData, UINT dataSize);
+    VOID       Close();
+
+    const BYTE* HeaderData() const { return m_pHeader; }
+    const BYTE* TrainerData() const { return m_pTrainer; }
+    UINT        TrainerSize() const { return (m_pTrainer) ? TrainerDataSize : 0; }
+    const BYTE* PrgRomData() const { return m_pPrgRom; }
+    UINT        PrgRomSize() const { return m_prgRomSize; }
+    const BYTE* ChrRomData() const { return m_pChrRom; }
+    UINT        ChrRomSize() const { return m_chrRomSize; }
+    const BYTE* MiscRomData() const { return m_pMiscRom; }
+    UINT        MiscRomSize() const { return m_miscRomSize; }
+
+    INesFormat    GetFormat() const { return m_format; }
+    UINT          GetMapper() const { return m_mapper; }
+    UINT          GetSubmapper() const { return m_submapper; }
+    INesMirroring GetMirroring() const { return m_mirroring; }
+    BOOL          HasBattery() const { return m_battery; }
+    UINT          GetConsoleType() const { return m_consoleType; }
+    INesTiming    GetTiming() const { return m_timing; }
+    UINT          GetPrgRamSize() const { return m_prgRamSize; }
+    UINT          GetPrgNvramSize() const { return m_prgNvramSize; }
+    UINT          GetChrRamSize() const { return m_chrRamSize; }
+    UINT          GetChrNvramSize() const { return m_chrNvramSize; }
+    UINT          GetMiscRomCnt() const { return m_miscRomCnt; }
+    UINT          GetExpansionDevice() const { return m_expansionDevice; }
+
+    static const UINT HeaderSize      = 16;      // header size, in bytes
+    static const UINT TrainerDataSize = 512;     // trainer size, in bytes, if present
+    static const UINT PrgRomBankSize  = 0x4000;  // PRG ROM size unit, in bytes
+    static const UINT ChrRomBankSize  = 0x2000;  // CHR ROM size unit, in bytes
+    static const UINT PrgRamBankSize  = 0x2000;  // iNES 1.0 PRG RAM size unit, in bytes
+
+private:
+    INesRom& operator=(const INesRom&);
+    INesRom(const INesRom&);
+
+    VOID Reset();
+    BOOL DecodeINes();
+    BOOL DecodeNes20();
+
+    static BOOL GetNes20RomSize(UINT lsb, UINT msb, UINT bankSize, UINT* pSize);
+    static UINT GetNes20RamSize(UINT shift);
+
+    MappedFile    m_file;             // file mapped by Open()
+
+    const BYTE*   m_pHeader;          // header, NULL if nothing has been parsed
+    const BYTE*   m_pTrainer;         // trainer, NULL if there is none
+    const BYTE*   m_pPrgRom;          // PRG ROM
+    UINT          m_prgRomSize;       // PRG ROM size, in bytes
+    const BYTE*   m_pChrRom;          // CHR ROM, NULL if the board uses CHR RAM
+    UINT          m_chrRomSize;       // CHR ROM size, in bytes
+    const BYTE*   m_pMiscRom;         // NES 2.0 miscellaneous ROM(s), NULL if there are none
+    UINT          m_miscRomSize;      // miscellaneous ROM size, in bytes
+
+    INesFormat    m_format;           // header flavour
+    UINT          m_mapper;           // mapper number
+    UINT          m_submapper;        // NES 2.0 submapper number
+    INesMirroring m_mirroring;        // nametable mirroring
+    BOOL          m_battery;          // PRG RAM (or other memory) is battery backed
+    UINT          m_consoleType;      // 0 NES, 1 Vs. System, 2 PlayChoice-10, 3 extended
+    INesTiming    m_timing;           // CPU/PPU timing
+    UINT          m_prgRamSize;       // volatile PRG RAM size, in bytes
+    UINT          m_prgNvramSize;     // non-volatile PRG RAM size, in bytes
+    UINT          m_chrRamSize;       // volatile CHR RAM size, in bytes
+    UINT          m_chrNvramSize;     // non-volatile CHR RAM size, in bytes
+    UINT          m_miscRomCnt;       // NES 2.0 miscellaneous ROM count
+    UINT          m_expansionDevice;  // NES 2.0 default expansion device
+};
+
+#endif // INESROM_H
@@ -0,0 +1,258 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/lzencoder.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  LzEncoder class implementation.
+***************************************************************************************************/
+
+#include "lzencoder.h"
+
+/***************************************************************************************************
+** % Method:      LzEncoder::LzEncoder()
+*  % Description: LzEncoder constructor.
+***************************************************************************************************/
+LzEncoder::LzEncoder(
+    LzEncodeLevel level)  // match search effort
+    :
+    m_level(level),
+    m_pData(NULL),
+    m_numBytes(0),
+    m_pos(0),
+    m_pChain(NULL)
+{
+    if (m_level == LzEncodeBest)
+    {
+        m_pChain = new UINT[WindowSize];
+    }
+}
+
+/***************************************************************************************************
+** % Method:      LzEncoder::~LzEncoder()
+*  % Description: LzEncoder destructor.
+***************************************************************************************************/
+LzEncoder::~LzEncoder()
+{
+    delete [] m_pChain;
+}
+
+/***************************************************************************************************
+** % Method:      LzEncoder::Start()
+*  % Description: Starts encoding a new span.  pData must remain valid until the span is done.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID LzEncoder::Start(
+    const BYTE* pData,     // span to encode
+    UINT        numBytes)  // size of pData, in bytes
+{
+    m_pData    = pData;
+    m_numBytes = numBytes;
+    m_pos      = 0;
+
+    // Chain entries are only reached through m_head, so they need no reset.
+    memset(&m_head[0], 0xFF, sizeof(m_head));
+}
+
+/***************************************************************************************************
+** % Method:      LzEncoder::Encode()
+*  % Description: Encodes as much of the rest of the span as fits in maxTokenBytes of tokens, for
+*                 one MEM_WR_LZ packet.  The packet writes the span from GetPosition() as it was
+*                 before the call.
+*  % Returns:     Number of token bytes written to pTokens.
+***************************************************************************************************/
+UINT LzEncoder::Encode(
+    BYTE* pTokens,        // receives the tokens
+    UINT  maxTokenBytes)  // size of pTokens, at least MinTokenBytes
+{
+    assert(maxTokenBytes >= MinTokenBytes);
+
+    UINT tokenBytes = 0;       // bytes of pTokens written
+    UINT literalPos = m_pos;   // first byte of the pending literal run
+    UINT literalLen = 0;       // bytes in the pending literal run
+
+    while (m_pos < m_numBytes)
+    {
+        // The pending literals cost their data plus a token byte.
+        const UINT literalBytes = (literalLen) ? literalLen + 1 : 0;
+
+        UINT dist = 0;
+        UINT len  = FindMatch(&dist);
+
+        if (len)
+        {
+            if (tokenBytes + literalBytes + GetCopyTokenSize(dist) > maxTokenBytes)
+            {
+                break;
+            }
+
+            tokenBytes += WriteLiterals(&pTokens[tokenBytes], literalPos, literalLen);
+            literalLen  = 0;
+
+            if (dist <= MaxShortDist)
+            {
+                pTokens[tokenBytes++] = static_cast<BYTE>(0x80 | (len - MinShortCopyLen));
+                pTokens[tokenBytes++] = static_cast<BYTE>(dist - 1);
+            }
+            else
+            {
+                pTokens[tokenBytes++] = static_cast<BYTE>(0xC0 | (len - MinLongCopyLen));
+                pTokens[tokenBytes++] = static_cast<BYTE>((dist - 1) & 0xFF);
+                pTokens[tokenBytes++] = static_cast<BYTE>((dist - 1) >> 8);
+            }
+
+            for (; len; len--)
+            {
+                Insert(m_pos++);
+            }
+
+            literalPos = m_pos;
+        }
+        else
+        {
+            if (tokenBytes + literalBytes + ((literalLen) ? 1 : 2) > maxTokenBytes)
+            {
+                break;
+            }
+
+            Insert(m_pos++);
+            literalLen++;
+
+            if (literalLen == MaxLiteralLen)
+            {
+                tokenBytes += WriteLiterals(&pTokens[tokenBytes], literalPos, literalLen);
+                literalPos  = m_pos;
+                literalLen  = 0;
+            }
+        }
+    }
+
+    tokenBytes += WriteLiterals(&pTokens[tokenBytes], literalPos, literalLen);
+
+    return tokenBytes;
+}
+
+/***************************************************************************************************
+** % Method:      LzEncoder::FindMatch()
+*  % Description: Looks for an earlier copy of the data at the current position, within copy range.
+*                 Of the candidates checked, the one that saves the most bytes wins, so a long
+*                 distance copy (a 3 byte token) must be longer to beat a short distance one.
+*  % Returns:     Length of the best match found, or 0 if none is long enough to be worth a copy
+*                 token.
+***************************************************************************************************/
+UINT LzEncoder::FindMatch(
+    UINT* pDist)  // receives the distance back to the match
+    const
+{
+    if (m_pos + MinShortCopyLen > m_numBytes)
+    {
+        return 0;
+    }
+
+    UINT bestLen  = 0;
+    UINT bestGain = 0;  // bytes the best match saves over literals (length less token size)
+    UINT cand     = m_head[GetHash(m_pos)];
+    UINT chainCnt = (m_level == LzEncodeBest) ? MaxChainLen : 1;
+
+    // Chains run from the most recent position back, so stop at the first one out of range.
+    for (; chainCnt && (cand != NoPos) && (m_pos - cand <= MaxLongDist); chainCnt--)
+    {
+        const UINT dist   = m_pos - cand;
+        const UINT minLen = (dist <= MaxShortDist) ? MinShortCopyLen : MinLongCopyLen;
+        const UINT maxLen = (minLen + CopyLenMask < m_numBytes - m_pos)
+                            ? minLen + CopyLenMask
+                            : m_numBytes - m_pos;
+
+        // The match may overlap the current position; the hci copies one byte at a time.
+        UINT len = 0;
+
+        while ((len < maxLen) && (m_pData[cand + len] == m_pData[m_pos + len]))
+        {
+            len++;
+        }
+
+        if ((len >= minLen) && (len - GetCopyTokenSize(dist) > bestGain))
+        {
+            bestLen  = len;
+            bestGain = len - GetCopyTokenSize(dist);
+            *pDist   = dist;
+        }
+
+        cand = (m_pChain) ? m_pChain[cand % WindowSize] : NoPos;
+    }
+
+    return bestLen;
+}
+
+/***************************************************************************************************
+** % Method:      LzEncoder::Insert()
+*  % Description: Records a position as a match candidate for later positions.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID LzEncoder::Insert(
+    UINT pos)  // position to record
+{
+    if (pos + MinShortCopyLen <= m_numBytes)
+    {
+        const UINT hash = GetHash(pos);
+
+        if (m_pChain)
+        {
+            m_pChain[pos % WindowSize] = m_head[hash];
+        }
+
+        m_head[hash] = pos;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      LzEncoder::GetHash()
+*  % Description: Hashes the 3 bytes at a position (the shortest copy).
+*  % Returns:     Hash table index.
+***************************************************************************************************/
+UINT LzEncoder::GetHash(
+    UINT pos)  // position to hash
+    const
+{
+    const UINT prefix = m_pData[pos] | (m_pData[pos + 1] << 8) | (m_pData[pos + 2] << 16);
+
+    return (prefix * 2654435761U) >> (32 - HashBits);
+}
+
+/***************************************************************************************************
+** % Method:      LzEncoder::WriteLiterals()
+*  % Description: Writes a literal token and its data, if there are any literals.
+*  % Returns:     Number of token bytes written.
+***************************************************************************************************/
+UINT LzEncoder::WriteLiterals(
+    BYTE* pTokens,  // receives the token
+    UINT  pos,      // first literal byte
+    UINT  len)      // number of literal bytes, at most MaxLiteralLen
+    const
+{
+    if (len)
+    {
+        pTokens[0] = static_cast<BYTE>(len - 1);
+        memcpy(&pTokens[1], &m_pData[pos], len);
+    }
+
+    return (len) ? len + 1 : 0;
+}
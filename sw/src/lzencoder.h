@@ -0,0 +1,104 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/lzencoder.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  LzEncoder class header.
+***************************************************************************************************/
+
+#ifndef LZENCODER_H
+#define LZENCODER_H
+
+#include "util.h"
+
+// Match search effort for LzEncoder.
+enum LzEncodeLevel
+{
+    LzEncodeFast,  // one hash probe per position
+    LzEncodeBest   // follow each hash chain up to LzEncoder::MaxChainLen candidates
+};
+
+/***************************************************************************************************
+** % Class:       LzEncoder
+*  % Description: Encodes a memory span as the LZ tokens expanded by hci.v's MEM_WR_LZ opcode (see
+*                 MemWrLzPacket):
+*
+*                   0LLLLLLL              - literal: the next L + 1 payload bytes
+*                   10LLLLLL DIST         - copy L + 3 bytes from DIST + 1 bytes back
+*                   11LLLLLL DIST_LO/HI   - copy L + 4 bytes from DIST + 1 bytes back
+*
+*                 Copies read back memory the hci has already written, so a span is encoded as a
+*                 series of Encode() calls, one per packet, and later packets may copy from data
+*                 sent by earlier ones.  The span must not contain addresses that alias each other
+*                 (mirrors), or copies would read back the wrong data.
+*
+*                 LzEncodeFast keeps the most recent position of each 3-byte prefix and checks only
+*                 that one, which finds runs (distance 1) and repeated tiles at the cost of one hash
+*                 probe per byte.  LzEncodeBest also keeps chains of earlier positions.
+***************************************************************************************************/
+class LzEncoder
+{
+public:
+    explicit LzEncoder(LzEncodeLevel level = LzEncodeFast);
+    ~LzEncoder();
+
+    VOID Start(const BYTE* pData, UINT numBytes);
+    UINT Encode(BYTE* pTokens, UINT maxTokenBytes);
+
+    UINT GetPosition() const { return m_pos; }
+    BOOL IsDone() const { return m_pos == m_numBytes; }
+
+    static const UINT MaxLiteralLen   = 0x80;     // longest literal token run
+    static const UINT MinShortCopyLen = 3;        // shortest copy with a one byte DIST
+    static const UINT MinLongCopyLen  = 4;        // shortest copy with a two byte DIST
+    static const UINT MaxShortDist    = 0x100;    // farthest copy with a one byte DIST
+    static const UINT MaxLongDist     = 0x10000;  // farthest copy with a two byte DIST
+    static const UINT MinTokenBytes   = 3;        // smallest maxTokenBytes Encode() accepts
+    static const UINT MaxChainLen     = 64;       // LzEncodeBest candidates checked per position
+
+private:
+    LzEncoder& operator=(const LzEncoder&);
+    LzEncoder(const LzEncoder&);
+
+    UINT FindMatch(UINT* pDist) const;
+    VOID Insert(UINT pos);
+    UINT GetHash(UINT pos) const;
+    UINT WriteLiterals(BYTE* pTokens, UINT pos, UINT len) const;
+
+    static UINT GetCopyTokenSize(UINT dist) { return (dist <= MaxShortDist) ? 2 : 3; }
+
+    static const UINT CopyLenMask = 0x3F;            // L field of a copy token
+    static const UINT HashBits    = 12;              // log2 of the hash table size
+    static const UINT HashSize    = 1 << HashBits;   // hash table entries
+    static const UINT WindowSize  = MaxLongDist;     // LzEncodeBest chain entries
+    static const UINT NoPos       = 0xFFFFFFFF;      // empty hash table/chain entry
+
+    LzEncodeLevel m_level;           // match search effort
+    const BYTE*   m_pData;           // span being encoded
+    UINT          m_numBytes;        // size of m_pData, in bytes
+    UINT          m_pos;             // bytes of m_pData encoded so far
+    UINT          m_head[HashSize];  // most recent position of each hash (NoPos if none)
+    UINT*         m_pChain;          // LzEncodeBest: previous position with the same hash, by
+                                     // position % WindowSize
+};
+
+#endif // LZENCODER_H
@@ -26,6 +26,7 @@
 ***************************************************************************************************/
 
 #include "nesdbg.h"
+#include "nesdbgcli.h"
 #include "resource.h"
 
 NesDbg* g_pNesDbg = NULL;
@@ -90,6 +91,24 @@ INT WINAPI WinMain(
     static TCHAR* pWndClassName = _T("nesdbg");
     static TCHAR* pWndTitle     = _T("FPGA NES Debugger");
 
+    // Command lines (e.g., "nesdbg load game.nes --run") run headless, with output going to the
+    // console nesdbg was started from, if any.
+    if (NesDbgCli::IsCliCommand(__argc, __targv))
+    {
+        if (AttachConsole(ATTACH_PARENT_PROCESS))
+        {
+            FILE* pConsole = NULL;
+            _tfreopen_s(&pConsole, _T("CONOUT$"), _T("w"), stdout);
+            _tfreopen_s(&pConsole, _T("CONOUT$"), _T("w"), stderr);
+        }
+
+        NesDbgCli* pCli = new NesDbgCli();
+        ret = pCli->Run(__argc, __targv);
+        delete pCli;
+
+        return ret;
+    }
+
     wcex.cbSize         = sizeof(WNDCLASSEX);
     wcex.style          = CS_HREDRAW | CS_VREDRAW;
     wcex.lpfnWndProc    = WndProc;
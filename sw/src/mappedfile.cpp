@@ -0,0 +1,163 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/mappedfile.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  MappedFile class implementation.
+***************************************************************************************************/
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "mappedfile.h"
+
+/***************************************************************************************************
+** % Method:      MappedFile::MappedFile()
+*  % Description: MappedFile constructor.
+***************************************************************************************************/
+MappedFile::MappedFile()
+    :
+    m_pData(NULL),
+    m_size(0)
+#ifdef _WIN32
+    ,
+    m_hFile(INVALID_HANDLE_VALUE),
+    m_hMapping(NULL)
+#endif
+{
+}
+
+/***************************************************************************************************
+** % Method:      MappedFile::~MappedFile()
+*  % Description: MappedFile destructor.
+***************************************************************************************************/
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+/***************************************************************************************************
+** % Method:      MappedFile::Open()
+*  % Description: Maps the specified file.  An empty file opens successfully, with no data.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL MappedFile::Open(
+    const TCHAR* pFilePath)  // file to map
+{
+    Close();
+
+    BOOL ret = FALSE;
+
+#ifdef _WIN32
+    m_hFile = CreateFile(pFilePath,
+                         GENERIC_READ,
+                         FILE_SHARE_READ,
+                         NULL,
+                         OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL,
+                         NULL);
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        m_size = GetFileSize(m_hFile, NULL);
+        ret    = (m_size != INVALID_FILE_SIZE);
+    }
+
+    if (ret && m_size)
+    {
+        m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        m_pData    = (m_hMapping)
+                   ? static_cast<const BYTE*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0))
+                   : NULL;
+        ret        = (m_pData != NULL);
+    }
+#else
+    const INT fd = open(pFilePath, O_RDONLY);
+
+    struct stat fileStat;
+
+    if ((fd >= 0) && (fstat(fd, &fileStat) == 0))
+    {
+        m_size = static_cast<UINT>(fileStat.st_size);
+        ret    = TRUE;
+    }
+
+    if (ret && m_size)
+    {
+        // The mapping stays valid once the file is closed.
+        VOID* pMapping = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        m_pData = (pMapping != MAP_FAILED) ? static_cast<const BYTE*>(pMapping) : NULL;
+        ret     = (m_pData != NULL);
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+#endif
+
+    if (!ret)
+    {
+        Close();
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      MappedFile::Close()
+*  % Description: Unmaps the file.  Data() is invalid afterwards.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID MappedFile::Close()
+{
+#ifdef _WIN32
+    if (m_pData)
+    {
+        UnmapViewOfFile(m_pData);
+    }
+
+    if (m_hMapping)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_pData)
+    {
+        munmap(const_cast<BYTE*>(m_pData), m_size);
+    }
+#endif
+
+    m_pData = NULL;
+    m_size  = 0;
+}
@@ -1,5 +1,5 @@
 /***************************************************************************************************
-** fpga_nes/sw/src/serialcomm.h
+** fpga_nes/sw/src/mappedfile.h
 *
 *  Copyright (c) 2012, Brian Bennett
 *  All rights reserved.
@@ -22,33 +22,42 @@
 *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
 *  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *
-*  SerialComm class header.
+*  MappedFile class header.
 ***************************************************************************************************/
 
-#ifndef SERIALCOMM_H
-#define SERIALCOMM_H
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "util.h"
 
 /***************************************************************************************************
-** % Class:       SerialComm
-*  % Description: Manages communication with NES FPGA through serial port.
+** % Class:       MappedFile
+*  % Description: Read-only memory mapping of a whole file, so its contents can be used in place
+*                 rather than read into a heap buffer.
 ***************************************************************************************************/
-class SerialComm
+class MappedFile
 {
 public:
-    SerialComm();
-    ~SerialComm();
+    MappedFile();
+    ~MappedFile();
 
-    BOOL Init();
+    BOOL Open(const TCHAR* pFilePath);
+    VOID Close();
 
-    BOOL SendData(const BYTE* pData, UINT numBytes);
-    BOOL ReceiveData(BYTE* pData, UINT numBytes);
+    const BYTE* Data() const { return m_pData; }
+    UINT        Size() const { return m_size; }
 
 private:
-    SerialComm& operator=(const SerialComm&);
-    SerialComm(const SerialComm&);
+    MappedFile& operator=(const MappedFile&);
+    MappedFile(const MappedFile&);
 
-    HANDLE m_hSerialComm;  // win32 handle to debug serial port
-};
+    const BYTE* m_pData;     // mapped file contents, NULL if not open (or empty)
+    UINT        m_size;      // file size, in bytes
 
-#endif // SERIALCOMM_H
+#ifdef _WIN32
+    HANDLE      m_hFile;     // win32 file handle
+    HANDLE      m_hMapping;  // win32 file mapping handle
+#endif
+};
 
+#endif // MAPPEDFILE_H
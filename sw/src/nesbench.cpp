@@ -0,0 +1,721 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/nesbench.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  NesBench class implementation.
+***************************************************************************************************/
+
+#include <time.h>
+
+#include "allocstats.h"
+#include "dbgpacket.h"
+#include "inesrom.h"
+#include "nesbench.h"
+
+const UINT NesBench::PayloadSizes[PayloadSizeCnt] = { 1, 4, 16, 64, 256, 1024 };
+const UINT NesBench::QueueDepths[QueueDepthCnt]   = { 1, 4, 16, 64 };
+
+/***************************************************************************************************
+** % Method:      NesBench::NesBench()
+*  % Description: NesBench constructor.
+***************************************************************************************************/
+NesBench::NesBench()
+    :
+    m_resultCnt(0),
+    m_pSamples(NULL),
+    m_pRomResults(NULL),
+    m_romResultCnt(0),
+    m_fastEncoder(LzEncodeFast),
+    m_bestEncoder(LzEncodeBest)
+{
+    m_portName[0] = 0;
+
+    for (UINT i = 0; i < MaxPayloadSize; i++)
+    {
+        m_payload[i] = static_cast<BYTE>(i * 7 + 1);
+    }
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::~NesBench()
+*  % Description: NesBench destructor.
+***************************************************************************************************/
+NesBench::~NesBench()
+{
+    delete [] m_pSamples;
+    delete [] m_pRomResults;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::Init()
+*  % Description: Connects to the NES FPGA (see SerialComm::Init()) and halts the CPU, so the
+*                 memory packets can be timed.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL NesBench::Init(
+    const TCHAR* pPortName,    // serial port to open, NULL to search for the NES FPGA
+    UINT         maxBaudRate,  // fastest baud rate to negotiate
+    BOOL         framed)       // TRUE to measure the link in framed mode
+{
+    if (pPortName)
+    {
+        _tcscpy_s(&m_portName[0], Transport::MaxPortNameLen, pPortName);
+    }
+
+    BOOL ret = m_serialComm.Init(pPortName, maxBaudRate, framed);
+
+    if (ret)
+    {
+        DbgHltPacket dbgHltPacket;
+
+        ret = m_serialComm.SubmitPacket(dbgHltPacket) && m_serialComm.Drain();
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::Run()
+*  % Description: Times every packet type at every payload size and queue depth.  Progress is
+*                 printed to stdout.  Stops at the first point where the link fails.
+*  % Returns:     TRUE if every request completed successfully, FALSE otherwise.
+***************************************************************************************************/
+BOOL NesBench::Run(
+    UINT requestCnt)  // requests to time for each point, AutoRequestCnt to pick per point
+{
+    BOOL ret = TRUE;
+
+    delete [] m_pSamples;
+    m_pSamples  = new Sample[(requestCnt > MaxRequests) ? requestCnt : MaxRequests];
+    m_resultCnt = 0;
+
+    _tprintf(_T("%u baud, %s\n"),
+             m_serialComm.GetBaudRate(),
+             (m_serialComm.IsFramedMode()) ? _T("framed") : _T("unframed"));
+
+    for (UINT op = 0; ret && (op < BenchOpCnt); op++)
+    {
+        for (UINT sizeIdx = 0; ret && (sizeIdx < PayloadSizeCnt); sizeIdx++)
+        {
+            for (UINT depthIdx = 0; ret && (depthIdx < QueueDepthCnt); depthIdx++)
+            {
+                const UINT payloadBytes = PayloadSizes[sizeIdx];
+                const UINT pointRequestCnt = (requestCnt == AutoRequestCnt) ?
+                                             GetAutoRequestCnt(payloadBytes) : requestCnt;
+
+                ret = RunPoint(static_cast<BenchOp>(op),
+                               payloadBytes,
+                               QueueDepths[depthIdx],
+                               pointRequestCnt);
+
+                const Result& result = m_results[m_resultCnt - 1];
+
+                _tprintf(_T("%-10s %5u B  depth %2u  %10.0f B/s  %5.1f%%  ")
+                         _T("p50 %7u us  p99 %7u us  p999 %7u us  allocs %u\n"),
+                         GetOpName(result.op),
+                         result.payloadBytes,
+                         result.queueDepth,
+                         result.bytesPerSec,
+                         result.efficiency * 100.0f,
+                         result.p50Us,
+                         result.p99Us,
+                         result.p999Us,
+                         result.allocCnt);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::RunRoms()
+*  % Description: Measures the transfer of the PRG and CHR ROM of each ROM image, plain and
+*                 compressed.  Progress and per-corpus totals are printed to stdout.  Images that
+*                 can't be parsed are reported and skipped.
+*  % Returns:     TRUE if every image was measured and read back correctly, FALSE otherwise.
+***************************************************************************************************/
+BOOL NesBench::RunRoms(
+    const TCHAR* const* ppRomPaths,  // ROM images to measure
+    UINT                romCnt)      // number of entries in ppRomPaths
+{
+    BOOL ret     = TRUE;
+    BOOL allRoms = TRUE;  // every image could be parsed
+
+    delete [] m_pRomResults;
+    m_pRomResults  = new RomResult[romCnt * 2];
+    m_romResultCnt = 0;
+
+    _tprintf(_T("%u baud, %s\n"),
+             m_serialComm.GetBaudRate(),
+             (m_serialComm.IsFramedMode()) ? _T("framed") : _T("unframed"));
+
+    for (UINT romIdx = 0; ret && (romIdx < romCnt); romIdx++)
+    {
+        const TCHAR* pRomPath = ppRomPaths[romIdx];
+
+        INesRom rom;
+
+        if (rom.Open(pRomPath) != INES_RESULT_SUCCESS)
+        {
+            _ftprintf(stderr, _T("Error parsing \"%s\", skipped.\n"), pRomPath);
+            allRoms = FALSE;
+        }
+        else
+        {
+            if (rom.PrgRomSize())
+            {
+                ret = RunRomRegion(pRomPath, MemSpaceCpu, rom.PrgRomData(), rom.PrgRomSize());
+            }
+
+            if (ret && rom.ChrRomSize())
+            {
+                ret = RunRomRegion(pRomPath, MemSpacePpu, rom.ChrRomData(), rom.ChrRomSize());
+            }
+        }
+    }
+
+    // Corpus totals.
+    RomResult total;
+    memset(&total, 0, sizeof(total));
+
+    total.pRomPath = _T("corpus");
+    total.verified = TRUE;
+
+    for (UINT i = 0; i < m_romResultCnt; i++)
+    {
+        const RomResult& result = m_pRomResults[i];
+
+        total.rawBytes      += result.rawBytes;
+        total.rawWireBytes  += result.rawWireBytes;
+        total.fastWireBytes += result.fastWireBytes;
+        total.bestWireBytes += result.bestWireBytes;
+        total.fastEncodeUs  += result.fastEncodeUs;
+        total.bestEncodeUs  += result.bestEncodeUs;
+        total.rawWriteUs    += result.rawWriteUs;
+        total.lzWriteUs     += result.lzWriteUs;
+        total.verified       = total.verified && result.verified;
+    }
+
+    PrintRomResult(total, _T("total"));
+
+    return ret && allRoms && total.verified;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::WriteJson()
+*  % Description: Saves the results of the last Run() as JSON, so they can be compared across host
+*                 software and bitstream versions.
+*  % Returns:     TRUE on success, FALSE if the file could not be written.
+***************************************************************************************************/
+BOOL NesBench::WriteJson(
+    const TCHAR* pFileName,  // file to create
+    const TCHAR* pLabel)     // free-form description of the setup (e.g., bitstream version)
+    const
+{
+    FILE* pFile = _tfopen(pFileName, _T("w"));
+
+    BOOL ret = (pFile != NULL);
+
+    if (ret)
+    {
+        const UINT baudRate = m_serialComm.GetBaudRate();
+
+        _ftprintf(pFile, _T("{\n"));
+        _ftprintf(pFile, _T("  \"label\": "));
+        WriteJsonString(pFile, pLabel);
+        _ftprintf(pFile, _T(",\n  \"hostBuild\": "));
+        WriteJsonString(pFile, _T(__DATE__) _T(" ") _T(__TIME__));
+        _ftprintf(pFile, _T(",\n  \"port\": "));
+        WriteJsonString(pFile, &m_portName[0]);
+        _ftprintf(pFile, _T(",\n  \"timestamp\": %lu,\n"), static_cast<unsigned long>(time(NULL)));
+        _ftprintf(pFile, _T("  \"baudRate\": %u,\n"), baudRate);
+        _ftprintf(pFile, _T("  \"framed\": %s,\n"),
+                  (m_serialComm.IsFramedMode()) ? _T("true") : _T("false"));
+        _ftprintf(pFile, _T("  \"lineBytesPerSec\": %u,\n"), baudRate / BitsPerByte);
+        _ftprintf(pFile, _T("  \"results\": ["));
+
+        for (UINT i = 0; i < m_resultCnt; i++)
+        {
+            const Result& result = m_results[i];
+
+            _ftprintf(pFile, _T("%s\n    {"), (i) ? _T(",") : _T(""));
+            _ftprintf(pFile, _T("\"op\": \"%s\", "), GetOpName(result.op));
+            _ftprintf(pFile, _T("\"payloadBytes\": %u, "), result.payloadBytes);
+            _ftprintf(pFile, _T("\"queueDepth\": %u, "), result.queueDepth);
+            _ftprintf(pFile, _T("\"requests\": %u, "), result.requestCnt);
+            _ftprintf(pFile, _T("\"failures\": %u, "), result.failCnt);
+            _ftprintf(pFile, _T("\"retries\": %u, "), result.retryCnt);
+            _ftprintf(pFile, _T("\"allocations\": %u, "), result.allocCnt);
+            _ftprintf(pFile, _T("\"elapsedUs\": %u, "), result.elapsedUs);
+            _ftprintf(pFile, _T("\"bytesPerSec\": %.0f, "), result.bytesPerSec);
+            _ftprintf(pFile, _T("\"efficiency\": %.4f, "), result.efficiency);
+            _ftprintf(pFile,
+                      _T("\"latencyUs\": { \"p50\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u }}"),
+                      result.p50Us,
+                      result.p99Us,
+                      result.p999Us,
+                      result.maxUs);
+        }
+
+        _ftprintf(pFile, _T("\n  ],\n  \"roms\": ["));
+
+        for (UINT i = 0; i < m_romResultCnt; i++)
+        {
+            const RomResult& result = m_pRomResults[i];
+
+            _ftprintf(pFile, _T("%s\n    {\"rom\": "), (i) ? _T(",") : _T(""));
+            WriteJsonString(pFile, result.pRomPath);
+            _ftprintf(pFile, _T(", \"region\": \"%s\", "),
+                      (result.space == MemSpaceCpu) ? _T("prg") : _T("chr"));
+            _ftprintf(pFile, _T("\"rawBytes\": %u, "), result.rawBytes);
+            _ftprintf(pFile, _T("\"rawWireBytes\": %u, "), result.rawWireBytes);
+            _ftprintf(pFile, _T("\"fastWireBytes\": %u, "), result.fastWireBytes);
+            _ftprintf(pFile, _T("\"bestWireBytes\": %u, "), result.bestWireBytes);
+            _ftprintf(pFile, _T("\"fastEncodeUs\": %u, "), result.fastEncodeUs);
+            _ftprintf(pFile, _T("\"bestEncodeUs\": %u, "), result.bestEncodeUs);
+            _ftprintf(pFile, _T("\"rawWriteUs\": %u, "), result.rawWriteUs);
+            _ftprintf(pFile, _T("\"lzWriteUs\": %u, "), result.lzWriteUs);
+            _ftprintf(pFile, _T("\"verified\": %s}"),
+                      (result.verified) ? _T("true") : _T("false"));
+        }
+
+        _ftprintf(pFile, _T("\n  ]\n}\n"));
+
+        ret = (ferror(pFile) == 0);
+        ret = (fclose(pFile) == 0) && ret;
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::RunPoint()
+*  % Description: Times requestCnt packets of one type and payload size, keeping up to queueDepth
+*                 of them outstanding, and appends the measurements to m_results.  Echo payloads
+*                 are counted once, since each direction of the link carries a copy.  Write packets
+*                 have no response, so their latency only covers transmission.
+*  % Returns:     TRUE if every request completed successfully, FALSE otherwise.
+***************************************************************************************************/
+BOOL NesBench::RunPoint(
+    BenchOp op,            // packet type
+    UINT    payloadBytes,  // data bytes carried by each packet
+    UINT    queueDepth,    // requests allowed outstanding
+    UINT    requestCnt)    // requests to time
+{
+    assert(payloadBytes <= MaxPayloadSize);
+    assert(m_resultCnt < MaxResults);
+
+    const USHORT addr = 0x0000;
+
+    DbgPacket* pPacket = NULL;
+
+    switch (op)
+    {
+        case BenchOpEcho:
+            pPacket = new EchoPacket(&m_payload[0], payloadBytes);
+            break;
+        case BenchOpCpuMemRd:
+            pPacket = new CpuMemRdPacket(addr, payloadBytes);
+            break;
+        case BenchOpCpuMemWr:
+        default:
+            pPacket = new CpuMemWrPacket(addr, payloadBytes, &m_payload[0]);
+            break;
+    }
+
+    BYTE* pRspData = (pPacket->ReturnBytesExpected()) ? &m_rspData[0] : NULL;
+
+    SerialCommRxStats startStats;
+    m_serialComm.GetRxStats(&startStats);
+
+    BOOL ret          = TRUE;
+    UINT submittedCnt = 0;
+
+    const LONG  startAllocCnt = GetAllocCnt();
+    const DWORD startUs       = GetTimeUs();
+
+    while (ret && (submittedCnt < requestCnt))
+    {
+        ret = m_serialComm.Drain(queueDepth - 1);
+
+        if (ret)
+        {
+            Sample& sample = m_pSamples[submittedCnt++];
+
+            sample.success   = FALSE;
+            sample.latencyUs = 0;
+            sample.submitUs  = GetTimeUs();
+
+            ret = m_serialComm.SubmitPacket(*pPacket, pRspData, CompletionProc, &sample);
+
+            m_serialComm.Flush();
+        }
+    }
+
+    ret = m_serialComm.Drain() && ret;
+
+    const DWORD endUs       = GetTimeUs();
+    const LONG  endAllocCnt = GetAllocCnt();
+
+    Result& result = m_results[m_resultCnt++];
+
+    result.op           = op;
+    result.payloadBytes = payloadBytes;
+    result.queueDepth   = queueDepth;
+    result.requestCnt   = requestCnt;
+    result.elapsedUs    = endUs - startUs;
+    result.allocCnt     = endAllocCnt - startAllocCnt;
+
+    SerialCommRxStats endStats;
+    m_serialComm.GetRxStats(&endStats);
+
+    result.retryCnt = endStats.retryCnt - startStats.retryCnt;
+
+    // Gather the latencies of the requests that made it.
+    DWORD* pLatencyUs = new DWORD[requestCnt];
+    UINT   successCnt = 0;
+
+    for (UINT i = 0; i < submittedCnt; i++)
+    {
+        if (m_pSamples[i].success)
+        {
+            pLatencyUs[successCnt++] = m_pSamples[i].latencyUs;
+        }
+    }
+
+    qsort(pLatencyUs, successCnt, sizeof(DWORD), CompareLatency);
+
+    result.failCnt = requestCnt - successCnt;
+    result.p50Us   = GetPercentile(pLatencyUs, successCnt, 500);
+    result.p99Us   = GetPercentile(pLatencyUs, successCnt, 990);
+    result.p999Us  = GetPercentile(pLatencyUs, successCnt, 999);
+    result.maxUs   = (successCnt) ? pLatencyUs[successCnt - 1] : 0;
+
+    const FLOAT elapsedSec      = (result.elapsedUs) ? (result.elapsedUs / 1000000.0f) : 1.0f;
+    const FLOAT lineBytesPerSec = static_cast<FLOAT>(m_serialComm.GetBaudRate()) / BitsPerByte;
+
+    result.bytesPerSec = (static_cast<FLOAT>(successCnt) * payloadBytes) / elapsedSec;
+    result.efficiency  = result.bytesPerSec / lineBytesPerSec;
+
+    delete [] pLatencyUs;
+    delete pPacket;
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::GetAutoRequestCnt()
+*  % Description: Picks how many requests to time for a payload size: enough to keep the link
+*                 busy for about TargetLineMs, within [MinRequests, MaxRequests].
+*  % Returns:     Number of requests.
+***************************************************************************************************/
+UINT NesBench::GetAutoRequestCnt(
+    UINT payloadBytes)  // data bytes carried by each packet
+    const
+{
+    const UINT lineBytes = (m_serialComm.GetBaudRate() / BitsPerByte) * TargetLineMs / 1000;
+
+    UINT requestCnt = lineBytes / payloadBytes;
+
+    if (requestCnt < MinRequests)
+    {
+        requestCnt = MinRequests;
+    }
+    else if (requestCnt > MaxRequests)
+    {
+        requestCnt = MaxRequests;
+    }
+
+    return requestCnt;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::RunRomRegion()
+*  % Description: Measures one ROM region, in spans the size of its address window (larger ROMs are
+*                 banked, so each span is written over the last), and appends the measurements to
+*                 m_pRomResults.
+*  % Returns:     TRUE if the link worked throughout, FALSE otherwise.
+***************************************************************************************************/
+BOOL NesBench::RunRomRegion(
+    const TCHAR* pRomPath,  // ROM image
+    MemSpace     space,     // MemSpaceCpu for PRG ROM, MemSpacePpu for CHR ROM
+    const BYTE*  pData,     // region data
+    UINT         numBytes)  // size of pData, in bytes
+{
+    const UINT window = (space == MemSpaceCpu) ? PrgRomWindow : ChrRomWindow;
+
+    RomResult& result = m_pRomResults[m_romResultCnt++];
+    memset(&result, 0, sizeof(result));
+
+    result.pRomPath = pRomPath;
+    result.space    = space;
+    result.rawBytes = numBytes;
+    result.verified = TRUE;
+
+    BOOL ret = TRUE;
+
+    for (UINT offset = 0; ret && (offset < numBytes); offset += window)
+    {
+        const BYTE* pSpan     = &pData[offset];
+        const UINT  spanBytes = (numBytes - offset < window) ? numBytes - offset : window;
+
+        DWORD startUs = GetTimeUs();
+        result.fastWireBytes += GetLzWireBytes(&m_fastEncoder, pSpan, spanBytes);
+        result.fastEncodeUs  += GetTimeUs() - startUs;
+
+        startUs = GetTimeUs();
+        result.bestWireBytes += GetLzWireBytes(&m_bestEncoder, pSpan, spanBytes);
+        result.bestEncodeUs  += GetTimeUs() - startUs;
+
+        result.rawWireBytes += GetRawWireBytes(spanBytes);
+
+        ret = WriteRomSpan(space, pSpan, spanBytes, FALSE, &result.rawWriteUs, &result.verified) &&
+              WriteRomSpan(space, pSpan, spanBytes, TRUE, &result.lzWriteUs, &result.verified);
+    }
+
+    PrintRomResult(result, (space == MemSpaceCpu) ? _T("PRG") : _T("CHR"));
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::WriteRomSpan()
+*  % Description: Writes one span of a ROM region to the start of its address window, timing the
+*                 write, then checks it with a MEM_CRC.  The write is timed until it has drained,
+*                 so the time includes the hci's processing of the last packet.
+*  % Returns:     TRUE if the link worked, FALSE otherwise.
+***************************************************************************************************/
+BOOL NesBench::WriteRomSpan(
+    MemSpace    space,       // address space
+    const BYTE* pData,       // span data
+    UINT        numBytes,    // size of pData, at most the window size
+    BOOL        compressed,  // TRUE to use StreamWriteCompressed(), FALSE for StreamWrite()
+    DWORD*      pElapsedUs,  // write time is added to this
+    BOOL*       pVerified)   // cleared if the span reads back with the wrong CRC
+{
+    const USHORT addr = (space == MemSpaceCpu) ? 0x8000 : 0x0000;
+
+    const DWORD startUs = GetTimeUs();
+
+    BOOL ret = (compressed) ? m_serialComm.StreamWriteCompressed(space, addr, pData, numBytes)
+                            : m_serialComm.StreamWrite(space, addr, pData, numBytes);
+
+    ret = m_serialComm.Drain() && ret;
+
+    *pElapsedUs += GetTimeUs() - startUs;
+
+    if (ret)
+    {
+        MemCrcPacket memCrcPacket(space, addr, static_cast<USHORT>(numBytes));
+        BYTE         rsp[MemCrcPacket::RspSize];
+
+        ret = m_serialComm.SubmitPacket(memCrcPacket, &rsp[0]) && m_serialComm.Drain();
+
+        if (!ret || !MemCrcPacket::RspMatches(&rsp[0], pData, numBytes))
+        {
+            *pVerified = FALSE;
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::GetLzWireBytes()
+*  % Description: Encodes a span into packets of RomPacketSize bytes the way StreamWriteCompressed()
+*                 does, sending a packet plain whenever compression would not make it smaller.
+*  % Returns:     Bytes the span takes on the wire, headers included.
+***************************************************************************************************/
+UINT NesBench::GetLzWireBytes(
+    LzEncoder*  pEncoder,  // encoder to use
+    const BYTE* pData,     // span data
+    UINT        numBytes)  // size of pData, in bytes
+{
+    const UINT rawHeaderSize = DbgOpSchema<DbgPacketOpCodeCpuMemWr>::HeaderSize;
+    const UINT lzHeaderSize  = DbgOpSchema<DbgPacketOpCodeMemWrLz>::HeaderSize;
+
+    UINT wireBytes = 0;
+
+    pEncoder->Start(pData, numBytes);
+
+    while (!pEncoder->IsDone())
+    {
+        const UINT offset     = pEncoder->GetPosition();
+        const UINT tokenBytes = pEncoder->Encode(&m_lzTokens[0], RomPacketSize - lzHeaderSize);
+        const UINT chunkBytes = pEncoder->GetPosition() - offset;
+
+        wireBytes += (tokenBytes + lzHeaderSize < chunkBytes + rawHeaderSize)
+                     ? tokenBytes + lzHeaderSize
+                     : chunkBytes + rawHeaderSize;
+    }
+
+    return wireBytes;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::PrintRomResult()
+*  % Description: Prints the measurements for one ROM region to stdout.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID NesBench::PrintRomResult(
+    const RomResult& result,   // measurements to print
+    const TCHAR*     pRegion)  // region name
+    const
+{
+    const FLOAT rawWireBytes = (result.rawWireBytes) ? static_cast<FLOAT>(result.rawWireBytes)
+                                                     : 1.0f;
+
+    _tprintf(_T("%s %s\n")
+             _T("    %7u B  wire: raw %7u  fast %7u (%5.1f%%)  best %7u (%5.1f%%)  ")
+             _T("encode: fast %6u us  best %7u us\n")
+             _T("    link: raw %8u us  lz %8u us  %s\n"),
+             result.pRomPath,
+             pRegion,
+             result.rawBytes,
+             result.rawWireBytes,
+             result.fastWireBytes,
+             result.fastWireBytes * 100.0f / rawWireBytes,
+             result.bestWireBytes,
+             result.bestWireBytes * 100.0f / rawWireBytes,
+             result.fastEncodeUs,
+             result.bestEncodeUs,
+             result.rawWriteUs,
+             result.lzWriteUs,
+             (result.verified) ? _T("verified") : _T("MISMATCH"));
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::GetRawWireBytes()
+*  % Description: Works out how many bytes a span takes on the wire as plain write packets of
+*                 RomPacketSize bytes.
+*  % Returns:     Bytes on the wire, headers included.
+***************************************************************************************************/
+UINT NesBench::GetRawWireBytes(
+    UINT numBytes)  // size of the span
+{
+    const UINT headerSize = DbgOpSchema<DbgPacketOpCodeCpuMemWr>::HeaderSize;
+    const UINT chunkSize  = RomPacketSize - headerSize;
+
+    return numBytes + ((numBytes + chunkSize - 1) / chunkSize) * headerSize;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::CompletionProc()
+*  % Description: Request completion callback.  Records the request's round-trip time.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID NesBench::CompletionProc(
+    VOID* pContext,  // Sample for the request
+    BOOL  success)   // TRUE if the response arrived
+{
+    Sample* pSample = static_cast<Sample*>(pContext);
+
+    pSample->latencyUs = GetTimeUs() - pSample->submitUs;
+    pSample->success   = success;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::GetPercentile()
+*  % Description: Finds a percentile of a sorted set of latencies, by the nearest-rank method.
+*  % Returns:     The percentile, or 0 if the set is empty.
+***************************************************************************************************/
+DWORD NesBench::GetPercentile(
+    const DWORD* pSortedUs,  // latencies, in ascending order
+    UINT         cnt,        // number of latencies
+    UINT         perMille)   // percentile to find, in tenths of a percent
+{
+    DWORD ret = 0;
+
+    if (cnt)
+    {
+        UINT rank = (cnt * perMille + 999) / 1000;
+
+        ret = pSortedUs[(rank) ? (rank - 1) : 0];
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::CompareLatency()
+*  % Description: qsort() comparison function for latencies.
+*  % Returns:     <0, 0 or >0 as *pLhs is less than, equal to or greater than *pRhs.
+***************************************************************************************************/
+INT NesBench::CompareLatency(
+    const VOID* pLhs,  // first latency
+    const VOID* pRhs)  // second latency
+{
+    const DWORD lhs = *static_cast<const DWORD*>(pLhs);
+    const DWORD rhs = *static_cast<const DWORD*>(pRhs);
+
+    return (lhs < rhs) ? -1 : ((lhs > rhs) ? 1 : 0);
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::GetOpName()
+*  % Description: Names a packet type, for reports.
+*  % Returns:     Packet type name.
+***************************************************************************************************/
+const TCHAR* NesBench::GetOpName(
+    BenchOp op)  // packet type
+{
+    static const TCHAR* pOpNames[BenchOpCnt] =
+    {
+        _T("echo"),
+        _T("cpu_mem_rd"),
+        _T("cpu_mem_wr")
+    };
+
+    return pOpNames[op];
+}
+
+/***************************************************************************************************
+** % Method:      NesBench::WriteJsonString()
+*  % Description: Writes a string as a quoted JSON string.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID NesBench::WriteJsonString(
+    FILE*        pFile,    // file to write to
+    const TCHAR* pString)  // string to write
+{
+    _fputts(_T("\""), pFile);
+
+    for (const TCHAR* pChar = pString; *pChar; pChar++)
+    {
+        if ((*pChar == _T('"')) || (*pChar == _T('\\')))
+        {
+            _ftprintf(pFile, _T("\\%c"), *pChar);
+        }
+        else if (static_cast<UINT>(*pChar) < 0x20)
+        {
+            _ftprintf(pFile, _T("\\u%04x"), static_cast<UINT>(*pChar));
+        }
+        else
+        {
+            _ftprintf(pFile, _T("%c"), *pChar);
+        }
+    }
+
+    _fputts(_T("\""), pFile);
+}
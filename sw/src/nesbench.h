@@ -0,0 +1,172 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/nesbench.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  NesBench class header.
+***************************************************************************************************/
+
+#ifndef NESBENCH_H
+#define NESBENCH_H
+
+#include "serialcomm.h"
+#include "transport.h"
+
+/***************************************************************************************************
+** % Class:       NesBench
+*  % Description: Measures what the debug link delivers.  Echo, CPU memory read and CPU memory
+*                 write packets are timed over a sweep of payload sizes and queue depths (the
+*                 number of requests SerialComm is allowed to have outstanding), against real
+*                 hardware or the HCI simulator.  Each point records payload throughput, round-trip
+*                 latency percentiles and efficiency: throughput as a fraction of the line rate of
+*                 one direction of the UART, baudRate / 11 bytes per second.  Heap allocations
+*                 made while timing each point are counted too (see GetAllocCnt()), since the
+*                 packet path is meant to make none once it has warmed up.
+*
+*                 RunRoms() measures ROM transfers instead: for the PRG and CHR ROM of each image,
+*                 the bytes on the wire sent plain and as LzEncodeFast/LzEncodeBest packets, the
+*                 encode times, and the time to write the ROM with StreamWrite() and with
+*                 StreamWriteCompressed(), each checked with a MEM_CRC.
+*
+*                 The CPU is halted for the run, and CPU memory from address 0 (or the cartridge,
+*                 for RunRoms()) is overwritten.
+***************************************************************************************************/
+class NesBench
+{
+public:
+    NesBench();
+    ~NesBench();
+
+    BOOL Init(const TCHAR* pPortName, UINT maxBaudRate, BOOL framed);
+    BOOL Run(UINT requestCnt);
+    BOOL RunRoms(const TCHAR* const* ppRomPaths, UINT romCnt);
+    BOOL WriteJson(const TCHAR* pFileName, const TCHAR* pLabel) const;
+
+    static const UINT AutoRequestCnt = 0;  // Run() picks a request count for each point
+
+private:
+    NesBench& operator=(const NesBench&);
+    NesBench(const NesBench&);
+
+    // Packet types exercised by the benchmark.
+    enum BenchOp
+    {
+        BenchOpEcho,
+        BenchOpCpuMemRd,
+        BenchOpCpuMemWr,
+        BenchOpCnt
+    };
+
+    // Timing of one request, filled in by CompletionProc().
+    struct Sample
+    {
+        DWORD submitUs;   // GetTimeUs() when the request was submitted
+        DWORD latencyUs;  // time from submission to completion
+        BOOL  success;    // TRUE if the request completed successfully
+    };
+
+    // Measurements for one point of the sweep.
+    struct Result
+    {
+        BenchOp op;            // packet type
+        UINT    payloadBytes;  // data bytes carried by each packet
+        UINT    queueDepth;    // requests allowed outstanding
+        UINT    requestCnt;    // requests timed
+        UINT    failCnt;       // requests that failed
+        UINT    retryCnt;      // framed mode retransmissions during the point
+        UINT    allocCnt;      // heap allocations made while timing the point
+        DWORD   elapsedUs;     // time from first submission to last completion
+        FLOAT   bytesPerSec;   // payload throughput
+        FLOAT   efficiency;    // bytesPerSec / line rate
+        DWORD   p50Us;         // median round-trip latency
+        DWORD   p99Us;         // 99th percentile round-trip latency
+        DWORD   p999Us;        // 99.9th percentile round-trip latency
+        DWORD   maxUs;         // worst round-trip latency
+    };
+
+    // Measurements for one ROM region, PRG ROM or CHR ROM.
+    struct RomResult
+    {
+        const TCHAR* pRomPath;       // ROM image (the caller's string)
+        MemSpace     space;          // MemSpaceCpu for PRG ROM, MemSpacePpu for CHR ROM
+        UINT         rawBytes;       // size of the region
+        UINT         rawWireBytes;   // bytes on the wire as plain write packets
+        UINT         fastWireBytes;  // bytes on the wire as LzEncodeFast packets
+        UINT         bestWireBytes;  // bytes on the wire as LzEncodeBest packets
+        DWORD        fastEncodeUs;   // time LzEncodeFast took to encode the region
+        DWORD        bestEncodeUs;   // time LzEncodeBest took to encode the region
+        DWORD        rawWriteUs;     // time to write the region with StreamWrite()
+        DWORD        lzWriteUs;      // time to write the region with StreamWriteCompressed()
+        BOOL         verified;       // both writes read back with the right CRC
+    };
+
+    BOOL RunPoint(BenchOp op, UINT payloadBytes, UINT queueDepth, UINT requestCnt);
+    UINT GetAutoRequestCnt(UINT payloadBytes) const;
+    BOOL RunRomRegion(const TCHAR* pRomPath, MemSpace space, const BYTE* pData, UINT numBytes);
+    BOOL WriteRomSpan(MemSpace    space,
+                      const BYTE* pData,
+                      UINT        numBytes,
+                      BOOL        compressed,
+                      DWORD*      pElapsedUs,
+                      BOOL*       pVerified);
+    UINT GetLzWireBytes(LzEncoder* pEncoder, const BYTE* pData, UINT numBytes);
+    VOID PrintRomResult(const RomResult& result, const TCHAR* pRegion) const;
+
+    static UINT         GetRawWireBytes(UINT numBytes);
+
+    static VOID         CompletionProc(VOID* pContext, BOOL success);
+    static DWORD        GetPercentile(const DWORD* pSortedUs, UINT cnt, UINT perMille);
+    static INT          CompareLatency(const VOID* pLhs, const VOID* pRhs);
+    static const TCHAR* GetOpName(BenchOp op);
+    static VOID         WriteJsonString(FILE* pFile, const TCHAR* pString);
+
+    static const UINT PayloadSizeCnt = 6;  // entries in PayloadSizes
+    static const UINT QueueDepthCnt  = 4;  // entries in QueueDepths
+    static const UINT MaxResults     = BenchOpCnt * PayloadSizeCnt * QueueDepthCnt;
+    static const UINT MinRequests    = 100;   // fewest requests timed for one point
+    static const UINT MaxRequests    = 2000;  // most requests timed for one point
+    static const UINT TargetLineMs   = 1000;  // line time Run() aims to spend on each point
+    static const UINT BitsPerByte    = 11;    // uart bits per byte: start, 8 data, parity, stop
+    static const UINT MaxPayloadSize = 1024;  // largest entry in PayloadSizes
+
+    static const UINT RomPacketSize  = 0x400;   // packet size for wire byte counts (a 1KB RX fifo)
+    static const UINT PrgRomWindow   = 0x8000;  // PRG ROM is written to CPU 0x8000-0xFFFF
+    static const UINT ChrRomWindow   = 0x2000;  // CHR ROM is written to PPU 0x0000-0x1FFF
+
+    static const UINT PayloadSizes[PayloadSizeCnt];
+    static const UINT QueueDepths[QueueDepthCnt];
+
+    SerialComm m_serialComm;                         // link to the NES FPGA
+    TCHAR      m_portName[Transport::MaxPortNameLen];  // port passed to Init() ("" if searched for)
+    Result     m_results[MaxResults];                // measurements taken by Run()
+    UINT       m_resultCnt;                          // valid entries in m_results
+    Sample*    m_pSamples;                           // per-request timings for the current point
+    BYTE       m_payload[MaxPayloadSize];            // data sent by echo and write packets
+    BYTE       m_rspData[MaxPayloadSize];            // response buffer (contents ignored)
+    RomResult* m_pRomResults;                        // measurements taken by RunRoms()
+    UINT       m_romResultCnt;                       // valid entries in m_pRomResults
+    LzEncoder  m_fastEncoder;                        // LzEncodeFast encoder for RunRoms()
+    LzEncoder  m_bestEncoder;                        // LzEncodeBest encoder for RunRoms()
+    BYTE       m_lzTokens[RomPacketSize];            // tokens of one packet, for GetLzWireBytes()
+};
+
+#endif // NESBENCH_H
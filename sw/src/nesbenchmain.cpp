@@ -0,0 +1,139 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/nesbenchmain.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  nesbench program entry point.  Measures the debug link and saves the results as JSON:
+*
+*        nesbench [-p port] [-b maxBaudRate] [-f] [-n requestsPerPoint] [-l label]
+*                 [-o results.json] [rom.nes ...]
+*
+*  Given ROM images (e.g., those in sw/roms/game_roms/supported), it measures plain and compressed
+*  ROM transfers instead of sweeping packet sizes.
+***************************************************************************************************/
+
+#include "nesbench.h"
+
+/***************************************************************************************************
+** % Function:    PrintUsage()
+*  % Description: Prints command line help.
+***************************************************************************************************/
+static VOID PrintUsage()
+{
+    _tprintf(_T("usage: nesbench [-p port] [-b maxBaudRate] [-f] [-n requestsPerPoint] ")
+             _T("[-l label] [-o results.json] [rom.nes ...]\n")
+             _T("  -p  serial port, or \"sim\" for the HCI simulator (default: search)\n")
+             _T("  -b  fastest baud rate to negotiate (default: 3000000)\n")
+             _T("  -f  measure the link in framed mode\n")
+             _T("  -n  requests timed per point (default: about 1s of line time)\n")
+             _T("  -l  label stored with the results, e.g. the bitstream version\n")
+             _T("  -o  JSON results file (default: nesbench.json)\n")
+             _T("  rom.nes  measure plain and compressed transfers of these ROM images instead\n"));
+}
+
+/***************************************************************************************************
+** % Function:    _tmain()
+*  % Description: Program entry-point.
+***************************************************************************************************/
+INT _tmain(
+    INT    argc,    // number of command line arguments
+    TCHAR* argv[])  // command line arguments
+{
+    const TCHAR* pPortName   = NULL;
+    const TCHAR* pLabel      = _T("");
+    const TCHAR* pFileName   = _T("nesbench.json");
+    UINT         maxBaudRate = SerialComm::DefaultMaxBaudRate;
+    UINT         requestCnt  = NesBench::AutoRequestCnt;
+    BOOL         framed      = FALSE;
+
+    BOOL ret = TRUE;
+    INT  i   = 1;
+
+    // Options come first; the remaining arguments are ROM images.
+    for (; ret && (i < argc) && (argv[i][0] == _T('-')); i += 2)
+    {
+        // Every option but -f takes a value.
+        const TCHAR* pValue = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (_tcscmp(argv[i], _T("-f")) == 0)
+        {
+            framed = TRUE;
+            i--;
+        }
+        else if (!pValue)
+        {
+            ret = FALSE;
+        }
+        else if (_tcscmp(argv[i], _T("-p")) == 0)
+        {
+            pPortName = pValue;
+        }
+        else if (_tcscmp(argv[i], _T("-b")) == 0)
+        {
+            maxBaudRate = _tcstoul(pValue, NULL, 0);
+        }
+        else if (_tcscmp(argv[i], _T("-n")) == 0)
+        {
+            requestCnt = _tcstoul(pValue, NULL, 0);
+        }
+        else if (_tcscmp(argv[i], _T("-l")) == 0)
+        {
+            pLabel = pValue;
+        }
+        else if (_tcscmp(argv[i], _T("-o")) == 0)
+        {
+            pFileName = pValue;
+        }
+        else
+        {
+            ret = FALSE;
+        }
+    }
+
+    if (!ret)
+    {
+        PrintUsage();
+    }
+    else
+    {
+        NesBench* pNesBench = new NesBench();
+
+        ret = pNesBench->Init(pPortName, maxBaudRate, framed);
+
+        if (ret)
+        {
+            // Save whatever was measured, even if the link failed part way through.
+            ret = (i < argc) ? pNesBench->RunRoms(&argv[i], argc - i)
+                             : pNesBench->Run(requestCnt);
+
+            if (!pNesBench->WriteJson(pFileName, pLabel))
+            {
+                _ftprintf(stderr, _T("Error writing \"%s\".\n"), pFileName);
+                ret = FALSE;
+            }
+        }
+
+        delete pNesBench;
+    }
+
+    return (ret) ? 0 : 1;
+}
@@ -28,6 +28,7 @@
 #include "dbgpacket.h"
 #include "nesdbg.h"
 #include "resource.h"
+#include "romloader.h"
 #include "scriptmgr.h"
 #include "serialcomm.h"
 
@@ -43,7 +44,8 @@ NesDbg::NesDbg(
     m_hWnd(hWnd),
     m_hFontCourierNew(NULL),
     m_pSerialComm(NULL),
-    m_pScriptMgr(NULL)
+    m_pScriptMgr(NULL),
+    m_romBlockCache()
 {
 }
 
@@ -121,7 +123,7 @@ BOOL NesDbg::Init()
     // Initialize the script manager object.
     if (ret)
     {
-        m_pScriptMgr = new ScriptMgr(this);
+        m_pScriptMgr = new ScriptMgr(m_pSerialComm);
         if (m_pScriptMgr && !m_pScriptMgr->Init())
         {
             delete m_pScriptMgr;
@@ -170,181 +172,29 @@ VOID NesDbg::LoadRom()
 
 	BOOL success = GetOpenFileName(&ofn);
 
-    HANDLE hPrgFile = INVALID_HANDLE_VALUE;
-
-    if (success)
-    {
-        hPrgFile = CreateFile(&filePath[0],
-                              GENERIC_READ,
-                              0,
-                              NULL,
-                              OPEN_EXISTING,
-                              FILE_ATTRIBUTE_NORMAL,
-                              NULL);
-
-        success = (hPrgFile != INVALID_HANDLE_VALUE);
-
-        if (!success)
-        {
-            MessageBox(NULL, _T("Failed to open ROM file."), _T("NesDbg"), MB_OK);
-        }
-    }
-
-    BYTE* pFileData = NULL;
-    DWORD fileDataSize = 0;
-
-    if (success)
-    {
-        static const UINT FileDataBufferSize = 0x100000;
-
-        pFileData = new BYTE[FileDataBufferSize];
-
-        success = ReadFile(hPrgFile, pFileData, FileDataBufferSize, &fileDataSize, NULL);
-
-        if (!success)
-        {
-            MessageBox(NULL, _T("Failed to read data from ROM file."), _T("NesDbg"), MB_OK);
-        }
-    }
-
-    UINT prgRomBanks = 0;
-    UINT chrRomBanks = 0;
-
-    if (success)
-    {
-        if ((pFileData[0] != 'N') || (pFileData[1] != 'E') || (pFileData[2] != 'S') ||
-            (pFileData[3] != 0x1A))
-        {
-            MessageBox(NULL, _T("Invalid ROM header."), _T("NesDbg"), MB_OK);
-            success = FALSE;
-        }
-
-        prgRomBanks = pFileData[4];
-        chrRomBanks = pFileData[5];
-
-        if ((prgRomBanks > 2) || (chrRomBanks > 1))
-        {
-            MessageBox(NULL, _T("Too many ROM banks."), _T("NesDbg"), MB_OK);
-            success = FALSE;
-        }
-
-        // Check mirror support.
-        if (pFileData[6] & 0x08)
-        {
-            MessageBox(NULL,
-                       _T("Only horizontal and vertical mirroring are supported."),
-                       _T("NesDbg"), MB_OK);
-            success = FALSE;
-        }
-
-        if ((((pFileData[6] & 0xF0) >> 4)| (pFileData[7] & 0xF0)) != 0)
-        {
-            MessageBox(NULL, _T("Only mapper 0 is supported."), _T("NesDbg"), MB_OK);
-            success = FALSE;
-        }
-    }
-
     if (success)
     {
-        FLOAT pctDone = 0.0f;
+        // The upload runs on the RomLoader's load thread.  The progress dialog is modal, so the
+        // serial port is left to that thread until the dialog closes itself when the load is done.
+        RomLoader     romLoader(m_pSerialComm, &m_romBlockCache);
+        RomLoadResult result = romLoader.StartLoadFile(&filePath[0],
+                                                       RomLoadFlagVerify | RomLoadFlagRun);
 
-        HWND hDlg = CreateDialog(m_hInstance,
-                                 _T("RomLoadProgressDlg"),
-                                 m_hWnd,
-                                 RomLoadProgressDlgProc);
-
-        PBRANGE pbRange;
-        SendDlgItemMessage(hDlg,
-                           IDC_ROMLOAD_PROGRESS,
-                           PBM_GETRANGE,
-                           0,
-                           (LPARAM)&pbRange);
-
-        // Issue a debug break.
-        DbgHltPacket dbgHltPacket;
-        g_pNesDbg->GetSerialComm()->SendData(dbgHltPacket.PacketData(),
-                                             dbgHltPacket.SizeInBytes());
-
-        PpuDisablePacket ppuDisablePacket;
-        g_pNesDbg->GetSerialComm()->SendData(ppuDisablePacket.PacketData(),
-                                             ppuDisablePacket.SizeInBytes());
-
-        // Set iNES header info to configure mappers.
-        CartSetCfgPacket cartSetCfgPacket(&pFileData[0]);
-
-        g_pNesDbg->GetSerialComm()->SendData(cartSetCfgPacket.PacketData(),
-                                             cartSetCfgPacket.SizeInBytes());
-
-        const UINT prgRomDataSize    = prgRomBanks * 0x4000;
-        const UINT chrRomDataSize    = chrRomBanks * 0x2000;
-        const UINT totalBytes        = prgRomDataSize + chrRomDataSize;
-        const UINT transferBlockSize = 0x400;
-
-        UINT transferredBytes = 0;
-
-        // Copy PRG ROM data.
-        for (UINT i = 0; i < (prgRomDataSize / transferBlockSize); i++)
+        if (result == ROM_LOAD_RESULT_SUCCESS)
         {
-            const UINT prgRomOffset = transferBlockSize * i;
-            CpuMemWrPacket prgRomMemWrPacket(0x8000 + prgRomOffset,
-                                             transferBlockSize,
-                                             &pFileData[16 + prgRomOffset]);
-
-            g_pNesDbg->GetSerialComm()->SendData(prgRomMemWrPacket.PacketData(),
-                                                 prgRomMemWrPacket.SizeInBytes());
+            DialogBoxParam(m_hInstance,
+                           _T("RomLoadProgressDlg"),
+                           m_hWnd,
+                           RomLoadProgressDlgProc,
+                           reinterpret_cast<LPARAM>(&romLoader));
 
-            transferredBytes += transferBlockSize;
-            pctDone = (FLOAT)transferredBytes / totalBytes;
-
-            const INT pos = (INT)(((pbRange.iHigh - pbRange.iLow) * pctDone) + pbRange.iLow);
-            SendDlgItemMessage(hDlg, IDC_ROMLOAD_PROGRESS, PBM_SETPOS, (WPARAM)pos, 0);
+            result = romLoader.FinishLoad();
         }
 
-        // Copy CHR ROM data.
-        for (UINT i = 0; i < (chrRomDataSize / transferBlockSize); i++)
+        if (result != ROM_LOAD_RESULT_SUCCESS)
         {
-            const UINT chrRomOffset = transferBlockSize * i;
-            PpuMemWrPacket ppuMemWrPacket(chrRomOffset,
-                                          transferBlockSize,
-                                          &pFileData[16 + prgRomDataSize + chrRomOffset]);
-
-            g_pNesDbg->GetSerialComm()->SendData(ppuMemWrPacket.PacketData(),
-                                                 ppuMemWrPacket.SizeInBytes());
-
-            transferredBytes += transferBlockSize;
-            pctDone = (FLOAT)transferredBytes / totalBytes;
-
-            const INT pos = (INT)(((pbRange.iHigh - pbRange.iLow) * pctDone) + pbRange.iLow);
-            SendDlgItemMessage(hDlg, IDC_ROMLOAD_PROGRESS, PBM_SETPOS, (WPARAM)pos, 0);
+            MessageBox(NULL, RomLoader::GetResultString(result), GetMessageBoxTitle(), MB_OK);
         }
-
-        // Update PC to point at the reset interrupt vector location.
-        BYTE pclVal = pFileData[16 + prgRomDataSize - 4];
-        BYTE pchVal = pFileData[16 + prgRomDataSize - 3];
-
-        CpuRegWrPacket pclRegWrPacket(CpuRegPcl, pclVal);
-        g_pNesDbg->GetSerialComm()->SendData(pclRegWrPacket.PacketData(),
-                                             pclRegWrPacket.SizeInBytes());
-        CpuRegWrPacket pchRegWrPacket(CpuRegPch, pchVal);
-        g_pNesDbg->GetSerialComm()->SendData(pchRegWrPacket.PacketData(),
-                                             pchRegWrPacket.SizeInBytes());
-
-        // Issue a debug run command.
-        DbgRunPacket dbgRunPacket;
-        g_pNesDbg->GetSerialComm()->SendData(dbgRunPacket.PacketData(),
-                                             dbgRunPacket.SizeInBytes());
-
-        DestroyWindow(hDlg);
-    }
-
-    if (pFileData != NULL)
-    {
-        delete [] pFileData;
-    }
-
-    if (hPrgFile != INVALID_HANDLE_VALUE)
-    {
-        CloseHandle(hPrgFile);
     }
 }
 
@@ -411,14 +261,12 @@ BOOL CALLBACK NesDbg::RawDbgDlgProc(
 
                     if (pDbgPacket)
                     {
-                        g_pNesDbg->m_pSerialComm->SendData(pDbgPacket->PacketData(),
-                                                           pDbgPacket->SizeInBytes());
-
                         bytesToReceive = pDbgPacket->ReturnBytesExpected();
 
                         pReceivedData = new BYTE[bytesToReceive];
 
-                        g_pNesDbg->m_pSerialComm->ReceiveData(pReceivedData, bytesToReceive);
+                        g_pNesDbg->m_pSerialComm->SubmitPacket(*pDbgPacket, pReceivedData);
+                        g_pNesDbg->m_pSerialComm->Drain();
 
                         pOutput = new TCHAR[bytesToReceive * 3 + 1];
 
@@ -483,7 +331,8 @@ BOOL CALLBACK NesDbg::RawDbgDlgProc(
 
 /***************************************************************************************************
 ** % Method:      NesDbg::RomLoadProgressDlgProc()
-*  % Description: Modeless dialog to show progress of ROM loads.
+*  % Description: Modal dialog to show progress of ROM loads.  Polls the RomLoader passed as the
+*                 init param every RomLoadPollMs, and closes once its load is done.
 *  % Returns:     TRUE if message was handled, FALSE otherwise.
 ***************************************************************************************************/
 BOOL CALLBACK NesDbg::RomLoadProgressDlgProc(
@@ -494,9 +343,27 @@ BOOL CALLBACK NesDbg::RomLoadProgressDlgProc(
 {
     BOOL ret = TRUE;
 
+    const RomLoader* pRomLoader =
+        reinterpret_cast<const RomLoader*>(GetWindowLongPtr(hWndDlg, GWLP_USERDATA));
+
     switch (msg)
     {
         case WM_INITDIALOG:
+            SetWindowLongPtr(hWndDlg, GWLP_USERDATA, lParam);
+            SetTimer(hWndDlg, RomLoadTimerId, RomLoadPollMs, NULL);
+            break;
+        case WM_TIMER:
+            UpdateRomLoadProgress(hWndDlg, pRomLoader->GetBytesDone(), pRomLoader->GetTotalBytes());
+
+            if (pRomLoader->IsLoadDone())
+            {
+                KillTimer(hWndDlg, RomLoadTimerId);
+                EndDialog(hWndDlg, 0);
+            }
+            break;
+        case WM_COMMAND:
+        case WM_CLOSE:
+            // The load can't be cancelled.
             break;
         default:
             ret = FALSE;
@@ -505,3 +372,27 @@ BOOL CALLBACK NesDbg::RomLoadProgressDlgProc(
 
     return ret;
 }
+
+/***************************************************************************************************
+** % Method:      NesDbg::UpdateRomLoadProgress()
+*  % Description: Updates the ROM load progress dialog's progress bar.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID NesDbg::UpdateRomLoadProgress(
+    HWND hDlg,        // handle to the ROM load progress dialog
+    UINT bytesDone,   // ROM bytes transferred so far
+    UINT totalBytes)  // total ROM bytes to transfer
+{
+    PBRANGE pbRange;
+    SendDlgItemMessage(hDlg,
+                       IDC_ROMLOAD_PROGRESS,
+                       PBM_GETRANGE,
+                       0,
+                       (LPARAM)&pbRange);
+
+    // A reload may find nothing to send.
+    const FLOAT pctDone = (totalBytes) ? (FLOAT)bytesDone / totalBytes : 1.0f;
+    const INT   pos     = (INT)(((pbRange.iHigh - pbRange.iLow) * pctDone) + pbRange.iLow);
+
+    SendDlgItemMessage(hDlg, IDC_ROMLOAD_PROGRESS, PBM_SETPOS, (WPARAM)pos, 0);
+}
@@ -32,6 +32,7 @@
 #include <commctrl.h>
 #include <tchar.h>
 
+#include "romloader.h"
 #include "util.h"
 
 class ScriptMgr;
@@ -68,14 +69,19 @@ private:
         UINT   msg,
         WPARAM wParam,
         LPARAM lParam);
+    static VOID UpdateRomLoadProgress(HWND hDlg, UINT bytesDone, UINT totalBytes);
 
-    HINSTANCE   m_hInstance;        // handle to application instance
-    HWND        m_hWnd;             // handle to main application window
+    static const UINT_PTR RomLoadTimerId = 1;   // progress dialog's timer
+    static const UINT     RomLoadPollMs  = 50;  // progress dialog's RomLoader polling interval
 
-    HFONT       m_hFontCourierNew;  // handle to the "Courier New" fixed-width font
+    HINSTANCE     m_hInstance;        // handle to application instance
+    HWND          m_hWnd;             // handle to main application window
 
-    SerialComm* m_pSerialComm;      // serial communication manager
-    ScriptMgr*  m_pScriptMgr;       // script manager
+    HFONT         m_hFontCourierNew;  // handle to the "Courier New" fixed-width font
+
+    SerialComm*   m_pSerialComm;      // serial communication manager
+    ScriptMgr*    m_pScriptMgr;       // script manager
+    RomBlockCache m_romBlockCache;    // block CRCs of the last ROM loaded, for fast reloads
 };
 
 extern NesDbg* g_pNesDbg;
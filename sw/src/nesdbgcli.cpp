@@ -0,0 +1,252 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/nesdbgcli.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  NesDbgCli class implementation.
+***************************************************************************************************/
+
+#include "nesdbgcli.h"
+
+/***************************************************************************************************
+** % Method:      NesDbgCli::NesDbgCli()
+*  % Description: NesDbgCli constructor.
+***************************************************************************************************/
+NesDbgCli::NesDbgCli()
+    :
+    m_serialComm(),
+    m_progressPercent(0)
+{
+}
+
+/***************************************************************************************************
+** % Method:      NesDbgCli::~NesDbgCli()
+*  % Description: NesDbgCli destructor.
+***************************************************************************************************/
+NesDbgCli::~NesDbgCli()
+{
+}
+
+/***************************************************************************************************
+** % Method:      NesDbgCli::IsCliCommand()
+*  % Description: Checks whether nesdbg was started with a command line command rather than for
+*                 the GUI.  Only a known command verb counts, so other arguments (e.g., a file
+*                 opened through Explorer) still start the GUI.
+*  % Returns:     TRUE if Run() should handle the command line, FALSE otherwise.
+***************************************************************************************************/
+BOOL NesDbgCli::IsCliCommand(
+    INT    argc,    // number of command line arguments
+    TCHAR* argv[])  // command line arguments
+{
+    return (argc > 1) && (_tcscmp(argv[1], _T("load")) == 0);
+}
+
+/***************************************************************************************************
+** % Method:      NesDbgCli::Run()
+*  % Description: Parses and executes the command line.
+*  % Returns:     Process exit code.
+***************************************************************************************************/
+CliExitCode NesDbgCli::Run(
+    INT    argc,    // number of command line arguments
+    TCHAR* argv[])  // command line arguments
+{
+    const TCHAR* pRomPath    = NULL;
+    const TCHAR* pPortName   = NULL;
+    UINT         maxBaudRate = SerialComm::DefaultMaxBaudRate;
+    UINT         flags       = 0;
+    BOOL         framed      = FALSE;
+
+    BOOL ret = IsCliCommand(argc, argv);
+
+    for (INT i = 2; ret && (i < argc); i++)
+    {
+        const TCHAR* pValue = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (_tcscmp(argv[i], _T("--verify")) == 0)
+        {
+            flags |= RomLoadFlagVerify;
+        }
+        else if (_tcscmp(argv[i], _T("--run")) == 0)
+        {
+            flags |= RomLoadFlagRun;
+        }
+        else if (_tcscmp(argv[i], _T("--framed")) == 0)
+        {
+            framed = TRUE;
+        }
+        else if ((_tcscmp(argv[i], _T("-p")) == 0) && pValue)
+        {
+            pPortName = pValue;
+            i++;
+        }
+        else if ((_tcscmp(argv[i], _T("-b")) == 0) && pValue)
+        {
+            maxBaudRate = _tcstoul(pValue, NULL, 0);
+            i++;
+        }
+        else if ((argv[i][0] != '-') && !pRomPath)
+        {
+            pRomPath = argv[i];
+        }
+        else
+        {
+            ret = FALSE;
+        }
+    }
+
+    if (!ret || !pRomPath)
+    {
+        PrintUsage();
+        return CLI_EXIT_USAGE;
+    }
+
+    return Load(pRomPath, flags, pPortName, maxBaudRate, framed);
+}
+
+/***************************************************************************************************
+** % Method:      NesDbgCli::Load()
+*  % Description: Checks a ROM file, then connects to the NES FPGA and uploads it.
+*  % Returns:     Process exit code.
+***************************************************************************************************/
+CliExitCode NesDbgCli::Load(
+    const TCHAR* pRomPath,     // path to .nes file
+    UINT         flags,        // RomLoadFlag options
+    const TCHAR* pPortName,    // serial port to open, NULL to search for the NES FPGA
+    UINT         maxBaudRate,  // fastest baud rate to negotiate
+    BOOL         framed)       // TRUE to use framed mode
+{
+    // A bad ROM is reported as such whether or not a board is attached.
+    INesRom       rom;
+    RomLoadResult result = RomLoader::OpenFile(pRomPath, &rom);
+
+    if (result == ROM_LOAD_RESULT_SUCCESS)
+    {
+        if (!m_serialComm.Init(pPortName, maxBaudRate, framed))
+        {
+            _ftprintf(stderr, _T("Error connecting to the NES FPGA.\n"));
+            return CLI_EXIT_CONNECT_FAILED;
+        }
+
+        _tprintf(_T("%s: %u baud, %s\n"),
+                 pRomPath,
+                 m_serialComm.GetBaudRate(),
+                 (m_serialComm.IsFramedMode()) ? _T("framed") : _T("unframed"));
+        fflush(stdout);
+
+        RomLoader romLoader(&m_serialComm);
+        result = romLoader.Load(rom, flags, LoadProgress, this);
+    }
+
+    CliExitCode ret = GetExitCode(result);
+
+    _ftprintf((ret == CLI_EXIT_SUCCESS) ? stdout : stderr,
+              _T("%s: %s\n"),
+              pRomPath,
+              RomLoader::GetResultString(result));
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      NesDbgCli::PrintUsage()
+*  % Description: Prints command line help.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID NesDbgCli::PrintUsage()
+{
+    _ftprintf(stderr,
+              _T("usage: nesdbg load <rom> [--verify] [--run] [--framed] [-p port] ")
+              _T("[-b maxBaudRate]\n")
+              _T("  --verify  check the upload with an on-device CRC\n")
+              _T("  --run     start the ROM once loaded (otherwise the CPU is left halted)\n")
+              _T("  --framed  send packets in CRC-checked frames, resending any that are lost\n")
+              _T("  -p        serial port, or \"sim\" for the HCI simulator (default: search)\n")
+              _T("  -b        fastest baud rate to negotiate (default: 3000000)\n")
+              _T("exit codes: 0 success, 1 usage, 2 no connection, 3 bad ROM file, ")
+              _T("4 link failure, 5 verify failure\n"));
+}
+
+/***************************************************************************************************
+** % Method:      NesDbgCli::LoadProgress()
+*  % Description: RomLoader progress callback.  Prints a line each ProgressStepPercent.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID NesDbgCli::LoadProgress(
+    VOID* pContext,    // NesDbgCli performing the load
+    UINT  bytesDone,   // ROM bytes transmitted so far
+    UINT  totalBytes)  // ROM bytes to transmit
+{
+    NesDbgCli* pCli    = static_cast<NesDbgCli*>(pContext);
+    const UINT percent = (totalBytes) ? (bytesDone * 100) / totalBytes : 100;
+
+    if ((bytesDone == 0) ||
+        (percent / ProgressStepPercent != pCli->m_progressPercent / ProgressStepPercent))
+    {
+        _tprintf(_T("%3u%% (%u/%u bytes)\n"), percent, bytesDone, totalBytes);
+        fflush(stdout);
+    }
+
+    pCli->m_progressPercent = percent;
+}
+
+/***************************************************************************************************
+** % Method:      NesDbgCli::GetExitCode()
+*  % Description: Maps a ROM load result to a process exit code.
+*  % Returns:     Process exit code.
+***************************************************************************************************/
+CliExitCode NesDbgCli::GetExitCode(
+    RomLoadResult result)  // result to map
+{
+    CliExitCode ret = CLI_EXIT_ROM_INVALID;
+
+    switch (result)
+    {
+        case ROM_LOAD_RESULT_SUCCESS:        ret = CLI_EXIT_SUCCESS;        break;
+        case ROM_LOAD_RESULT_COMM_ERROR:     ret = CLI_EXIT_COMM_ERROR;     break;
+        case ROM_LOAD_RESULT_VERIFY_FAILED:  ret = CLI_EXIT_VERIFY_FAILED;  break;
+        default:                                                            break;
+    }
+
+    return ret;
+}
+
+#ifndef _WIN32
+
+/***************************************************************************************************
+** % Function:    _tmain()
+*  % Description: Program entry-point for non-Windows builds, which are headless only.  (Windows
+*                 builds start in WinMain(), which hands command lines to NesDbgCli.)
+***************************************************************************************************/
+INT _tmain(
+    INT    argc,    // number of command line arguments
+    TCHAR* argv[])  // command line arguments
+{
+    NesDbgCli* pCli = new NesDbgCli();
+
+    INT ret = pCli->Run(argc, argv);
+
+    delete pCli;
+
+    return ret;
+}
+
+#endif // _WIN32
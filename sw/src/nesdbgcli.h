@@ -0,0 +1,88 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/nesdbgcli.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  NesDbgCli class header.
+***************************************************************************************************/
+
+#ifndef NESDBGCLI_H
+#define NESDBGCLI_H
+
+#include "romloader.h"
+#include "serialcomm.h"
+
+/***************************************************************************************************
+** % Enum:        CliExitCode
+*  % Description: Process exit codes for command line (headless) runs of nesdbg.
+***************************************************************************************************/
+enum CliExitCode
+{
+    CLI_EXIT_SUCCESS        = 0,  // command completed
+    CLI_EXIT_USAGE          = 1,  // bad command line
+    CLI_EXIT_CONNECT_FAILED = 2,  // no link to the NES FPGA
+    CLI_EXIT_ROM_INVALID    = 3,  // ROM file couldn't be read, or isn't supported
+    CLI_EXIT_COMM_ERROR     = 4,  // link to the NES FPGA failed part way through
+    CLI_EXIT_VERIFY_FAILED  = 5   // ROM data on the NES FPGA doesn't match the ROM file
+};
+
+/***************************************************************************************************
+** % Class:       NesDbgCli
+*  % Description: Headless nesdbg, for scripts and deployment automation:
+*
+*                     nesdbg load <rom> [--verify] [--run] [--framed] [-p port] [-b maxBaudRate]
+*
+*                 uploads a ROM with the same RomLoader the GUI uses, printing progress to stdout
+*                 and errors to stderr, and returns a CliExitCode.  Boards can be loaded in
+*                 parallel by running one nesdbg per port.
+***************************************************************************************************/
+class NesDbgCli
+{
+public:
+    NesDbgCli();
+    ~NesDbgCli();
+
+    CliExitCode Run(INT argc, TCHAR* argv[]);
+
+    static BOOL IsCliCommand(INT argc, TCHAR* argv[]);
+
+private:
+    NesDbgCli& operator=(const NesDbgCli&);
+    NesDbgCli(const NesDbgCli&);
+
+    CliExitCode Load(const TCHAR* pRomPath,
+                     UINT         flags,
+                     const TCHAR* pPortName,
+                     UINT         maxBaudRate,
+                     BOOL         framed);
+
+    static VOID        PrintUsage();
+    static VOID        LoadProgress(VOID* pContext, UINT bytesDone, UINT totalBytes);
+    static CliExitCode GetExitCode(RomLoadResult result);
+
+    static const UINT ProgressStepPercent = 10;  // load progress is printed in steps this big
+
+    SerialComm m_serialComm;       // link to the NES FPGA
+    UINT       m_progressPercent;  // load progress last printed, in percent
+};
+
+#endif // NESDBGCLI_H
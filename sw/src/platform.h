@@ -0,0 +1,244 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/platform.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  Platform abstraction header.  The core NesDbg sources (packets, serial transport, ROM loading,
+*  scripting) are written against the Win32 type names.  On non-Windows hosts this header supplies
+*  equivalent definitions so the same sources build unmodified.
+***************************************************************************************************/
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <tchar.h>
+
+/***************************************************************************************************
+** % Function:    GetTimeMs
+*  % Description: Returns a monotonic millisecond counter, used for computing I/O deadlines.
+***************************************************************************************************/
+static inline DWORD GetTimeMs()
+{
+    return GetTickCount();
+}
+
+/***************************************************************************************************
+** % Function:    GetTimeUs
+*  % Description: Returns a monotonic microsecond counter, used for timing short operations.  Wraps
+*                 every 71 minutes, so only differences between nearby readings are meaningful.
+***************************************************************************************************/
+static inline DWORD GetTimeUs()
+{
+    static LARGE_INTEGER freq = { 0 };
+
+    if (!freq.QuadPart)
+    {
+        QueryPerformanceFrequency(&freq);
+    }
+
+    LARGE_INTEGER cnt;
+    QueryPerformanceCounter(&cnt);
+
+    // Whole seconds and the remainder are scaled separately, so the multiply can't overflow
+    // however long the machine has been up.
+    return static_cast<DWORD>((cnt.QuadPart / freq.QuadPart) * 1000000 +
+                              ((cnt.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart);
+}
+
+/***************************************************************************************************
+** % Function:    AtomicLoad
+*  % Description: Reads a value shared between threads, with acquire semantics.
+***************************************************************************************************/
+static inline LONG AtomicLoad(
+    const volatile LONG* pVal)  // shared value
+{
+    LONG val = *pVal;
+    MemoryBarrier();
+
+    return val;
+}
+
+/***************************************************************************************************
+** % Function:    AtomicStore
+*  % Description: Writes a value shared between threads, with release semantics.
+***************************************************************************************************/
+static inline VOID AtomicStore(
+    volatile LONG* pVal,  // shared value
+    LONG           val)   // new value
+{
+    MemoryBarrier();
+    *pVal = val;
+}
+
+/***************************************************************************************************
+** % Function:    AtomicIncrement
+*  % Description: Atomically increments a value shared between threads.
+*  % Returns:     The incremented value.
+***************************************************************************************************/
+static inline LONG AtomicIncrement(
+    volatile LONG* pVal)  // shared value
+{
+    return InterlockedIncrement(pVal);
+}
+
+#else // _WIN32
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef void           VOID;
+typedef char           CHAR;
+typedef unsigned char  BYTE;
+typedef unsigned short USHORT;
+typedef int            INT;
+typedef unsigned int   UINT;
+typedef int32_t        LONG;
+typedef uint32_t       ULONG;
+typedef uint32_t       DWORD;
+typedef int            BOOL;
+typedef float          FLOAT;
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+// Non-Windows builds are always ascii builds.
+typedef char TCHAR;
+
+#define _T(x)                              x
+#define _tcslen                            strlen
+#define _tcscmp                            strcmp
+#define _tcsncmp                           strncmp
+#define _tcscpy_s(dst, dstSize, src)       (strncpy((dst), (src), (dstSize)),                   \
+                                            (dst)[(dstSize) - 1] = 0)
+#define _tcscat_s(dst, dstSize, src)       strncat((dst), (src), (dstSize) - strlen(dst) - 1)
+#define _stprintf_s                        snprintf
+#define _vstprintf_s                       vsnprintf
+#define _ftprintf                          fprintf
+#define _fputts                            fputs
+#define _fgetts                            fgets
+#define _tfopen                            fopen
+#define _tgetenv                           getenv
+#define _tputenv_s(name, val)              setenv((name), (val), 1)
+#define _tremove                           remove
+#define _tcstoul                           strtoul
+#define _tprintf                           printf
+#define _tmain                             main
+
+// Marks a parameter the function deliberately ignores, as windows.h does.
+#define UNREFERENCED_PARAMETER(p)          ((VOID)(p))
+
+/***************************************************************************************************
+** % Function:    Sleep
+*  % Description: Suspends the calling thread for the specified number of milliseconds.
+***************************************************************************************************/
+static inline VOID Sleep(
+    DWORD ms)  // milliseconds to sleep
+{
+    usleep(static_cast<useconds_t>(ms) * 1000);
+}
+
+/***************************************************************************************************
+** % Function:    GetTimeMs
+*  % Description: Returns a monotonic millisecond counter, used for computing I/O deadlines.
+***************************************************************************************************/
+static inline DWORD GetTimeMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return static_cast<DWORD>((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+/***************************************************************************************************
+** % Function:    GetTimeUs
+*  % Description: Returns a monotonic microsecond counter, used for timing short operations.  Wraps
+*                 every 71 minutes, so only differences between nearby readings are meaningful.
+***************************************************************************************************/
+static inline DWORD GetTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return static_cast<DWORD>((ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+}
+
+/***************************************************************************************************
+** % Function:    AtomicLoad
+*  % Description: Reads a value shared between threads, with acquire semantics.
+***************************************************************************************************/
+static inline LONG AtomicLoad(
+    const volatile LONG* pVal)  // shared value
+{
+    return __atomic_load_n(pVal, __ATOMIC_ACQUIRE);
+}
+
+/***************************************************************************************************
+** % Function:    AtomicStore
+*  % Description: Writes a value shared between threads, with release semantics.
+***************************************************************************************************/
+static inline VOID AtomicStore(
+    volatile LONG* pVal,  // shared value
+    LONG           val)   // new value
+{
+    __atomic_store_n(pVal, val, __ATOMIC_RELEASE);
+}
+
+/***************************************************************************************************
+** % Function:    AtomicIncrement
+*  % Description: Atomically increments a value shared between threads.
+*  % Returns:     The incremented value.
+***************************************************************************************************/
+static inline LONG AtomicIncrement(
+    volatile LONG* pVal)  // shared value
+{
+    return __atomic_add_fetch(pVal, 1, __ATOMIC_SEQ_CST);
+}
+
+#endif // _WIN32
+
+/***************************************************************************************************
+** % Function:    RemainingMs
+*  % Description: Computes how much of a deadline remains.
+*  % Returns:     Milliseconds until the deadline, or 0 if it has passed.
+***************************************************************************************************/
+static inline UINT RemainingMs(
+    DWORD startMs,    // time the operation started, from GetTimeMs()
+    UINT  timeoutMs)  // total time allowed for the operation
+{
+    DWORD elapsedMs = GetTimeMs() - startMs;
+
+    return (elapsedMs < timeoutMs) ? (timeoutMs - elapsedMs) : 0;
+}
+
+#endif // PLATFORM_H
+
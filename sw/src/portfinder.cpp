@@ -0,0 +1,267 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/portfinder.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  PortFinder class implementation.
+***************************************************************************************************/
+
+#include "dbgpacket.h"
+#include "portfinder.h"
+
+/***************************************************************************************************
+** % Method:      PortFinder::FindPort()
+*  % Description: Finds the serial port an NES FPGA is attached to.  The last port that worked is
+*                 tried first, then all the others at once.  If several ports answer, the first in
+*                 Transport::EnumeratePorts() order wins.
+*  % Returns:     TRUE if a port was found, FALSE otherwise.
+***************************************************************************************************/
+BOOL PortFinder::FindPort(
+    TCHAR* pPortName)  // receives the port name, Transport::MaxPortNameLen TCHARs
+{
+    TCHAR lastGoodPortName[Transport::MaxPortNameLen];
+
+    BOOL lastGood = LoadLastGoodPort(&lastGoodPortName[0]);
+    BOOL ret      = lastGood && ProbePort(&lastGoodPortName[0]);
+
+    if (ret)
+    {
+        _tcscpy_s(pPortName, Transport::MaxPortNameLen, &lastGoodPortName[0]);
+    }
+    else
+    {
+        TCHAR (*pPortNames)[Transport::MaxPortNameLen] =
+            new TCHAR[MaxPorts][Transport::MaxPortNameLen];
+
+        UINT portCnt = Transport::EnumeratePorts(pPortNames, MaxPorts);
+
+        ret = ScanPorts(pPortName, pPortNames, portCnt, (lastGood) ? &lastGoodPortName[0] : NULL);
+
+        delete [] pPortNames;
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      PortFinder::ProbePort()
+*  % Description: Checks whether an NES FPGA is attached to a port, by sending it a debug echo
+*                 packet at ProbeBaudRate.  The port is closed again afterwards.
+*  % Returns:     TRUE if the echo came back within ProbeTimeoutMs, FALSE otherwise.
+***************************************************************************************************/
+BOOL PortFinder::ProbePort(
+    const TCHAR* pPortName)  // port to probe
+{
+    const char* pProbeString = "NES";
+    const UINT  probeSize    = strlen(pProbeString) + 1;
+
+    EchoPacket probePkt(reinterpret_cast<const BYTE*>(pProbeString), probeSize);
+    BYTE       probe[DbgPacket::MaxHeaderSize + 4];
+    BYTE       echo[4];
+
+    assert(probePkt.SizeInBytes() <= sizeof(probe));
+    assert(probePkt.ReturnBytesExpected() == sizeof(echo));
+
+    const UINT probePktSize = probePkt.Encode(&probe[0]);
+
+    Transport* pTransport = Transport::Create(pPortName);
+
+    BOOL ret = pTransport->Open(pPortName, ProbeBaudRate);
+
+    if (ret)
+    {
+        const DWORD startMs = GetTimeMs();
+
+        ret = (pTransport->Write(&probe[0], probePktSize, ProbeTimeoutMs) == probePktSize) &&
+              (pTransport->Read(&echo[0],
+                                sizeof(echo),
+                                RemainingMs(startMs, ProbeTimeoutMs)) == sizeof(echo)) &&
+              (memcmp(pProbeString, &echo[0], probeSize) == 0);
+
+        pTransport->Close();
+    }
+
+    delete pTransport;
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      PortFinder::SaveLastGoodPort()
+*  % Description: Records the port an NES FPGA was found on, so the next FindPort() tries it first.
+*                 Failure to write the cache file is not an error.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID PortFinder::SaveLastGoodPort(
+    const TCHAR* pPortName)  // port the NES FPGA answered on
+{
+    TCHAR cacheFilePath[Transport::MaxPortNameLen * 2];
+
+    if (GetCacheFilePath(&cacheFilePath[0], Transport::MaxPortNameLen * 2))
+    {
+        FILE* pFile = _tfopen(&cacheFilePath[0], _T("w"));
+
+        if (pFile)
+        {
+            _fputts(pPortName, pFile);
+            _fputts(_T("\n"), pFile);
+            fclose(pFile);
+        }
+    }
+}
+
+/***************************************************************************************************
+** % Method:      PortFinder::ScanPorts()
+*  % Description: Probes up to MaxPorts candidate ports at the same time, one thread per port,
+*                 skipping the one already known not to answer.  If several ports answer, the first
+*                 in pPortNames wins.
+*  % Returns:     TRUE if a port was found, FALSE otherwise.
+***************************************************************************************************/
+BOOL PortFinder::ScanPorts(
+    TCHAR*       pPortName,                                // receives the port name
+    const TCHAR  (*pPortNames)[Transport::MaxPortNameLen], // ports to probe
+    UINT         portCnt,                                  // number of ports in pPortNames
+    const TCHAR* pSkipPortName)                            // port known not to answer (may be NULL)
+{
+    BOOL ret = FALSE;
+
+    Probe* pProbes  = new Probe[MaxPorts];
+    UINT   probeCnt = 0;
+
+    if (portCnt > MaxPorts)
+    {
+        portCnt = MaxPorts;
+    }
+
+    for (UINT i = 0; i < portCnt; i++)
+    {
+        if (pSkipPortName && (_tcscmp(pPortNames[i], pSkipPortName) == 0))
+        {
+            continue;
+        }
+
+        Probe& probe = pProbes[probeCnt++];
+
+        probe.pPortName = pPortNames[i];
+        probe.found     = FALSE;
+
+        if (!probe.thread.Start(ProbeThreadProc, &probe))
+        {
+            // Out of threads; probe this one the slow way.
+            ProbeThreadProc(&probe);
+        }
+    }
+
+    for (UINT i = 0; i < probeCnt; i++)
+    {
+        pProbes[i].thread.Join();
+
+        if (!ret && pProbes[i].found)
+        {
+            _tcscpy_s(pPortName, Transport::MaxPortNameLen, pProbes[i].pPortName);
+            ret = TRUE;
+        }
+    }
+
+    delete [] pProbes;
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      PortFinder::ProbeThreadProc()
+*  % Description: Probe thread entry point.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID PortFinder::ProbeThreadProc(
+    VOID* pContext)  // Probe object
+{
+    Probe* pProbe = static_cast<Probe*>(pContext);
+
+    pProbe->found = ProbePort(pProbe->pPortName);
+}
+
+/***************************************************************************************************
+** % Method:      PortFinder::LoadLastGoodPort()
+*  % Description: Reads the port recorded by SaveLastGoodPort().
+*  % Returns:     TRUE if a port was recorded, FALSE otherwise.
+***************************************************************************************************/
+BOOL PortFinder::LoadLastGoodPort(
+    TCHAR* pPortName)  // receives the port name, Transport::MaxPortNameLen TCHARs
+{
+    BOOL ret = FALSE;
+
+    TCHAR cacheFilePath[Transport::MaxPortNameLen * 2];
+
+    if (GetCacheFilePath(&cacheFilePath[0], Transport::MaxPortNameLen * 2))
+    {
+        FILE* pFile = _tfopen(&cacheFilePath[0], _T("r"));
+
+        if (pFile)
+        {
+            if (_fgetts(pPortName, Transport::MaxPortNameLen, pFile))
+            {
+                // Strip the line ending.
+                UINT len = _tcslen(pPortName);
+                while (len &&
+                       ((pPortName[len - 1] == _T('\n')) || (pPortName[len - 1] == _T('\r'))))
+                {
+                    pPortName[--len] = 0;
+                }
+
+                ret = (len > 0);
+            }
+
+            fclose(pFile);
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      PortFinder::GetCacheFilePath()
+*  % Description: Works out where the last good port is recorded: nesdbg_port.txt in the user's
+*                 application data folder on Windows, ~/.nesdbg_port elsewhere.
+*  % Returns:     TRUE on success, FALSE if the user's home folder is unknown.
+***************************************************************************************************/
+BOOL PortFinder::GetCacheFilePath(
+    TCHAR* pPath,     // receives the path
+    UINT   pathSize)  // size of pPath, in TCHARs
+{
+#ifdef _WIN32
+    const TCHAR* pDir      = _tgetenv(_T("APPDATA"));
+    const TCHAR* pFileName = _T("\\nesdbg_port.txt");
+#else
+    const TCHAR* pDir      = _tgetenv(_T("HOME"));
+    const TCHAR* pFileName = _T("/.nesdbg_port");
+#endif
+
+    BOOL ret = (pDir != NULL) && (_tcslen(pDir) + _tcslen(pFileName) < pathSize);
+
+    if (ret)
+    {
+        _stprintf_s(pPath, pathSize, _T("%s%s"), pDir, pFileName);
+    }
+
+    return ret;
+}
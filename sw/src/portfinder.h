@@ -0,0 +1,75 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/portfinder.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  PortFinder class header.
+***************************************************************************************************/
+
+#ifndef PORTFINDER_H
+#define PORTFINDER_H
+
+#include "thread.h"
+#include "transport.h"
+
+/***************************************************************************************************
+** % Class:       PortFinder
+*  % Description: Locates the serial port an NES FPGA is attached to.  The port that last worked is
+*                 remembered in a per-user cache file and tried first; if it doesn't answer, every
+*                 candidate port (Transport::EnumeratePorts()) is probed with a debug echo packet
+*                 at the same time, each on its own thread, so a full scan costs one probe
+*                 deadline rather than one per port.
+***************************************************************************************************/
+class PortFinder
+{
+public:
+    static BOOL FindPort(TCHAR* pPortName);
+    static BOOL ProbePort(const TCHAR* pPortName);
+    static BOOL ScanPorts(TCHAR*       pPortName,
+                          const TCHAR  (*pPortNames)[Transport::MaxPortNameLen],
+                          UINT         portCnt,
+                          const TCHAR* pSkipPortName);
+    static BOOL LoadLastGoodPort(TCHAR* pPortName);
+    static VOID SaveLastGoodPort(const TCHAR* pPortName);
+    static BOOL GetCacheFilePath(TCHAR* pPath, UINT pathSize);
+
+    static const UINT MaxPorts       = 64;     // most ports probed by one scan
+    static const UINT ProbeBaudRate  = 38400;  // hci.v reset rate (BAUD_SEL_38400)
+    static const UINT ProbeTimeoutMs = 250;    // deadline for a port to echo the probe
+
+private:
+    PortFinder();
+    PortFinder& operator=(const PortFinder&);
+    PortFinder(const PortFinder&);
+
+    // State for one port probed by ScanPorts().
+    struct Probe
+    {
+        const TCHAR* pPortName;  // port to probe
+        BOOL         found;      // TRUE if an NES FPGA answered
+        Thread       thread;     // thread running the probe
+    };
+
+    static VOID ProbeThreadProc(VOID* pContext);
+};
+
+#endif // PORTFINDER_H
@@ -0,0 +1,435 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/posixserialtransport.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  PosixSerialTransport class implementation.
+***************************************************************************************************/
+
+#ifndef _WIN32
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "posixserialtransport.h"
+
+/***************************************************************************************************
+** % Function:    BaudRateToSpeed
+*  % Description: Converts a numeric baud rate to the corresponding termios speed constant.
+*  % Returns:     termios speed_t constant, or B0 if the rate is unsupported.
+***************************************************************************************************/
+static speed_t BaudRateToSpeed(
+    UINT baudRate)  // baud rate
+{
+    speed_t speed = B0;
+
+    switch (baudRate)
+    {
+        case 9600:    speed = B9600;    break;
+        case 19200:   speed = B19200;   break;
+        case 38400:   speed = B38400;   break;
+        case 57600:   speed = B57600;   break;
+        case 115200:  speed = B115200;  break;
+        case 230400:  speed = B230400;  break;
+#ifdef B460800
+        case 460800:  speed = B460800;  break;
+#endif
+#ifdef B921600
+        case 921600:  speed = B921600;  break;
+#endif
+#ifdef B1000000
+        case 1000000: speed = B1000000; break;
+#endif
+#ifdef B2000000
+        case 2000000: speed = B2000000; break;
+#endif
+#ifdef B3000000
+        case 3000000: speed = B3000000; break;
+#endif
+        default:      speed = B0;       break;
+    }
+
+    return speed;
+}
+
+/***************************************************************************************************
+** % Method:      PosixSerialTransport::PosixSerialTransport()
+*  % Description: PosixSerialTransport constructor.
+***************************************************************************************************/
+PosixSerialTransport::PosixSerialTransport()
+    :
+    m_fd(-1)
+{
+}
+
+/***************************************************************************************************
+** % Method:      PosixSerialTransport::~PosixSerialTransport()
+*  % Description: PosixSerialTransport destructor.
+***************************************************************************************************/
+PosixSerialTransport::~PosixSerialTransport()
+{
+    Close();
+}
+
+/***************************************************************************************************
+** % Method:      PosixSerialTransport::Open()
+*  % Description: Opens the specified tty and configures it for the NES FPGA: raw mode, 8 data bits,
+*                 odd parity, 1 stop bit, no flow control.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL PosixSerialTransport::Open(
+    const TCHAR* pPortName,  // tty path (e.g., "/dev/ttyUSB0")
+    UINT         baudRate)   // baud rate
+{
+    BOOL ret = TRUE;
+
+    speed_t speed = BaudRateToSpeed(baudRate);
+    if (speed == B0)
+    {
+        ret = FALSE;
+    }
+
+    if (ret)
+    {
+        // Non-blocking so reads/writes can be bounded by poll() deadlines.
+        m_fd = open(pPortName, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+        ret = (m_fd >= 0);
+    }
+
+    struct termios tio;
+    if (ret)
+    {
+        ret = (tcgetattr(m_fd, &tio) == 0);
+    }
+
+    if (ret)
+    {
+        cfmakeraw(&tio);
+
+        tio.c_cflag &= ~(CSIZE | CSTOPB | CRTSCTS);
+        tio.c_cflag |= CS8 | PARENB | PARODD | CLOCAL | CREAD;
+        tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+
+        // Reads are paced by poll(), so never block inside read() itself.
+        tio.c_cc[VMIN]  = 0;
+        tio.c_cc[VTIME] = 0;
+
+        ret = (cfsetispeed(&tio, speed) == 0) &&
+              (cfsetospeed(&tio, speed) == 0) &&
+              (tcsetattr(m_fd, TCSANOW, &tio) == 0);
+    }
+
+    if (ret)
+    {
+        tcflush(m_fd, TCIOFLUSH);
+    }
+    else
+    {
+        Close();
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      PosixSerialTransport::Close()
+*  % Description: Closes the tty, if open.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID PosixSerialTransport::Close()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      PosixSerialTransport::SetBaudRate()
+*  % Description: Changes the tty baud rate once all previously written data has been transmitted.
+*  % Returns:     TRUE on success, FALSE if the rate is unsupported or the tty rejected it.
+***************************************************************************************************/
+BOOL PosixSerialTransport::SetBaudRate(
+    UINT baudRate)  // new baud rate
+{
+    speed_t speed = BaudRateToSpeed(baudRate);
+
+    struct termios tio;
+    BOOL ret = (speed != B0) && (tcgetattr(m_fd, &tio) == 0);
+
+    if (ret)
+    {
+        ret = (cfsetispeed(&tio, speed) == 0) &&
+              (cfsetospeed(&tio, speed) == 0) &&
+              (tcsetattr(m_fd, TCSADRAIN, &tio) == 0);
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      PosixSerialTransport::Write()
+*  % Description: Transmits up to numBytes through the tty, waiting at most timeoutMs.
+*  % Returns:     Number of bytes written.
+***************************************************************************************************/
+UINT PosixSerialTransport::Write(
+    const BYTE* pData,      // data to transmit
+    UINT        numBytes,   // number of bytes to transmit
+    UINT        timeoutMs)  // maximum time to wait for the write to complete
+{
+    const DWORD startMs      = GetTimeMs();
+    UINT        bytesWritten = 0;
+
+    while (bytesWritten < numBytes)
+    {
+        ssize_t ret = write(m_fd, pData + bytesWritten, numBytes - bytesWritten);
+
+        if (ret > 0)
+        {
+            bytesWritten += static_cast<UINT>(ret);
+        }
+        else if ((ret < 0) && (errno != EAGAIN) && (errno != EINTR))
+        {
+            break;
+        }
+        else
+        {
+            struct pollfd pfd = { m_fd, POLLOUT, 0 };
+            INT remainingMs   = static_cast<INT>(RemainingMs(startMs, timeoutMs));
+
+            if ((remainingMs == 0) || (poll(&pfd, 1, remainingMs) <= 0))
+            {
+                break;
+            }
+        }
+    }
+
+    return bytesWritten;
+}
+
+/***************************************************************************************************
+** % Method:      PosixSerialTransport::Read()
+*  % Description: Receives up to numBytes from the tty, waiting at most timeoutMs for them to
+*                 arrive.
+*  % Returns:     Number of bytes read.
+***************************************************************************************************/
+UINT PosixSerialTransport::Read(
+    BYTE* pData,      // where to store received data
+    UINT  numBytes,   // number of bytes to receive
+    UINT  timeoutMs)  // maximum time to wait for the data
+{
+    const DWORD startMs   = GetTimeMs();
+    UINT        bytesRead = 0;
+
+    while (bytesRead < numBytes)
+    {
+        ssize_t ret = read(m_fd, pData + bytesRead, numBytes - bytesRead);
+
+        if (ret > 0)
+        {
+            bytesRead += static_cast<UINT>(ret);
+        }
+        else if ((ret < 0) && (errno != EAGAIN) && (errno != EINTR))
+        {
+            break;
+        }
+        else
+        {
+            struct pollfd pfd = { m_fd, POLLIN, 0 };
+            INT remainingMs   = static_cast<INT>(RemainingMs(startMs, timeoutMs));
+
+            if ((remainingMs == 0) || (poll(&pfd, 1, remainingMs) <= 0))
+            {
+                break;
+            }
+        }
+    }
+
+    return bytesRead;
+}
+
+/***************************************************************************************************
+** % Method:      PosixSerialTransport::WaitForIo()
+*  % Description: Waits for the tty to become readable and/or writable, as selected by ioFlags.
+*  % Returns:     TRUE if the tty became ready before timeoutMs elapsed, FALSE otherwise.
+***************************************************************************************************/
+BOOL PosixSerialTransport::WaitForIo(
+    UINT ioFlags,    // TransportIo conditions to wait for
+    UINT timeoutMs)  // maximum time to wait
+{
+    struct pollfd pfd = { m_fd, 0, 0 };
+
+    if (ioFlags & TransportIoRead)
+    {
+        pfd.events |= POLLIN;
+    }
+    if (ioFlags & TransportIoWrite)
+    {
+        pfd.events |= POLLOUT;
+    }
+
+    INT ret;
+    do
+    {
+        ret = poll(&pfd, 1, static_cast<INT>(timeoutMs));
+    } while ((ret < 0) && (errno == EINTR));
+
+    return (ret > 0);
+}
+
+/***************************************************************************************************
+** % Method:      PosixSerialTransport::Purge()
+*  % Description: Discards any data buffered by the driver in either direction.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID PosixSerialTransport::Purge()
+{
+    tcflush(m_fd, TCIOFLUSH);
+}
+
+/***************************************************************************************************
+** % Function:    ComparePortNames
+*  % Description: qsort() comparison function for port names.
+*  % Returns:     strcmp() result.
+***************************************************************************************************/
+static int ComparePortNames(
+    const void* pLeft,   // first port name
+    const void* pRight)  // second port name
+{
+    return strcmp(static_cast<const CHAR*>(pLeft), static_cast<const CHAR*>(pRight));
+}
+
+/***************************************************************************************************
+** % Method:      PosixSerialTransport::EnumeratePorts()
+*  % Description: Lists USB serial adapters.  The /dev/serial/by-id links come first: they are named
+*                 after the adapter's USB serial number, so a board keeps its name across replugs.
+*                 Then any /dev/ttyUSB* and /dev/ttyACM* nodes the links don't cover.  Paths too
+*                 long for MaxPortNameLen are skipped.
+*  % Returns:     Number of port names stored in pPortNames.
+***************************************************************************************************/
+UINT PosixSerialTransport::EnumeratePorts(
+    TCHAR (*pPortNames)[MaxPortNameLen],  // receives the port names
+    UINT  maxPorts)                       // capacity of pPortNames
+{
+    static const CHAR* pByIdDir = "/dev/serial/by-id";
+    static const CHAR* pDevDir  = "/dev";
+
+    UINT portCnt = 0;
+
+    // Device nodes the by-id links resolve to.
+    CHAR (*pLinkTargets)[PATH_MAX] = new CHAR[maxPorts][PATH_MAX];
+
+    DIR* pDir = opendir(pByIdDir);
+    if (pDir)
+    {
+        struct dirent* pEntry;
+
+        while ((portCnt < maxPorts) && ((pEntry = readdir(pDir)) != NULL))
+        {
+            if (pEntry->d_name[0] == '.')
+            {
+                continue;
+            }
+
+            // Skip names that don't fit; a cut off name would open the wrong device, or none.
+            INT nameLen = snprintf(pPortNames[portCnt],
+                                   MaxPortNameLen,
+                                   "%s/%s",
+                                   pByIdDir,
+                                   pEntry->d_name);
+
+            if ((nameLen < 0) || (static_cast<UINT>(nameLen) >= MaxPortNameLen))
+            {
+                continue;
+            }
+
+            if (!realpath(pPortNames[portCnt], pLinkTargets[portCnt]))
+            {
+                pLinkTargets[portCnt][0] = 0;
+            }
+
+            portCnt++;
+        }
+
+        closedir(pDir);
+    }
+
+    const UINT linkCnt = portCnt;
+
+    pDir = opendir(pDevDir);
+    if (pDir)
+    {
+        struct dirent* pEntry;
+
+        while ((portCnt < maxPorts) && ((pEntry = readdir(pDir)) != NULL))
+        {
+            if ((strncmp(pEntry->d_name, "ttyUSB", 6) != 0) &&
+                (strncmp(pEntry->d_name, "ttyACM", 6) != 0))
+            {
+                continue;
+            }
+
+            INT nameLen = snprintf(pPortNames[portCnt],
+                                   MaxPortNameLen,
+                                   "%s/%s",
+                                   pDevDir,
+                                   pEntry->d_name);
+
+            if ((nameLen < 0) || (static_cast<UINT>(nameLen) >= MaxPortNameLen))
+            {
+                continue;
+            }
+
+            BOOL linked = FALSE;
+            for (UINT i = 0; !linked && (i < linkCnt); i++)
+            {
+                linked = (strcmp(pPortNames[portCnt], pLinkTargets[i]) == 0);
+            }
+
+            if (!linked)
+            {
+                portCnt++;
+            }
+        }
+
+        closedir(pDir);
+    }
+
+    delete [] pLinkTargets;
+
+    // readdir() order is arbitrary; keep probe order (and so the choice between boards) stable.
+    qsort(pPortNames, linkCnt, MaxPortNameLen, ComparePortNames);
+    qsort(pPortNames + linkCnt, portCnt - linkCnt, MaxPortNameLen, ComparePortNames);
+
+    return portCnt;
+}
+
+#endif // _WIN32
+
@@ -0,0 +1,67 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/posixserialtransport.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  PosixSerialTransport class header.
+***************************************************************************************************/
+
+#ifndef POSIXSERIALTRANSPORT_H
+#define POSIXSERIALTRANSPORT_H
+
+#ifndef _WIN32
+
+#include "transport.h"
+
+/***************************************************************************************************
+** % Class:       PosixSerialTransport
+*  % Description: Transport implementation for a POSIX tty (e.g., /dev/ttyUSB0) using termios.
+***************************************************************************************************/
+class PosixSerialTransport : public Transport
+{
+public:
+    PosixSerialTransport();
+    virtual ~PosixSerialTransport();
+
+    virtual BOOL Open(const TCHAR* pPortName, UINT baudRate);
+    virtual VOID Close();
+    virtual BOOL SetBaudRate(UINT baudRate);
+
+    virtual UINT Write(const BYTE* pData, UINT numBytes, UINT timeoutMs);
+    virtual UINT Read(BYTE* pData, UINT numBytes, UINT timeoutMs);
+
+    virtual BOOL WaitForIo(UINT ioFlags, UINT timeoutMs);
+    virtual VOID Purge();
+
+    static UINT EnumeratePorts(TCHAR (*pPortNames)[MaxPortNameLen], UINT maxPorts);
+
+private:
+    PosixSerialTransport& operator=(const PosixSerialTransport&);
+    PosixSerialTransport(const PosixSerialTransport&);
+
+    INT m_fd;  // file descriptor for the tty device
+};
+
+#endif // _WIN32
+
+#endif // POSIXSERIALTRANSPORT_H
+
@@ -0,0 +1,150 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/ringbuffer.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  RingBuffer class implementation.
+***************************************************************************************************/
+
+#include "ringbuffer.h"
+
+/***************************************************************************************************
+** % Method:      RingBuffer::RingBuffer()
+*  % Description: RingBuffer constructor.
+***************************************************************************************************/
+RingBuffer::RingBuffer()
+    :
+    m_pData(NULL),
+    m_capacity(0),
+    m_writeIdx(0),
+    m_readIdx(0)
+{
+}
+
+/***************************************************************************************************
+** % Method:      RingBuffer::~RingBuffer()
+*  % Description: RingBuffer destructor.
+***************************************************************************************************/
+RingBuffer::~RingBuffer()
+{
+    delete [] m_pData;
+}
+
+/***************************************************************************************************
+** % Method:      RingBuffer::Init()
+*  % Description: RingBuffer initialization method.  Must be called before any other method.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL RingBuffer::Init(
+    UINT capacity)  // ring size in bytes, must be a power of 2
+{
+    BOOL ret = ((capacity != 0) && ((capacity & (capacity - 1)) == 0));
+
+    assert(ret);
+    if (ret)
+    {
+        m_pData    = new BYTE[capacity];
+        m_capacity = capacity;
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      RingBuffer::GetWriteSpan()
+*  % Description: Producer: returns the largest contiguous free region of the ring.  The producer
+*                 may fill any prefix of it and then publish that prefix with CommitWrite().
+*  % Returns:     Size of the span, in bytes (0 if the ring is full).
+***************************************************************************************************/
+UINT RingBuffer::GetWriteSpan(
+    BYTE** ppData)  // receives a pointer to the free span
+{
+    const UINT writeIdx = static_cast<UINT>(m_writeIdx);
+    const UINT readIdx  = static_cast<UINT>(AtomicLoad(&m_readIdx));
+    const UINT offset   = writeIdx & (m_capacity - 1);
+
+    UINT spanSize = m_capacity - (writeIdx - readIdx);
+    if (spanSize > m_capacity - offset)
+    {
+        spanSize = m_capacity - offset;
+    }
+
+    *ppData = m_pData + offset;
+
+    return spanSize;
+}
+
+/***************************************************************************************************
+** % Method:      RingBuffer::CommitWrite()
+*  % Description: Producer: publishes numBytes bytes written into the span from GetWriteSpan().
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID RingBuffer::CommitWrite(
+    UINT numBytes)  // number of bytes written
+{
+    AtomicStore(&m_writeIdx, static_cast<LONG>(static_cast<UINT>(m_writeIdx) + numBytes));
+}
+
+/***************************************************************************************************
+** % Method:      RingBuffer::GetReadSpan()
+*  % Description: Consumer: returns the largest contiguous region of published data.  The span
+*                 remains valid until it is released with CommitRead().
+*  % Returns:     Size of the span, in bytes (0 if the ring is empty).
+***************************************************************************************************/
+UINT RingBuffer::GetReadSpan(
+    const BYTE** ppData)  // receives a pointer to the data span
+{
+    const UINT readIdx  = static_cast<UINT>(m_readIdx);
+    const UINT writeIdx = static_cast<UINT>(AtomicLoad(&m_writeIdx));
+    const UINT offset   = readIdx & (m_capacity - 1);
+
+    UINT spanSize = writeIdx - readIdx;
+    if (spanSize > m_capacity - offset)
+    {
+        spanSize = m_capacity - offset;
+    }
+
+    *ppData = m_pData + offset;
+
+    return spanSize;
+}
+
+/***************************************************************************************************
+** % Method:      RingBuffer::CommitRead()
+*  % Description: Consumer: releases numBytes bytes from the front of the ring back to the producer.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID RingBuffer::CommitRead(
+    UINT numBytes)  // number of bytes consumed
+{
+    AtomicStore(&m_readIdx, static_cast<LONG>(static_cast<UINT>(m_readIdx) + numBytes));
+}
+
+/***************************************************************************************************
+** % Method:      RingBuffer::Discard()
+*  % Description: Consumer: releases all currently published data.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID RingBuffer::Discard()
+{
+    AtomicStore(&m_readIdx, AtomicLoad(&m_writeIdx));
+}
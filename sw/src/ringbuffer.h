@@ -0,0 +1,73 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/ringbuffer.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  RingBuffer class header.
+***************************************************************************************************/
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include "util.h"
+
+/***************************************************************************************************
+** % Class:       RingBuffer
+*  % Description: Lock-free single-producer/single-consumer byte ring.  Both sides work on spans of
+*                 the ring's own storage: the producer fills GetWriteSpan() in place (e.g., as the
+*                 target of a transport read) and the consumer reads GetReadSpan() in place, so no
+*                 data is copied through the ring.  One thread may produce while another consumes
+*                 without any locking.
+***************************************************************************************************/
+class RingBuffer
+{
+public:
+    RingBuffer();
+    ~RingBuffer();
+
+    BOOL Init(UINT capacity);
+
+    // Producer side.
+    UINT GetWriteSpan(BYTE** ppData);
+    VOID CommitWrite(UINT numBytes);
+
+    // Consumer side.
+    UINT GetReadSpan(const BYTE** ppData);
+    VOID CommitRead(UINT numBytes);
+    VOID Discard();
+
+    UINT GetCapacity() const { return m_capacity; }
+
+private:
+    RingBuffer& operator=(const RingBuffer&);
+    RingBuffer(const RingBuffer&);
+
+    BYTE*         m_pData;     // ring storage
+    UINT          m_capacity;  // size of m_pData, a power of 2
+
+    // Free-running byte counts; only the low bits index into m_pData.  m_writeIdx is only written
+    // by the producer, m_readIdx only by the consumer.
+    volatile LONG m_writeIdx;  // total bytes committed by the producer
+    volatile LONG m_readIdx;   // total bytes committed by the consumer
+};
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,668 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/romloader.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  RomLoader class implementation.
+***************************************************************************************************/
+
+#include "dbgpacket.h"
+#include "romloader.h"
+#include "serialcomm.h"
+
+/***************************************************************************************************
+** % Method:      RomLoader::RomLoader()
+*  % Description: RomLoader constructor.
+***************************************************************************************************/
+RomLoader::RomLoader(
+    SerialComm*    pSerialComm,  // serial communication manager used to reach the NES FPGA
+    RomBlockCache* pBlockCache)  // block CRC cache for the board (NULL to always ask the board)
+    :
+    m_pSerialComm(pSerialComm),
+    m_pBlockCache(pBlockCache),
+    m_pfnProgress(NULL),
+    m_pProgressContext(NULL),
+    m_totalBytes(0),
+    m_streamBase(0),
+    m_rom(),
+    m_loadFlags(0),
+    m_loadResult(ROM_LOAD_RESULT_SUCCESS),
+    m_loadThread(),
+    m_bytesDone(0),
+    m_loadDone(FALSE)
+{
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::~RomLoader()
+*  % Description: RomLoader destructor.  Waits for any upload started with StartLoadFile().
+***************************************************************************************************/
+RomLoader::~RomLoader()
+{
+    m_loadThread.Join();
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::LoadFile()
+*  % Description: Memory-maps the specified iNES file and uploads it to the NES FPGA.
+*  % Returns:     Result of the load.
+***************************************************************************************************/
+RomLoadResult RomLoader::LoadFile(
+    const TCHAR*            pFilePath,    // path to .nes file
+    UINT                    flags,        // RomLoadFlag options
+    RomLoadProgressCallback pfnProgress,  // optional progress callback
+    VOID*                   pContext)     // context passed to pfnProgress
+{
+    INesRom       rom;
+    RomLoadResult ret = OpenFile(pFilePath, &rom);
+
+    if (ret == ROM_LOAD_RESULT_SUCCESS)
+    {
+        ret = Load(rom, flags, pfnProgress, pContext);
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::Load()
+*  % Description: Parses an in-memory iNES image and uploads it to the NES FPGA.
+*  % Returns:     Result of the load.
+***************************************************************************************************/
+RomLoadResult RomLoader::Load(
+    const BYTE*             pRomData,     // iNES image, starting with the header
+    UINT                    romDataSize,  // size of pRomData, in bytes
+    UINT                    flags,        // RomLoadFlag options
+    RomLoadProgressCallback pfnProgress,  // optional progress callback
+    VOID*                   pContext)     // context passed to pfnProgress
+{
+    INesRom       rom;
+    RomLoadResult ret = GetParseResult(rom.Parse(pRomData, romDataSize));
+
+    if (ret == ROM_LOAD_RESULT_SUCCESS)
+    {
+        ret = Load(rom, flags, pfnProgress, pContext);
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::Load()
+*  % Description: Uploads a parsed iNES image to the NES FPGA, if it is supported.  The CPU is
+*                 halted during the upload, and only blocks that differ from the board's copy are
+*                 sent.  With RomLoadFlagVerify the upload is checked, and with RomLoadFlagRun the
+*                 CPU is then resumed at the image's reset vector.
+*  % Returns:     Result of the load.
+***************************************************************************************************/
+RomLoadResult RomLoader::Load(
+    const INesRom&          rom,          // parsed iNES image
+    UINT                    flags,        // RomLoadFlag options
+    RomLoadProgressCallback pfnProgress,  // optional progress callback
+    VOID*                   pContext)     // context passed to pfnProgress
+{
+    RomLoadResult ret = Validate(rom);
+
+    if (ret != ROM_LOAD_RESULT_SUCCESS)
+    {
+        return ret;
+    }
+
+    // The changed blocks are staged as one batch and flushed to the FPGA with a single write,
+    // followed by a second batch that starts the image once the upload has been verified.
+    // Progress is reported as each chunk is handed to the transport, out of the changed bytes.
+    // The flags only drop steps.
+    const UINT  prgRomDataSize = rom.PrgRomSize();
+    const UINT  chrRomDataSize = rom.ChrRomSize();
+    const BYTE* pPrgRomData    = rom.PrgRomData();
+    const BYTE* pChrRomData    = rom.ChrRomData();
+
+    m_pfnProgress      = pfnProgress;
+    m_pProgressContext = pContext;
+
+    AtomicStore(&m_totalBytes, static_cast<LONG>(prgRomDataSize + chrRomDataSize));
+    AtomicStore(&m_bytesDone, 0);
+
+    BOOL success = TRUE;
+
+    // Issue a debug break.
+    DbgHltPacket dbgHltPacket;
+    success = success && m_pSerialComm->SubmitPacket(dbgHltPacket);
+
+    PpuDisablePacket ppuDisablePacket;
+    success = success && m_pSerialComm->SubmitPacket(ppuDisablePacket);
+
+    // Set iNES header info to configure mappers.  The hci takes iNES 1.0 bytes 4-8, so NES 2.0
+    // headers (and stray bits) are passed on in that form.
+    BYTE cartCfgHeader[INesRom::HeaderSize] = { 0 };
+
+    cartCfgHeader[4] = static_cast<BYTE>(prgRomDataSize / INesRom::PrgRomBankSize);
+    cartCfgHeader[5] = static_cast<BYTE>(chrRomDataSize / INesRom::ChrRomBankSize);
+    cartCfgHeader[6] = (rom.GetMirroring() == INesMirroringVertical) ? 0x01 : 0x00;
+
+    CartSetCfgPacket cartSetCfgPacket(&cartCfgHeader[0]);
+    success = success && m_pSerialComm->SubmitPacket(cartSetCfgPacket);
+
+    // Work out what the board holds.  A cached image of the same size is trusted until the region
+    // CRCs below say otherwise; the board is asked (after CartSetCfg, so the CRCs see the new
+    // mapping) when there is no cache or the cache turns out to be stale.
+    UINT prgRomCrcs[RomBlockCache::MaxPrgRomBlocks];
+    UINT chrRomCrcs[RomBlockCache::MaxChrRomBlocks];
+    UINT boardPrgRomCrcs[RomBlockCache::MaxPrgRomBlocks];
+    UINT boardChrRomCrcs[RomBlockCache::MaxChrRomBlocks];
+
+    GetBlockCrcs(pPrgRomData, prgRomDataSize, &prgRomCrcs[0]);
+    GetBlockCrcs(pChrRomData, chrRomDataSize, &chrRomCrcs[0]);
+
+    BOOL predicted = m_pBlockCache && m_pBlockCache->valid &&
+                     (m_pBlockCache->prgRomSize == prgRomDataSize) &&
+                     (m_pBlockCache->chrRomSize == chrRomDataSize);
+
+    if (predicted)
+    {
+        memcpy(&boardPrgRomCrcs[0], &m_pBlockCache->prgRomCrcs[0], sizeof(boardPrgRomCrcs));
+        memcpy(&boardChrRomCrcs[0], &m_pBlockCache->chrRomCrcs[0], sizeof(boardChrRomCrcs));
+    }
+
+    if (m_pBlockCache)
+    {
+        m_pBlockCache->valid = FALSE;
+    }
+
+    const BOOL verify  = (flags & RomLoadFlagVerify) != 0;
+    BOOL       matches = TRUE;
+    BOOL       done    = FALSE;
+
+    while (success && !done)
+    {
+        if (!predicted)
+        {
+            success = success && QueryBlockCrcs(MemSpaceCpu,
+                                                0x8000,
+                                                prgRomDataSize,
+                                                &boardPrgRomCrcs[0]);
+            success = success && QueryBlockCrcs(MemSpacePpu,
+                                                0x0000,
+                                                chrRomDataSize,
+                                                &boardChrRomCrcs[0]);
+        }
+
+        // Copy the changed PRG ROM and CHR ROM blocks.
+        m_streamBase = 0;
+
+        AtomicStore(&m_totalBytes,
+                    static_cast<LONG>(GetChangedBytes(prgRomDataSize,
+                                                      &prgRomCrcs[0],
+                                                      &boardPrgRomCrcs[0]) +
+                                      GetChangedBytes(chrRomDataSize,
+                                                      &chrRomCrcs[0],
+                                                      &boardChrRomCrcs[0])));
+        AtomicStore(&m_bytesDone, 0);
+
+        success = success && SendChangedBlocks(MemSpaceCpu,
+                                               0x8000,
+                                               pPrgRomData,
+                                               prgRomDataSize,
+                                               &prgRomCrcs[0],
+                                               &boardPrgRomCrcs[0]);
+        success = success && SendChangedBlocks(MemSpacePpu,
+                                               0x0000,
+                                               pChrRomData,
+                                               chrRomDataSize,
+                                               &chrRomCrcs[0],
+                                               &boardChrRomCrcs[0]);
+
+        // Check the upload with an on-device CRC of each region rather than reading it back.  A
+        // cache prediction is always checked.
+        BYTE prgRomCrc[MemCrcPacket::RspSize];
+        BYTE chrRomCrc[MemCrcPacket::RspSize];
+
+        const BOOL check = verify || predicted;
+
+        MemCrcPacket prgRomCrcPacket(MemSpaceCpu, 0x8000, static_cast<USHORT>(prgRomDataSize));
+        success = success && (!check ||
+                              m_pSerialComm->SubmitPacket(prgRomCrcPacket, &prgRomCrc[0]));
+
+        if (check && chrRomDataSize)
+        {
+            MemCrcPacket chrRomCrcPacket(MemSpacePpu, 0x0000, static_cast<USHORT>(chrRomDataSize));
+            success = success && m_pSerialComm->SubmitPacket(chrRomCrcPacket, &chrRomCrc[0]);
+        }
+
+        success = m_pSerialComm->Drain() && success;
+
+        matches = !check ||
+                  (MemCrcPacket::RspMatches(&prgRomCrc[0], pPrgRomData, prgRomDataSize) &&
+                   (!chrRomDataSize ||
+                    MemCrcPacket::RspMatches(&chrRomCrc[0], pChrRomData, chrRomDataSize)));
+
+        // The board's memory changed since the cached image was loaded.  Ask it what it holds.
+        done      = matches || !predicted;
+        predicted = FALSE;
+    }
+
+    if (success && !matches)
+    {
+        m_pfnProgress      = NULL;
+        m_pProgressContext = NULL;
+
+        return ROM_LOAD_RESULT_VERIFY_FAILED;
+    }
+
+    if (success && m_pBlockCache)
+    {
+        m_pBlockCache->prgRomSize = prgRomDataSize;
+        m_pBlockCache->chrRomSize = chrRomDataSize;
+
+        memcpy(&m_pBlockCache->prgRomCrcs[0], &prgRomCrcs[0], sizeof(prgRomCrcs));
+        memcpy(&m_pBlockCache->chrRomCrcs[0], &chrRomCrcs[0], sizeof(chrRomCrcs));
+
+        m_pBlockCache->valid = TRUE;
+    }
+
+    if (flags & RomLoadFlagRun)
+    {
+        // Update PC to point at the reset interrupt vector location.
+        BYTE pclVal = pPrgRomData[prgRomDataSize - 4];
+        BYTE pchVal = pPrgRomData[prgRomDataSize - 3];
+
+        CpuRegWrPacket pclRegWrPacket(CpuRegPcl, pclVal);
+        success = success && m_pSerialComm->SubmitPacket(pclRegWrPacket);
+        CpuRegWrPacket pchRegWrPacket(CpuRegPch, pchVal);
+        success = success && m_pSerialComm->SubmitPacket(pchRegWrPacket);
+
+        // Issue a debug run command.
+        DbgRunPacket dbgRunPacket;
+        success = success && m_pSerialComm->SubmitPacket(dbgRunPacket);
+
+        // Flush the batch and wait for it to go out.
+        success = m_pSerialComm->Drain() && success;
+    }
+
+    m_pfnProgress      = NULL;
+    m_pProgressContext = NULL;
+
+    return (success) ? ROM_LOAD_RESULT_SUCCESS : ROM_LOAD_RESULT_COMM_ERROR;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::StartLoadFile()
+*  % Description: Memory-maps the specified iNES file and, if it is supported, starts uploading it
+*                 to the NES FPGA on the load thread.  Poll IsLoadDone() and GetBytesDone(), then
+*                 call FinishLoad() for the result.
+*  % Returns:     ROM_LOAD_RESULT_SUCCESS if the upload was started, the failure reason otherwise.
+***************************************************************************************************/
+RomLoadResult RomLoader::StartLoadFile(
+    const TCHAR* pFilePath,  // path to .nes file
+    UINT         flags)      // RomLoadFlag options
+{
+    RomLoadResult ret = OpenFile(pFilePath, &m_rom);
+
+    if (ret == ROM_LOAD_RESULT_SUCCESS)
+    {
+        m_loadFlags  = flags;
+        m_loadResult = ROM_LOAD_RESULT_COMM_ERROR;
+
+        AtomicStore(&m_totalBytes, static_cast<LONG>(m_rom.PrgRomSize() + m_rom.ChrRomSize()));
+        AtomicStore(&m_bytesDone, 0);
+        AtomicStore(&m_loadDone, FALSE);
+
+        if (!m_loadThread.Start(LoadThreadProc, this))
+        {
+            ret = ROM_LOAD_RESULT_COMM_ERROR;
+        }
+    }
+
+    if (ret != ROM_LOAD_RESULT_SUCCESS)
+    {
+        m_rom.Close();
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::IsLoadDone()
+*  % Description: Checks whether the upload started with StartLoadFile() has finished.
+*  % Returns:     TRUE if FinishLoad() will return without waiting, FALSE otherwise.
+***************************************************************************************************/
+BOOL RomLoader::IsLoadDone() const
+{
+    return AtomicLoad(&m_loadDone) != FALSE;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::GetBytesDone()
+*  % Description: Returns the progress of the current load.  May be called from any thread.
+*  % Returns:     ROM bytes transmitted so far, out of GetTotalBytes().
+***************************************************************************************************/
+UINT RomLoader::GetBytesDone() const
+{
+    return static_cast<UINT>(AtomicLoad(&m_bytesDone));
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::GetTotalBytes()
+*  % Description: Returns the size of the current load.  May be called from any thread.  Once the
+*                 board's contents are known this drops to the size of the blocks that changed.
+*  % Returns:     ROM bytes to transmit for the current load.
+***************************************************************************************************/
+UINT RomLoader::GetTotalBytes() const
+{
+    return static_cast<UINT>(AtomicLoad(&m_totalBytes));
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::FinishLoad()
+*  % Description: Waits for the upload started with StartLoadFile() to finish, and unmaps the file.
+*  % Returns:     Result of the load.
+***************************************************************************************************/
+RomLoadResult RomLoader::FinishLoad()
+{
+    m_loadThread.Join();
+    m_rom.Close();
+
+    return m_loadResult;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::OpenFile()
+*  % Description: Memory-maps the specified iNES file and checks that it is supported, without
+*                 touching the NES FPGA, so a bad ROM can be reported before connecting.  On
+*                 success the caller uploads pRom with Load().
+*  % Returns:     ROM_LOAD_RESULT_SUCCESS if the image is loadable, the failure reason otherwise.
+***************************************************************************************************/
+RomLoadResult RomLoader::OpenFile(
+    const TCHAR* pFilePath,  // path to .nes file
+    INesRom*     pRom)       // receives the parsed image
+{
+    RomLoadResult ret = GetParseResult(pRom->Open(pFilePath));
+
+    if (ret == ROM_LOAD_RESULT_SUCCESS)
+    {
+        ret = Validate(*pRom);
+    }
+
+    if (ret != ROM_LOAD_RESULT_SUCCESS)
+    {
+        pRom->Close();
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::GetResultString()
+*  % Description: Returns a user readable description of a RomLoadResult.
+***************************************************************************************************/
+const TCHAR* RomLoader::GetResultString(
+    RomLoadResult result)  // result to describe
+{
+    // Indexed by RomLoadResult.
+    static const TCHAR* resultStrTbl[] =
+    {
+        _T("ROM loaded successfully."),                               // SUCCESS
+        _T("Failed to open ROM file."),                               // OPEN_FAILED
+        _T("Invalid ROM header."),                                    // INVALID_HEADER
+        _T("ROM file is smaller than its header specifies."),         // TRUNCATED
+        _T("Too many ROM banks."),                                    // TOO_MANY_BANKS
+        _T("Only horizontal and vertical mirroring are supported."),  // UNSUPPORTED_MIRRORING
+        _T("Only mapper 0 is supported."),                            // UNSUPPORTED_MAPPER
+        _T("Communication with the NES FPGA failed."),                // COMM_ERROR
+        _T("ROM data on the NES FPGA does not match the ROM file.")   // VERIFY_FAILED
+    };
+
+    return resultStrTbl[result];
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::Validate()
+*  % Description: Checks that a parsed iNES image is supported by the FPGA cartridge emulation.
+*  % Returns:     ROM_LOAD_RESULT_SUCCESS if the image is loadable, the failure reason otherwise.
+***************************************************************************************************/
+RomLoadResult RomLoader::Validate(
+    const INesRom& rom)  // parsed iNES image
+{
+    // PRG ROM is mirrored to fill 0x8000-0xFFFF, so it must be one or two whole banks.
+    if ((rom.PrgRomSize() > MaxPrgRomSize) || (rom.ChrRomSize() > MaxChrRomSize) ||
+        (rom.PrgRomSize() % INesRom::PrgRomBankSize) ||
+        (rom.ChrRomSize() % INesRom::ChrRomBankSize))
+    {
+        return ROM_LOAD_RESULT_TOO_MANY_BANKS;
+    }
+
+    // Check mirror support.
+    if (rom.GetMirroring() == INesMirroringFourScreen)
+    {
+        return ROM_LOAD_RESULT_UNSUPPORTED_MIRRORING;
+    }
+
+    if (rom.GetMapper() != 0)
+    {
+        return ROM_LOAD_RESULT_UNSUPPORTED_MAPPER;
+    }
+
+    return ROM_LOAD_RESULT_SUCCESS;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::GetParseResult()
+*  % Description: Maps the result of parsing an iNES image to a RomLoadResult.
+*  % Returns:     Equivalent RomLoadResult.
+***************************************************************************************************/
+RomLoadResult RomLoader::GetParseResult(
+    INesResult result)  // result of INesRom::Open() or INesRom::Parse()
+{
+    RomLoadResult ret = ROM_LOAD_RESULT_SUCCESS;
+
+    switch (result)
+    {
+        case INES_RESULT_SUCCESS:         ret = ROM_LOAD_RESULT_SUCCESS;         break;
+        case INES_RESULT_OPEN_FAILED:     ret = ROM_LOAD_RESULT_OPEN_FAILED;     break;
+        case INES_RESULT_INVALID_HEADER:  ret = ROM_LOAD_RESULT_INVALID_HEADER;  break;
+        case INES_RESULT_TRUNCATED:       ret = ROM_LOAD_RESULT_TRUNCATED;       break;
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::QueryBlockCrcs()
+*  % Description: Asks the NES for the CRC of each RomBlockCache::BlockSize block of a memory range,
+*                 and waits for the answers.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL RomLoader::QueryBlockCrcs(
+    MemSpace space,     // address space
+    USHORT   addr,      // first address of the range
+    UINT     numBytes,  // size of the range, a multiple of RomBlockCache::BlockSize
+    UINT*    pCrcs)     // receives numBytes / RomBlockCache::BlockSize CRCs
+{
+    const UINT blockCnt = numBytes / RomBlockCache::BlockSize;
+
+    BYTE rsp[RomBlockCache::MaxPrgRomBlocks * MemCrcPacket::RspSize];
+    assert(blockCnt <= RomBlockCache::MaxPrgRomBlocks);
+
+    BOOL ret = TRUE;
+
+    for (UINT blockIdx = 0; ret && (blockIdx < blockCnt); blockIdx++)
+    {
+        MemCrcPacket packet(space,
+                            static_cast<USHORT>(addr + (blockIdx * RomBlockCache::BlockSize)),
+                            static_cast<USHORT>(RomBlockCache::BlockSize));
+        ret = m_pSerialComm->SubmitPacket(packet, &rsp[blockIdx * MemCrcPacket::RspSize]);
+    }
+
+    ret = m_pSerialComm->Drain() && ret;
+
+    for (UINT blockIdx = 0; ret && (blockIdx < blockCnt); blockIdx++)
+    {
+        pCrcs[blockIdx] = MemCrcPacket::GetRspCrc(&rsp[blockIdx * MemCrcPacket::RspSize]);
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::SendChangedBlocks()
+*  % Description: Stages writes of the blocks of a memory range whose CRC differs from the board's,
+*                 merging neighbouring blocks into one compressed stream.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL RomLoader::SendChangedBlocks(
+    MemSpace    space,       // address space
+    USHORT      addr,        // first address of the range
+    const BYTE* pData,       // new contents of the range
+    UINT        numBytes,    // size of pData, a multiple of RomBlockCache::BlockSize
+    const UINT* pCrcs,       // CRC of each block of pData
+    const UINT* pBoardCrcs)  // CRC of each block the board holds
+{
+    const UINT blockCnt = numBytes / RomBlockCache::BlockSize;
+
+    BOOL ret = TRUE;
+
+    for (UINT blockIdx = 0; ret && (blockIdx < blockCnt); blockIdx++)
+    {
+        if (pCrcs[blockIdx] != pBoardCrcs[blockIdx])
+        {
+            const UINT firstBlockIdx = blockIdx;
+
+            while ((blockIdx + 1 < blockCnt) && (pCrcs[blockIdx + 1] != pBoardCrcs[blockIdx + 1]))
+            {
+                blockIdx++;
+            }
+
+            const UINT offset      = firstBlockIdx * RomBlockCache::BlockSize;
+            const UINT streamBytes = (blockIdx + 1) * RomBlockCache::BlockSize - offset;
+
+            ret = m_pSerialComm->StreamWriteCompressed(space,
+                                                       static_cast<USHORT>(addr + offset),
+                                                       &pData[offset],
+                                                       streamBytes,
+                                                       StreamProgress,
+                                                       this);
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::GetBlockCrcs()
+*  % Description: Computes the CRC of each RomBlockCache::BlockSize block of the specified data.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID RomLoader::GetBlockCrcs(
+    const BYTE* pData,     // data to checksum
+    UINT        numBytes,  // size of pData, a multiple of RomBlockCache::BlockSize
+    UINT*       pCrcs)     // receives numBytes / RomBlockCache::BlockSize CRCs
+{
+    for (UINT offset = 0; offset < numBytes; offset += RomBlockCache::BlockSize)
+    {
+        *pCrcs++ = MemCrcPacket::UpdateCrc(0, &pData[offset], RomBlockCache::BlockSize);
+    }
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::GetChangedBytes()
+*  % Description: Works out how much of a memory range SendChangedBlocks() will send.
+*  % Returns:     Size of the blocks whose CRC differs from the board's, in bytes.
+***************************************************************************************************/
+UINT RomLoader::GetChangedBytes(
+    UINT        numBytes,    // size of the range, a multiple of RomBlockCache::BlockSize
+    const UINT* pCrcs,       // CRC of each block of the range's new contents
+    const UINT* pBoardCrcs)  // CRC of each block the board holds
+{
+    UINT ret = 0;
+
+    for (UINT blockIdx = 0; blockIdx < numBytes / RomBlockCache::BlockSize; blockIdx++)
+    {
+        if (pCrcs[blockIdx] != pBoardCrcs[blockIdx])
+        {
+            ret += RomBlockCache::BlockSize;
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::ReportProgress()
+*  % Description: Publishes load progress for GetBytesDone(), and passes it on to the caller's
+*                 progress callback, if any.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID RomLoader::ReportProgress(
+    UINT bytesDone)  // ROM bytes transmitted so far
+{
+    AtomicStore(&m_bytesDone, static_cast<LONG>(bytesDone));
+
+    if (m_pfnProgress)
+    {
+        m_pfnProgress(m_pProgressContext, bytesDone, GetTotalBytes());
+    }
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::StreamProgress()
+*  % Description: SerialComm stream progress callback for the streams staged by SendChangedBlocks().
+*                 Streams complete in the order they were staged, so the load's progress is the
+*                 size of the streams already complete plus the progress of this one.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID RomLoader::StreamProgress(
+    VOID* pContext,    // RomLoader performing the load
+    UINT  bytesDone,   // stream bytes transmitted so far
+    UINT  totalBytes)  // stream size
+{
+    RomLoader* pRomLoader = static_cast<RomLoader*>(pContext);
+
+    pRomLoader->ReportProgress(pRomLoader->m_streamBase + bytesDone);
+
+    if (bytesDone == totalBytes)
+    {
+        pRomLoader->m_streamBase += totalBytes;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::LoadThreadProc()
+*  % Description: Load thread entry point.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID RomLoader::LoadThreadProc(
+    VOID* pContext)  // RomLoader object
+{
+    static_cast<RomLoader*>(pContext)->LoadThread();
+}
+
+/***************************************************************************************************
+** % Method:      RomLoader::LoadThread()
+*  % Description: Load thread body.  Uploads m_rom, then flags the load as done.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID RomLoader::LoadThread()
+{
+    m_loadResult = Load(m_rom, m_loadFlags, NULL, NULL);
+
+    AtomicStore(&m_loadDone, TRUE);
+}
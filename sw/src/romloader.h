@@ -0,0 +1,173 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/romloader.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  RomLoader class header.
+***************************************************************************************************/
+
+#ifndef ROMLOADER_H
+#define ROMLOADER_H
+
+#include "dbgpacket.h"
+#include "inesrom.h"
+#include "thread.h"
+
+class SerialComm;
+
+/***************************************************************************************************
+** % Enum:        RomLoadResult
+*  % Description: Conveys result of a ROM load.
+***************************************************************************************************/
+enum RomLoadResult
+{
+    ROM_LOAD_RESULT_SUCCESS,
+    ROM_LOAD_RESULT_OPEN_FAILED,
+    ROM_LOAD_RESULT_INVALID_HEADER,
+    ROM_LOAD_RESULT_TRUNCATED,
+    ROM_LOAD_RESULT_TOO_MANY_BANKS,
+    ROM_LOAD_RESULT_UNSUPPORTED_MIRRORING,
+    ROM_LOAD_RESULT_UNSUPPORTED_MAPPER,
+    ROM_LOAD_RESULT_COMM_ERROR,
+    ROM_LOAD_RESULT_VERIFY_FAILED
+};
+
+// Options for RomLoader::Load().
+enum RomLoadFlag
+{
+    RomLoadFlagVerify = 0x1, // check the upload with an on-device CRC of each ROM region
+    RomLoadFlagRun    = 0x2, // start the CPU at the image's reset vector (otherwise left halted)
+};
+
+// Called as ROM data is transferred to the NES FPGA.
+typedef VOID (*RomLoadProgressCallback)(VOID* pContext, UINT bytesDone, UINT totalBytes);
+
+// Block CRCs of the ROM image last uploaded to a board, so the next load can predict what the board
+// holds instead of asking it.  Keep one per board, zero-initialized, and pass it to each RomLoader
+// used with that board.
+struct RomBlockCache
+{
+    static const UINT BlockSize       = 0x400;                                    // bytes per block
+    static const UINT MaxPrgRomBlocks = 2 * INesRom::PrgRomBankSize / BlockSize;  // 32KB of PRG ROM
+    static const UINT MaxChrRomBlocks = 1 * INesRom::ChrRomBankSize / BlockSize;  // 8KB of CHR ROM
+
+    BOOL valid;                         // TRUE if the fields below describe the board's contents
+    UINT prgRomSize;                    // PRG ROM size of the cached image, in bytes
+    UINT chrRomSize;                    // CHR ROM size of the cached image, in bytes
+    UINT prgRomCrcs[MaxPrgRomBlocks];   // CRC of each PRG ROM block
+    UINT chrRomCrcs[MaxChrRomBlocks];   // CRC of each CHR ROM block
+};
+
+/***************************************************************************************************
+** % Class:       RomLoader
+*  % Description: Checks that iNES ROM images (as parsed by INesRom) are supported by the FPGA
+*                 cartridge emulation, and uploads them to the NES FPGA.
+*
+*                 StartLoadFile() runs the upload on a load thread, so the caller stays responsive
+*                 and the load thread can keep SerialComm's request queue (and so the serial line)
+*                 full.  Progress is published through an atomic counter for the caller to poll
+*                 with GetBytesDone(), rather than through a callback on the load thread.  The
+*                 SerialComm must not be used by any other thread until FinishLoad() returns.
+*
+*                 Uploads are incremental.  The image is split into RomBlockCache::BlockSize
+*                 blocks, and only blocks whose CRC differs from the board's copy are sent.  The
+*                 board's block CRCs come from the RomBlockCache if it describes an image of the
+*                 same size, and otherwise from MemCrc packets.  A cache prediction is always
+*                 checked with a CRC of each ROM region, and if the board's memory changed behind
+*                 the cache's back the board is asked for its block CRCs and the load redone.
+***************************************************************************************************/
+class RomLoader
+{
+public:
+    explicit RomLoader(SerialComm* pSerialComm, RomBlockCache* pBlockCache = NULL);
+    ~RomLoader();
+
+    RomLoadResult LoadFile(const TCHAR*            pFilePath,
+                           UINT                    flags,
+                           RomLoadProgressCallback pfnProgress,
+                           VOID*                   pContext);
+    RomLoadResult Load(const BYTE*             pRomData,
+                       UINT                    romDataSize,
+                       UINT                    flags,
+                       RomLoadProgressCallback pfnProgress,
+                       VOID*                   pContext);
+    RomLoadResult Load(const INesRom&          rom,
+                       UINT                    flags,
+                       RomLoadProgressCallback pfnProgress,
+                       VOID*                   pContext);
+
+    RomLoadResult StartLoadFile(const TCHAR* pFilePath, UINT flags);
+    BOOL          IsLoadDone() const;
+    UINT          GetBytesDone() const;
+    UINT          GetTotalBytes() const;
+    RomLoadResult FinishLoad();
+
+    static RomLoadResult OpenFile(const TCHAR* pFilePath, INesRom* pRom);
+    static const TCHAR*  GetResultString(RomLoadResult result);
+
+private:
+    RomLoader& operator=(const RomLoader&);
+    RomLoader(const RomLoader&);
+
+    static RomLoadResult Validate(const INesRom& rom);
+
+    static RomLoadResult GetParseResult(INesResult result);
+
+    BOOL QueryBlockCrcs(MemSpace space, USHORT addr, UINT numBytes, UINT* pCrcs);
+    BOOL SendChangedBlocks(MemSpace    space,
+                           USHORT      addr,
+                           const BYTE* pData,
+                           UINT        numBytes,
+                           const UINT* pCrcs,
+                           const UINT* pBoardCrcs);
+
+    static VOID GetBlockCrcs(const BYTE* pData, UINT numBytes, UINT* pCrcs);
+    static UINT GetChangedBytes(UINT numBytes, const UINT* pCrcs, const UINT* pBoardCrcs);
+
+    VOID ReportProgress(UINT bytesDone);
+
+    static VOID StreamProgress(VOID* pContext, UINT bytesDone, UINT totalBytes);
+
+    VOID LoadThread();
+
+    static VOID LoadThreadProc(VOID* pContext);
+
+    static const UINT MaxPrgRomSize = 2 * INesRom::PrgRomBankSize;  // largest supported PRG ROM
+    static const UINT MaxChrRomSize = 1 * INesRom::ChrRomBankSize;  // largest supported CHR ROM
+
+    SerialComm*             m_pSerialComm;       // used to reach the NES FPGA
+    RomBlockCache*          m_pBlockCache;       // board's block CRC cache (may be NULL)
+    RomLoadProgressCallback m_pfnProgress;       // progress callback for the current load
+    VOID*                   m_pProgressContext;  // context passed to m_pfnProgress
+    volatile LONG           m_totalBytes;        // ROM bytes to transmit for the current load
+    UINT                    m_streamBase;        // bytes of completed streams in the current load
+
+    INesRom                 m_rom;               // image uploaded by the load thread
+    UINT                    m_loadFlags;         // RomLoadFlag options for the load thread
+    RomLoadResult           m_loadResult;        // result of the load thread's upload
+    Thread                  m_loadThread;        // runs uploads started with StartLoadFile()
+    volatile LONG           m_bytesDone;         // ROM bytes transmitted so far (any thread)
+    volatile LONG           m_loadDone;          // set once the load thread's upload finishes
+};
+
+#endif // ROMLOADER_H
+
@@ -25,11 +25,10 @@
 *  ScriptMgr class implementation.
 ***************************************************************************************************/
 
+#include <stdarg.h>
 #include <lua.hpp>
 
 #include "dbgpacket.h"
-#include "nesdbg.h"
-#include "resource.h"
 #include "scriptmgr.h"
 #include "serialcomm.h"
 
@@ -41,9 +40,15 @@ const TCHAR* ScriptMgr::__pAsmPrgDir = _T("../asm/prg/");
 *  % Description: ScriptMgr constructor.
 ***************************************************************************************************/
 ScriptMgr::ScriptMgr(
-    NesDbg* pNesDbg)  // NesDbg object that is creating this script manager
+    SerialComm* pSerialComm)  // serial communication manager used to reach the NES FPGA
     :
-    m_pNesDbg(pNesDbg)
+    m_pSerialComm(pSerialComm),
+    m_pLuaVm(NULL),
+    m_program()
+#ifdef _WIN32
+    ,
+    m_hWndDlg(NULL)
+#endif
 {
 }
 
@@ -83,6 +88,14 @@ BOOL ScriptMgr::Init()
         luaopen_math(m_pLuaVm);
     }
 
+    // Store a pointer to this object in the lua registry, so the static lua/C functions can find
+    // their ScriptMgr.
+    if (ret)
+    {
+        lua_pushlightuserdata(m_pLuaVm, this);
+        lua_setfield(m_pLuaVm, LUA_REGISTRYINDEX, "ScriptMgr");
+    }
+
     // Register lua/C functions.
     if (ret)
     {
@@ -104,6 +117,15 @@ BOOL ScriptMgr::Init()
             { "LoadAsm",     LuaLoadAsm     },
             { "PpuMemRd",    LuaPpuMemRd    },
             { "PpuMemWr",    LuaPpuMemWr    },
+            { "MultiRd",     LuaMultiRd     },
+            { "Fill",        LuaFill        },
+            { "MemCrc",      LuaMemCrc      },
+            { "MemCompare",  LuaMemCompare  },
+            { "CpuRegsRd",   LuaCpuRegsRd   },
+            { "CpuRegsWr",   LuaCpuRegsWr   },
+            { "Wait",        LuaWait        },
+            { "ProgWr",      LuaProgWr      },
+            { "ProgRun",     LuaProgRun     },
             { NULL,          NULL           }
         };
 
@@ -124,9 +146,18 @@ ScriptResult ScriptMgr::ExecuteScript(
     ScriptResult ret = SCRIPT_RESULT_ERROR;
 
     const CHAR* pAsciiFilePath = CreateAsciiString(pFilePath);
-    INT luaRet = luaL_dofile(g_pNesDbg->GetScriptMgr()->m_pLuaVm, pAsciiFilePath);
+    INT luaRet = luaL_dofile(m_pLuaVm, pAsciiFilePath);
 
-    if (luaRet == 0)
+    // Writes are issued asynchronously; make sure the last of them reached the FPGA.
+    BOOL drained = m_pSerialComm->Drain();
+
+    if ((luaRet == 0) && !drained)
+    {
+        ret = SCRIPT_RESULT_ERROR;
+
+        AppendOutput(_T("Lost communication with the NES FPGA.\r\n"));
+    }
+    else if (luaRet == 0)
     {
         ret = static_cast<ScriptResult>(static_cast<UINT>(lua_tonumber(m_pLuaVm, -1)));
     }
@@ -135,7 +166,7 @@ ScriptResult ScriptMgr::ExecuteScript(
         ret = SCRIPT_RESULT_ERROR;
 
         const TCHAR* pErrString = CreateTcharString(lua_tostring(m_pLuaVm, -1));
-        TestScriptDlgAppendOutput(_T("%s\r\n"), pErrString);
+        AppendOutput(_T("%s\r\n"), pErrString);
         DestroyTcharString(pErrString);
     }
 
@@ -144,6 +175,131 @@ ScriptResult ScriptMgr::ExecuteScript(
     return ret;
 }
 
+/***************************************************************************************************
+** % Method:      ScriptMgr::AppendOutput()
+*  % Description: Appends the specified string to the script output: the test script dialog if it
+*                 is open, stdout otherwise.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID ScriptMgr::AppendOutput(
+    const TCHAR* pFmtText,  // format string for output
+    ...)                    // var args
+{
+    static const UINT TmpBufSize = 1024;
+    TCHAR tmpBuf[TmpBufSize];
+
+    va_list argList;
+
+    va_start(argList, pFmtText);
+    _vstprintf_s(&tmpBuf[0], TmpBufSize, pFmtText, argList);
+    va_end(argList);
+
+#ifdef _WIN32
+    if (m_hWndDlg)
+    {
+        TestScriptDlgAppendOutput(_T("%s"), &tmpBuf[0]);
+        return;
+    }
+#endif
+
+    _fputts(&tmpBuf[0], stdout);
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::GetScriptMgr()
+*  % Description: Retrieves the ScriptMgr object that owns the specified lua state.
+*  % Returns:     Owning ScriptMgr object.
+***************************************************************************************************/
+ScriptMgr* ScriptMgr::GetScriptMgr(
+    lua_State* pLuaVm)  // lua state
+{
+    lua_getfield(pLuaVm, LUA_REGISTRYINDEX, "ScriptMgr");
+    ScriptMgr* pScriptMgr = static_cast<ScriptMgr*>(lua_touserdata(pLuaVm, -1));
+    lua_pop(pLuaVm, 1);
+
+    assert(pScriptMgr);
+    return pScriptMgr;
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::PushByteTable()
+*  % Description: Pushes a lua array holding the specified bytes.  The table is created at its final
+*                 size, so filling it doesn't rehash.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID ScriptMgr::PushByteTable(
+    lua_State*  pLuaVm,    // lua state
+    const BYTE* pData,     // bytes to push
+    UINT        numBytes)  // number of bytes in pData
+{
+    lua_createtable(pLuaVm, numBytes, 0);
+
+    for (UINT i = 0; i < numBytes; i++)
+    {
+        lua_pushinteger(pLuaVm, pData[i]);
+        lua_rawseti(pLuaVm, -2, i + 1);
+    }
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::AppendProgCmd()
+*  % Description: Adds the ProgWr command table at the top of the lua stack to a program.
+*  % Returns:     TRUE if the command was added, FALSE if it is malformed, unsupported, or doesn't
+*                 fit.
+***************************************************************************************************/
+BOOL ScriptMgr::AppendProgCmd(
+    lua_State*  pLuaVm,    // lua state
+    DbgProgram* pProgram)  // program to add the command to
+{
+    BOOL ret = FALSE;
+
+    if (lua_istable(pLuaVm, -1))
+    {
+        lua_rawgeti(pLuaVm, -1, 1);
+        lua_rawgeti(pLuaVm, -2, 2);
+        lua_rawgeti(pLuaVm, -3, 3);
+        lua_rawgeti(pLuaVm, -4, 4);
+
+        const UINT   op   = static_cast<UINT>(lua_tonumber(pLuaVm, -4));
+        const USHORT arg1 = static_cast<USHORT>(lua_tonumber(pLuaVm, -3));
+        const USHORT arg2 = static_cast<USHORT>(lua_tonumber(pLuaVm, -2));
+        const USHORT arg3 = static_cast<USHORT>(lua_tonumber(pLuaVm, -1));
+
+        switch (op)
+        {
+            case DbgPacketOpCodeDbgHlt:
+                ret = pProgram->Append(DbgHltPacket());
+                break;
+            case DbgPacketOpCodeDbgRun:
+                ret = pProgram->Append(DbgRunPacket());
+                break;
+            case DbgPacketOpCodeCpuRegsRd:
+                ret = pProgram->Append(CpuRegsRdPacket());
+                break;
+            case DbgPacketOpCodeCpuRegWr:
+                ret = (arg1 < CpuRegCnt) &&
+                      pProgram->Append(CpuRegWrPacket(static_cast<CpuReg>(arg1),
+                                                      static_cast<BYTE>(arg2)));
+                break;
+            case DbgPacketOpCodeCpuMemRd:
+                ret = pProgram->Append(CpuMemRdPacket(arg1, arg2));
+                break;
+            case DbgPacketOpCodePpuMemRd:
+                ret = pProgram->Append(PpuMemRdPacket(arg1, arg2));
+                break;
+            case DbgPacketOpCodeMemCrc:
+                ret = pProgram->Append(MemCrcPacket(static_cast<MemSpace>(arg1 & 0x01),
+                                                    arg2,
+                                                    arg3));
+                break;
+        }
+
+        lua_pop(pLuaVm, 4);
+    }
+
+    return ret;
+}
+
 /***************************************************************************************************
 ** % Method:      ScriptMgr::LuaPrint()
 *  % Description: Overload standard lua print with a version that outputs to the test script dialog
@@ -153,7 +309,7 @@ ScriptResult ScriptMgr::ExecuteScript(
 INT ScriptMgr::LuaPrint(
     lua_State* pLuaVm)  // lua state
 {
-    ScriptMgr* pScriptMgr = g_pNesDbg->GetScriptMgr();
+    ScriptMgr* pScriptMgr = GetScriptMgr(pLuaVm);
 
     // Usage: print(input [string])
     if (!lua_isstring(pLuaVm, 1))
@@ -163,7 +319,7 @@ INT ScriptMgr::LuaPrint(
     }
 
     const TCHAR* pString = CreateTcharString(lua_tostring(pLuaVm, 1));
-    pScriptMgr->TestScriptDlgAppendOutput(pString);
+    pScriptMgr->AppendOutput(_T("%s"), pString);
     DestroyTcharString(pString);
 
     return 0;
@@ -172,11 +328,14 @@ INT ScriptMgr::LuaPrint(
 /***************************************************************************************************
 ** % Method:      ScriptMgr::LuaEcho()
 *  % Description: Issues a echo debug packet to the FPGA and returns an array with the result data.
+*                 Raises a lua error if communication with the FPGA fails.
 *  % Returns:     Number of values returned to lua.  (1)
 ***************************************************************************************************/
 INT ScriptMgr::LuaEcho(
     lua_State* pLuaVm)  // lua state
 {
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
     // Usage: [table] Echo(numBytes [number], inData [table])
     if (!lua_isnumber(pLuaVm, 1) || !lua_istable(pLuaVm, 2))
     {
@@ -184,10 +343,12 @@ INT ScriptMgr::LuaEcho(
         return 0;
     }
 
-    // Read the number of echo bytes from arg 1, and allocate memory on the heap to store it.
-    USHORT numBytes = static_cast<USHORT>(lua_tonumber(pLuaVm, 1));
-    BYTE* pEchoData = new BYTE [numBytes];
-    assert(pEchoData);
+    ScriptMgr* pScriptMgr = GetScriptMgr(pLuaVm);
+
+    // Read the number of echo bytes from arg 1.  The data is staged in the script manager's TX
+    // buffer, which holds the largest possible packet.
+    USHORT numBytes  = static_cast<USHORT>(lua_tonumber(pLuaVm, 1));
+    BYTE*  pEchoData = &pScriptMgr->m_txBuf[0];
 
     // Copy the array from arg 2 into pEchoData.
     for (UINT i = 1; i <= numBytes; i++)
@@ -197,29 +358,26 @@ INT ScriptMgr::LuaEcho(
         lua_pop(pLuaVm, 1);
     }
 
-    // Create an echo packet, and issue it to the FPGA.
-    EchoPacket echoPacket(pEchoData, numBytes);
-    g_pNesDbg->GetSerialComm()->SendData(echoPacket.PacketData(), echoPacket.SizeInBytes());
+    // Issue an echo packet to the FPGA, and wait for the data to come back.
+    UINT  bytesToReceive;
+    BYTE* pReceivedData = &pScriptMgr->m_rxBuf[0];
+    BOOL  ok;
 
-    // Allocate space to receive the FPGA returned data.
-    UINT bytesToReceive = echoPacket.ReturnBytesExpected();
-    BYTE* pReceivedData = new BYTE[bytesToReceive];
-    assert(pReceivedData);
+    {
+        EchoPacket echoPacket(pEchoData, numBytes);
 
-    // Read data back from the FPGA.
-    g_pNesDbg->GetSerialComm()->ReceiveData(pReceivedData, bytesToReceive);
+        bytesToReceive = echoPacket.ReturnBytesExpected();
+        ok             = pSerialComm->SubmitPacket(echoPacket, pReceivedData) &&
+                         pSerialComm->Drain();
+    }
 
-    // Push the return data into a return table.
-    lua_newtable(pLuaVm);
-    for (UINT i = 0; i < bytesToReceive; i++)
+    // luaL_error() doesn't return, so raise it once the packet is out of scope.
+    if (!ok)
     {
-        lua_pushnumber(pLuaVm, i + 1);
-        lua_pushnumber(pLuaVm, pReceivedData[i]);
-        lua_settable(pLuaVm, -3);
+        return luaL_error(pLuaVm, "Echo: lost communication with the NES FPGA.");
     }
 
-    delete [] pReceivedData;
-    delete [] pEchoData;
+    PushByteTable(pLuaVm, pReceivedData, bytesToReceive);
 
     return 1;
 }
@@ -233,6 +391,8 @@ INT ScriptMgr::LuaEcho(
 INT ScriptMgr::LuaCpuMemRd(
     lua_State* pLuaVm)  // lua state
 {
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
     // Usage: [table] CpuMemRd(address [number], numBytes [number])
     if (!lua_isnumber(pLuaVm, 1) || !lua_isnumber(pLuaVm, 2))
     {
@@ -241,30 +401,21 @@ INT ScriptMgr::LuaCpuMemRd(
     }
 
     USHORT addr     = static_cast<USHORT>(lua_tonumber(pLuaVm, 1));
-    USHORT numBytes = static_cast<USHORT>(lua_tonumber(pLuaVm, 2));
-
-    // Create a cpu memory read packet, and issue it to the FPGA.
-    CpuMemRdPacket cpuMemRdPacket(addr, numBytes);
-    g_pNesDbg->GetSerialComm()->SendData(cpuMemRdPacket.PacketData(), cpuMemRdPacket.SizeInBytes());
+    UINT   numBytes = static_cast<UINT>(lua_tonumber(pLuaVm, 2));
 
-    // Allocate space to receive the FPGA returned data.
-    UINT bytesToReceive = cpuMemRdPacket.ReturnBytesExpected();
-    BYTE* pReceivedData = new BYTE[bytesToReceive];
-    assert(pReceivedData);
-
-    // Read data back from the FPGA.
-    g_pNesDbg->GetSerialComm()->ReceiveData(pReceivedData, bytesToReceive);
-
-    // Push the return data into a return table.
-    lua_newtable(pLuaVm);
-    for (UINT i = 0; i < bytesToReceive; i++)
+    if (numBytes > MaxDataSize)
     {
-        lua_pushnumber(pLuaVm, i + 1);
-        lua_pushnumber(pLuaVm, pReceivedData[i]);
-        lua_settable(pLuaVm, -3);
+        assert(0);
+        return 0;
     }
 
-    delete [] pReceivedData;
+    // Stream the read to the FPGA, and wait for the data to come back.
+    BYTE* pReceivedData = &GetScriptMgr(pLuaVm)->m_rxBuf[0];
+
+    pSerialComm->StreamRead(MemSpaceCpu, addr, pReceivedData, numBytes);
+    pSerialComm->Drain();
+
+    PushByteTable(pLuaVm, pReceivedData, numBytes);
 
     return 1;
 }
@@ -278,6 +429,8 @@ INT ScriptMgr::LuaCpuMemRd(
 INT ScriptMgr::LuaCpuMemWr(
     lua_State* pLuaVm)  // lua state
 {
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
     // Usage: CpuMemWr(address [number], numBytes [number], data [table])
     if (!lua_isnumber(pLuaVm, 1) || !lua_isnumber(pLuaVm, 2)  || !lua_istable(pLuaVm, 3))
     {
@@ -286,13 +439,18 @@ INT ScriptMgr::LuaCpuMemWr(
     }
 
     USHORT addr     = static_cast<USHORT>(lua_tonumber(pLuaVm, 1));
-    USHORT numBytes = static_cast<USHORT>(lua_tonumber(pLuaVm, 2));
+    UINT   numBytes = static_cast<UINT>(lua_tonumber(pLuaVm, 2));
+
+    if (numBytes > MaxDataSize)
+    {
+        assert(0);
+        return 0;
+    }
 
-    // Allocate memory on the heap to store a copy of the lua data table.
-    BYTE* pData = new BYTE [numBytes];
-    assert(pData);
+    // Copy the lua data table from arg 3 into the TX buffer.  StreamWrite() copies it out again
+    // right away, so the buffer can be reused by the next call.
+    BYTE* pData = &GetScriptMgr(pLuaVm)->m_txBuf[0];
 
-    // Copy the array from arg 2 into pEchoData.
     for (UINT i = 1; i <= numBytes; i++)
     {
         lua_rawgeti(pLuaVm, 3, i);
@@ -300,13 +458,11 @@ INT ScriptMgr::LuaCpuMemWr(
         lua_pop(pLuaVm, 1);
     }
 
-    // Create a cpu memory write packet, and issue it to the FPGA.
-    CpuMemWrPacket cpuMemWrPacket(addr, numBytes, pData);
-    g_pNesDbg->GetSerialComm()->SendData(cpuMemWrPacket.PacketData(), cpuMemWrPacket.SizeInBytes());
+    // Queue the write for the FPGA.  No response is expected, so don't wait for it.
+    pSerialComm->StreamWrite(MemSpaceCpu, addr, pData, numBytes);
 
-    assert(cpuMemWrPacket.ReturnBytesExpected() == 0);
-
-    delete [] pData;
+    STATIC_ASSERT(!DbgOpSchema<DbgPacketOpCodeCpuMemWr>::RspSize &&
+                  !DbgOpSchema<DbgPacketOpCodeCpuMemWr>::RspLenOffset);
 
     return 0;
 }
@@ -320,8 +476,10 @@ INT ScriptMgr::LuaCpuMemWr(
 INT ScriptMgr::LuaDbgHlt(
     lua_State* pLuaVm)  // lua state
 {
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
     DbgHltPacket dbgHltPacket;
-    g_pNesDbg->GetSerialComm()->SendData(dbgHltPacket.PacketData(), dbgHltPacket.SizeInBytes());
+    pSerialComm->SubmitPacket(dbgHltPacket);
 
     return 0;
 }
@@ -334,45 +492,79 @@ INT ScriptMgr::LuaDbgHlt(
 INT ScriptMgr::LuaDbgRun(
     lua_State* pLuaVm)  // lua state
 {
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
     DbgRunPacket dbgRunPacket;
-    g_pNesDbg->GetSerialComm()->SendData(dbgRunPacket.PacketData(), dbgRunPacket.SizeInBytes());
+    pSerialComm->SubmitPacket(dbgRunPacket);
 
     return 0;
 }
 
 /***************************************************************************************************
 ** % Method:      ScriptMgr::LuaCpuRegRd()
-*  % Description: Issues a CpuRegRd debug packet to the FPGA and returns the register data.
+*  % Description: Issues a CpuRegRd debug packet to the FPGA and returns the register data.  If a
+*                 table of register selects is passed, all the reads are pipelined and a table of
+*                 results is returned.
 *  % Returns:     Number of values returned to lua.  (1)
 ***************************************************************************************************/
 INT ScriptMgr::LuaCpuRegRd(
     lua_State* pLuaVm)  // lua state
 {
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
     // Usage: [number] CpuRegRd(regSel [number])
-    if (!lua_isnumber(pLuaVm, 1))
+    //        [table]  CpuRegRd(regSels [table])
+    if (!lua_isnumber(pLuaVm, 1) && !lua_istable(pLuaVm, 1))
     {
         assert(0);
         return 0;
     }
 
-    CpuReg regSel = static_cast<CpuReg>(static_cast<UINT>((lua_tonumber(pLuaVm, 1))));
+    BOOL isTable = lua_istable(pLuaVm, 1);
+    UINT regCnt  = (isTable) ? lua_objlen(pLuaVm, 1) : 1;
 
-    // Create a cpu memory read packet, and issue it to the FPGA.
-    CpuRegRdPacket cpuRegRdPacket(regSel);
-    g_pNesDbg->GetSerialComm()->SendData(cpuRegRdPacket.PacketData(), cpuRegRdPacket.SizeInBytes());
+    if (regCnt > MaxDataSize)
+    {
+        assert(0);
+        return 0;
+    }
 
-    // Allocate space to receive the FPGA returned data.
-    UINT bytesToReceive = cpuRegRdPacket.ReturnBytesExpected();
-    BYTE* pReceivedData = new BYTE[bytesToReceive];
-    assert(pReceivedData);
+    BYTE* pReceivedData = &GetScriptMgr(pLuaVm)->m_rxBuf[0];
 
-    // Read data back from the FPGA.
-    g_pNesDbg->GetSerialComm()->ReceiveData(pReceivedData, bytesToReceive);
+    // Create a cpu register read packet for each register, and issue them all to the FPGA
+    // before waiting for any of the data to come back.
+    for (UINT i = 0; i < regCnt; i++)
+    {
+        CpuReg regSel;
 
-    // Push the return data.
-    lua_pushinteger(pLuaVm, *pReceivedData);
+        if (isTable)
+        {
+            lua_rawgeti(pLuaVm, 1, i + 1);
+            regSel = static_cast<CpuReg>(static_cast<UINT>((lua_tonumber(pLuaVm, -1))));
+            lua_pop(pLuaVm, 1);
+        }
+        else
+        {
+            regSel = static_cast<CpuReg>(static_cast<UINT>((lua_tonumber(pLuaVm, 1))));
+        }
+
+        CpuRegRdPacket cpuRegRdPacket(regSel);
+        STATIC_ASSERT(DbgOpSchema<DbgPacketOpCodeCpuRegRd>::RspSize == 1);
+
+        pSerialComm->SubmitPacket(cpuRegRdPacket, &pReceivedData[i]);
+    }
 
-    delete [] pReceivedData;
+    pSerialComm->Drain();
+
+    // Push the return data.
+    if (isTable)
+    {
+        PushByteTable(pLuaVm, pReceivedData, regCnt);
+    }
+    else
+    {
+        lua_pushinteger(pLuaVm, *pReceivedData);
+    }
 
     return 1;
 }
@@ -385,6 +577,8 @@ INT ScriptMgr::LuaCpuRegRd(
 INT ScriptMgr::LuaCpuRegWr(
     lua_State* pLuaVm)  // lua state
 {
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
     // Usage: CpuRegWr(regSel [number], val [number])
     if (!lua_isnumber(pLuaVm, 1) || !lua_isnumber(pLuaVm, 2))
     {
@@ -395,41 +589,36 @@ INT ScriptMgr::LuaCpuRegWr(
     CpuReg regSel = static_cast<CpuReg>(static_cast<UINT>((lua_tonumber(pLuaVm, 1))));
     BYTE   val    = static_cast<BYTE>(lua_tonumber(pLuaVm, 2));
 
-    // Create a cpu memory read packet, and issue it to the FPGA.
+    // Create a cpu register write packet, and queue it for the FPGA.
     CpuRegWrPacket cpuRegWrPacket(regSel, val);
-    g_pNesDbg->GetSerialComm()->SendData(cpuRegWrPacket.PacketData(), cpuRegWrPacket.SizeInBytes());
+    pSerialComm->SubmitPacket(cpuRegWrPacket);
 
-    assert(cpuRegWrPacket.ReturnBytesExpected() == 0);
+    STATIC_ASSERT(!DbgOpSchema<DbgPacketOpCodeCpuRegWr>::RspSize &&
+                  !DbgOpSchema<DbgPacketOpCodeCpuRegWr>::RspLenOffset);
     return 0;
 }
 
 /***************************************************************************************************
 ** % Method:      ScriptMgr::LuaWaitForHlt()
-*  % Description: Returns control to the lua script once the NES CPU is halted.
+*  % Description: Returns control to the lua script once the NES CPU is halted.  The FPGA does the
+*                 waiting, and answers as soon as the CPU halts.
 *  % Returns:     Number of values returned to lua.  (0)
 ***************************************************************************************************/
 INT ScriptMgr::LuaWaitForHlt(
     lua_State* pLuaVm)  // lua state
 {
-    // Create a debug break query packet, and issue it to the FPGA until we detect a debug break.
-    QueryHltPacket queryDbgHltPacket;
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
 
-    // Allocate space to receive the FPGA returned data.
-    UINT bytesToReceive = queryDbgHltPacket.ReturnBytesExpected();
-    assert(bytesToReceive == 1);
-    BYTE* pReceivedData = new BYTE[bytesToReceive];
-    assert(pReceivedData);
+    // Issue halt waits to the FPGA until one is met, or communication is lost.
+    WaitPacket waitPacket(WaitPacket::CondHalted, 0, 0, 0, WaitForHltSliceMs);
 
-    do
-    {
-        g_pNesDbg->GetSerialComm()->SendData(queryDbgHltPacket.PacketData(),
-                                             queryDbgHltPacket.SizeInBytes());
-        g_pNesDbg->GetSerialComm()->ReceiveData(pReceivedData, bytesToReceive);
-
-        Sleep(10);
-    } while (*pReceivedData == 0);
+    BYTE status = WaitPacket::StatusTimeout;
+    BOOL ok     = TRUE;
 
-    delete [] pReceivedData;
+    while (ok && (status != WaitPacket::StatusMet))
+    {
+        ok = pSerialComm->SubmitPacket(waitPacket, &status) && pSerialComm->Drain();
+    }
 
     return 0;
 }
@@ -442,6 +631,8 @@ INT ScriptMgr::LuaWaitForHlt(
 INT ScriptMgr::LuaLoadAsm(
     lua_State* pLuaVm)  // lua state
 {
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
     // Usage: [number] LoadAsm(input [string])
     if (!lua_isstring(pLuaVm, 1))
     {
@@ -457,46 +648,34 @@ INT ScriptMgr::LuaLoadAsm(
     _tcscpy_s(pFilePath, filePathLen, pAsmPrgDir);
     _tcscat_s(pFilePath, filePathLen, pFileName);
 
-    HANDLE hPrgFile = CreateFile(pFilePath,
-                                 GENERIC_READ,
-                                 0,
-                                 NULL,
-                                 OPEN_EXISTING,
-                                 FILE_ATTRIBUTE_NORMAL,
-                                 NULL);
-    USHORT startPc = 0;
+    FILE*  pPrgFile = _tfopen(pFilePath, _T("rb"));
+    USHORT startPc  = 0;
 
-    if (hPrgFile != INVALID_HANDLE_VALUE)
+    if (pPrgFile)
     {
-        static const UINT FileDataBufferSize = 0x10000;
-
-        BYTE* pFileData = new BYTE[FileDataBufferSize];
-        DWORD fileDataActualSize = 0;
+        BYTE* pFileData = &GetScriptMgr(pLuaVm)->m_txBuf[0];
+        UINT  fileDataActualSize = fread(pFileData, 1, MaxDataSize, pPrgFile);
 
-        if (ReadFile(hPrgFile, pFileData, FileDataBufferSize, &fileDataActualSize, NULL))
+        if (fileDataActualSize > 2)
         {
             startPc = pFileData[0] | (pFileData[1] << 8);
 
-            // Create a cpu memory write packet, and issue it to the FPGA.
-            CpuMemWrPacket cpuMemWrPacket(startPc,
-                                          (USHORT)(fileDataActualSize - 2),
-                                          &pFileData[2]);
-            g_pNesDbg->GetSerialComm()->SendData(cpuMemWrPacket.PacketData(),
-                                                 cpuMemWrPacket.SizeInBytes());
+            // Queue the program for the FPGA.
+            pSerialComm->StreamWrite(MemSpaceCpu, startPc, &pFileData[2], fileDataActualSize - 2);
 
-            assert(cpuMemWrPacket.ReturnBytesExpected() == 0);
+            STATIC_ASSERT(!DbgOpSchema<DbgPacketOpCodeCpuMemWr>::RspSize &&
+                          !DbgOpSchema<DbgPacketOpCodeCpuMemWr>::RspLenOffset);
         }
         else
         {
-            MessageBox(NULL, _T("Failed to read data from .prg file."), _T("NesDbg"), MB_OK);
+            ReportError(_T("Failed to read data from .prg file."));
         }
 
-        delete [] pFileData;
-        CloseHandle(hPrgFile);
+        fclose(pPrgFile);
     }
     else
     {
-        MessageBox(NULL, _T("Failed to open .prg file."), _T("NesDbg"), MB_OK);
+        ReportError(_T("Failed to open .prg file."));
     }
 
     DestroyTcharString(pFileName);
@@ -517,6 +696,8 @@ INT ScriptMgr::LuaLoadAsm(
 INT ScriptMgr::LuaPpuMemRd(
     lua_State* pLuaVm)  // lua state
 {
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
     // Usage: [table] PpuMemRd(address [number], numBytes [number])
     if (!lua_isnumber(pLuaVm, 1) || !lua_isnumber(pLuaVm, 2))
     {
@@ -525,30 +706,21 @@ INT ScriptMgr::LuaPpuMemRd(
     }
 
     USHORT addr     = static_cast<USHORT>(lua_tonumber(pLuaVm, 1));
-    USHORT numBytes = static_cast<USHORT>(lua_tonumber(pLuaVm, 2));
-
-    // Create a ppu memory read packet, and issue it to the FPGA.
-    PpuMemRdPacket ppuMemRdPacket(addr, numBytes);
-    g_pNesDbg->GetSerialComm()->SendData(ppuMemRdPacket.PacketData(), ppuMemRdPacket.SizeInBytes());
-
-    // Allocate space to receive the FPGA returned data.
-    UINT bytesToReceive = ppuMemRdPacket.ReturnBytesExpected();
-    BYTE* pReceivedData = new BYTE[bytesToReceive];
-    assert(pReceivedData);
-
-    // Read data back from the FPGA.
-    g_pNesDbg->GetSerialComm()->ReceiveData(pReceivedData, bytesToReceive);
+    UINT   numBytes = static_cast<UINT>(lua_tonumber(pLuaVm, 2));
 
-    // Push the return data into a return table.
-    lua_newtable(pLuaVm);
-    for (UINT i = 0; i < bytesToReceive; i++)
+    if (numBytes > MaxDataSize)
     {
-        lua_pushnumber(pLuaVm, i + 1);
-        lua_pushnumber(pLuaVm, pReceivedData[i]);
-        lua_settable(pLuaVm, -3);
+        assert(0);
+        return 0;
     }
 
-    delete [] pReceivedData;
+    // Stream the read to the FPGA, and wait for the data to come back.
+    BYTE* pReceivedData = &GetScriptMgr(pLuaVm)->m_rxBuf[0];
+
+    pSerialComm->StreamRead(MemSpacePpu, addr, pReceivedData, numBytes);
+    pSerialComm->Drain();
+
+    PushByteTable(pLuaVm, pReceivedData, numBytes);
 
     return 1;
 }
@@ -562,6 +734,8 @@ INT ScriptMgr::LuaPpuMemRd(
 INT ScriptMgr::LuaPpuMemWr(
     lua_State* pLuaVm)  // lua state
 {
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
     // Usage: PpuMemWr(address [number], numBytes [number], data [table])
     if (!lua_isnumber(pLuaVm, 1) || !lua_isnumber(pLuaVm, 2)  || !lua_istable(pLuaVm, 3))
     {
@@ -570,13 +744,17 @@ INT ScriptMgr::LuaPpuMemWr(
     }
 
     USHORT addr     = static_cast<USHORT>(lua_tonumber(pLuaVm, 1));
-    USHORT numBytes = static_cast<USHORT>(lua_tonumber(pLuaVm, 2));
+    UINT   numBytes = static_cast<UINT>(lua_tonumber(pLuaVm, 2));
+
+    if (numBytes > MaxDataSize)
+    {
+        assert(0);
+        return 0;
+    }
 
-    // Allocate memory on the heap to store a copy of the lua data table.
-    BYTE* pData = new BYTE [numBytes];
-    assert(pData);
+    // Copy the lua data table from arg 3 into the TX buffer.
+    BYTE* pData = &GetScriptMgr(pLuaVm)->m_txBuf[0];
 
-    // Copy the array from arg 2 into pEchoData.
     for (UINT i = 1; i <= numBytes; i++)
     {
         lua_rawgeti(pLuaVm, 3, i);
@@ -584,14 +762,594 @@ INT ScriptMgr::LuaPpuMemWr(
         lua_pop(pLuaVm, 1);
     }
 
-    // Create a ppu memory write packet, and issue it to the FPGA.
-    PpuMemWrPacket ppuMemWrPacket(addr, numBytes, pData);
-    g_pNesDbg->GetSerialComm()->SendData(ppuMemWrPacket.PacketData(), ppuMemWrPacket.SizeInBytes());
+    // Queue the write for the FPGA.
+    pSerialComm->StreamWrite(MemSpacePpu, addr, pData, numBytes);
+
+    STATIC_ASSERT(!DbgOpSchema<DbgPacketOpCodePpuMemWr>::RspSize &&
+                  !DbgOpSchema<DbgPacketOpCodePpuMemWr>::RspLenOffset);
+
+    return 0;
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::LuaMultiRd()
+*  % Description: Issues a MultiRd debug packet to the FPGA, reading several CPU/PPU memory ranges
+*                 in one round trip, and returns an array holding an array of data for each range.
+*                 Raises a lua error if communication with the FPGA fails.
+*  % Returns:     Number of values returned to lua.  (1)
+***************************************************************************************************/
+INT ScriptMgr::LuaMultiRd(
+    lua_State* pLuaVm)  // lua state
+{
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
+    // Usage: [table] MultiRd(ranges [table])
+    //
+    // Each range is a table: { space [MemSpace], address [number], numBytes [number] }.
+    if (!lua_istable(pLuaVm, 1))
+    {
+        assert(0);
+        return 0;
+    }
+
+    const UINT rangeCnt = lua_objlen(pLuaVm, 1);
+    MemRange   ranges[MultiReadPacket::MaxRanges];
+    UINT       totalBytes = 0;
+
+    if (rangeCnt > MultiReadPacket::MaxRanges)
+    {
+        assert(0);
+        return 0;
+    }
+
+    for (UINT i = 0; i < rangeCnt; i++)
+    {
+        lua_rawgeti(pLuaVm, 1, i + 1);
+
+        lua_rawgeti(pLuaVm, -1, 1);
+        lua_rawgeti(pLuaVm, -2, 2);
+        lua_rawgeti(pLuaVm, -3, 3);
+
+        ranges[i].space    = static_cast<MemSpace>(static_cast<UINT>(lua_tonumber(pLuaVm, -3)));
+        ranges[i].addr     = static_cast<USHORT>(lua_tonumber(pLuaVm, -2));
+        ranges[i].numBytes = static_cast<USHORT>(lua_tonumber(pLuaVm, -1));
+
+        lua_pop(pLuaVm, 4);
+
+        totalBytes += ranges[i].numBytes;
+    }
+
+    if (totalBytes >= MaxDataSize)
+    {
+        assert(0);
+        return 0;
+    }
+
+    // Issue a multi-range read packet to the FPGA, and wait for the data to come back.
+    BYTE* pReceivedData = &GetScriptMgr(pLuaVm)->m_rxBuf[0];
+    BOOL  ok;
+
+    {
+        MultiReadPacket multiReadPacket(&ranges[0], rangeCnt);
+
+        ok = pSerialComm->SubmitPacket(multiReadPacket, pReceivedData) && pSerialComm->Drain();
+    }
+
+    // luaL_error() doesn't return, so raise it once the packet is out of scope.
+    if (!ok)
+    {
+        return luaL_error(pLuaVm, "MultiRd: lost communication with the NES FPGA.");
+    }
+
+    // Split the response up by range.
+    lua_createtable(pLuaVm, rangeCnt, 0);
+
+    for (UINT i = 0; i < rangeCnt; i++)
+    {
+        PushByteTable(pLuaVm, pReceivedData, ranges[i].numBytes);
+        lua_rawseti(pLuaVm, -2, i + 1);
+
+        pReceivedData += ranges[i].numBytes;
+    }
+
+    return 1;
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::LuaFill()
+*  % Description: Issues a MemFill debug packet to the FPGA, filling a CPU or PPU memory range with
+*                 a byte value or a short repeating pattern.  Raises a lua error if the packet
+*                 can't be queued.
+*  % Returns:     Number of values returned to lua.  (0)
+***************************************************************************************************/
+INT ScriptMgr::LuaFill(
+    lua_State* pLuaVm)  // lua state
+{
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
+    // Usage: Fill(space [MemSpace], address [number], numBytes [number], val [number])
+    //        Fill(space [MemSpace], address [number], numBytes [number], pattern [table])
+    if (!lua_isnumber(pLuaVm, 1) || !lua_isnumber(pLuaVm, 2) || !lua_isnumber(pLuaVm, 3) ||
+        (!lua_isnumber(pLuaVm, 4) && !lua_istable(pLuaVm, 4)))
+    {
+        assert(0);
+        return 0;
+    }
+
+    MemSpace space    = static_cast<MemSpace>(static_cast<UINT>(lua_tonumber(pLuaVm, 1)));
+    USHORT   addr     = static_cast<USHORT>(lua_tonumber(pLuaVm, 2));
+    USHORT   numBytes = static_cast<USHORT>(lua_tonumber(pLuaVm, 3));
+
+    BYTE pattern[MemFillPacket::MaxPatternSize];
+    UINT patternSize = 1;
+
+    if (lua_istable(pLuaVm, 4))
+    {
+        patternSize = lua_objlen(pLuaVm, 4);
+
+        if ((patternSize == 0) || (patternSize > MemFillPacket::MaxPatternSize))
+        {
+            assert(0);
+            return 0;
+        }
+
+        for (UINT i = 0; i < patternSize; i++)
+        {
+            lua_rawgeti(pLuaVm, 4, i + 1);
+            pattern[i] = static_cast<BYTE>(static_cast<UINT>(lua_tonumber(pLuaVm, -1)));
+            lua_pop(pLuaVm, 1);
+        }
+    }
+    else
+    {
+        pattern[0] = static_cast<BYTE>(static_cast<UINT>(lua_tonumber(pLuaVm, 4)));
+    }
+
+    // Create a memory fill packet, and queue it for the FPGA.
+    BOOL ok;
+
+    {
+        MemFillPacket memFillPacket(space, addr, numBytes, &pattern[0], patternSize);
+
+        ok = pSerialComm->SubmitPacket(memFillPacket);
+    }
+
+    STATIC_ASSERT(!DbgOpSchema<DbgPacketOpCodeMemFill>::RspSize &&
+                  !DbgOpSchema<DbgPacketOpCodeMemFill>::RspLenOffset);
+
+    // luaL_error() doesn't return, so raise it once the packet is out of scope.
+    if (!ok)
+    {
+        return luaL_error(pLuaVm, "Fill: lost communication with the NES FPGA.");
+    }
+
+    return 0;
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::LuaMemCrc()
+*  % Description: Issues a MemCrc debug packet to the FPGA.  Given a byte count, returns the CRC-32
+*                 of the CPU or PPU memory range; given a table of expected data, returns whether
+*                 the range holds that data.  Raises a lua error if communication with the FPGA
+*                 fails.
+*  % Returns:     Number of values returned to lua.  (1)
+***************************************************************************************************/
+INT ScriptMgr::LuaMemCrc(
+    lua_State* pLuaVm)  // lua state
+{
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
+    // Usage: [number]  MemCrc(space [MemSpace], address [number], numBytes [number])
+    //        [boolean] MemCrc(space [MemSpace], address [number], expected [table])
+    if (!lua_isnumber(pLuaVm, 1) || !lua_isnumber(pLuaVm, 2) ||
+        (!lua_isnumber(pLuaVm, 3) && !lua_istable(pLuaVm, 3)))
+    {
+        assert(0);
+        return 0;
+    }
+
+    MemSpace space    = static_cast<MemSpace>(static_cast<UINT>(lua_tonumber(pLuaVm, 1)));
+    USHORT   addr     = static_cast<USHORT>(lua_tonumber(pLuaVm, 2));
+    BOOL     check    = lua_istable(pLuaVm, 3);
+    UINT     numBytes = (check) ? lua_objlen(pLuaVm, 3)
+                                : static_cast<UINT>(lua_tonumber(pLuaVm, 3));
+
+    if (numBytes > 0xFFFF)
+    {
+        assert(0);
+        return 0;
+    }
+
+    // Issue the packet to the FPGA, and wait for the CRC to come back.
+    BYTE rsp[MemCrcPacket::RspSize];
+    BOOL ok;
+
+    {
+        MemCrcPacket memCrcPacket(space, addr, static_cast<USHORT>(numBytes));
+
+        ok = pSerialComm->SubmitPacket(memCrcPacket, &rsp[0]) && pSerialComm->Drain();
+    }
+
+    // luaL_error() doesn't return, so raise it once the packet is out of scope.
+    if (!ok)
+    {
+        return luaL_error(pLuaVm, "MemCrc: lost communication with the NES FPGA.");
+    }
+
+    if (check)
+    {
+        // Copy the expected data from arg 3 into the TX buffer and CRC it locally.
+        BYTE* pData = &GetScriptMgr(pLuaVm)->m_txBuf[0];
+
+        for (UINT i = 1; i <= numBytes; i++)
+        {
+            lua_rawgeti(pLuaVm, 3, i);
+            pData[i - 1] = static_cast<BYTE>(static_cast<UINT>(lua_tonumber(pLuaVm, -1)));
+            lua_pop(pLuaVm, 1);
+        }
+
+        lua_pushboolean(pLuaVm, MemCrcPacket::RspMatches(&rsp[0], pData, numBytes));
+    }
+    else
+    {
+        lua_pushnumber(pLuaVm, MemCrcPacket::GetRspCrc(&rsp[0]));
+    }
+
+    return 1;
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::LuaMemCompare()
+*  % Description: Issues MemCmp debug packets to the FPGA, comparing a CPU or PPU memory range with
+*                 expected data on the FPGA.  Returns the number of mismatching bytes and an array
+*                 of the first few, each { address, actual }.  Raises a lua error if communication
+*                 with the FPGA fails.
+*  % Returns:     Number of values returned to lua.  (2)
+***************************************************************************************************/
+INT ScriptMgr::LuaMemCompare(
+    lua_State* pLuaVm)  // lua state
+{
+    static const UINT DefaultMaxMismatches = 8;
+
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
+    // Usage: [number], [table] MemCompare(space [MemSpace], address [number], expected [table],
+    //                                     maxMismatches [number, optional])
+    if (!lua_isnumber(pLuaVm, 1) || !lua_isnumber(pLuaVm, 2) || !lua_istable(pLuaVm, 3))
+    {
+        assert(0);
+        return 0;
+    }
+
+    MemSpace space         = static_cast<MemSpace>(static_cast<UINT>(lua_tonumber(pLuaVm, 1)));
+    USHORT   addr          = static_cast<USHORT>(lua_tonumber(pLuaVm, 2));
+    UINT     numBytes      = lua_objlen(pLuaVm, 3);
+    UINT     maxMismatches = (lua_isnumber(pLuaVm, 4))
+                             ? static_cast<UINT>(lua_tonumber(pLuaVm, 4))
+                             : DefaultMaxMismatches;
+
+    if ((numBytes > 0xFFFF) ||
+        ((maxMismatches * MemComparePacket::MismatchSize) + sizeof(USHORT) > MaxDataSize))
+    {
+        assert(0);
+        return 0;
+    }
+
+    // Copy the expected data from arg 3 into the TX buffer.
+    BYTE* pData = &GetScriptMgr(pLuaVm)->m_txBuf[0];
+
+    for (UINT i = 1; i <= numBytes; i++)
+    {
+        lua_rawgeti(pLuaVm, 3, i);
+        pData[i - 1] = static_cast<BYTE>(static_cast<UINT>(lua_tonumber(pLuaVm, -1)));
+        lua_pop(pLuaVm, 1);
+    }
+
+    // Framed mode caps the packet size, so compare one frame-sized piece at a time.  Each piece
+    // reports up to the mismatches still wanted, and its count is added to the total.
+    const UINT chunkSize =
+        SetFramedPacket::MaxPayloadSize - DbgOpSchema<DbgPacketOpCodeMemCmp>::HeaderSize;
+
+    BYTE* pReceivedData = &GetScriptMgr(pLuaVm)->m_rxBuf[0];
+    UINT  mismatchCnt   = 0;
+    UINT  reportCnt     = 0;
+    BOOL  ok            = TRUE;
+
+    lua_createtable(pLuaVm, 0, 0);
+
+    for (UINT offset = 0; ok && (offset < numBytes); offset += chunkSize)
+    {
+        UINT chunkBytes = (numBytes - offset < chunkSize) ? numBytes - offset : chunkSize;
+
+        MemComparePacket memComparePacket(space,
+                                          static_cast<USHORT>(addr + offset),
+                                          static_cast<USHORT>(chunkBytes),
+                                          pData + offset,
+                                          maxMismatches - reportCnt);
+
+        ok = pSerialComm->SubmitPacket(memComparePacket, pReceivedData) && pSerialComm->Drain();
+
+        if (ok)
+        {
+            const UINT chunkMismatchCnt = memComparePacket.GetMismatchCnt(pReceivedData);
+            const UINT chunkReportCnt   = (chunkMismatchCnt < maxMismatches - reportCnt)
+                                          ? chunkMismatchCnt
+                                          : maxMismatches - reportCnt;
+
+            for (UINT i = 0; i < chunkReportCnt; i++)
+            {
+                USHORT mismatchAddr;
+                BYTE   actual;
+
+                memComparePacket.GetMismatch(pReceivedData, i, &mismatchAddr, &actual);
+
+                lua_createtable(pLuaVm, 2, 0);
+                lua_pushnumber(pLuaVm, mismatchAddr);
+                lua_rawseti(pLuaVm, -2, 1);
+                lua_pushnumber(pLuaVm, actual);
+                lua_rawseti(pLuaVm, -2, 2);
+
+                lua_rawseti(pLuaVm, -2, ++reportCnt);
+            }
+
+            mismatchCnt += chunkMismatchCnt;
+        }
+    }
+
+    // luaL_error() doesn't return, so raise it once the last packet is out of scope.
+    if (!ok)
+    {
+        return luaL_error(pLuaVm, "MemCompare: lost communication with the NES FPGA.");
+    }
+
+    // Return the count ahead of the mismatch table.
+    lua_pushnumber(pLuaVm, mismatchCnt);
+    lua_insert(pLuaVm, -2);
+
+    return 2;
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::LuaCpuRegsRd()
+*  % Description: Issues a CpuRegsRd debug packet to the FPGA and returns a table of all CPU
+*                 registers, indexed by CpuReg.  Raises a lua error if communication with the FPGA
+*                 fails.
+*  % Returns:     Number of values returned to lua.  (1)
+***************************************************************************************************/
+INT ScriptMgr::LuaCpuRegsRd(
+    lua_State* pLuaVm)  // lua state
+{
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
+    // Usage: [table] CpuRegsRd()
+    BYTE regs[CpuRegCnt];
+    BOOL ok;
+
+    {
+        CpuRegsRdPacket cpuRegsRdPacket;
+
+        ok = pSerialComm->SubmitPacket(cpuRegsRdPacket, &regs[0]) && pSerialComm->Drain();
+    }
+
+    // luaL_error() doesn't return, so raise it once the packet is out of scope.
+    if (!ok)
+    {
+        return luaL_error(pLuaVm, "CpuRegsRd: lost communication with the NES FPGA.");
+    }
+
+    // CpuReg values start at 0, so the table does too.
+    lua_createtable(pLuaVm, CpuRegCnt - 1, 1);
+
+    for (UINT i = 0; i < CpuRegCnt; i++)
+    {
+        lua_pushinteger(pLuaVm, regs[i]);
+        lua_rawseti(pLuaVm, -2, i);
+    }
+
+    return 1;
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::LuaCpuRegsWr()
+*  % Description: Issues a CpuRegsWr debug packet to the FPGA.  Raises a lua error if the packet
+*                 can't be queued.
+*  % Returns:     Number of values returned to lua.  (0)
+***************************************************************************************************/
+INT ScriptMgr::LuaCpuRegsWr(
+    lua_State* pLuaVm)  // lua state
+{
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
+    // Usage: CpuRegsWr(regs [table])
+    //
+    // regs is indexed by CpuReg, as returned by CpuRegsRd().
+    if (!lua_istable(pLuaVm, 1))
+    {
+        assert(0);
+        return 0;
+    }
+
+    BYTE regs[CpuRegCnt];
+
+    for (UINT i = 0; i < CpuRegCnt; i++)
+    {
+        lua_rawgeti(pLuaVm, 1, i);
+        regs[i] = static_cast<BYTE>(static_cast<UINT>(lua_tonumber(pLuaVm, -1)));
+        lua_pop(pLuaVm, 1);
+    }
+
+    // Create a cpu registers write packet, and queue it for the FPGA.
+    BOOL ok;
 
-    assert(ppuMemWrPacket.ReturnBytesExpected() == 0);
+    {
+        CpuRegsWrPacket cpuRegsWrPacket(&regs[0]);
+
+        ok = pSerialComm->SubmitPacket(cpuRegsWrPacket);
+    }
 
-    delete [] pData;
+    STATIC_ASSERT(!DbgOpSchema<DbgPacketOpCodeCpuRegsWr>::RspSize &&
+                  !DbgOpSchema<DbgPacketOpCodeCpuRegsWr>::RspLenOffset);
+
+    // luaL_error() doesn't return, so raise it once the packet is out of scope.
+    if (!ok)
+    {
+        return luaL_error(pLuaVm, "CpuRegsWr: lost communication with the NES FPGA.");
+    }
 
     return 0;
 }
 
+/***************************************************************************************************
+** % Method:      ScriptMgr::LuaWait()
+*  % Description: Issues a Wait debug packet to the FPGA, which answers once the condition holds,
+*                 the CPU halts, or the timeout passes.  The CPU keeps running if it was.  Raises a
+*                 lua error if communication with the FPGA fails.
+*  % Returns:     Number of values returned to lua.  (1)
+***************************************************************************************************/
+INT ScriptMgr::LuaWait(
+    lua_State* pLuaVm)  // lua state
+{
+    SerialComm* pSerialComm = GetScriptMgr(pLuaVm)->m_pSerialComm;
+
+    // Usage: [WaitStatus] Wait(cond [WaitCond], addr [number], mask [number], value [number],
+    //                          timeoutMs [number])
+    //
+    // addr is the frame count for WaitCond.Frames; mask and value only apply to WaitCond.Mem.
+    if (!lua_isnumber(pLuaVm, 1) || !lua_isnumber(pLuaVm, 2) || !lua_isnumber(pLuaVm, 3) ||
+        !lua_isnumber(pLuaVm, 4) || !lua_isnumber(pLuaVm, 5))
+    {
+        assert(0);
+        return 0;
+    }
+
+    BYTE   cond      = static_cast<BYTE>(static_cast<UINT>(lua_tonumber(pLuaVm, 1)));
+    USHORT addr      = static_cast<USHORT>(lua_tonumber(pLuaVm, 2));
+    BYTE   mask      = static_cast<BYTE>(static_cast<UINT>(lua_tonumber(pLuaVm, 3)));
+    BYTE   value     = static_cast<BYTE>(static_cast<UINT>(lua_tonumber(pLuaVm, 4)));
+    USHORT timeoutMs = static_cast<USHORT>(lua_tonumber(pLuaVm, 5));
+
+    // Issue the packet to the FPGA, and wait for the status to come back.
+    BYTE status = WaitPacket::StatusTimeout;
+    BOOL ok;
+
+    {
+        WaitPacket waitPacket(cond, addr, mask, value, timeoutMs);
+
+        ok = pSerialComm->SubmitPacket(waitPacket, &status) && pSerialComm->Drain();
+    }
+
+    // luaL_error() doesn't return, so raise it once the packet is out of scope.
+    if (!ok)
+    {
+        return luaL_error(pLuaVm, "Wait: lost communication with the NES FPGA.");
+    }
+
+    lua_pushnumber(pLuaVm, status);
+
+    return 1;
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::LuaProgWr()
+*  % Description: Stores a program of debug commands on the FPGA, for ProgRun() to execute without
+*                 a round trip per command.
+*  % Returns:     Number of values returned to lua.  (1)
+***************************************************************************************************/
+INT ScriptMgr::LuaProgWr(
+    lua_State* pLuaVm)  // lua state
+{
+    ScriptMgr*  pScriptMgr  = GetScriptMgr(pLuaVm);
+    SerialComm* pSerialComm = pScriptMgr->m_pSerialComm;
+
+    // Usage: [boolean] ProgWr(cmds [table])
+    //
+    // Each command is a table: { op [ProgCmd], args... }, with the same arguments as the matching
+    // nesdbg function (e.g., { ProgCmd.CpuMemRd, address, numBytes }).  Returns false, and stores
+    // nothing, if a command is unsupported or the program is too big.
+    if (!lua_istable(pLuaVm, 1))
+    {
+        assert(0);
+        return 0;
+    }
+
+    const UINT cmdCnt = lua_objlen(pLuaVm, 1);
+    BOOL       ret    = TRUE;
+
+    pScriptMgr->m_program.Clear();
+
+    for (UINT i = 0; (i < cmdCnt) && ret; i++)
+    {
+        lua_rawgeti(pLuaVm, 1, i + 1);
+        ret = AppendProgCmd(pLuaVm, &pScriptMgr->m_program);
+        lua_pop(pLuaVm, 1);
+    }
+
+    if (ret)
+    {
+        ProgWrPacket progWrPacket(pScriptMgr->m_program);
+
+        ret = pSerialComm->SubmitPacket(progWrPacket) && pSerialComm->Drain();
+    }
+    else
+    {
+        pScriptMgr->m_program.Clear();
+    }
+
+    lua_pushboolean(pLuaVm, ret);
+
+    return 1;
+}
+
+/***************************************************************************************************
+** % Method:      ScriptMgr::LuaProgRun()
+*  % Description: Runs the program stored by ProgWr() on the FPGA one or more times, optionally
+*                 once per frame, and returns the concatenated responses of its commands.  Raises a
+*                 lua error if communication with the FPGA fails.
+*  % Returns:     Number of values returned to lua.  (1)
+***************************************************************************************************/
+INT ScriptMgr::LuaProgRun(
+    lua_State* pLuaVm)  // lua state
+{
+    ScriptMgr*  pScriptMgr  = GetScriptMgr(pLuaVm);
+    SerialComm* pSerialComm = pScriptMgr->m_pSerialComm;
+
+    // Usage: [table] ProgRun(runCnt [number], vblank [boolean])
+    //
+    // With vblank set, each run waits for the start of a vblank, so runCnt runs sample runCnt
+    // consecutive frames.
+    if (!lua_isnumber(pLuaVm, 1))
+    {
+        assert(0);
+        return 0;
+    }
+
+    const UINT runCnt = static_cast<UINT>(lua_tonumber(pLuaVm, 1));
+    const BOOL vblank = lua_toboolean(pLuaVm, 2);
+    const UINT rspCnt = pScriptMgr->m_program.RspSize() * runCnt;
+
+    if ((runCnt > 0xFFFF) || (rspCnt >= MaxDataSize))
+    {
+        assert(0);
+        return 0;
+    }
+
+    // Issue the packet to the FPGA, and wait for the data to come back.
+    BYTE* pReceivedData = &pScriptMgr->m_rxBuf[0];
+    BOOL  ok;
+
+    {
+        ProgRunPacket progRunPacket(pScriptMgr->m_program, static_cast<USHORT>(runCnt), vblank);
+
+        ok = pSerialComm->SubmitPacket(progRunPacket, pReceivedData) && pSerialComm->Drain();
+    }
+
+    // luaL_error() doesn't return, so raise it once the packet is out of scope.
+    if (!ok)
+    {
+        return luaL_error(pLuaVm, "ProgRun: lost communication with the NES FPGA.");
+    }
+
+    PushByteTable(pLuaVm, pReceivedData, rspCnt);
+
+    return 1;
+}
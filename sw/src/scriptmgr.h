@@ -28,8 +28,10 @@
 #ifndef SCRIPTMGR_H
 #define SCRIPTMGR_H
 
-#include "nesdbg.h"
+#include "dbgpacket.h"
+#include "util.h"
 
+class SerialComm;
 struct lua_State;
 
 /***************************************************************************************************
@@ -50,12 +52,16 @@ enum ScriptResult
 class ScriptMgr
 {
 public:
-    explicit ScriptMgr(NesDbg* pNesDbg);
+    explicit ScriptMgr(SerialComm* pSerialComm);
     ~ScriptMgr();
 
     BOOL Init();
 
+    ScriptResult ExecuteScript(const TCHAR* pFilePath);
+
+#ifdef _WIN32
     static BOOL CALLBACK TestScriptDlgProc(HWND hWndDlg, UINT msg, WPARAM wParam, LPARAM lParam);
+#endif
 
 private:
     ScriptMgr& operator=(const ScriptMgr&);
@@ -69,13 +75,19 @@ private:
     static const TCHAR* __pAsmPrgDir;
     static const TCHAR* GetAsmPrgDir() { return __pAsmPrgDir; }
 
-    ScriptResult ExecuteScript(const TCHAR* pFilePath);
+    VOID AppendOutput(const TCHAR* pFmtText, ...);
 
+#ifdef _WIN32
     VOID TestScriptDlgInit();
     VOID TestScriptDlgRun();
     VOID TestScriptDlgSetProgress(UINT testsDone, UINT testCnt);
     VOID TestScriptDlgSetResults(UINT passCnt, UINT failCnt, UINT errorCnt);
     VOID TestScriptDlgAppendOutput(const TCHAR* pFmtText, ...);
+#endif
+
+    static ScriptMgr* GetScriptMgr(lua_State* pLuaVm);
+    static VOID       PushByteTable(lua_State* pLuaVm, const BYTE* pData, UINT numBytes);
+    static BOOL       AppendProgCmd(lua_State* pLuaVm, DbgProgram* pProgram);
 
     // Lua/C functions
     static INT LuaPrint(lua_State* pLuaVm);
@@ -90,11 +102,34 @@ private:
     static INT LuaLoadAsm(lua_State* pLuaVm);
     static INT LuaPpuMemRd(lua_State* pLuaVm);
     static INT LuaPpuMemWr(lua_State* pLuaVm);
-
-    NesDbg*      m_pNesDbg;  // NesDbg object that owns this ScriptMgr object
-    lua_State*   m_pLuaVm;   // lua virtual machine
-
-    HWND         m_hWndDlg;  // HWND for the test script dialog box
+    static INT LuaMultiRd(lua_State* pLuaVm);
+    static INT LuaFill(lua_State* pLuaVm);
+    static INT LuaMemCrc(lua_State* pLuaVm);
+    static INT LuaMemCompare(lua_State* pLuaVm);
+    static INT LuaCpuRegsRd(lua_State* pLuaVm);
+    static INT LuaCpuRegsWr(lua_State* pLuaVm);
+    static INT LuaWait(lua_State* pLuaVm);
+    static INT LuaProgWr(lua_State* pLuaVm);
+    static INT LuaProgRun(lua_State* pLuaVm);
+
+    SerialComm*  m_pSerialComm;  // serial communication manager used to reach the NES FPGA
+    lua_State*   m_pLuaVm;       // lua virtual machine
+
+    // Largest packet payload (USHORT length), and the most registers CpuRegRd() reads at once.
+    static const UINT MaxDataSize = 0x10000;
+
+    // WaitForHlt() waits on the FPGA this long at a time, so a lost response is noticed.
+    static const USHORT WaitForHltSliceMs = 1000;
+
+    // Per-call packet data and responses are staged here rather than on the heap.
+    BYTE         m_txBuf[MaxDataSize];  // payload of the packet being built
+    BYTE         m_rxBuf[MaxDataSize];  // response of the packet being issued
+
+    DbgProgram   m_program;  // program last stored on the FPGA by ProgWr()
+
+#ifdef _WIN32
+    HWND         m_hWndDlg;      // HWND for the test script dialog box
+#endif
 };
 
 #endif // SCRIPTMGR_H
@@ -121,7 +121,7 @@ VOID ScriptMgr::TestScriptDlgRun()
 
     if (scriptCnt == 0)
     {
-        MessageBox(NULL, _T("No tests selected."), m_pNesDbg->GetMessageBoxTitle(), 0);
+        MessageBox(NULL, _T("No tests selected."), NesDbg::GetMessageBoxTitle(), 0);
         return;
     }
 
@@ -25,18 +25,46 @@
 *  SerialComm class implementation.
 ***************************************************************************************************/
 
-#include <windows.h>
-#include <tchar.h>
-
 #include "dbgpacket.h"
-#include "nesdbg.h"
+#include "hcisim.h"
+#include "portfinder.h"
 #include "serialcomm.h"
+#include "transport.h"
 
 /***************************************************************************************************
 ** % Method:      SerialComm::SerialComm()
 *  % Description: SerialComm constructor.
 ***************************************************************************************************/
 SerialComm::SerialComm()
+    :
+    m_pTransport(NULL),
+    m_baudRate(DefaultBaudRate),
+    m_framed(FALSE),
+    m_txSeq(0),
+    m_frameErr(FALSE),
+    m_txQueue(),
+    m_txOffset(0),
+    m_requestHead(0),
+    m_requestCnt(0),
+    m_txRequestIdx(0),
+    m_rxRequestIdx(0),
+    m_rspBytesInFlight(0),
+    m_txBytesInFlight(0),
+    m_bytesBehindStall(0),
+    m_stallPending(FALSE),
+    m_stallIdx(0),
+    m_stallExecMs(0),
+    m_reqCredits(MinFifoCredits),
+    m_rspCredits(MinFifoCredits),
+    m_lzEncoder(),
+    m_rxRing(),
+    m_rxEvent(),
+    m_readerThread(),
+    m_stopReader(0),
+    m_rxHitCnt(0),
+    m_rxMissCnt(0),
+    m_rxOverflowCnt(0),
+    m_retryCnt(0)
 {
 }
 
@@ -46,117 +74,136 @@ SerialComm::SerialComm()
 ***************************************************************************************************/
 SerialComm::~SerialComm()
 {
-    if (m_hSerialComm)
+    if (m_pTransport)
     {
-        CloseHandle(m_hSerialComm);
+        // Don't drop fire-and-forget writes that are still queued.
+        Drain();
+
+        // Leave the NES in the mode and at the rate the next session will connect with.  It takes
+        // both changes even if the CPU has been left running.
+        if (m_framed)
+        {
+            SetFramedMode(FALSE);
+        }
+
+        if (m_baudRate != DefaultBaudRate)
+        {
+            SetBaudRate(DefaultBaudRate);
+        }
+
+        StopReader();
+
+        delete m_pTransport;
     }
 }
 
 /***************************************************************************************************
 ** % Method:      SerialComm::Init()
-*  % Description: SerialComm initialization method.  Must be called before any other method.
+*  % Description: SerialComm initialization method.  Opens the specified serial port, or searches
+*                 for the NES FPGA (see PortFinder) if pPortName is NULL.  The port name "sim"
+*                 connects to the in-process HCI simulator instead.  Once connected, switches to the
+*                 fastest baud rate up to maxBaudRate that works, and to framed mode if framed is
+*                 set.  Must be called before any other method.
 *  % Returns:     TRUE on success, FALSE otherwise.
-*
-*  % TODO:        Allow user configuration of serial connection (currently hardcoded to COM4, etc.)
 ***************************************************************************************************/
-BOOL SerialComm::Init()
+BOOL SerialComm::Init(
+    const TCHAR* pPortName,    // serial port to open, NULL to search for the NES FPGA
+    UINT         maxBaudRate,  // fastest baud rate to negotiate, DefaultBaudRate to stay there
+    BOOL         framed)       // TRUE to enter framed mode (see SetFramedMode())
 {
     BOOL ret = TRUE;
 
-    if (ret)
+    TCHAR foundPortName[Transport::MaxPortNameLen];
+
+    if (!pPortName)
     {
-        m_hSerialComm = CreateFile(_T("COM5"),
-                                   GENERIC_READ | GENERIC_WRITE,
-                                   0,
-                                   0,
-                                   OPEN_EXISTING,
-                                   FILE_ATTRIBUTE_NORMAL,
-                                   0);
+        ret = PortFinder::FindPort(&foundPortName[0]);
 
-        if (m_hSerialComm == INVALID_HANDLE_VALUE)
+        if (ret)
         {
-            ret = FALSE;
-            if (GetLastError() == ERROR_FILE_NOT_FOUND)
-            {
-                MessageBox(NULL, _T("\"COM5\" file not found."), _T("NesDbg"), MB_OK);
-            }
-            else
-            {
-                MessageBox(NULL, _T("Unknown error initializing COM5"), _T("NesDbg"), MB_OK);
-            }
+            pPortName = &foundPortName[0];
+        }
+        else
+        {
+            ReportError(_T("No NES FPGA found on any serial port."));
         }
     }
 
-    DCB serialConfig = {0};
-    if (ret)
+    Transport* pTransport = (ret) ? Transport::Create(pPortName) : NULL;
+
+    if (ret && !pTransport->Open(pPortName, DefaultBaudRate))
     {
-        serialConfig.DCBlength = sizeof(DCB);
+        // Room for the message and the longest port name; longer names are cut off.
+        static const UINT MsgBufSize = 64 + Transport::MaxPortNameLen;
+        TCHAR msgBuf[MsgBufSize];
+        _stprintf_s(&msgBuf[0],
+                    MsgBufSize,
+                    _T("Error opening serial port \"%.*s\"."),
+                    static_cast<INT>(Transport::MaxPortNameLen - 1),
+                    pPortName);
+        ReportError(&msgBuf[0]);
 
-        if (!GetCommState(m_hSerialComm, &serialConfig))
-        {
-            ret = FALSE;
-            MessageBox(NULL, _T("Error getting comm state for COM5."), _T("NesDbg"), MB_OK);
-        }
+        delete pTransport;
+        ret = FALSE;
     }
 
     if (ret)
     {
-        serialConfig.BaudRate = CBR_38400;
-        serialConfig.ByteSize = 8;
-        serialConfig.StopBits = ONESTOPBIT;
-        serialConfig.Parity   = ODDPARITY;
-
-        if (!SetCommState(m_hSerialComm, &serialConfig))
-        {
-            ret = FALSE;
-            MessageBox(NULL, _T("Error setting comm state for COM5."), _T("NesDbg"), MB_OK);
-        }
+        ret = Init(pTransport);
     }
 
-    if (ret)
+    if (ret && (_tcscmp(pPortName, HciSim::GetPortName()) != 0))
     {
-        COMMTIMEOUTS timeouts = {0};
+        PortFinder::SaveLastGoodPort(pPortName);
+    }
 
-        timeouts.ReadIntervalTimeout         = 50;
-        timeouts.ReadTotalTimeoutMultiplier  = 10;
-        timeouts.ReadTotalTimeoutConstant    = 5000;
-        timeouts.WriteTotalTimeoutMultiplier = 10;
-        timeouts.WriteTotalTimeoutConstant   = 50;
+    if (ret && (maxBaudRate > DefaultBaudRate))
+    {
+        ret = NegotiateBaudRate(maxBaudRate);
 
-        if (!SetCommTimeouts(m_hSerialComm, &timeouts))
+        if (!ret)
         {
-            ret = FALSE;
-            MessageBox(NULL, _T("Error setting timeout state for COM5."), _T("NesDbg"), MB_OK);
+            ReportError(_T("Lost communication with the NES FPGA while changing baud rate."));
         }
     }
 
-    if (ret)
+    if (ret && framed)
     {
-        // Add short sleep here.  The first serial read/write fails sometimes if it occurs to soon
-        // after init.
-        Sleep(200);
+        ret = SetFramedMode(TRUE);
 
-        // Send a debug echo packet to the NES to verify the connection.
-        const char* pInitString = "NES";
-        const UINT initStringSize = strlen(pInitString) + 1;
+        if (!ret)
+        {
+            ReportError(_T("Lost communication with the NES FPGA while entering framed mode."));
+        }
+    }
 
-        EchoPacket initEchoPkt(reinterpret_cast<const BYTE*>(pInitString), initStringSize);
+    return ret;
+}
 
-        SendData(initEchoPkt.PacketData(), initEchoPkt.SizeInBytes());
+/***************************************************************************************************
+** % Method:      SerialComm::Init()
+*  % Description: SerialComm initialization method taking an already opened transport.  The
+*                 SerialComm object takes ownership of pTransport, even on failure.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::Init(
+    Transport* pTransport)  // open transport connected to the NES FPGA
+{
+    assert(pTransport);
+    assert(!m_pTransport);
 
-        UINT bytesToReceive = initEchoPkt.ReturnBytesExpected();
+    m_pTransport = pTransport;
 
-        char* pOutString = new char[bytesToReceive];
+    BOOL ret = StartReader();
 
-        ReceiveData(reinterpret_cast<BYTE*>(pOutString), bytesToReceive);
+    if (ret)
+    {
+        ret = Connect();
 
-        if (strcmp(pInitString, pOutString))
+        if (!ret)
         {
-            ret = FALSE;
-            MessageBox(NULL, _T("NES FPGA not connected."), _T("NesDbg"), MB_OK);
+            ReportError(_T("NES FPGA not connected."));
         }
-
-        delete [] pOutString;
     }
 
     return ret;
@@ -164,47 +211,1422 @@ BOOL SerialComm::Init()
 
 /***************************************************************************************************
 ** % Method:      SerialComm::SendData()
-*  % Description: Transmits specified data through the serial port.
+*  % Description: Transmits specified data through the serial port.  Any asynchronously submitted
+*                 packets are completed first, so the data is not interleaved with them.  The data
+*                 is sent as is, so this may not be used in framed mode.
 *  % Returns:     TRUE on success, FALSE otherwise.
 ***************************************************************************************************/
 BOOL SerialComm::SendData(
     const BYTE* pData,     // data to transmit
     UINT        numBytes)  // number of bytes to transmit
 {
-    BOOL  ret          = TRUE;
-    DWORD bytesWritten = 0;
-
-    ret = WriteFile(m_hSerialComm, pData, numBytes, &bytesWritten, NULL);
+    BOOL ret = Drain();
 
-    assert(bytesWritten == numBytes);
-    if (bytesWritten != numBytes)
+    if (ret)
     {
-        ret = FALSE;
+        UINT bytesWritten = m_pTransport->Write(pData, numBytes, SendTimeoutMs);
+
+        assert(bytesWritten == numBytes);
+        if (bytesWritten != numBytes)
+        {
+            ret = FALSE;
+        }
     }
 
     return ret;
 }
 
+/***************************************************************************************************
+** % Method:      SerialComm::SendPacket()
+*  % Description: Sends a packet synchronously with SendData(), header and payload in turn.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::SendPacket(
+    const DbgPacket& packet)  // packet to send
+{
+    return SendData(packet.HeaderData(), packet.HeaderSize()) &&
+           ((packet.PayloadSize() == 0) || SendData(packet.PayloadData(), packet.PayloadSize()));
+}
+
 /***************************************************************************************************
 ** % Method:      SerialComm::ReceiveData()
 *  % Description: Receives specified number of bytes through the serial port, and stores them at
-*                 the location specified by pData.
+*                 the location specified by pData.  Any asynchronously submitted packets are
+*                 completed first, so their responses are not mistaken for this data.
 *  % Returns:     TRUE on success, FALSE otherwise.
 ***************************************************************************************************/
 BOOL SerialComm::ReceiveData(
     BYTE* pData,     // where to store received data
     UINT  numBytes)  // number of bytes to receive
 {
-    BOOL  ret       = TRUE;
-    DWORD bytesRead = 0;
+    BOOL ret = Drain() && ReceiveWithin(pData, numBytes, ReceiveTimeoutMs);
+
+    assert(ret);
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::ReceiveWithin()
+*  % Description: Receives specified number of bytes from the RX ring, waiting at most timeoutMs
+*                 for them to arrive.  Unlike ReceiveData(), a timeout is an expected outcome.
+*  % Returns:     TRUE if all bytes were received, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::ReceiveWithin(
+    BYTE* pData,      // where to store received data
+    UINT  numBytes,   // number of bytes to receive
+    UINT  timeoutMs)  // maximum time to wait for the data
+{
+    BOOL ret = TRUE;
+
+    const DWORD startMs   = GetTimeMs();
+    UINT        bytesRead = 0;
+
+    while (ret && (bytesRead < numBytes))
+    {
+        const BYTE* pSpan;
+        UINT        spanSize = m_rxRing.GetReadSpan(&pSpan);
+
+        if (spanSize)
+        {
+            AtomicIncrement(&m_rxHitCnt);
+
+            if (spanSize > numBytes - bytesRead)
+            {
+                spanSize = numBytes - bytesRead;
+            }
+
+            memcpy(pData + bytesRead, pSpan, spanSize);
+            m_rxRing.CommitRead(spanSize);
+
+            bytesRead += spanSize;
+        }
+        else
+        {
+            AtomicIncrement(&m_rxMissCnt);
+
+            UINT remainingMs = RemainingMs(startMs, timeoutMs);
+            ret = (remainingMs > 0) && m_rxEvent.Wait(remainingMs);
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::SubmitPacket()
+*  % Description: Stages a packet for asynchronous transmission.  The packet (header and payload)
+*                 is copied into the TX staging buffer, so the packet may be destroyed and its
+*                 payload buffer reused as soon as this returns.  Nothing is transmitted until the
+*                 next Flush() or Drain() (or until the request queue fills up), so a sequence of
+*                 packets goes out as a single write.  Once all ReturnBytesExpected() response
+*                 bytes have been stored at pRspData, pfnCompletion is called from within a later
+*                 SubmitPacket(), Flush() or Drain() call.
+*  % Returns:     TRUE on success, FALSE if the request queue could not be drained to make room.
+***************************************************************************************************/
+BOOL SerialComm::SubmitPacket(
+    const DbgPacket&      packet,         // packet to transmit
+    BYTE*                 pRspData,       // where to store the response (NULL to discard it)
+    DbgPacketCompletionFn pfnCompletion,  // called when the response has arrived (may be NULL)
+    VOID*                 pContext)       // context passed to pfnCompletion
+{
+    BOOL ret = TRUE;
 
-    ret = ReadFile(m_hSerialComm, pData, numBytes, &bytesRead, NULL);
+    // Keep frame SEQs unambiguous: the NES tells frames that were lost from resends of frames it
+    // already executed by how far their SEQ is from the one it expects.
+    const UINT maxRequests = (m_framed) ? MaxPendingFrames : MaxPendingRequests;
+
+    while (ret && (m_requestCnt >= maxRequests))
+    {
+        ret = PumpRequests(TRUE);
+    }
 
-    assert(bytesRead == numBytes);
-    if (bytesRead != numBytes)
+    if (ret && m_framed && (packet.SizeInBytes() > SetFramedPacket::MaxPayloadSize))
     {
+        assert(!"Packet too large for framed mode.");
         ret = FALSE;
     }
 
+    if (ret)
+    {
+        PendingRequest& request = GetRequest(m_requestHead + m_requestCnt);
+
+        request.txBytes       = packet.SizeInBytes();
+        request.txStarted     = FALSE;
+        request.behindStall   = FALSE;
+        request.pRspData      = pRspData;
+        request.rspBytes      = packet.ReturnBytesExpected();
+        request.rspBytesDone  = 0;
+        request.execTimeoutMs = packet.ExecTimeoutMs();
+        request.pfnCompletion = pfnCompletion;
+        request.pContext      = pContext;
+        request.pfnProgress   = NULL;
+        request.streamDone    = 0;
+        request.streamBytes   = 0;
+        request.seq           = 0;
+        request.rspCrc        = SetFramedPacket::CrcInit;
+        request.retryCnt      = 0;
+
+        if (m_framed)
+        {
+            request.seq       = m_txSeq++;
+            request.txBytes  += SetFramedPacket::TxHeaderSize + SetFramedPacket::CrcSize;
+            request.rspBytes += SetFramedPacket::RxHeaderSize + SetFramedPacket::CrcSize;
+
+            BYTE header[SetFramedPacket::TxHeaderSize];
+
+            header[0] = SetFramedPacket::FrameSof;
+            header[1] = request.seq;
+            header[2] = static_cast<BYTE>(packet.SizeInBytes() & 0xFF);
+            header[3] = static_cast<BYTE>(packet.SizeInBytes() >> 8);
+
+            USHORT crc = SetFramedPacket::UpdateCrc(SetFramedPacket::CrcInit,
+                                                    &header[1],
+                                                    SetFramedPacket::TxHeaderSize - 1);
+            crc = SetFramedPacket::UpdateCrc(crc, packet.HeaderData(), packet.HeaderSize());
+            crc = SetFramedPacket::UpdateCrc(crc, packet.PayloadData(), packet.PayloadSize());
+
+            m_txQueue.Push(&header[0], SetFramedPacket::TxHeaderSize);
+            QueuePacket(packet);
+            m_txQueue.Push(static_cast<BYTE>(crc & 0xFF));
+            m_txQueue.Push(static_cast<BYTE>(crc >> 8));
+        }
+        else
+        {
+            QueuePacket(packet);
+        }
+
+        request.txBytesLeft = request.txBytes;
+
+        m_requestCnt++;
+    }
+    else
+    {
+        AbortRequests();
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::StreamWrite()
+*  % Description: Stages a write of a CPU or PPU memory span of any length, as a series of
+*                 CpuMemWr/PpuMemWr packets of GetStreamChunkSize() bytes.  Like SubmitPacket(),
+*                 the data is copied, so pData may be reused as soon as this returns, and nothing is
+*                 waited for; pfnProgress is called as each chunk has been transmitted.  Staged
+*                 data is flushed every StreamFlushBytes, so the line is busy while later chunks
+*                 are still being encoded.  Addresses wrap at the end of the address space.
+*  % Returns:     TRUE on success, FALSE if the request queue could not be drained to make room.
+***************************************************************************************************/
+BOOL SerialComm::StreamWrite(
+    MemSpace         space,        // address space
+    USHORT           addr,         // first address to write
+    const BYTE*      pData,        // data to write
+    UINT             numBytes,     // size of pData, in bytes
+    StreamProgressFn pfnProgress,  // called as each chunk completes (may be NULL)
+    VOID*            pContext)     // context passed to pfnProgress
+{
+    const UINT chunkSize = GetStreamChunkSize(FALSE);
+
+    BOOL ret         = TRUE;
+    UINT stagedBytes = 0;
+
+    for (UINT offset = 0; ret && (offset < numBytes); offset += chunkSize)
+    {
+        const USHORT chunkBytes = static_cast<USHORT>((numBytes - offset < chunkSize)
+                                                      ? numBytes - offset
+                                                      : chunkSize);
+
+        ret = SubmitWriteChunk(space,
+                               static_cast<USHORT>(addr + offset),
+                               &pData[offset],
+                               chunkBytes,
+                               pfnProgress,
+                               pContext,
+                               offset + chunkBytes,
+                               numBytes);
+
+        stagedBytes += chunkBytes;
+
+        if (ret && (stagedBytes >= StreamFlushBytes))
+        {
+            Flush();
+            stagedBytes = 0;
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::StreamWriteCompressed()
+*  % Description: Like StreamWrite(), but each packet carries as much of the span as LzEncoder can
+*                 pack into the same packet size, as a MemWrLzPacket; packets that would not shrink
+*                 are sent as plain writes.  Copies read back memory written earlier in the span,
+*                 so the span must not contain addresses that alias each other (mirrors).
+*  % Returns:     TRUE on success, FALSE if the request queue could not be drained to make room.
+***************************************************************************************************/
+BOOL SerialComm::StreamWriteCompressed(
+    MemSpace         space,        // address space
+    USHORT           addr,         // first address to write
+    const BYTE*      pData,        // data to write
+    UINT             numBytes,     // size of pData, in bytes
+    StreamProgressFn pfnProgress,  // called as each chunk completes (may be NULL)
+    VOID*            pContext)     // context passed to pfnProgress
+{
+    // Keep packets the size StreamWrite() would use.
+    const UINT rawHeaderSize = DbgOpSchema<DbgPacketOpCodeCpuMemWr>::HeaderSize;
+    const UINT lzHeaderSize  = DbgOpSchema<DbgPacketOpCodeMemWrLz>::HeaderSize;
+    const UINT chunkSize     = GetStreamChunkSize(FALSE);
+
+    UINT tokenBudget = (chunkSize + rawHeaderSize > lzHeaderSize)
+                       ? chunkSize + rawHeaderSize - lzHeaderSize
+                       : 0;
+
+    if (tokenBudget > MaxLzTokenBytes)
+    {
+        tokenBudget = MaxLzTokenBytes;
+    }
+
+    if (tokenBudget < LzEncoder::MinTokenBytes)
+    {
+        // The link's packets are too small to hold a copy token.
+        return StreamWrite(space, addr, pData, numBytes, pfnProgress, pContext);
+    }
+
+    BOOL ret         = TRUE;
+    UINT stagedBytes = 0;
+
+    m_lzEncoder.Start(pData, numBytes);
+
+    while (ret && !m_lzEncoder.IsDone())
+    {
+        const UINT   offset     = m_lzEncoder.GetPosition();
+        const UINT   tokenBytes = m_lzEncoder.Encode(&m_lzTokens[0], tokenBudget);
+        const UINT   chunkBytes = m_lzEncoder.GetPosition() - offset;
+        const USHORT chunkAddr  = static_cast<USHORT>(addr + offset);
+
+        if (tokenBytes + lzHeaderSize < chunkBytes + rawHeaderSize)
+        {
+            MemWrLzPacket packet(space, chunkAddr, &m_lzTokens[0], static_cast<USHORT>(tokenBytes));
+            ret = SubmitChunk(packet, NULL, pfnProgress, pContext, offset + chunkBytes, numBytes);
+
+            stagedBytes += tokenBytes;
+        }
+        else
+        {
+            // All literals.  The plain write is no bigger, and the hci stores it a byte per cycle.
+            ret = SubmitWriteChunk(space,
+                                   chunkAddr,
+                                   &pData[offset],
+                                   static_cast<USHORT>(chunkBytes),
+                                   pfnProgress,
+                                   pContext,
+                                   offset + chunkBytes,
+                                   numBytes);
+
+            stagedBytes += chunkBytes;
+        }
+
+        if (ret && (stagedBytes >= StreamFlushBytes))
+        {
+            Flush();
+            stagedBytes = 0;
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::StreamRead()
+*  % Description: Stages a read of a CPU or PPU memory span of any length, as a series of
+*                 CpuMemRd/PpuMemRd packets of GetStreamChunkSize() bytes.  pData must remain valid
+*                 until the data has arrived (e.g., until the next Drain()); pfnProgress is called
+*                 as each chunk's data arrives.  Addresses wrap at the end of the address space.
+*  % Returns:     TRUE on success, FALSE if the request queue could not be drained to make room.
+***************************************************************************************************/
+BOOL SerialComm::StreamRead(
+    MemSpace         space,        // address space
+    USHORT           addr,         // first address to read
+    BYTE*            pData,        // receives the data
+    UINT             numBytes,     // size of pData, in bytes
+    StreamProgressFn pfnProgress,  // called as each chunk completes (may be NULL)
+    VOID*            pContext)     // context passed to pfnProgress
+{
+    const UINT chunkSize = GetStreamChunkSize(TRUE);
+
+    BOOL ret = TRUE;
+
+    for (UINT offset = 0; ret && (offset < numBytes); offset += chunkSize)
+    {
+        const USHORT chunkAddr  = static_cast<USHORT>(addr + offset);
+        const USHORT chunkBytes = static_cast<USHORT>((numBytes - offset < chunkSize)
+                                                      ? numBytes - offset
+                                                      : chunkSize);
+
+        if (space == MemSpaceCpu)
+        {
+            CpuMemRdPacket packet(chunkAddr, chunkBytes);
+            ret = SubmitChunk(packet,
+                              &pData[offset],
+                              pfnProgress,
+                              pContext,
+                              offset + chunkBytes,
+                              numBytes);
+        }
+        else
+        {
+            PpuMemRdPacket packet(chunkAddr, chunkBytes);
+            ret = SubmitChunk(packet,
+                              &pData[offset],
+                              pfnProgress,
+                              pContext,
+                              offset + chunkBytes,
+                              numBytes);
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::SubmitChunk()
+*  % Description: Submits one packet of a StreamWrite()/StreamRead(), recording the stream progress
+*                 to report when it completes.
+*  % Returns:     TRUE on success, FALSE if the request queue could not be drained to make room.
+***************************************************************************************************/
+BOOL SerialComm::SubmitChunk(
+    const DbgPacket& packet,       // chunk packet
+    BYTE*            pRspData,     // where to store the response (NULL to discard it)
+    StreamProgressFn pfnProgress,  // stream progress callback (may be NULL)
+    VOID*            pContext,     // context passed to pfnProgress
+    UINT             streamDone,   // stream bytes done once this chunk completes
+    UINT             streamBytes)  // total size of the stream
+{
+    BOOL ret = SubmitPacket(packet, pRspData, NULL, pContext);
+
+    if (ret)
+    {
+        PendingRequest& request = GetRequest(m_requestHead + m_requestCnt - 1);
+
+        request.pfnProgress = pfnProgress;
+        request.streamDone  = streamDone;
+        request.streamBytes = streamBytes;
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::SubmitWriteChunk()
+*  % Description: Submits one CpuMemWr/PpuMemWr packet of a stream write.
+*  % Returns:     TRUE on success, FALSE if the request queue could not be drained to make room.
+***************************************************************************************************/
+BOOL SerialComm::SubmitWriteChunk(
+    MemSpace         space,        // address space
+    USHORT           addr,         // first address to write
+    const BYTE*      pData,        // data to write
+    USHORT           numBytes,     // size of pData, in bytes
+    StreamProgressFn pfnProgress,  // stream progress callback (may be NULL)
+    VOID*            pContext,     // context passed to pfnProgress
+    UINT             streamDone,   // stream bytes done once this chunk completes
+    UINT             streamBytes)  // total size of the stream
+{
+    BOOL ret;
+
+    if (space == MemSpaceCpu)
+    {
+        CpuMemWrPacket packet(addr, numBytes, pData);
+        ret = SubmitChunk(packet, NULL, pfnProgress, pContext, streamDone, streamBytes);
+    }
+    else
+    {
+        PpuMemWrPacket packet(addr, numBytes, pData);
+        ret = SubmitChunk(packet, NULL, pfnProgress, pContext, streamDone, streamBytes);
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::GetStreamChunkSize()
+*  % Description: Works out the largest chunk a stream should be split into.  In framed mode a
+*                 packet has to fit in one frame.  Otherwise, write chunks are sized so header and
+*                 data fit in the NES RX fifo, and read chunks so the data fits in the NES TX fifo;
+*                 either way the chunk can be sent even while the hci is stalled on earlier
+*                 responses (see CanStart()), which keeps the link busy.
+*  % Returns:     Chunk size, in bytes.
+***************************************************************************************************/
+UINT SerialComm::GetStreamChunkSize(
+    BOOL read)  // TRUE for StreamRead() chunks, FALSE for StreamWrite() chunks
+    const
+{
+    // CPU and PPU memory packets share a layout.
+    const UINT headerSize = DbgOpSchema<DbgPacketOpCodeCpuMemWr>::HeaderSize;
+
+    STATIC_ASSERT((DbgOpSchema<DbgPacketOpCodeCpuMemRd>::HeaderSize == headerSize) &&
+                  (DbgOpSchema<DbgPacketOpCodePpuMemRd>::HeaderSize == headerSize) &&
+                  (DbgOpSchema<DbgPacketOpCodePpuMemWr>::HeaderSize == headerSize));
+
+    UINT ret;
+
+    if (m_framed)
+    {
+        ret = SetFramedPacket::MaxPayloadSize - headerSize;
+    }
+    else if (read)
+    {
+        ret = m_rspCredits;
+    }
+    else
+    {
+        ret = (m_reqCredits > headerSize) ? m_reqCredits - headerSize : 1;
+    }
+
+    // The packet length fields are 16 bits.
+    return (ret < 0xFFFF) ? ret : 0xFFFF;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::QueuePacket()
+*  % Description: Appends a packet's header and payload to the TX staging buffer.  The buffer only
+*                 grows until it fits the largest batch, so in steady state this never allocates.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID SerialComm::QueuePacket(
+    const DbgPacket& packet)  // packet to stage
+{
+    m_txQueue.Push(packet.HeaderData(), packet.HeaderSize());
+
+    if (packet.PayloadSize())
+    {
+        m_txQueue.Push(packet.PayloadData(), packet.PayloadSize());
+    }
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::Flush()
+*  % Description: Hands all staged packet data to the transport in a single write (as much as it
+*                 will take without blocking), receives any available responses, and delivers
+*                 completions for finished requests.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID SerialComm::Flush()
+{
+    PumpRequests(FALSE);
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::Drain()
+*  % Description: Flushes staged packets and waits for submitted packets to complete, until no more
+*                 than maxRequestCnt remain outstanding (by default, until all have completed).  If
+*                 the NES FPGA stops responding for ReceiveTimeoutMs, all outstanding requests are
+*                 completed with failure.
+*  % Returns:     TRUE if the requests completed successfully, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::Drain(
+    UINT maxRequestCnt)  // number of requests that may still be outstanding on return
+{
+    BOOL ret = TRUE;
+
+    while (ret && (m_requestCnt > maxRequestCnt))
+    {
+        ret = PumpRequests(TRUE);
+    }
+
+    if (!ret)
+    {
+        AbortRequests();
+    }
+
     return ret;
 }
+
+/***************************************************************************************************
+** % Method:      SerialComm::Connect()
+*  % Description: Establishes communication with the NES over a freshly opened transport.  Stale
+*                 bytes left from before the port was opened (or garbled while it was being
+*                 configured) are discarded before each echo attempt, rather than waiting a fixed
+*                 time for the line to settle.  Then learns the NES fifo credits.
+*  % Returns:     TRUE if the NES responded, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::Connect()
+{
+    BOOL ret = FALSE;
+
+    for (UINT attempt = 0; !ret && (attempt < ConnectAttempts); attempt++)
+    {
+        m_pTransport->Purge();
+        m_rxRing.Discard();
+
+        ret = VerifyConnection();
+    }
+
+    if (ret)
+    {
+        ret = QueryCredits();
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::QueryCredits()
+*  % Description: Asks the NES how much space its uart fifos have, and sizes the transmit window
+*                 to match.  Must be called while no requests are outstanding, so the fifos are
+*                 empty and the free counts are the full depths.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::QueryCredits()
+{
+    QueryCreditsPacket queryCreditsPkt;
+    BYTE               credits[DbgOpSchema<DbgPacketOpCodeQueryCredits>::RspSize];
+
+    STATIC_ASSERT(sizeof(credits) == 4);
+
+    BOOL ret = SendPacket(queryCreditsPkt) &&
+               ReceiveWithin(&credits[0], sizeof(credits), ConnectTimeoutMs);
+
+    if (ret)
+    {
+        UINT reqCredits = credits[0] | (credits[1] << 8);
+        UINT rspCredits = credits[2] | (credits[3] << 8);
+
+        ret = (reqCredits > 0) && (rspCredits > 0);
+
+        if (ret)
+        {
+            m_reqCredits = reqCredits;
+            m_rspCredits = rspCredits;
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::VerifyConnection()
+*  % Description: Sends a debug echo packet to the NES to verify the connection.
+*  % Returns:     TRUE if the NES echoed the packet correctly, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::VerifyConnection()
+{
+    const char* pInitString = "NES";
+    const UINT initStringSize = strlen(pInitString) + 1;
+
+    EchoPacket initEchoPkt(reinterpret_cast<const BYTE*>(pInitString), initStringSize);
+
+    BYTE outString[4];
+
+    assert(initEchoPkt.ReturnBytesExpected() == sizeof(outString));
+
+    BOOL ret = SendPacket(initEchoPkt) &&
+               ReceiveWithin(&outString[0], sizeof(outString), ConnectTimeoutMs) &&
+               (memcmp(pInitString, &outString[0], initStringSize) == 0);
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::SetBaudRate()
+*  % Description: Switches both ends of the link to a new baud rate.  The NES echoes a test burst
+*                 at the new rate, and the switch is only confirmed if the burst comes back
+*                 intact.  On failure the NES times out and both ends fall back to
+*                 DefaultBaudRate.  The switch can't be made in framed mode, so this leaves it.
+*  % Returns:     TRUE if the link is now running at baudRate, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::SetBaudRate(
+    UINT baudRate)  // new baud rate, must be one SetBaudPacket supports
+{
+    BYTE baudSel = 0;
+    BOOL ret     = SetBaudPacket::GetBaudSel(baudRate, &baudSel) && Drain();
+
+    if (ret && (baudRate != m_baudRate))
+    {
+        SetBaudPacket setBaudPkt(baudSel);
+        BYTE          ack = 0;
+
+        ret = SetFramedMode(FALSE) &&
+              SendPacket(setBaudPkt) &&
+              ReceiveWithin(&ack, 1, ReceiveTimeoutMs) &&
+              (ack == baudSel);
+
+        // From here on the NES may be at the new rate, waiting for confirmation.
+        const DWORD switchMs = GetTimeMs();
+
+        if (ret)
+        {
+            ret = m_pTransport->SetBaudRate(baudRate);
+        }
+
+        if (ret)
+        {
+            // Drop anything garbled by the switch.
+            Sleep(BaudSettleMs);
+            m_rxRing.Discard();
+
+            ret = TestLink();
+        }
+
+        if (ret)
+        {
+            BYTE confirm = SetBaudPacket::ConfirmByte;
+
+            ret = (m_pTransport->Write(&confirm, 1, SendTimeoutMs) == 1) &&
+                  ReceiveWithin(&confirm, 1, BaudTestTimeoutMs) &&
+                  (confirm == SetBaudPacket::ConfirmByte);
+        }
+
+        if (ret)
+        {
+            m_baudRate = baudRate;
+        }
+        else
+        {
+            // Wait out the NES confirmation timeout so it has reverted to the default rate too.
+            m_pTransport->SetBaudRate(DefaultBaudRate);
+            Sleep(RemainingMs(switchMs, SetBaudPacket::ConfirmTimeoutMs + BaudSettleMs));
+
+            m_pTransport->Purge();
+            m_rxRing.Discard();
+
+            m_baudRate = DefaultBaudRate;
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::NegotiateBaudRate()
+*  % Description: Tries each rate SetBaudPacket supports, fastest first, up to maxBaudRate, and
+*                 keeps the first one that works.
+*  % Returns:     TRUE if the NES is still reachable afterwards (possibly at DefaultBaudRate),
+*                 FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::NegotiateBaudRate(
+    UINT maxBaudRate)  // fastest baud rate to try
+{
+    BOOL ret = TRUE;
+
+    for (INT baudSel = SetBaudPacket::BaudSelCnt - 1;
+         ret && (baudSel > SetBaudPacket::BaudSelDefault);
+         baudSel--)
+    {
+        UINT baudRate = SetBaudPacket::GetBaudRate(static_cast<BYTE>(baudSel));
+
+        if (baudRate <= maxBaudRate)
+        {
+            if (SetBaudRate(baudRate))
+            {
+                break;
+            }
+
+            // A failed switch falls back to the default rate; make sure that actually worked.
+            ret = VerifyConnection();
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::SetFramedMode()
+*  % Description: Enters or leaves framed mode (see SetFramedPacket).  Outstanding requests are
+*                 completed first.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::SetFramedMode(
+    BOOL enable)  // TRUE to enter framed mode, FALSE to leave it
+{
+    BOOL ret = Drain();
+
+    if (ret && (!enable != !m_framed))
+    {
+        SetFramedPacket setFramedPkt(enable);
+        BYTE            ack = 0xFF;
+
+        // The NES acknowledges in the mode it received the packet in.
+        ret = SubmitPacket(setFramedPkt, &ack) &&
+              Drain() &&
+              (ack == setFramedPkt.HeaderData()[1]);
+
+        if (ret)
+        {
+            // The NES starts the SEQs over on entering framed mode.
+            m_framed = enable;
+            m_txSeq  = 0;
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::TestLink()
+*  % Description: Sends a BaudTestBytes burst while the NES is echoing after a rate switch, and
+*                 checks that it comes back intact.  The pattern never contains
+*                 SetBaudPacket::ConfirmByte, so the NES keeps echoing.
+*  % Returns:     TRUE if the burst was echoed correctly, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::TestLink()
+{
+    BYTE testData[BaudTestBytes];
+    BYTE echoData[BaudTestBytes];
+
+    // Walk every bit position through both levels, with alternating and solid bytes mixed in.
+    for (UINT i = 0; i < BaudTestBytes; i++)
+    {
+        static const BYTE Patterns[] = { 0x55, 0xAA, 0x00, 0xFF };
+
+        testData[i] = (i & 1) ? Patterns[(i >> 1) & 3] : static_cast<BYTE>(1 << ((i >> 1) & 7));
+    }
+
+    return (m_pTransport->Write(&testData[0], BaudTestBytes, SendTimeoutMs) == BaudTestBytes) &&
+           ReceiveWithin(&echoData[0], BaudTestBytes, BaudTestTimeoutMs) &&
+           (memcmp(&testData[0], &echoData[0], BaudTestBytes) == 0);
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::PumpRequests()
+*  % Description: Transmits queued packet data, receives response data and completes finished
+*                 requests.  TX and RX are serviced in the same pass so both directions of the
+*                 UART stay busy.  If nothing could be done and wait is set, blocks until the
+*                 transport is ready, or until a stall point that sends nothing back must have
+*                 finished.
+*  % Returns:     FALSE if wait was set and the transport stayed idle for GetResponseTimeoutMs()
+*                 with requests outstanding, or if a frame could not be delivered in framed mode,
+*                 TRUE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::PumpRequests(
+    BOOL wait)  // TRUE to block if no progress can be made immediately
+{
+    BOOL ret = TRUE;
+
+    BOOL progress = TransmitRequests();
+    progress      = ReceiveResponses() || progress;
+
+    CompleteRequests();
+
+    if (m_frameErr)
+    {
+        ret = RetransmitFrames();
+    }
+    else if (!progress && wait && m_requestCnt)
+    {
+        // The reader thread owns the receive side of the transport; wait on it for responses.
+        if (CanTransmit())
+        {
+            ret = m_pTransport->WaitForIo(TransportIoWrite, ReceiveTimeoutMs);
+        }
+        else if (m_stallPending && (m_rspBytesInFlight == 0))
+        {
+            // The queue is held back by a stall point with no response of its own (a vblank mode
+            // ProgRun of a program that reads nothing), and nothing is owed that would show it has
+            // finished.  Wait out the time it may take instead.
+            Sleep(m_stallExecMs);
+
+            m_stallPending     = FALSE;
+            m_bytesBehindStall = 0;
+        }
+        else
+        {
+            AtomicIncrement(&m_rxMissCnt);
+            ret = m_rxEvent.Wait(GetResponseTimeoutMs());
+
+            // In framed mode, silence means a frame was lost (or dropped after one was).
+            if (!ret && m_framed)
+            {
+                ret = RetransmitFrames();
+            }
+        }
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::TransmitRequests()
+*  % Description: Hands as much queued packet data to the transport as it will take without
+*                 blocking, subject to the NES fifo credits (see CanStart()).
+*  % Returns:     TRUE if any data was transmitted, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::TransmitRequests()
+{
+    // Work out how much of the queued data the credits allow to go out now.
+    UINT txBytes          = 0;
+    UINT rspBytesInFlight = m_rspBytesInFlight;
+    BOOL stallPending     = m_stallPending;
+    UINT bytesBehindStall = m_bytesBehindStall;
+    UINT txBytesInFlight  = m_txBytesInFlight;
+
+    for (UINT idx = m_txRequestIdx; (idx - m_requestHead) < m_requestCnt; idx++)
+    {
+        const PendingRequest& request = GetRequest(idx);
+
+        if (!request.txStarted)
+        {
+            if (!CanStart(request,
+                          rspBytesInFlight,
+                          stallPending,
+                          bytesBehindStall,
+                          txBytesInFlight))
+            {
+                break;
+            }
+
+            if (stallPending || (rspBytesInFlight > m_rspCredits))
+            {
+                bytesBehindStall += request.txBytesLeft;
+            }
+
+            rspBytesInFlight += request.rspBytes;
+            txBytesInFlight  += request.txBytes;
+            stallPending      = stallPending || (request.execTimeoutMs > 0);
+        }
+        else if (request.behindStall)
+        {
+            bytesBehindStall += request.txBytesLeft;
+        }
+
+        txBytes += request.txBytesLeft;
+    }
+
+    UINT bytesWritten = 0;
+    if (txBytes)
+    {
+        bytesWritten = m_pTransport->Write(m_txQueue.Data() + m_txOffset, txBytes, 0);
+        m_txOffset  += bytesWritten;
+    }
+
+    // Credit the transmitted bytes to their requests.
+    for (UINT bytesLeft = bytesWritten; bytesLeft; )
+    {
+        PendingRequest& request = GetRequest(m_txRequestIdx);
+
+        if (!request.txStarted)
+        {
+            request.txStarted   = TRUE;
+            request.behindStall = m_stallPending || (m_rspBytesInFlight > m_rspCredits);
+            m_rspBytesInFlight += request.rspBytes;
+            m_txBytesInFlight  += request.txBytes;
+
+            if (request.execTimeoutMs)
+            {
+                m_stallPending = TRUE;
+                m_stallIdx     = m_txRequestIdx;
+                m_stallExecMs  = request.execTimeoutMs;
+            }
+        }
+
+        UINT requestBytes = (bytesLeft < request.txBytesLeft) ? bytesLeft : request.txBytesLeft;
+
+        request.txBytesLeft -= requestBytes;
+        bytesLeft           -= requestBytes;
+
+        if (request.behindStall)
+        {
+            m_bytesBehindStall += requestBytes;
+        }
+
+        if (request.txBytesLeft == 0)
+        {
+            m_txRequestIdx++;
+        }
+    }
+
+    return (bytesWritten > 0);
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::ReceiveResponses()
+*  % Description: Consumes whatever response data the reader thread has buffered, and distributes
+*                 it to transmitted requests in FIFO order.  Discarded responses are released from
+*                 the ring without being copied.  In framed mode, stops at the first bad frame.
+*  % Returns:     TRUE if any data was received, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::ReceiveResponses()
+{
+    BOOL progress = FALSE;
+
+    while (!m_frameErr && ((m_rxRequestIdx - m_requestHead) < m_requestCnt))
+    {
+        PendingRequest& request = GetRequest(m_rxRequestIdx);
+
+        if (request.rspBytesDone == request.rspBytes)
+        {
+            m_rxRequestIdx++;
+            continue;
+        }
+
+        // Nothing can arrive for a request that hasn't been sent yet.
+        if (!request.txStarted)
+        {
+            break;
+        }
+
+        const BYTE* pSpan;
+        UINT        bytesRead = m_rxRing.GetReadSpan(&pSpan);
+
+        if (bytesRead == 0)
+        {
+            break;
+        }
+
+        AtomicIncrement(&m_rxHitCnt);
+
+        if (bytesRead > request.rspBytes - request.rspBytesDone)
+        {
+            bytesRead = request.rspBytes - request.rspBytesDone;
+        }
+
+        if (m_framed)
+        {
+            bytesRead = ReceiveFrame(request, pSpan, bytesRead);
+        }
+        else if (request.pRspData)
+        {
+            memcpy(request.pRspData + request.rspBytesDone, pSpan, bytesRead);
+        }
+
+        m_rxRing.CommitRead(bytesRead);
+
+        request.rspBytesDone += bytesRead;
+        m_rspBytesInFlight   -= bytesRead;
+        progress              = TRUE;
+
+        // A response shows that everything before it has finished executing, including any stall
+        // point.
+        const UINT doneIdx = (request.rspBytesDone == request.rspBytes) ? m_rxRequestIdx
+                                                                        : m_rxRequestIdx - 1;
+
+        if (m_stallPending && (static_cast<INT>(doneIdx - m_stallIdx) >= 0))
+        {
+            m_stallPending = FALSE;
+        }
+
+        // Once no stall point is executing and the rest of the owed responses fit in the TX fifo,
+        // the hci can no longer stall, and it will drain everything sent behind the stall.
+        if (!m_stallPending && (m_rspBytesInFlight <= m_rspCredits))
+        {
+            m_bytesBehindStall = 0;
+        }
+    }
+
+    return progress;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::ReceiveFrame()
+*  % Description: Checks and unwraps part of a response frame (see SetFramedPacket), storing the
+*                 response data.  pData holds the bytes following the request's rspBytesDone, and
+*                 no more than the rest of the frame.  Flags m_frameErr if anything doesn't match,
+*                 including a NAK.
+*  % Returns:     Number of bytes consumed.
+***************************************************************************************************/
+UINT SerialComm::ReceiveFrame(
+    PendingRequest& request,   // request the response frame belongs to
+    const BYTE*     pData,     // response frame bytes
+    UINT            numBytes)  // number of bytes in pData
+{
+    const UINT dataEnd = request.rspBytes - SetFramedPacket::CrcSize;
+
+    UINT bytesUsed = 0;
+
+    while (!m_frameErr && (bytesUsed < numBytes))
+    {
+        const UINT pos = request.rspBytesDone + bytesUsed;
+
+        if ((pos >= SetFramedPacket::RxHeaderSize) && (pos < dataEnd))
+        {
+            // Response data.
+            UINT chunkSize = dataEnd - pos;
+            if (chunkSize > numBytes - bytesUsed)
+            {
+                chunkSize = numBytes - bytesUsed;
+            }
+
+            if (request.pRspData)
+            {
+                memcpy(request.pRspData + pos - SetFramedPacket::RxHeaderSize,
+                       pData + bytesUsed,
+                       chunkSize);
+            }
+
+            request.rspCrc = SetFramedPacket::UpdateCrc(request.rspCrc,
+                                                        pData + bytesUsed,
+                                                        chunkSize);
+            bytesUsed += chunkSize;
+        }
+        else
+        {
+            const BYTE data = pData[bytesUsed++];
+
+            switch (pos)
+            {
+                case 0:  m_frameErr = (data != SetFramedPacket::FrameSof); break;
+                case 1:  m_frameErr = (data != request.seq);               break;
+                case 2:  m_frameErr = (data != SetFramedPacket::FrameAck); break;
+                default:
+                    // CRC, low byte first.
+                    m_frameErr = (pos == dataEnd) ? (data != (request.rspCrc & 0xFF))
+                                                  : (data != (request.rspCrc >> 8));
+                    break;
+            }
+
+            if (pos < SetFramedPacket::RxHeaderSize)
+            {
+                request.rspCrc = (pos == 0) ? SetFramedPacket::CrcInit
+                                            : SetFramedPacket::UpdateCrc(request.rspCrc, &data, 1);
+            }
+        }
+    }
+
+    return bytesUsed;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::RetransmitFrames()
+*  % Description: Recovers from a bad, missing or NAKed response frame in framed mode.  Lets
+*                 everything already sent play out, discards the responses, and then rewinds to
+*                 the oldest request without a response: the frame the NES NAKed, or one whose
+*                 response was lost.  The NES drops frames ahead of the one it expects, and answers
+*                 resends of frames it already executed with their kept responses instead of
+*                 executing them again, so each frame is executed once, in order.
+*  % Returns:     TRUE to carry on, FALSE if the oldest request has failed too many times.
+***************************************************************************************************/
+BOOL SerialComm::RetransmitFrames()
+{
+    assert(m_framed && m_requestCnt);
+
+    m_frameErr = FALSE;
+    AtomicIncrement(&m_retryCnt);
+
+    BOOL ret = (++GetRequest(m_requestHead).retryCnt <= MaxFrameRetries);
+
+    // Finish any frame that is partway out, so the NES frame parser ends on a frame boundary.
+    if (ret && ((m_txRequestIdx - m_requestHead) < m_requestCnt))
+    {
+        const PendingRequest& request = GetRequest(m_txRequestIdx);
+
+        if (request.txStarted)
+        {
+            ret = (m_pTransport->Write(m_txQueue.Data() + m_txOffset,
+                                       request.txBytesLeft,
+                                       SendTimeoutMs) == request.txBytesLeft);
+        }
+    }
+
+    // Every response that may have to be sent again is still in the NES replay buffer.
+    STATIC_ASSERT(FrameWindowBytes <= SetFramedPacket::ReplaySize);
+
+    if (ret)
+    {
+        // Wait for the line to go quiet.  FrameWindowBytes limits how long that can take.
+        do
+        {
+            m_rxRing.Discard();
+        } while (m_rxEvent.Wait(GetFrameTimeoutMs()));
+
+        m_rxRing.Discard();
+
+        for (UINT i = 0; i < m_requestCnt; i++)
+        {
+            PendingRequest& request = GetRequest(m_requestHead + i);
+
+            request.txBytesLeft  = request.txBytes;
+            request.txStarted    = FALSE;
+            request.behindStall  = FALSE;
+            request.rspBytesDone = 0;
+            request.rspCrc       = SetFramedPacket::CrcInit;
+        }
+
+        m_txOffset         = 0;
+        m_txRequestIdx     = m_requestHead;
+        m_rxRequestIdx     = m_requestHead;
+        m_rspBytesInFlight = 0;
+        m_txBytesInFlight  = 0;
+        m_bytesBehindStall = 0;
+        m_stallPending     = FALSE;
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::GetFrameTimeoutMs()
+*  % Description: Works out how long a framed mode response may take: FrameTimeoutMs, plus the
+*                 time to send a full FrameWindowBytes window at the current baud rate (11 bits per
+*                 byte, with parity).
+*  % Returns:     Timeout, in milliseconds.
+***************************************************************************************************/
+UINT SerialComm::GetFrameTimeoutMs() const
+{
+    return FrameTimeoutMs + ((FrameWindowBytes * 11 * 1000) / m_baudRate);
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::GetResponseTimeoutMs()
+*  % Description: Works out how long to wait for more response data before giving up (or, in
+*                 framed mode, retransmitting): GetFrameTimeoutMs() or ReceiveTimeoutMs, plus the
+*                 execution time allowed for the request awaiting a response (e.g., a Wait).
+*  % Returns:     Timeout, in milliseconds.
+***************************************************************************************************/
+UINT SerialComm::GetResponseTimeoutMs() const
+{
+    UINT timeoutMs = (m_framed) ? GetFrameTimeoutMs() : ReceiveTimeoutMs;
+
+    if ((m_rxRequestIdx - m_requestHead) < m_requestCnt)
+    {
+        timeoutMs += GetRequest(m_rxRequestIdx).execTimeoutMs;
+    }
+
+    return timeoutMs;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::CompleteRequests()
+*  % Description: Retires requests that have been fully transmitted and have received their full
+*                 response, in submission order, calling their completion callbacks.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID SerialComm::CompleteRequests()
+{
+    while (m_requestCnt &&
+           (m_requestHead != m_txRequestIdx) &&
+           (m_requestHead != m_rxRequestIdx))
+    {
+        const PendingRequest& request = GetRequest(m_requestHead);
+
+        DbgPacketCompletionFn pfnCompletion = request.pfnCompletion;
+        StreamProgressFn      pfnProgress   = request.pfnProgress;
+        VOID*                 pContext      = request.pContext;
+        const UINT            streamDone    = request.streamDone;
+        const UINT            streamBytes   = request.streamBytes;
+
+        // Packet bytes are kept until now, in case they have to be resent.
+        m_txQueue.Pop(request.txBytes);
+        m_txOffset        -= request.txBytes;
+        m_txBytesInFlight -= request.txBytes;
+
+        // Retire the request before the callback runs, in case it submits another packet.
+        m_requestHead++;
+        m_requestCnt--;
+
+        if (pfnCompletion)
+        {
+            pfnCompletion(pContext, TRUE);
+        }
+
+        if (pfnProgress)
+        {
+            pfnProgress(pContext, streamDone, streamBytes);
+        }
+    }
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::AbortRequests()
+*  % Description: Discards all queued and in-flight data and completes every outstanding request
+*                 with failure.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID SerialComm::AbortRequests()
+{
+    m_pTransport->Purge();
+    m_rxRing.Discard();
+    m_txQueue.Clear();
+
+    m_txOffset = 0;
+    m_frameErr = FALSE;
+
+    const UINT requestCnt = m_requestCnt;
+    const UINT requestIdx = m_requestHead;
+
+    m_requestHead     += m_requestCnt;
+    m_requestCnt       = 0;
+    m_txRequestIdx     = m_requestHead;
+    m_rxRequestIdx     = m_requestHead;
+    m_rspBytesInFlight = 0;
+    m_txBytesInFlight  = 0;
+    m_bytesBehindStall = 0;
+    m_stallPending     = FALSE;
+
+    for (UINT i = 0; i < requestCnt; i++)
+    {
+        const PendingRequest& request = GetRequest(requestIdx + i);
+
+        if (request.pfnCompletion)
+        {
+            request.pfnCompletion(request.pContext, FALSE);
+        }
+    }
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::CanTransmit()
+*  % Description: Determines whether the next queued packet may be transmitted now.
+*  % Returns:     TRUE if there is queued data the credits allow to go out, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::CanTransmit() const
+{
+    BOOL ret = FALSE;
+
+    if ((m_txRequestIdx - m_requestHead) < m_requestCnt)
+    {
+        const PendingRequest& request = GetRequest(m_txRequestIdx);
+
+        ret = request.txStarted ||
+              CanStart(request,
+                       m_rspBytesInFlight,
+                       m_stallPending,
+                       m_bytesBehindStall,
+                       m_txBytesInFlight);
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::CanStart()
+*  % Description: Determines whether a request may begin transmission without overrunning the NES
+*                 uart fifos.  The hci stops draining its RX fifo while it is stalled, which happens
+*                 in two ways:
+*
+*                 - on a full TX fifo, which can only happen once more response bytes are owed
+*                   than the TX fifo holds (m_rspCredits);
+*                 - while executing a stall point: any request with an execTimeoutMs, such as a
+*                   Wait, which holds the hci until its condition is met, or a vblank mode
+*                   ProgRun, which holds it until each vblank.
+*
+*                 Until either may have happened anything may be sent; the request that crosses
+*                 the line, or the stall point itself, is consumed before the hci stalls.  Every
+*                 byte sent after it counts against the RX fifo (m_reqCredits) until the responses
+*                 drain below m_rspCredits and a response shows the stall point has finished.
+*
+*                 In framed mode, the unacknowledged frames and the responses they still owe are
+*                 also limited to FrameWindowBytes, which bounds how much has to play out before
+*                 frames can be resent.  Small requests for large responses would otherwise keep
+*                 the line busy well past GetFrameTimeoutMs().
+*  % Returns:     TRUE if the request may be transmitted, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::CanStart(
+    const PendingRequest& request,           // request to check
+    UINT                  rspBytesInFlight,  // response bytes owed by earlier requests
+    BOOL                  stallPending,      // an earlier stall point may still be executing
+    UINT                  bytesBehindStall,  // bytes sent since the hci may have stalled
+    UINT                  txBytesInFlight)   // bytes of earlier requests not yet completed
+    const
+{
+    BOOL ret = (!stallPending && (rspBytesInFlight <= m_rspCredits)) ||
+               (bytesBehindStall + request.txBytesLeft <= m_reqCredits);
+
+    if (ret && m_framed && txBytesInFlight)
+    {
+        ret = (txBytesInFlight + rspBytesInFlight + request.txBytes + request.rspBytes <=
+               FrameWindowBytes);
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::GetRxStats()
+*  % Description: Returns receive path statistics accumulated since Init().
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID SerialComm::GetRxStats(
+    SerialCommRxStats* pStats)  // receives the statistics
+    const
+{
+    pStats->hitCnt      = static_cast<UINT>(AtomicLoad(&m_rxHitCnt));
+    pStats->missCnt     = static_cast<UINT>(AtomicLoad(&m_rxMissCnt));
+    pStats->overflowCnt = static_cast<UINT>(AtomicLoad(&m_rxOverflowCnt));
+    pStats->retryCnt    = static_cast<UINT>(AtomicLoad(&m_retryCnt));
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::StartReader()
+*  % Description: Allocates the RX ring and starts the background reader thread.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL SerialComm::StartReader()
+{
+    AtomicStore(&m_stopReader, 0);
+
+    return m_rxRing.Init(RxRingSize) &&
+           m_readerThread.Start(ReaderThreadProc, this);
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::StopReader()
+*  % Description: Stops the background reader thread, and waits for it to exit.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID SerialComm::StopReader()
+{
+    AtomicStore(&m_stopReader, 1);
+    m_readerThread.Join();
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::ReaderThreadProc()
+*  % Description: Reader thread entry point.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID SerialComm::ReaderThreadProc(
+    VOID* pContext)  // SerialComm object
+{
+    static_cast<SerialComm*>(pContext)->ReaderThread();
+}
+
+/***************************************************************************************************
+** % Method:      SerialComm::ReaderThread()
+*  % Description: Reader thread body.  Reads from the transport directly into free spans of the RX
+*                 ring, and signals m_rxEvent as data is published.  Wakes at least every
+*                 ReaderPollMs to check for shutdown.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID SerialComm::ReaderThread()
+{
+    BOOL ringFull = FALSE;
+
+    while (!AtomicLoad(&m_stopReader))
+    {
+        BYTE* pSpan;
+        UINT  spanSize = m_rxRing.GetWriteSpan(&pSpan);
+
+        if (spanSize == 0)
+        {
+            // The consumer is a whole ring behind.  Leave further data in the driver until it
+            // catches up.
+            if (!ringFull)
+            {
+                AtomicIncrement(&m_rxOverflowCnt);
+                ringFull = TRUE;
+            }
+
+            Sleep(1);
+            continue;
+        }
+
+        ringFull = FALSE;
+
+        if (m_pTransport->WaitForIo(TransportIoRead, ReaderPollMs))
+        {
+            UINT bytesRead = m_pTransport->Read(pSpan, spanSize, 0);
+
+            if (bytesRead)
+            {
+                m_rxRing.CommitWrite(bytesRead);
+                m_rxEvent.Set();
+            }
+            else
+            {
+                // Readable but empty (e.g., the device was unplugged); don't spin.
+                Sleep(ReaderPollMs);
+            }
+        }
+    }
+}
@@ -0,0 +1,271 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/serialcomm.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  SerialComm class header.
+***************************************************************************************************/
+
+#ifndef SERIALCOMM_H
+#define SERIALCOMM_H
+
+#include "bytequeue.h"
+#include "dbgpacket.h"
+#include "lzencoder.h"
+#include "ringbuffer.h"
+#include "thread.h"
+#include "util.h"
+
+class Transport;
+
+// Called when an asynchronously submitted packet completes.  success is FALSE if the response did
+// not arrive, in which case the response buffer contents are undefined.
+typedef VOID (*DbgPacketCompletionFn)(VOID* pContext, BOOL success);
+
+// Called as each chunk of a StreamWrite()/StreamRead() completes.
+typedef VOID (*StreamProgressFn)(VOID* pContext, UINT bytesDone, UINT totalBytes);
+
+// Receive path statistics, see SerialComm::GetRxStats().
+struct SerialCommRxStats
+{
+    UINT hitCnt;       // receives satisfied from data the reader thread had already buffered
+    UINT missCnt;      // receives that had to wait for the reader thread
+    UINT overflowCnt;  // times the RX ring filled up and the reader thread had to stall
+    UINT retryCnt;     // framed mode retransmissions, after a NAK, bad response or timeout
+};
+
+/***************************************************************************************************
+** % Class:       SerialComm
+*  % Description: Manages communication with NES FPGA through serial port.
+*
+*                 Packets may be sent synchronously (SendData/ReceiveData) or submitted to an
+*                 asynchronous request queue (SubmitPacket).  Submitted packets are staged in a
+*                 single buffer until the next Flush() or Drain(), and then transmitted
+*                 back-to-back with one write while earlier responses are still arriving.
+*                 Responses are matched to requests in FIFO order using
+*                 DbgPacket::ReturnBytesExpected().  Transmission is paced by credits, the NES uart
+*                 fifo depths learned with QueryCreditsPacket at Init(), so the NES RX fifo is
+*                 never overrun even while the hci is stalled sending responses.
+*
+*                 A background reader thread drains the transport into a lock-free RX ring as
+*                 soon as data arrives, and all receives are served from spans of that ring.
+*
+*                 The link starts at DefaultBaudRate.  Init() then negotiates the fastest rate up to
+*                 maxBaudRate that passes an echo test (see SetBaudPacket), and the destructor
+*                 switches back so the next session can connect.
+*
+*                 Callers may opt in to framed mode (see SetFramedPacket), through Init() or
+*                 SetFramedMode(), where every submitted packet is CRC-checked in both directions.
+*                 A corrupted or lost frame is resent along with the frames behind it, rather than
+*                 silently corrupting NES memory.  SendData()/ReceiveData() bypass framing, so only
+*                 SubmitPacket() may be used in framed mode, with packets of at most
+*                 SetFramedPacket::MaxPayloadSize bytes.
+*
+*                 StreamWrite()/StreamRead() move memory spans of any length, split into packets
+*                 sized for the link (see GetStreamChunkSize()) and submitted like SubmitPacket().
+*                 StreamWriteCompressed() packs more of a span into each packet with MemWrLzPacket.
+***************************************************************************************************/
+class SerialComm
+{
+public:
+    SerialComm();
+    ~SerialComm();
+
+    BOOL Init(const TCHAR* pPortName   = NULL,
+              UINT         maxBaudRate = DefaultMaxBaudRate,
+              BOOL         framed      = FALSE);
+    BOOL Init(Transport* pTransport);
+
+    BOOL SendData(const BYTE* pData, UINT numBytes);
+    BOOL ReceiveData(BYTE* pData, UINT numBytes);
+
+    BOOL SubmitPacket(const DbgPacket&      packet,
+                      BYTE*                 pRspData      = NULL,
+                      DbgPacketCompletionFn pfnCompletion = NULL,
+                      VOID*                 pContext      = NULL);
+    VOID Flush();
+    BOOL Drain(UINT maxRequestCnt = 0);
+
+    BOOL StreamWrite(MemSpace         space,
+                     USHORT           addr,
+                     const BYTE*      pData,
+                     UINT             numBytes,
+                     StreamProgressFn pfnProgress = NULL,
+                     VOID*            pContext    = NULL);
+    BOOL StreamWriteCompressed(MemSpace         space,
+                               USHORT           addr,
+                               const BYTE*      pData,
+                               UINT             numBytes,
+                               StreamProgressFn pfnProgress = NULL,
+                               VOID*            pContext    = NULL);
+    BOOL StreamRead(MemSpace         space,
+                    USHORT           addr,
+                    BYTE*            pData,
+                    UINT             numBytes,
+                    StreamProgressFn pfnProgress = NULL,
+                    VOID*            pContext    = NULL);
+
+    BOOL SetBaudRate(UINT baudRate);
+    BOOL NegotiateBaudRate(UINT maxBaudRate);
+    UINT GetBaudRate() const { return m_baudRate; }
+
+    BOOL SetFramedMode(BOOL enable);
+    BOOL IsFramedMode() const { return m_framed; }
+
+    UINT GetPendingRequestCnt() const { return m_requestCnt; }
+    VOID GetRxStats(SerialCommRxStats* pStats) const;
+
+    static const UINT DefaultMaxBaudRate = 3000000;  // fastest rate Init() tries by default
+
+private:
+    SerialComm& operator=(const SerialComm&);
+    SerialComm(const SerialComm&);
+
+    // Bookkeeping for a packet submitted with SubmitPacket().
+    struct PendingRequest
+    {
+        UINT                  txBytes;        // packet size (including framing), in bytes
+        UINT                  txBytesLeft;    // packet bytes not yet handed to the transport
+        BOOL                  txStarted;      // TRUE once the packet has begun transmission
+        BOOL                  behindStall;    // TRUE if started while the hci may be stalled
+        BYTE*                 pRspData;       // where to store the response (NULL to discard)
+        UINT                  rspBytes;       // number of response bytes expected
+        UINT                  rspBytesDone;   // number of response bytes received so far
+        UINT                  execTimeoutMs;  // time the NES may spend executing the packet
+        DbgPacketCompletionFn pfnCompletion;  // completion callback (may be NULL)
+        VOID*                 pContext;       // completion (or stream progress) callback context
+        StreamProgressFn      pfnProgress;    // stream progress callback (may be NULL)
+        UINT                  streamDone;     // stream bytes done once this request completes
+        UINT                  streamBytes;    // total size of the stream
+        BYTE                  seq;            // frame SEQ (framed mode only)
+        USHORT                rspCrc;         // response frame CRC so far (framed mode only)
+        UINT                  retryCnt;       // times resent as the oldest request (framed mode)
+    };
+
+    BOOL SendPacket(const DbgPacket& packet);
+    BOOL SubmitChunk(const DbgPacket& packet,
+                     BYTE*            pRspData,
+                     StreamProgressFn pfnProgress,
+                     VOID*            pContext,
+                     UINT             streamDone,
+                     UINT             streamBytes);
+    BOOL SubmitWriteChunk(MemSpace         space,
+                          USHORT           addr,
+                          const BYTE*      pData,
+                          USHORT           numBytes,
+                          StreamProgressFn pfnProgress,
+                          VOID*            pContext,
+                          UINT             streamDone,
+                          UINT             streamBytes);
+    UINT GetStreamChunkSize(BOOL read) const;
+    VOID QueuePacket(const DbgPacket& packet);
+    BOOL Connect();
+    BOOL VerifyConnection();
+    BOOL QueryCredits();
+    BOOL ReceiveWithin(BYTE* pData, UINT numBytes, UINT timeoutMs);
+    BOOL TestLink();
+
+    BOOL StartReader();
+    VOID StopReader();
+    VOID ReaderThread();
+
+    static VOID ReaderThreadProc(VOID* pContext);
+
+    BOOL PumpRequests(BOOL wait);
+    BOOL TransmitRequests();
+    BOOL ReceiveResponses();
+    UINT ReceiveFrame(PendingRequest& request, const BYTE* pData, UINT numBytes);
+    BOOL RetransmitFrames();
+    UINT GetFrameTimeoutMs() const;
+    UINT GetResponseTimeoutMs() const;
+    VOID CompleteRequests();
+    VOID AbortRequests();
+    BOOL CanTransmit() const;
+
+    BOOL CanStart(const PendingRequest& request,
+                  UINT                  rspBytesInFlight,
+                  BOOL                  stallPending,
+                  UINT                  bytesBehindStall,
+                  UINT                  txBytesInFlight) const;
+
+    PendingRequest& GetRequest(UINT idx) { return m_requests[idx % MaxPendingRequests]; }
+    const PendingRequest& GetRequest(UINT idx) const
+        { return m_requests[idx % MaxPendingRequests]; }
+
+    static const UINT DefaultBaudRate     = 38400;    // hci.v reset rate (BAUD_SEL_38400)
+    static const UINT BaudSettleMs        = 10;       // time allowed for a rate switch to settle
+    static const UINT BaudTestBytes       = 64;       // size of the echo burst testing a new rate
+    static const UINT BaudTestTimeoutMs   = 100;      // deadline for the echo burst to return
+    static const UINT ReceiveTimeoutMs    = 5000;     // deadline for a complete ReceiveData() call
+    static const UINT SendTimeoutMs       = 5000;     // deadline for a complete SendData() call
+    static const UINT MaxPendingRequests  = 256;      // capacity of the asynchronous request queue
+    static const UINT RxRingSize          = 0x10000;  // RX ring capacity, in bytes
+    static const UINT ReaderPollMs        = 50;       // reader thread shutdown latency
+    static const UINT MinFifoCredits      = 8;        // uart fifo depth assumed until queried
+    static const UINT ConnectAttempts     = 3;        // echo attempts made by Init()
+    static const UINT ConnectTimeoutMs    = 500;      // deadline for each echo attempt
+    static const UINT MaxPendingFrames    = 64;       // request queue capacity in framed mode
+    static const UINT FrameWindowBytes    = 0x2000;   // unacknowledged frame and response bytes
+    static const UINT FrameTimeoutMs      = 100;      // response latency allowed beyond line time
+    static const UINT MaxFrameRetries     = 8;        // resends of one frame before giving up
+    static const UINT StreamFlushBytes    = 0x1000;   // StreamWrite() data staged between flushes
+    static const UINT MaxLzTokenBytes     = 0x800;    // size of m_lzTokens (a frame's worth)
+
+    Transport*     m_pTransport;        // byte stream connection to the NES FPGA (owned)
+    UINT           m_baudRate;          // current baud rate of the link
+
+    BOOL           m_framed;            // TRUE in framed mode
+    BYTE           m_txSeq;             // SEQ for the next submitted frame
+    BOOL           m_frameErr;          // a bad response frame was received
+
+    ByteQueue      m_txQueue;           // packet bytes of all incomplete requests
+    UINT           m_txOffset;          // bytes of m_txQueue already handed to the transport
+    PendingRequest m_requests[MaxPendingRequests];  // asynchronous request ring
+    UINT           m_requestHead;       // index of the oldest incomplete request
+    UINT           m_requestCnt;        // number of incomplete requests
+    UINT           m_txRequestIdx;      // index of the first request not fully transmitted
+    UINT           m_rxRequestIdx;      // index of the first request still awaiting a response
+    UINT           m_rspBytesInFlight;  // response bytes owed by transmitted requests
+    UINT           m_txBytesInFlight;   // packet bytes of transmitted, incomplete requests
+    UINT           m_bytesBehindStall;  // bytes sent while the hci may have been stalled
+    BOOL           m_stallPending;      // a stall point (see CanStart()) may still be executing
+    UINT           m_stallIdx;          // index of the last stall point transmitted
+    UINT           m_stallExecMs;       // execTimeoutMs of the last stall point transmitted
+    UINT           m_reqCredits;        // NES uart RX fifo depth (request bytes it can buffer)
+    UINT           m_rspCredits;        // NES uart TX fifo depth (response bytes it can buffer)
+
+    LzEncoder      m_lzEncoder;                  // encodes StreamWriteCompressed() spans
+    BYTE           m_lzTokens[MaxLzTokenBytes];  // tokens of the MemWrLz packet being submitted
+
+    RingBuffer     m_rxRing;            // received bytes not yet consumed (reader -> consumer)
+    Event          m_rxEvent;           // set by the reader thread when it adds to m_rxRing
+    Thread         m_readerThread;      // drains m_pTransport into m_rxRing
+    volatile LONG  m_stopReader;        // tells the reader thread to exit
+
+    volatile LONG  m_rxHitCnt;          // see SerialCommRxStats
+    volatile LONG  m_rxMissCnt;         // see SerialCommRxStats
+    volatile LONG  m_rxOverflowCnt;     // see SerialCommRxStats
+    volatile LONG  m_retryCnt;          // see SerialCommRxStats
+};
+
+#endif // SERIALCOMM_H
+
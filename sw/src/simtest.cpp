@@ -0,0 +1,350 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/simtest.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  simtest program entry point, and SimTest class implementation.  Runs behavioural tests of the
+*  host software against HciSim, so they need no hardware:
+*
+*        simtest [script.lua ...]
+*
+*  With no arguments, runs every built-in test, over each SimLinkMode unless the test sets up links
+*  of its own or doesn't use one.  Builds with Lua (SIMTEST_LUA) instead run the given nesdbg test
+*  scripts over each SimLinkMode; scripts find their includes relative to sw/src.  Returns the
+*  number of failures.
+***************************************************************************************************/
+
+#include <stdarg.h>
+
+#include "simtest.h"
+
+#ifdef SIMTEST_LUA
+#include "scriptmgr.h"
+#endif
+
+/***************************************************************************************************
+** % Method:      SimTest::SimTest()
+*  % Description: SimTest constructor.
+***************************************************************************************************/
+SimTest::SimTest(
+    const TCHAR* pName,     // test name, for messages
+    SimLinkMode  linkMode)  // how the host talks to the simulator
+    :
+    m_pName(pName),
+    m_linkMode(linkMode),
+    m_pSim(NULL),
+    m_serialComm(),
+    m_failCnt(0)
+{
+    m_tempDir[0] = 0;
+}
+
+/***************************************************************************************************
+** % Method:      SimTest::~SimTest()
+*  % Description: SimTest destructor.  Removes the MakeTempPath() directory, if the test left it
+*                 empty.
+***************************************************************************************************/
+SimTest::~SimTest()
+{
+    if (m_tempDir[0])
+    {
+#ifdef _WIN32
+        RemoveDirectory(&m_tempDir[0]);
+#else
+        rmdir(&m_tempDir[0]);
+#endif
+    }
+}
+
+/***************************************************************************************************
+** % Method:      SimTest::Connect()
+*  % Description: Links the SerialComm to a new simulated NES FPGA, set up for the link mode, and
+*                 halts its CPU.  A failure to connect fails the test.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL SimTest::Connect()
+{
+    m_pSim = new HciSim();
+    m_pSim->Open(HciSim::GetPortName(), SetBaudPacket::GetBaudRate(SetBaudPacket::BaudSelDefault));
+
+    BOOL ret = m_serialComm.Init(m_pSim);
+
+    // Framed mode at the fastest rate, as SerialComm::Init() sets up a real link when asked to.
+    // The rate also sets how long resends wait for the line to go quiet.
+    if (ret && (m_linkMode != SimLinkPlain))
+    {
+        ret = m_serialComm.NegotiateBaudRate(SerialComm::DefaultMaxBaudRate) &&
+              m_serialComm.SetFramedMode(TRUE);
+    }
+
+    if (ret && (m_linkMode == SimLinkNoisy))
+    {
+        m_pSim->SetErrorInterval(NoisyErrorInterval);
+    }
+
+    if (ret)
+    {
+        ret = m_serialComm.SubmitPacket(DbgHltPacket()) && m_serialComm.Drain();
+    }
+
+    return Check(ret, _T("connect to the simulator"));
+}
+
+/***************************************************************************************************
+** % Method:      SimTest::Check()
+*  % Description: Records the result of a check, printing a message if it failed.
+*  % Returns:     cond.
+***************************************************************************************************/
+BOOL SimTest::Check(
+    BOOL         cond,      // TRUE if the check passed
+    const TCHAR* pFmtText,  // format string describing what was checked
+    ...)                    // var args
+{
+    if (!cond)
+    {
+        static const UINT TmpBufSize = 256;
+        TCHAR tmpBuf[TmpBufSize];
+
+        va_list argList;
+
+        va_start(argList, pFmtText);
+        _vstprintf_s(&tmpBuf[0], TmpBufSize, pFmtText, argList);
+        va_end(argList);
+
+        _tprintf(_T("  %s (%s): check failed: %s\n"),
+                 m_pName,
+                 GetLinkModeName(m_linkMode),
+                 &tmpBuf[0]);
+
+        m_failCnt++;
+    }
+
+    return cond;
+}
+
+/***************************************************************************************************
+** % Method:      SimTest::MakeTempPath()
+*  % Description: Builds the path of a file in a directory private to this test (of the directory
+*                 itself if pFileName is empty), creating the directory on first use.  The test
+*                 must delete any file it creates there.
+*  % Returns:     TRUE on success, FALSE if the directory can't be created or the path is too long.
+***************************************************************************************************/
+BOOL SimTest::MakeTempPath(
+    const TCHAR* pFileName,  // file name, without a directory
+    TCHAR*       pPath,      // receives the path
+    UINT         pathSize)   // size of pPath, in TCHARs
+{
+    BOOL ret = TRUE;
+
+    if (!m_tempDir[0])
+    {
+#ifdef _WIN32
+        TCHAR tempRoot[MaxPathLen];
+
+        ret = GetTempPath(MaxPathLen, &tempRoot[0]) &&
+              GetTempFileName(&tempRoot[0], _T("sim"), 0, &m_tempDir[0]) &&
+              DeleteFile(&m_tempDir[0]) &&
+              CreateDirectory(&m_tempDir[0], NULL);
+#else
+        _tcscpy_s(&m_tempDir[0], MaxPathLen, _T("/tmp/simtest_XXXXXX"));
+
+        ret = (mkdtemp(&m_tempDir[0]) != NULL);
+#endif
+
+        if (!ret)
+        {
+            m_tempDir[0] = 0;
+        }
+    }
+
+#ifdef _WIN32
+    const TCHAR* pSeparator = _T("\\");
+#else
+    const TCHAR* pSeparator = _T("/");
+#endif
+
+    if (!pFileName[0])
+    {
+        pSeparator = _T("");
+    }
+
+    if (ret)
+    {
+        ret = (_tcslen(&m_tempDir[0]) + _tcslen(pSeparator) + _tcslen(pFileName) < pathSize);
+    }
+
+    if (ret)
+    {
+        _stprintf_s(pPath, pathSize, _T("%s%s%s"), &m_tempDir[0], pSeparator, pFileName);
+    }
+
+    return Check(ret, _T("make a temporary path for %s"), pFileName);
+}
+
+/***************************************************************************************************
+** % Method:      SimTest::GetLinkModeName()
+*  % Description: Names a link mode, for messages.
+*  % Returns:     Link mode name.
+***************************************************************************************************/
+const TCHAR* SimTest::GetLinkModeName(
+    SimLinkMode linkMode)  // link mode
+{
+    static const TCHAR* pLinkModeNames[] = { _T("plain"), _T("framed"), _T("noisy") };
+
+    return pLinkModeNames[linkMode];
+}
+
+// Every link mode, in the order tests are run over them.
+static const SimLinkMode SimLinkModes[] = { SimLinkPlain, SimLinkFramed, SimLinkNoisy };
+static const UINT        SimLinkModeCnt = sizeof(SimLinkModes) / sizeof(SimLinkModes[0]);
+
+/***************************************************************************************************
+** % Function:    RunTests()
+*  % Description: Runs every built-in test, over each link mode where it applies.
+*  % Returns:     Number of failed tests.
+***************************************************************************************************/
+static INT RunTests()
+{
+    static const struct
+    {
+        const TCHAR* pName;     // test name
+        SimTestFn    pfnTest;   // test function
+        BOOL         eachLink;  // run over each link mode, not just once (for tests that set up
+                                // links of their own)
+    } Tests[] =
+    {
+        { _T("Echo"),        TestEcho,        TRUE  },
+        { _T("MemFill"),     TestMemFill,     TRUE  },
+        { _T("MemCompare"),  TestMemCompare,  TRUE  },
+        { _T("Wait"),        TestWait,        TRUE  },
+        { _T("Program"),     TestProgram,     TRUE  },
+        { _T("MultiRead"),   TestMultiRead,   TRUE  },
+        { _T("MemCrc"),      TestMemCrc,      TRUE  },
+        { _T("CpuRegs"),     TestCpuRegs,     TRUE  },
+        { _T("BaudRates"),   TestBaudRates,   FALSE },
+        { _T("FrameSeq"),    TestFrameSeq,    FALSE },
+        { _T("NoisyLink"),   TestNoisyLink,   FALSE },
+        { _T("PortFinder"),  TestPortFinder,  FALSE },
+        { _T("Completions"), TestCompletions, TRUE  },
+        { _T("RxPath"),      TestRxPath,      TRUE  },
+        { _T("Stream"),      TestStream,      TRUE  },
+        { _T("Credits"),     TestCredits,     TRUE  },
+        { _T("LzRoundTrip"), TestLzRoundTrip, FALSE },
+        { _T("MemWrLz"),     TestMemWrLz,     TRUE  },
+        { _T("INesRom"),     TestINesRom,     FALSE },
+        { _T("RomDelta"),    TestRomDelta,    TRUE  },
+        { _T("Reconnect"),   TestReconnect,   FALSE },
+        { _T("RomThread"),   TestRomThread,   TRUE  },
+    };
+
+    INT failCnt = 0;
+
+    for (UINT i = 0; i < sizeof(Tests) / sizeof(Tests[0]); i++)
+    {
+        const UINT linkModeCnt = (Tests[i].eachLink) ? SimLinkModeCnt : 1;
+
+        for (UINT j = 0; j < linkModeCnt; j++)
+        {
+            SimTest test(Tests[i].pName, SimLinkModes[j]);
+
+            if (test.Connect())
+            {
+                Tests[i].pfnTest(&test);
+            }
+
+            _tprintf(_T("%s %s (%s)\n"),
+                     (test.Passed()) ? _T("PASS") : _T("FAIL"),
+                     Tests[i].pName,
+                     SimTest::GetLinkModeName(SimLinkModes[j]));
+
+            if (!test.Passed())
+            {
+                failCnt++;
+            }
+        }
+    }
+
+    return failCnt;
+}
+
+#ifdef SIMTEST_LUA
+/***************************************************************************************************
+** % Function:    RunScripts()
+*  % Description: Runs nesdbg test scripts over each link mode.
+*  % Returns:     Number of scripts that did not pass.
+***************************************************************************************************/
+static INT RunScripts(
+    UINT          scriptCnt,      // number of scripts
+    TCHAR* const* ppScriptPaths)  // script paths
+{
+    INT failCnt = 0;
+
+    for (UINT i = 0; i < scriptCnt; i++)
+    {
+        for (UINT j = 0; j < SimLinkModeCnt; j++)
+        {
+            SimTest   test(ppScriptPaths[i], SimLinkModes[j]);
+            ScriptMgr scriptMgr(test.GetComm());
+
+            if (test.Connect() && test.Check(scriptMgr.Init(), _T("start lua")))
+            {
+                ScriptResult result = scriptMgr.ExecuteScript(ppScriptPaths[i]);
+
+                test.Check(result == SCRIPT_RESULT_PASS, _T("script result %d"), result);
+            }
+
+            _tprintf(_T("%s %s (%s)\n"),
+                     (test.Passed()) ? _T("PASS") : _T("FAIL"),
+                     ppScriptPaths[i],
+                     SimTest::GetLinkModeName(SimLinkModes[j]));
+
+            if (!test.Passed())
+            {
+                failCnt++;
+            }
+        }
+    }
+
+    return failCnt;
+}
+#endif
+
+/***************************************************************************************************
+** % Function:    _tmain()
+*  % Description: Program entry-point.
+***************************************************************************************************/
+INT _tmain(
+    INT    argc,    // number of command line arguments
+    TCHAR* argv[])  // command line arguments
+{
+    if (argc == 1)
+    {
+        return RunTests();
+    }
+
+#ifdef SIMTEST_LUA
+    return RunScripts(argc - 1, &argv[1]);
+#else
+    _ftprintf(stderr, _T("simtest: built without lua, can't run %s\n"), argv[1]);
+    return 1;
+#endif
+}
@@ -0,0 +1,150 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/simtest.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  SimTest class header, and the tests run by the simtest program.
+***************************************************************************************************/
+
+#ifndef SIMTEST_H
+#define SIMTEST_H
+
+#include "dbgpacket.h"
+#include "hcisim.h"
+#include "serialcomm.h"
+
+// How the host talks to the simulated NES FPGA for a test.
+enum SimLinkMode
+{
+    SimLinkPlain,   // unframed, at the default baud rate
+    SimLinkFramed,  // framed mode, at the fastest baud rate
+    SimLinkNoisy    // framed mode, with one byte in SimTest::NoisyErrorInterval corrupted
+};
+
+/***************************************************************************************************
+** % Class:       SimTest
+*  % Description: One test run against HciSim, with no hardware.  Connect() links a SerialComm to a
+*                 fresh simulated NES FPGA, halted; the test then drives it through GetComm() and
+*                 checks the simulator's memory and registers directly through GetSim().  Failed
+*                 Check()s are printed and make the test fail.  Tests that need files put them in
+*                 a private directory (MakeTempPath()), and delete them before they return.
+***************************************************************************************************/
+class SimTest
+{
+public:
+    SimTest(const TCHAR* pName, SimLinkMode linkMode);
+    ~SimTest();
+
+    BOOL Connect();
+    BOOL Check(BOOL cond, const TCHAR* pFmtText, ...);
+    BOOL MakeTempPath(const TCHAR* pFileName, TCHAR* pPath, UINT pathSize);
+
+    HciSim*      GetSim() { return m_pSim; }
+    SerialComm*  GetComm() { return &m_serialComm; }
+    SimLinkMode  GetLinkMode() const { return m_linkMode; }
+    BOOL         Passed() const { return m_failCnt == 0; }
+
+    static const TCHAR* GetLinkModeName(SimLinkMode linkMode);
+
+    static const UINT NoisyErrorInterval = 10000;  // link bytes per corrupted byte (SimLinkNoisy)
+    static const UINT MaxPathLen         = 260;    // longest MakeTempPath() path, with terminator
+
+private:
+    SimTest& operator=(const SimTest&);
+    SimTest(const SimTest&);
+
+    const TCHAR* m_pName;                // test name, for messages
+    SimLinkMode  m_linkMode;             // how the host talks to the simulator
+    HciSim*      m_pSim;                 // simulated NES FPGA (owned by m_serialComm)
+    SerialComm   m_serialComm;           // link to m_pSim
+    UINT         m_failCnt;              // failed checks
+    TCHAR        m_tempDir[MaxPathLen];  // directory for MakeTempPath(), empty until created
+};
+
+/***************************************************************************************************
+** % Class:       SimLink
+*  % Description: Transport that forwards to an HciSim it doesn't own, so that SerialComms can
+*                 connect to the same simulated NES FPGA in turn, as successive sessions would.
+***************************************************************************************************/
+class SimLink : public Transport
+{
+public:
+    explicit SimLink(HciSim* pSim) : m_pSim(pSim) {}
+
+    virtual BOOL Open(const TCHAR* pPortName, UINT baudRate)
+        { return m_pSim->Open(pPortName, baudRate); }
+    virtual VOID Close() { m_pSim->Close(); }
+    virtual BOOL SetBaudRate(UINT baudRate) { return m_pSim->SetBaudRate(baudRate); }
+
+    virtual UINT Write(const BYTE* pData, UINT numBytes, UINT timeoutMs)
+        { return m_pSim->Write(pData, numBytes, timeoutMs); }
+    virtual UINT Read(BYTE* pData, UINT numBytes, UINT timeoutMs)
+        { return m_pSim->Read(pData, numBytes, timeoutMs); }
+
+    virtual BOOL WaitForIo(UINT ioFlags, UINT timeoutMs)
+        { return m_pSim->WaitForIo(ioFlags, timeoutMs); }
+    virtual VOID Purge() { m_pSim->Purge(); }
+
+private:
+    SimLink& operator=(const SimLink&);
+    SimLink(const SimLink&);
+
+    HciSim* m_pSim;  // simulated NES FPGA (owned by the test)
+};
+
+// A test: drives pTest's connected simulator and Check()s the results.
+typedef VOID (*SimTestFn)(SimTest* pTest);
+
+// simtestops.cpp
+VOID FillTestData(BYTE* pData, UINT numBytes, UINT seed);
+VOID TestEcho(SimTest* pTest);
+VOID TestMemFill(SimTest* pTest);
+VOID TestMemCompare(SimTest* pTest);
+VOID TestWait(SimTest* pTest);
+VOID TestProgram(SimTest* pTest);
+VOID TestMultiRead(SimTest* pTest);
+VOID TestMemCrc(SimTest* pTest);
+VOID TestCpuRegs(SimTest* pTest);
+
+// simtestlink.cpp
+VOID TestBaudRates(SimTest* pTest);
+VOID TestFrameSeq(SimTest* pTest);
+VOID TestNoisyLink(SimTest* pTest);
+VOID TestPortFinder(SimTest* pTest);
+
+// simtestcomm.cpp
+VOID TestCompletions(SimTest* pTest);
+VOID TestRxPath(SimTest* pTest);
+VOID TestStream(SimTest* pTest);
+VOID TestCredits(SimTest* pTest);
+
+// simtestlz.cpp
+VOID TestLzRoundTrip(SimTest* pTest);
+VOID TestMemWrLz(SimTest* pTest);
+
+// simtestrom.cpp
+VOID TestINesRom(SimTest* pTest);
+VOID TestRomDelta(SimTest* pTest);
+VOID TestReconnect(SimTest* pTest);
+VOID TestRomThread(SimTest* pTest);
+
+#endif // SIMTEST_H
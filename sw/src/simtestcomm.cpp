@@ -0,0 +1,399 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/simtestcomm.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  simtest tests of SerialComm: the request queue, the receive path and streaming.
+***************************************************************************************************/
+
+#include "simtest.h"
+
+// Records the order and outcome of the completions seen by TestCompletions().
+struct CompletionLog
+{
+    static const UINT MaxRequests = 16;
+
+    UINT cnt;                   // completions seen
+    UINT order[MaxRequests];    // request index of each completion, in the order they arrived
+    BOOL success[MaxRequests];  // success passed to each completion
+};
+
+// Context of one request submitted by TestCompletions().
+struct CompletionContext
+{
+    CompletionLog* pLog;  // log to record the completion in
+    UINT           idx;   // request index
+};
+
+/***************************************************************************************************
+** % Function:    CompletionProc()
+*  % Description: DbgPacketCompletionFn for TestCompletions(): appends the completion to the log.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID CompletionProc(
+    VOID* pContext,  // CompletionContext
+    BOOL  success)   // TRUE if the response arrived
+{
+    CompletionContext* pCompletion = static_cast<CompletionContext*>(pContext);
+    CompletionLog*     pLog        = pCompletion->pLog;
+
+    if (pLog->cnt < CompletionLog::MaxRequests)
+    {
+        pLog->order[pLog->cnt]   = pCompletion->idx;
+        pLog->success[pLog->cnt] = success;
+    }
+
+    pLog->cnt++;
+}
+
+/***************************************************************************************************
+** % Function:    TestCompletions()
+*  % Description: Queues echoes of assorted sizes and checks that nothing is sent before a Flush()
+*                 or Drain(), that a partial Drain() leaves requests outstanding, and that every
+*                 completion is delivered once, in submission order, with its response.  In framed
+*                 mode, a link that corrupts every byte must complete the request with failure.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestCompletions(
+    SimTest* pTest)  // connected test
+{
+    static const UINT RequestCnt = CompletionLog::MaxRequests;
+    static const UINT MaxSize    = 0x100;
+
+    SerialComm* pComm = pTest->GetComm();
+
+    CompletionLog     log = { 0 };
+    CompletionContext contexts[RequestCnt];
+    BYTE              data[MaxSize];
+    BYTE              rsp[RequestCnt][MaxSize];
+
+    FillTestData(&data[0], MaxSize, 0x44);
+    memset(&rsp[0][0], 0, sizeof(rsp));
+
+    BOOL ret = TRUE;
+
+    for (UINT i = 0; i < RequestCnt; i++)
+    {
+        contexts[i].pLog = &log;
+        contexts[i].idx  = i;
+
+        ret = ret && pComm->SubmitPacket(EchoPacket(&data[i], static_cast<USHORT>(1 + (i * 15))),
+                                         &rsp[i][0],
+                                         CompletionProc,
+                                         &contexts[i]);
+    }
+
+    pTest->Check(ret, _T("submit echoes"));
+    pTest->Check((pComm->GetPendingRequestCnt() == RequestCnt) && (log.cnt == 0),
+                 _T("echoes held until drained, %u pending, %u completed"),
+                 pComm->GetPendingRequestCnt(),
+                 log.cnt);
+
+    ret = pComm->Drain(RequestCnt / 2);
+    pTest->Check(ret && (pComm->GetPendingRequestCnt() <= RequestCnt / 2) &&
+                 (log.cnt == RequestCnt - pComm->GetPendingRequestCnt()),
+                 _T("partial drain, %u pending, %u completed"),
+                 pComm->GetPendingRequestCnt(),
+                 log.cnt);
+
+    ret = pComm->Drain();
+    pTest->Check(ret && (pComm->GetPendingRequestCnt() == 0) && (log.cnt == RequestCnt),
+                 _T("drain, %u completed"),
+                 log.cnt);
+
+    for (UINT i = 0; (i < RequestCnt) && (i < log.cnt); i++)
+    {
+        pTest->Check((log.order[i] == i) && log.success[i],
+                     _T("completion %u: request %u, success %u"),
+                     i,
+                     log.order[i],
+                     log.success[i]);
+        pTest->Check(memcmp(&rsp[i][0], &data[i], 1 + (i * 15)) == 0, _T("echo %u response"), i);
+    }
+
+    // A link that corrupts everything: the resends run out, and the request fails.
+    if (pTest->GetLinkMode() == SimLinkFramed)
+    {
+        log.cnt = 0;
+        pTest->GetSim()->SetErrorInterval(1);
+
+        ret = pComm->SubmitPacket(EchoPacket(&data[0], 1),
+                                  &rsp[0][0],
+                                  CompletionProc,
+                                  &contexts[0]) &&
+              pComm->Drain();
+
+        pTest->Check(!ret && (log.cnt == 1) && !log.success[0],
+                     _T("dead link, drain %u, %u completed"),
+                     ret,
+                     log.cnt);
+        pTest->Check(pComm->GetPendingRequestCnt() == 0, _T("dead link, requests aborted"));
+
+        pTest->GetSim()->SetErrorInterval(0);
+    }
+}
+
+/***************************************************************************************************
+** % Function:    TestRxPath()
+*  % Description: Checks that the reader thread buffers a response that arrives while nobody is
+*                 waiting, so collecting it is a hit, and that responses adding up to more than
+*                 the RX ring arrive intact as the ring wraps.  Only the noisy link may resend.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestRxPath(
+    SimTest* pTest)  // connected test
+{
+    static const USHORT ReadSize = 0x400;
+    static const UINT   ReadCnt  = 96;  // 0x18000 bytes, one and a half times the RX ring
+
+    SerialComm* pComm = pTest->GetComm();
+    BYTE*       pMem  = pTest->GetSim()->GetCpuMem();
+
+    SerialCommRxStats before;
+    SerialCommRxStats after;
+
+    FillTestData(&pMem[0], 0x10000, 0x55);
+
+    // A response that is already buffered by the time it's collected.
+    BYTE rsp[ReadSize];
+
+    pComm->GetRxStats(&before);
+
+    BOOL ret = pComm->SubmitPacket(CpuMemRdPacket(0x1000, ReadSize), &rsp[0]);
+    pComm->Flush();
+    Sleep(50);
+    ret = ret && pComm->Drain();
+
+    pComm->GetRxStats(&after);
+
+    pTest->Check(ret && (memcmp(&rsp[0], &pMem[0x1000], ReadSize) == 0), _T("buffered read"));
+    pTest->Check(after.hitCnt > before.hitCnt, _T("buffered read hit the RX ring"));
+    pTest->Check((pTest->GetLinkMode() == SimLinkNoisy) || (after.missCnt == before.missCnt),
+                 _T("buffered read waited %u times"),
+                 after.missCnt - before.missCnt);
+
+    // Responses that wrap the RX ring.
+    BYTE* pRsp = new BYTE[ReadCnt * ReadSize];
+    memset(pRsp, 0, ReadCnt * ReadSize);
+
+    for (UINT i = 0; ret && (i < ReadCnt); i++)
+    {
+        ret = pComm->SubmitPacket(CpuMemRdPacket(static_cast<USHORT>(i * ReadSize), ReadSize),
+                                  &pRsp[i * ReadSize]);
+    }
+
+    ret = ret && pComm->Drain();
+
+    pComm->GetRxStats(&after);
+
+    BOOL match = TRUE;
+
+    for (UINT i = 0; i < ReadCnt * ReadSize; i++)
+    {
+        match = match && (pRsp[i] == pMem[i & 0xFFFF]);
+    }
+
+    pTest->Check(ret && match, _T("read 0x%X bytes"), ReadCnt * ReadSize);
+    pTest->Check((pTest->GetLinkMode() == SimLinkNoisy) || (after.retryCnt == 0),
+                 _T("%u resends"),
+                 after.retryCnt);
+
+    delete [] pRsp;
+}
+
+// Progress seen by StreamProgressProc().
+struct StreamProgress
+{
+    UINT callCnt;     // progress calls
+    UINT bytesDone;   // bytesDone of the last call
+    UINT totalBytes;  // totalBytes of the last call
+    BOOL ordered;     // every call reported more bytes done than the one before
+};
+
+/***************************************************************************************************
+** % Function:    StreamProgressProc()
+*  % Description: StreamProgressFn for the stream tests: records the progress reported.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID StreamProgressProc(
+    VOID* pContext,    // StreamProgress
+    UINT  bytesDone,   // stream bytes done so far
+    UINT  totalBytes)  // total size of the stream
+{
+    StreamProgress* pProgress = static_cast<StreamProgress*>(pContext);
+
+    pProgress->ordered    = pProgress->ordered && (bytesDone > pProgress->bytesDone);
+    pProgress->bytesDone  = bytesDone;
+    pProgress->totalBytes = totalBytes;
+    pProgress->callCnt++;
+}
+
+/***************************************************************************************************
+** % Function:    CheckStreamProgress()
+*  % Description: Checks that a stream reported its progress in order, up to its full size.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID CheckStreamProgress(
+    SimTest*              pTest,     // test to record the result in
+    const StreamProgress& progress,  // progress seen
+    UINT                  numBytes,  // size of the stream
+    const TCHAR*          pStream)   // stream name, for messages
+{
+    pTest->Check(progress.ordered && (progress.callCnt > 1) &&
+                 (progress.bytesDone == numBytes) && (progress.totalBytes == numBytes),
+                 _T("%s progress: %u calls, 0x%X of 0x%X bytes"),
+                 pStream,
+                 progress.callCnt,
+                 progress.bytesDone,
+                 progress.totalBytes);
+}
+
+/***************************************************************************************************
+** % Function:    TestStream()
+*  % Description: Streams the whole 64KB CPU address space out and back, and a PPU pattern table,
+*                 checking the data and the progress reported.  Then checks that a stream past the
+*                 end of the CPU address space wraps to address 0.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestStream(
+    SimTest* pTest)  // connected test
+{
+    static const UINT   CpuBytes  = HciSim::CpuMemSize;
+    static const UINT   ChrBytes  = 0x2000;
+    static const USHORT WrapAddr  = 0xFFC0;
+    static const UINT   WrapBytes = 0x100;
+
+    SerialComm* pComm = pTest->GetComm();
+    BYTE*       pCpu  = pTest->GetSim()->GetCpuMem();
+    BYTE*       pPpu  = pTest->GetSim()->GetPpuMem();
+
+    BYTE* pData = new BYTE[CpuBytes];
+    BYTE* pRd   = new BYTE[CpuBytes];
+
+    // CPU write and read back.
+    StreamProgress progress = { 0, 0, 0, TRUE };
+
+    FillTestData(pData, CpuBytes, 0xAA);
+    memset(pCpu, 0, CpuBytes);
+
+    BOOL ret = pComm->StreamWrite(MemSpaceCpu, 0, pData, CpuBytes, StreamProgressProc, &progress) &&
+               pComm->Drain();
+    pTest->Check(ret && (memcmp(pCpu, pData, CpuBytes) == 0), _T("CPU stream write"));
+    CheckStreamProgress(pTest, progress, CpuBytes, _T("CPU write"));
+
+    StreamProgress rdProgress = { 0, 0, 0, TRUE };
+
+    memset(pRd, 0, CpuBytes);
+
+    ret = pComm->StreamRead(MemSpaceCpu, 0, pRd, CpuBytes, StreamProgressProc, &rdProgress) &&
+          pComm->Drain();
+    pTest->Check(ret && (memcmp(pRd, pData, CpuBytes) == 0), _T("CPU stream read"));
+    CheckStreamProgress(pTest, rdProgress, CpuBytes, _T("CPU read"));
+
+    // PPU write and read back.
+    FillTestData(pData, ChrBytes, 0xBB);
+    memset(pPpu, 0, HciSim::PpuMemSize);
+    memset(pRd, 0, ChrBytes);
+
+    ret = pComm->StreamWrite(MemSpacePpu, 0, pData, ChrBytes) &&
+          pComm->StreamRead(MemSpacePpu, 0, pRd, ChrBytes) &&
+          pComm->Drain();
+    pTest->Check(ret && (memcmp(pPpu, pData, ChrBytes) == 0) &&
+                 (memcmp(pRd, pData, ChrBytes) == 0),
+                 _T("PPU stream write and read"));
+
+    // A span that runs off the end of the CPU address space.
+    FillTestData(pData, WrapBytes, 0xCC);
+    memset(pCpu, 0, CpuBytes);
+
+    const UINT endBytes = CpuBytes - WrapAddr;  // bytes written before the wrap
+
+    ret = pComm->StreamWrite(MemSpaceCpu, WrapAddr, pData, WrapBytes) && pComm->Drain();
+    pTest->Check(ret && (memcmp(&pCpu[WrapAddr], pData, endBytes) == 0) &&
+                 (memcmp(&pCpu[0], &pData[endBytes], WrapBytes - endBytes) == 0),
+                 _T("CPU stream write wraps"));
+
+    delete [] pData;
+    delete [] pRd;
+}
+
+/***************************************************************************************************
+** % Function:    TestCredits()
+*  % Description: Queues more than the RX fifo holds behind a WAIT and behind a vblank PROG_RUN,
+*                 with the simulator modelling the uart fifos, and checks that no byte is lost: the
+*                 host must hold back what the device can't take until the stall is over.  Each
+*                 run ends with a read, as writes complete once they are sent.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestCredits(
+    SimTest* pTest)  // connected test
+{
+    static const UINT   NumBytes = 2 * HciSim::FifoSize;
+    static const USHORT Addr     = 0x0400;
+    static const USHORT RunCnt   = 6;
+
+    SerialComm* pComm = pTest->GetComm();
+    HciSim*     pSim  = pTest->GetSim();
+    BYTE*       pMem  = pSim->GetCpuMem();
+
+    BYTE data[NumBytes];
+    BYTE ac = 0;
+
+    pTest->Check(pSim->StartFifoModel(), _T("start fifo model"));
+
+    // Behind a WAIT, which only owes a status byte.
+    BYTE status = 0xFF;
+
+    FillTestData(&data[0], NumBytes, 0x77);
+    memset(&pMem[Addr], 0, NumBytes);
+
+    BOOL ret = pComm->SubmitPacket(DbgRunPacket()) &&
+               pComm->SubmitPacket(WaitPacket(WaitPacket::CondFrames, RunCnt, 0, 0, 1000),
+                                   &status) &&
+               pComm->SubmitPacket(DbgHltPacket()) &&
+               pComm->StreamWrite(MemSpaceCpu, Addr, &data[0], NumBytes) &&
+               pComm->SubmitPacket(CpuRegRdPacket(CpuRegAc), &ac) &&
+               pComm->Drain();
+    pTest->Check(ret && (status == WaitPacket::StatusMet), _T("wait, status %u"), status);
+    pTest->Check(memcmp(&pMem[Addr], &data[0], NumBytes) == 0, _T("write behind wait"));
+    pTest->Check(pSim->GetRxOverrunCnt() == 0,
+                 _T("%u bytes lost behind wait"),
+                 pSim->GetRxOverrunCnt());
+
+    // Behind a vblank PROG_RUN of a program with no response.
+    DbgProgram program;
+    pTest->Check(program.Append(CpuRegWrPacket(CpuRegAc, 0x5A)), _T("build program"));
+
+    FillTestData(&data[0], NumBytes, 0x78);
+    memset(&pMem[Addr], 0, NumBytes);
+
+    ret = pComm->SubmitPacket(ProgWrPacket(program)) &&
+          pComm->SubmitPacket(ProgRunPacket(program, RunCnt, TRUE)) &&
+          pComm->StreamWrite(MemSpaceCpu, Addr, &data[0], NumBytes) &&
+          pComm->SubmitPacket(CpuRegRdPacket(CpuRegAc), &ac) &&
+          pComm->Drain();
+    pTest->Check(ret && (ac == 0x5A), _T("run program"));
+    pTest->Check(memcmp(&pMem[Addr], &data[0], NumBytes) == 0, _T("write behind program"));
+    pTest->Check(pSim->GetRxOverrunCnt() == 0,
+                 _T("%u bytes lost behind program"),
+                 pSim->GetRxOverrunCnt());
+}
@@ -0,0 +1,437 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/simtestlink.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  simtest tests of the link itself: baud rate negotiation, and framed mode sequencing and recovery.
+***************************************************************************************************/
+
+#include "portfinder.h"
+#include "simtest.h"
+
+/***************************************************************************************************
+** % Function:    SendFrame()
+*  % Description: Writes a packet to the simulator wrapped in a frame, bypassing SerialComm so the
+*                 SEQ and SOF can be chosen freely.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID SendFrame(
+    HciSim*          pSim,     // simulator, in framed mode
+    BYTE             seq,      // frame SEQ
+    const DbgPacket& packet,   // packet to send
+    BOOL             loseSof)  // send a corrupted SOF, so the simulator never sees the frame
+{
+    BYTE frame[SetFramedPacket::TxHeaderSize + DbgPacket::MaxHeaderSize + SetFramedPacket::CrcSize];
+
+    const UINT len = packet.Encode(&frame[SetFramedPacket::TxHeaderSize]);
+
+    frame[0] = (loseSof) ? 0x00 : SetFramedPacket::FrameSof;
+    frame[1] = seq;
+    frame[2] = static_cast<BYTE>(len & 0xFF);
+    frame[3] = static_cast<BYTE>(len >> 8);
+
+    const UINT   crcEnd = SetFramedPacket::TxHeaderSize + len;
+    const USHORT crc    = SetFramedPacket::UpdateCrc(SetFramedPacket::CrcInit,
+                                                     &frame[1],
+                                                     crcEnd - 1);
+
+    frame[crcEnd]     = static_cast<BYTE>(crc & 0xFF);
+    frame[crcEnd + 1] = static_cast<BYTE>(crc >> 8);
+
+    pSim->Write(&frame[0], crcEnd + SetFramedPacket::CrcSize, 0);
+}
+
+/***************************************************************************************************
+** % Function:    CheckFrameRsp()
+*  % Description: Reads a response frame with no data from the simulator, and checks its SEQ and
+*                 status.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID CheckFrameRsp(
+    SimTest* pTest,   // test to record the result in
+    HciSim*  pSim,    // simulator, in framed mode
+    BYTE     seq,     // expected SEQ
+    BYTE     status)  // expected status (FrameAck or FrameNak)
+{
+    BYTE rsp[SetFramedPacket::RxHeaderSize + SetFramedPacket::CrcSize];
+
+    const UINT   rspSize = pSim->Read(&rsp[0], sizeof(rsp), 100);
+    const USHORT crc     = SetFramedPacket::UpdateCrc(SetFramedPacket::CrcInit, &rsp[1], 2);
+
+    pTest->Check((rspSize == sizeof(rsp)) &&
+                 (rsp[0] == SetFramedPacket::FrameSof) &&
+                 (rsp[1] == seq) &&
+                 (rsp[2] == status) &&
+                 (rsp[3] == (crc & 0xFF)) &&
+                 (rsp[4] == (crc >> 8)),
+                 _T("response SEQ 0x%02X status 0x%02X, expected SEQ 0x%02X status 0x%02X"),
+                 rsp[1],
+                 rsp[2],
+                 seq,
+                 status);
+}
+
+/***************************************************************************************************
+** % Function:    TestFrameSeq()
+*  % Description: Checks that only the expected frame moves the simulator on.  A frame whose
+*                 predecessor was lost outright (corrupted SOF) must be NAKed rather than executed,
+*                 and resends of executed frames are answered with their kept responses, without
+*                 being executed again or moving the expected SEQ back.
+*                 Uses a simulator of its own, so the frames can be hand built.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestFrameSeq(
+    SimTest* pTest)  // connected test
+{
+    static const BYTE Data[] = { 0x11, 0x22, 0x33, 0x44 };
+
+    HciSim sim;
+    sim.Open(HciSim::GetPortName(), SetBaudPacket::GetBaudRate(SetBaudPacket::BaudSelDefault));
+
+    BYTE packet[DbgPacket::MaxHeaderSize];
+    BYTE enable = 0x00;
+
+    sim.Write(&packet[0], DbgHltPacket().Encode(&packet[0]), 0);
+    sim.Write(&packet[0], SetFramedPacket(TRUE).Encode(&packet[0]), 0);
+    pTest->Check((sim.Read(&enable, 1, 100) == 1) && sim.IsFramed(), _T("enter framed mode"));
+
+    BYTE* pMem = sim.GetCpuMem();
+
+    // Frame 0 arrives; frame 1 is lost outright, so frame 2 is NAKed, asking for frame 1.
+    SendFrame(&sim, 0, CpuMemWrPacket(0x6000, 1, &Data[0]), FALSE);
+    CheckFrameRsp(pTest, &sim, 0, SetFramedPacket::FrameAck);
+
+    SendFrame(&sim, 1, CpuMemWrPacket(0x6001, 1, &Data[1]), TRUE);
+    SendFrame(&sim, 2, CpuMemWrPacket(0x6002, 1, &Data[2]), FALSE);
+    CheckFrameRsp(pTest, &sim, 1, SetFramedPacket::FrameNak);
+    pTest->Check((pMem[0x6000] == Data[0]) && (pMem[0x6001] != Data[1]) &&
+                 (pMem[0x6002] != Data[2]),
+                 _T("frame after a lost frame not executed"));
+
+    // Frames further ahead are NAKed too, even though a NAK is already outstanding.
+    SendFrame(&sim, 3, CpuMemWrPacket(0x6003, 1, &Data[3]), FALSE);
+    CheckFrameRsp(pTest, &sim, 1, SetFramedPacket::FrameNak);
+
+    // The host goes back to frame 1.
+    SendFrame(&sim, 1, CpuMemWrPacket(0x6001, 1, &Data[1]), FALSE);
+    SendFrame(&sim, 2, CpuMemWrPacket(0x6002, 1, &Data[2]), FALSE);
+    CheckFrameRsp(pTest, &sim, 1, SetFramedPacket::FrameAck);
+    CheckFrameRsp(pTest, &sim, 2, SetFramedPacket::FrameAck);
+    pTest->Check(memcmp(&pMem[0x6000], &Data[0], 3) == 0, _T("resent frames executed"));
+
+    // A resend of an executed frame is answered but not executed again, and doesn't move the
+    // expected SEQ back: frame 3 is still the one expected.
+    pMem[0x6001] = 0x00;
+    SendFrame(&sim, 1, CpuMemWrPacket(0x6001, 1, &Data[1]), FALSE);
+    CheckFrameRsp(pTest, &sim, 1, SetFramedPacket::FrameAck);
+    pTest->Check(pMem[0x6001] == 0x00, _T("resent frame not executed again"));
+    pMem[0x6001] = Data[1];
+
+    SendFrame(&sim, 2, CpuMemWrPacket(0x6002, 1, &Data[2]), TRUE);
+    SendFrame(&sim, 4, CpuMemWrPacket(0x6003, 1, &Data[3]), FALSE);
+    CheckFrameRsp(pTest, &sim, 3, SetFramedPacket::FrameNak);
+    SendFrame(&sim, 3, CpuMemWrPacket(0x6003, 1, &Data[3]), FALSE);
+    CheckFrameRsp(pTest, &sim, 3, SetFramedPacket::FrameAck);
+    pTest->Check(memcmp(&pMem[0x6000], &Data[0], 4) == 0, _T("expected frame executed"));
+
+    // A resent read is answered with the response kept from the first time, though the memory has
+    // changed since.
+    BYTE rsp[2][SetFramedPacket::RxHeaderSize + sizeof(Data) + SetFramedPacket::CrcSize];
+
+    SendFrame(&sim, 4, CpuMemRdPacket(0x6000, sizeof(Data)), FALSE);
+    UINT rspSize = sim.Read(&rsp[0][0], sizeof(rsp[0]), 100);
+
+    pMem[0x6000] ^= 0xFF;
+    SendFrame(&sim, 4, CpuMemRdPacket(0x6000, sizeof(Data)), FALSE);
+    rspSize += sim.Read(&rsp[1][0], sizeof(rsp[1]), 100);
+
+    pTest->Check((rspSize == sizeof(rsp)) &&
+                 (memcmp(&rsp[0][SetFramedPacket::RxHeaderSize], &Data[0], sizeof(Data)) == 0) &&
+                 (memcmp(&rsp[0][0], &rsp[1][0], sizeof(rsp[0])) == 0),
+                 _T("resent read answered with the kept response"));
+    pMem[0x6000] = Data[0];
+
+    // Entering framed mode again starts the SEQs over, so frame 0 is executed, not taken for a
+    // resend.
+    BYTE unframeRsp[SetFramedPacket::RxHeaderSize + 1 + SetFramedPacket::CrcSize];
+
+    SendFrame(&sim, 5, SetFramedPacket(FALSE), FALSE);
+    pTest->Check((sim.Read(&unframeRsp[0], sizeof(unframeRsp), 100) == sizeof(unframeRsp)) &&
+                 !sim.IsFramed(),
+                 _T("leave framed mode"));
+
+    sim.Write(&packet[0], SetFramedPacket(TRUE).Encode(&packet[0]), 0);
+    pTest->Check((sim.Read(&enable, 1, 100) == 1) && sim.IsFramed(), _T("enter framed mode again"));
+
+    pMem[0x6000] = 0x00;
+    SendFrame(&sim, 0, CpuMemWrPacket(0x6000, 1, &Data[0]), FALSE);
+    CheckFrameRsp(pTest, &sim, 0, SetFramedPacket::FrameAck);
+    pTest->Check(pMem[0x6000] == Data[0], _T("SEQs start over"));
+}
+
+/***************************************************************************************************
+** % Function:    TestNoisyLink()
+*  % Description: Checks that framed mode gets packets through a link that corrupts a byte in
+*                 every round trip, on average, so most packets need resends.  Noise at regular
+*                 intervals would hit each resend in the same place and never let it through.  Uses
+*                 a link of its own, with far more noise than SimLinkNoisy.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestNoisyLink(
+    SimTest* pTest)  // connected test
+{
+    static const USHORT EchoSize = 1000;
+    static const UINT   EchoCnt  = 8;
+
+    HciSim*    pSim = new HciSim();
+    SerialComm serialComm;
+
+    pSim->Open(HciSim::GetPortName(), SetBaudPacket::GetBaudRate(SetBaudPacket::BaudSelDefault));
+
+    BOOL ret = serialComm.Init(pSim) &&
+               serialComm.NegotiateBaudRate(SerialComm::DefaultMaxBaudRate) &&
+               serialComm.SetFramedMode(TRUE);
+    pTest->Check(ret, _T("enter framed mode"));
+
+    BYTE data[EchoSize];
+    BYTE rsp[EchoSize];
+
+    // Bytes on the wire for one echo: the request and response frames.
+    const EchoPacket sizePacket(&data[0], EchoSize);
+    const UINT       roundTripSize = SetFramedPacket::TxHeaderSize + sizePacket.SizeInBytes() +
+                                     SetFramedPacket::RxHeaderSize + EchoSize +
+                                     (2 * SetFramedPacket::CrcSize);
+
+    pSim->SetErrorInterval(roundTripSize);
+
+    for (UINT i = 0; ret && (i < EchoCnt); i++)
+    {
+        memset(&data[0], i, EchoSize);
+
+        ret = serialComm.SubmitPacket(EchoPacket(&data[0], EchoSize), &rsp[0]) &&
+              serialComm.Drain();
+
+        pTest->Check(ret && (memcmp(&rsp[0], &data[0], EchoSize) == 0), _T("echo %u"), i);
+    }
+
+    SerialCommRxStats rxStats;
+    serialComm.GetRxStats(&rxStats);
+
+    pTest->Check(rxStats.retryCnt > 0, _T("noise caused resends"));
+
+    pSim->SetErrorInterval(0);
+}
+
+/***************************************************************************************************
+** % Function:    CheckNegotiate()
+*  % Description: Drops the link back to the default rate, limits the rate the simulated link can
+*                 carry, and negotiates up to maxBaudRate.  Checks the rate the link lands on, and
+*                 that it carries an echo there.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID CheckNegotiate(
+    SimTest* pTest,         // connected test, unframed
+    UINT     linkBaudRate,  // fastest rate the simulated link can carry
+    UINT     maxBaudRate,   // fastest rate to negotiate
+    UINT     expected)      // rate the link should land on
+{
+    static const BYTE Data[] = { 0x00, 0x55, 0xAA, 0xFF };
+
+    SerialComm* pSerialComm = pTest->GetComm();
+    BYTE        rsp[sizeof(Data)];
+
+    memset(&rsp[0], 0, sizeof(rsp));
+
+    BOOL ret = pSerialComm->SetBaudRate(SetBaudPacket::GetBaudRate(SetBaudPacket::BaudSelDefault));
+
+    pTest->GetSim()->SetMaxBaudRate(linkBaudRate);
+
+    ret = ret && pSerialComm->NegotiateBaudRate(maxBaudRate);
+
+    pTest->Check(ret && (pSerialComm->GetBaudRate() == expected),
+                 _T("link %u, max %u: at %u baud, expected %u"),
+                 linkBaudRate,
+                 maxBaudRate,
+                 pSerialComm->GetBaudRate(),
+                 expected);
+
+    ret = pSerialComm->SubmitPacket(EchoPacket(&Data[0], sizeof(Data)), &rsp[0]) &&
+          pSerialComm->Drain() &&
+          (memcmp(&rsp[0], &Data[0], sizeof(Data)) == 0);
+
+    pTest->Check(ret, _T("link %u, max %u: echo"), linkBaudRate, maxBaudRate);
+}
+
+/***************************************************************************************************
+** % Function:    TestBaudRates()
+*  % Description: Negotiates baud rates over a simulated link that can't carry every rate, and
+*                 checks that the link lands on the fastest rate that works, capped at the rate
+*                 asked for, or falls back to the default rate if no faster one works.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestBaudRates(
+    SimTest* pTest)  // connected test, unframed
+{
+    const UINT defaultBaudRate = SetBaudPacket::GetBaudRate(SetBaudPacket::BaudSelDefault);
+
+    // The link is slower than asked for: the rates above 1M fail.
+    CheckNegotiate(pTest, 1000000, SerialComm::DefaultMaxBaudRate, 1000000);
+
+    // The link is faster than asked for.
+    CheckNegotiate(pTest, SerialComm::DefaultMaxBaudRate, 921600, 921600);
+
+    // Only the default rate works.
+    CheckNegotiate(pTest, defaultBaudRate, SerialComm::DefaultMaxBaudRate, defaultBaudRate);
+}
+
+/***************************************************************************************************
+** % Function:    CheckScan()
+*  % Description: Scans a list of ports with PortFinder::ScanPorts(), and checks which one, if any,
+*                 it finds.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID CheckScan(
+    SimTest*     pTest,          // test
+    const TCHAR* pFirstName,     // first port in the list
+    const TCHAR* pSecondName,    // second port in the list
+    const TCHAR* pSkipPortName,  // port to skip (may be NULL)
+    const TCHAR* pExpectedName)  // port that should be found, NULL if none
+{
+    TCHAR portNames[2][Transport::MaxPortNameLen];
+    TCHAR foundName[Transport::MaxPortNameLen] = { 0 };
+
+    _tcscpy_s(&portNames[0][0], Transport::MaxPortNameLen, pFirstName);
+    _tcscpy_s(&portNames[1][0], Transport::MaxPortNameLen, pSecondName);
+
+    BOOL ret = PortFinder::ScanPorts(&foundName[0], portNames, 2, pSkipPortName);
+
+    pTest->Check((pExpectedName) ? (ret && (_tcscmp(&foundName[0], pExpectedName) == 0)) : !ret,
+                 _T("scan %s, %s skipping %s: found %s"),
+                 pFirstName,
+                 pSecondName,
+                 (pSkipPortName) ? pSkipPortName : _T("none"),
+                 (ret) ? &foundName[0] : _T("none"));
+}
+
+/***************************************************************************************************
+** % Function:    TestPortFinder()
+*  % Description: Checks the last good port cache, with the user's home folder pointed at a
+*                 temporary directory, and that a scan finds the simulator among ports that don't
+*                 answer, unless told to skip it as the last good port.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestPortFinder(
+    SimTest* pTest)  // test (the simulator it connects to isn't used)
+{
+#ifdef _WIN32
+    static const TCHAR* pHomeVar = _T("APPDATA");
+#else
+    static const TCHAR* pHomeVar = _T("HOME");
+#endif
+    static const TCHAR* pDeadPortName = _T("nesdbg_no_such_port");
+
+    const TCHAR* pSimPortName = HciSim::GetPortName();
+
+    // Point the cache at an empty temporary directory, and put the user's back afterwards.
+    TCHAR        homeDir[SimTest::MaxPathLen];
+    TCHAR        oldHomeDir[SimTest::MaxPathLen];
+    const TCHAR* pOldHomeDir = _tgetenv(pHomeVar);
+
+    if (pOldHomeDir)
+    {
+        _tcscpy_s(&oldHomeDir[0], SimTest::MaxPathLen, pOldHomeDir);
+    }
+
+    if (!pTest->MakeTempPath(_T(""), &homeDir[0], SimTest::MaxPathLen))
+    {
+        return;
+    }
+
+    _tputenv_s(pHomeVar, &homeDir[0]);
+
+    TCHAR cacheFilePath[Transport::MaxPortNameLen * 2];
+    TCHAR portName[Transport::MaxPortNameLen];
+
+    pTest->Check(PortFinder::GetCacheFilePath(&cacheFilePath[0], Transport::MaxPortNameLen * 2) &&
+                 (_tcsncmp(&cacheFilePath[0], &homeDir[0], _tcslen(&homeDir[0])) == 0),
+                 _T("cache file in the home folder"));
+    pTest->Check(!PortFinder::LoadLastGoodPort(&portName[0]), _T("no port cached"));
+
+    // Save, then load.
+    PortFinder::SaveLastGoodPort(pSimPortName);
+
+    FILE* pFile = _tfopen(&cacheFilePath[0], _T("r"));
+    TCHAR line[Transport::MaxPortNameLen];
+
+    pTest->Check(pFile && _fgetts(&line[0], Transport::MaxPortNameLen, pFile) &&
+                 (_tcscmp(&line[0], _T("sim\n")) == 0),
+                 _T("cache file written"));
+
+    if (pFile)
+    {
+        fclose(pFile);
+    }
+
+    pTest->Check(PortFinder::LoadLastGoodPort(&portName[0]) &&
+                 (_tcscmp(&portName[0], pSimPortName) == 0),
+                 _T("cached port loaded"));
+
+    // A cache file edited on Windows, and an empty one.
+    pFile = _tfopen(&cacheFilePath[0], _T("wb"));
+
+    if (pFile)
+    {
+        _fputts(_T("sim\r\n"), pFile);
+        fclose(pFile);
+    }
+
+    pTest->Check(PortFinder::LoadLastGoodPort(&portName[0]) &&
+                 (_tcscmp(&portName[0], pSimPortName) == 0),
+                 _T("CRLF line ending stripped"));
+
+    pFile = _tfopen(&cacheFilePath[0], _T("w"));
+
+    if (pFile)
+    {
+        fclose(pFile);
+    }
+
+    pTest->Check(!PortFinder::LoadLastGoodPort(&portName[0]), _T("empty cache file ignored"));
+
+    // The cached port answers, so FindPort() needn't scan (which couldn't find the simulator).
+    PortFinder::SaveLastGoodPort(pSimPortName);
+
+    pTest->Check(PortFinder::FindPort(&portName[0]) && (_tcscmp(&portName[0], pSimPortName) == 0),
+                 _T("last good port found"));
+
+    _tremove(&cacheFilePath[0]);
+
+    if (pOldHomeDir)
+    {
+        _tputenv_s(pHomeVar, &oldHomeDir[0]);
+    }
+
+    // A scan probes every port but the last good one, which FindPort() has already tried.
+    CheckScan(pTest, pDeadPortName, pSimPortName, NULL, pSimPortName);
+    CheckScan(pTest, pSimPortName, pDeadPortName, pDeadPortName, pSimPortName);
+    CheckScan(pTest, pDeadPortName, pSimPortName, pSimPortName, NULL);
+}
@@ -0,0 +1,323 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/simtestlz.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  simtest tests of LZ compressed writes: LzEncoder, MemWrLzPacket and StreamWriteCompressed().
+***************************************************************************************************/
+
+#include "simtest.h"
+
+// Kinds of test data, from most to least compressible.
+enum LzTestData
+{
+    LzTestDataZeros,   // all zeros
+    LzTestDataTiles,   // a few 16-byte tiles, repeated in a varying order
+    LzTestDataMixed,   // runs, repeats from up to 4KB back, and noise
+    LzTestDataNoise,   // pseudo-random bytes
+    LzTestDataCnt
+};
+
+/***************************************************************************************************
+** % Function:    FillLzTestData()
+*  % Description: Fills a buffer with one kind of LZ test data.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID FillLzTestData(
+    BYTE*      pData,     // buffer to fill
+    UINT       numBytes,  // size of pData, in bytes
+    LzTestData kind)      // kind of data
+{
+    UINT rand = 0x1234567;
+
+    for (UINT i = 0; i < numBytes; i++)
+    {
+        rand ^= rand << 13;
+        rand ^= rand >> 17;
+        rand ^= rand << 5;
+
+        switch (kind)
+        {
+            case LzTestDataZeros:
+                pData[i] = 0;
+                break;
+
+            case LzTestDataTiles:
+                pData[i] = static_cast<BYTE>(((((i >> 4) * 5) % 7) << 4) | (i & 0xF));
+                break;
+
+            case LzTestDataMixed:
+                pData[i] = ((i & 0x300) == 0x000) ? 0x20 :
+                           ((i & 0x300) == 0x100) ? static_cast<BYTE>(rand) :
+                           (i >= 0x1000)          ? pData[i - 0x1000 + ((i >> 10) & 3)] :
+                                                    static_cast<BYTE>(i >> 3);
+                break;
+
+            default:
+                pData[i] = static_cast<BYTE>(rand);
+                break;
+        }
+    }
+}
+
+/***************************************************************************************************
+** % Function:    DecodeLz()
+*  % Description: Reference decoder for LzEncoder's tokens: expands one packet's tokens onto the
+*                 end of the data decoded so far, as hci.v does in memory.
+*  % Returns:     TRUE if the tokens were well formed and fit in pOut, FALSE otherwise.
+***************************************************************************************************/
+static BOOL DecodeLz(
+    const BYTE* pTokens,     // tokens of one packet
+    UINT        tokenBytes,  // size of pTokens, in bytes
+    BYTE*       pOut,        // data decoded so far, and receives the rest
+    UINT*       pOutPos,     // bytes of pOut decoded so far; updated
+    UINT        outSize)     // size of pOut, in bytes
+{
+    BOOL ret = TRUE;
+    UINT i   = 0;
+    UINT pos = *pOutPos;
+
+    while (ret && (i < tokenBytes))
+    {
+        const BYTE token = pTokens[i++];
+
+        if (!(token & 0x80))
+        {
+            // Literal.
+            const UINT len = (token & 0x7F) + 1;
+
+            ret = (i + len <= tokenBytes) && (pos + len <= outSize);
+
+            if (ret)
+            {
+                memcpy(&pOut[pos], &pTokens[i], len);
+                i   += len;
+                pos += len;
+            }
+        }
+        else
+        {
+            // Copy, with a one or two byte distance.  The source may overlap the destination.
+            const BOOL longCopy = (token & 0x40) != 0;
+            const UINT len      = (token & 0x3F) + ((longCopy) ? LzEncoder::MinLongCopyLen :
+                                                                 LzEncoder::MinShortCopyLen);
+            UINT       dist     = 0;
+
+            ret = (i + ((longCopy) ? 2 : 1) <= tokenBytes);
+
+            if (ret)
+            {
+                dist = ((longCopy) ? (pTokens[i] | (pTokens[i + 1] << 8)) : pTokens[i]) + 1;
+                i   += (longCopy) ? 2 : 1;
+                ret  = (dist <= pos) && (pos + len <= outSize);
+            }
+
+            for (UINT j = 0; ret && (j < len); j++, pos++)
+            {
+                pOut[pos] = pOut[pos - dist];
+            }
+        }
+    }
+
+    *pOutPos = pos;
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Function:    TestLzRoundTrip()
+*  % Description: Encodes each kind of test data at each level and several packet sizes, decodes
+*                 the tokens with DecodeLz(), and checks that the data comes back, that every
+*                 packet fits its budget and writes exactly the span it advanced over, and that
+*                 compressible data shrinks.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestLzRoundTrip(
+    SimTest* pTest)  // test (the link isn't used)
+{
+    static const UINT DataSize       = 0x6000;
+    static const UINT MaxTokenBytes  = 0x800;
+    static const UINT TokenBudgets[] = { LzEncoder::MinTokenBytes, 0x41, MaxTokenBytes };
+
+    BYTE* pData = new BYTE[DataSize];
+    BYTE* pOut  = new BYTE[DataSize];
+    BYTE  tokens[MaxTokenBytes];
+
+    for (UINT kind = 0; kind < LzTestDataCnt; kind++)
+    {
+        FillLzTestData(pData, DataSize, static_cast<LzTestData>(kind));
+
+        UINT wireBytes[LzEncodeBest + 1] = { 0 };
+
+        for (UINT level = LzEncodeFast; level <= LzEncodeBest; level++)
+        {
+            for (UINT i = 0; i < sizeof(TokenBudgets) / sizeof(TokenBudgets[0]); i++)
+            {
+                LzEncoder encoder(static_cast<LzEncodeLevel>(level));
+                encoder.Start(pData, DataSize);
+
+                memset(pOut, 0xA5, DataSize);
+
+                UINT tokenTotal = 0;
+                UINT outPos     = 0;
+                BOOL valid      = TRUE;
+
+                while (valid && !encoder.IsDone())
+                {
+                    const UINT startPos   = encoder.GetPosition();
+                    const UINT tokenBytes = encoder.Encode(&tokens[0], TokenBudgets[i]);
+
+                    valid = (tokenBytes > 0) && (tokenBytes <= TokenBudgets[i]) &&
+                            DecodeLz(&tokens[0], tokenBytes, pOut, &outPos, DataSize) &&
+                            (outPos == encoder.GetPosition()) && (outPos > startPos);
+
+                    tokenTotal += tokenBytes;
+                }
+
+                pTest->Check(valid && (memcmp(pOut, pData, DataSize) == 0),
+                             _T("data %u, level %u, budget 0x%X: round trip"),
+                             kind,
+                             level,
+                             TokenBudgets[i]);
+
+                if (TokenBudgets[i] == MaxTokenBytes)
+                {
+                    wireBytes[level] = tokenTotal;
+                }
+            }
+        }
+
+        // Zeros and tiles shrink to a fraction.  Noise grows by little more than a token byte per
+        // literal run, and Best never does worse than Fast.
+        const UINT maxWireBytes = (kind == LzTestDataZeros) ? DataSize / 32    :
+                                  (kind == LzTestDataTiles) ? DataSize / 8     :
+                                  (kind == LzTestDataMixed) ? DataSize * 3 / 4 :
+                                                              DataSize + (DataSize / 64);
+
+        pTest->Check((wireBytes[LzEncodeFast] <= maxWireBytes) &&
+                     (wireBytes[LzEncodeBest] <= wireBytes[LzEncodeFast]),
+                     _T("data %u: 0x%X bytes fast, 0x%X best, at most 0x%X"),
+                     kind,
+                     wireBytes[LzEncodeFast],
+                     wireBytes[LzEncodeBest],
+                     maxWireBytes);
+    }
+
+    delete [] pData;
+    delete [] pOut;
+}
+
+// Progress seen by LzProgressProc().
+struct LzProgress
+{
+    UINT bytesDone;   // bytesDone of the last call
+    UINT totalBytes;  // totalBytes of the last call
+};
+
+/***************************************************************************************************
+** % Function:    LzProgressProc()
+*  % Description: StreamProgressFn for TestMemWrLz(): records the progress reported.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID LzProgressProc(
+    VOID* pContext,    // LzProgress
+    UINT  bytesDone,   // stream bytes done so far
+    UINT  totalBytes)  // total size of the stream
+{
+    LzProgress* pProgress = static_cast<LzProgress*>(pContext);
+
+    pProgress->bytesDone  = bytesDone;
+    pProgress->totalBytes = totalBytes;
+}
+
+/***************************************************************************************************
+** % Function:    TestMemWrLz()
+*  % Description: Writes a PPU pattern table of tiles with MemWrLzPacket, packet by packet, then
+*                 writes CPU spans of mixed data and of noise with StreamWriteCompressed(), and
+*                 checks the simulator's memory after each.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestMemWrLz(
+    SimTest* pTest)  // connected test
+{
+    static const UINT ChrBytes      = 0x2000;
+    static const UINT PrgBytes      = 0x8000;
+    static const UINT MaxTokenBytes = 0x400;
+
+    SerialComm* pComm = pTest->GetComm();
+    BYTE*       pCpu  = pTest->GetSim()->GetCpuMem();
+    BYTE*       pPpu  = pTest->GetSim()->GetPpuMem();
+
+    BYTE* pData = new BYTE[PrgBytes];
+    BYTE  tokens[MaxTokenBytes];
+
+    // Tiles, one MemWrLzPacket per Encode() call.
+    FillLzTestData(pData, ChrBytes, LzTestDataTiles);
+    memset(pPpu, 0, ChrBytes);
+
+    LzEncoder encoder(LzEncodeBest);
+    encoder.Start(pData, ChrBytes);
+
+    BOOL ret = TRUE;
+
+    while (ret && !encoder.IsDone())
+    {
+        const USHORT addr       = static_cast<USHORT>(encoder.GetPosition());
+        const UINT   tokenBytes = encoder.Encode(&tokens[0], MaxTokenBytes);
+
+        ret = pComm->SubmitPacket(MemWrLzPacket(MemSpacePpu,
+                                                addr,
+                                                &tokens[0],
+                                                static_cast<USHORT>(tokenBytes)));
+    }
+
+    ret = ret && pComm->Drain();
+    pTest->Check(ret && (memcmp(pPpu, pData, ChrBytes) == 0), _T("MemWrLz tiles"));
+
+    // Mixed data and noise, through StreamWriteCompressed().
+    for (UINT kind = LzTestDataMixed; kind <= LzTestDataNoise; kind++)
+    {
+        LzProgress progress = { 0, 0 };
+
+        FillLzTestData(pData, PrgBytes, static_cast<LzTestData>(kind));
+        memset(&pCpu[0x8000], 0, PrgBytes);
+
+        ret = pComm->StreamWriteCompressed(MemSpaceCpu,
+                                           0x8000,
+                                           pData,
+                                           PrgBytes,
+                                           LzProgressProc,
+                                           &progress) &&
+              pComm->Drain();
+
+        pTest->Check(ret && (memcmp(&pCpu[0x8000], pData, PrgBytes) == 0),
+                     _T("compressed stream, data %u"),
+                     kind);
+        pTest->Check((progress.bytesDone == PrgBytes) && (progress.totalBytes == PrgBytes),
+                     _T("compressed stream progress, data %u: 0x%X of 0x%X"),
+                     kind,
+                     progress.bytesDone,
+                     progress.totalBytes);
+    }
+
+    delete [] pData;
+}
@@ -0,0 +1,492 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/simtestops.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  simtest tests of the debug packet opcodes.
+***************************************************************************************************/
+
+#include "simtest.h"
+
+/***************************************************************************************************
+** % Function:    FillTestData()
+*  % Description: Fills a buffer with a pattern that doesn't repeat every 256 bytes, so misplaced
+*                 data is noticed.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID FillTestData(
+    BYTE* pData,     // buffer to fill
+    UINT  numBytes,  // size of pData, in bytes
+    UINT  seed)      // varies the pattern
+{
+    for (UINT i = 0; i < numBytes; i++)
+    {
+        pData[i] = static_cast<BYTE>((i * 7) + (i >> 8) + seed);
+    }
+}
+
+/***************************************************************************************************
+** % Function:    TestEcho()
+*  % Description: Echoes payloads of assorted sizes, up to the largest that fits in a frame.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestEcho(
+    SimTest* pTest)  // connected test
+{
+    static const USHORT Sizes[] = { 1, 2, 0x100, 0x7FC, 0x7FD };
+
+    BYTE data[0x7FD];
+    BYTE rsp[0x7FD];
+
+    FillTestData(&data[0], sizeof(data), 0x11);
+
+    for (UINT i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]); i++)
+    {
+        memset(&rsp[0], 0, sizeof(rsp));
+
+        BOOL ret = pTest->GetComm()->SubmitPacket(EchoPacket(&data[0], Sizes[i]), &rsp[0]) &&
+                   pTest->GetComm()->Drain();
+
+        pTest->Check(ret, _T("echo 0x%X bytes"), Sizes[i]);
+        pTest->Check(memcmp(&rsp[0], &data[0], Sizes[i]) == 0, _T("echoed 0x%X bytes"), Sizes[i]);
+    }
+}
+
+/***************************************************************************************************
+** % Function:    TestMemFill()
+*  % Description: Fills CPU and PPU ranges with patterns of each size, and checks that exactly the
+*                 range was written.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestMemFill(
+    SimTest* pTest)  // connected test
+{
+    static const USHORT Addr     = 0x0203;
+    static const USHORT NumBytes = 0x123;
+    static const BYTE   Pattern[MemFillPacket::MaxPatternSize] =
+    {
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF
+    };
+
+    for (UINT space = MemSpaceCpu; space <= MemSpacePpu; space++)
+    {
+        BYTE* pMem = (space == MemSpaceCpu) ? pTest->GetSim()->GetCpuMem() :
+                                              pTest->GetSim()->GetPpuMem();
+
+        for (UINT patternSize = 1; patternSize <= MemFillPacket::MaxPatternSize; patternSize++)
+        {
+            memset(&pMem[Addr - 1], 0x5A, NumBytes + 2);
+
+            BOOL ret = pTest->GetComm()->SubmitPacket(MemFillPacket(static_cast<MemSpace>(space),
+                                                                    Addr,
+                                                                    NumBytes,
+                                                                    &Pattern[0],
+                                                                    patternSize)) &&
+                       pTest->GetComm()->Drain();
+
+            pTest->Check(ret, _T("fill space %u, pattern size %u"), space, patternSize);
+
+            BOOL match = (pMem[Addr - 1] == 0x5A) && (pMem[Addr + NumBytes] == 0x5A);
+
+            for (UINT i = 0; i < NumBytes; i++)
+            {
+                match = match && (pMem[Addr + i] == Pattern[i % patternSize]);
+            }
+
+            pTest->Check(match, _T("filled space %u, pattern size %u"), space, patternSize);
+        }
+    }
+}
+
+/***************************************************************************************************
+** % Function:    TestMemCompare()
+*  % Description: Compares a range with a few planted mismatches, and checks the count and the
+*                 mismatches reported.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestMemCompare(
+    SimTest* pTest)  // connected test
+{
+    static const USHORT Addr          = 0x1000;
+    static const USHORT NumBytes      = 0x400;
+    static const UINT   MaxMismatches = 2;
+
+    BYTE expected[NumBytes];
+    BYTE rsp[(MaxMismatches * MemComparePacket::MismatchSize) + 2];
+
+    FillTestData(&expected[0], NumBytes, 0x22);
+
+    BYTE* pMem = pTest->GetSim()->GetPpuMem();
+    memcpy(&pMem[Addr], &expected[0], NumBytes);
+
+    // A matching range reports no mismatches.
+    {
+        MemComparePacket packet(MemSpacePpu, Addr, NumBytes, &expected[0], MaxMismatches);
+
+        BOOL ret = pTest->GetComm()->SubmitPacket(packet, &rsp[0]) && pTest->GetComm()->Drain();
+
+        pTest->Check(ret && (packet.GetMismatchCnt(&rsp[0]) == 0), _T("compare matching range"));
+    }
+
+    // Three mismatches, of which the first two are reported.
+    pMem[Addr + 0x010] ^= 0xFF;
+    pMem[Addr + 0x200] ^= 0x01;
+    pMem[Addr + 0x3FF] ^= 0x80;
+
+    {
+        MemComparePacket packet(MemSpacePpu, Addr, NumBytes, &expected[0], MaxMismatches);
+
+        BOOL ret = pTest->GetComm()->SubmitPacket(packet, &rsp[0]) && pTest->GetComm()->Drain();
+
+        USHORT addr[MaxMismatches];
+        BYTE   actual[MaxMismatches];
+
+        for (UINT i = 0; i < MaxMismatches; i++)
+        {
+            packet.GetMismatch(&rsp[0], i, &addr[i], &actual[i]);
+        }
+
+        pTest->Check(ret && (packet.GetMismatchCnt(&rsp[0]) == 3),
+                     _T("mismatch count %u"),
+                     packet.GetMismatchCnt(&rsp[0]));
+        pTest->Check((addr[0] == Addr + 0x010) && (actual[0] == pMem[Addr + 0x010]) &&
+                     (addr[1] == Addr + 0x200) && (actual[1] == pMem[Addr + 0x200]),
+                     _T("mismatches reported"));
+    }
+}
+
+/***************************************************************************************************
+** % Function:    SignalCpuWriteProc()
+*  % Description: Stands in for the CPU for TestWait(): writes to a watched address every few
+*                 milliseconds until told to stop.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID SignalCpuWriteProc(
+    VOID* pContext)  // SimTest
+{
+    SimTest* pTest = static_cast<SimTest*>(pContext);
+
+    // Give up after 2s, in case the WAIT never got to the simulator.
+    for (UINT i = 0; (i < 200) && !pTest->GetSim()->IsHalted(); i++)
+    {
+        Sleep(10);
+        pTest->GetSim()->SignalCpuWrite(0x6000, 0x81);
+    }
+}
+
+/***************************************************************************************************
+** % Function:    TestWait()
+*  % Description: Checks each WAIT condition, met and timed out, with the CPU halted and running.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestWait(
+    SimTest* pTest)  // connected test
+{
+    SerialComm* pComm = pTest->GetComm();
+
+    BYTE status = 0xFF;
+
+    // Halted: met at once while halted.
+    BOOL ret = pComm->SubmitPacket(WaitPacket(WaitPacket::CondHalted, 0, 0, 0, 0), &status) &&
+               pComm->Drain();
+    pTest->Check(ret && (status == WaitPacket::StatusMet), _T("wait halted, status %u"), status);
+
+    // Frames, with the CPU running: two vblanks pass well within the timeout.
+    ret = pComm->SubmitPacket(DbgRunPacket()) &&
+          pComm->SubmitPacket(WaitPacket(WaitPacket::CondFrames, 2, 0, 0, 1000), &status) &&
+          pComm->Drain();
+    pTest->Check(ret && (status == WaitPacket::StatusMet), _T("wait frames, status %u"), status);
+
+    // Memory, with the CPU running: nothing written, so the wait times out.
+    ret = pComm->SubmitPacket(WaitPacket(WaitPacket::CondMem, 0x6000, 0x80, 0x80, 20), &status) &&
+          pComm->Drain();
+    pTest->Check(ret && (status == WaitPacket::StatusTimeout),
+                 _T("wait mem timeout, status %u"),
+                 status);
+    pTest->Check(!pTest->GetSim()->IsHalted(), _T("CPU left running"));
+
+    // Memory, with the CPU running: met when the "CPU" writes a matching value.
+    Thread cpuThread;
+    pTest->Check(cpuThread.Start(SignalCpuWriteProc, pTest), _T("start CPU thread"));
+
+    ret = pComm->SubmitPacket(WaitPacket(WaitPacket::CondMem, 0x6000, 0x80, 0x80, 2000), &status) &&
+          pComm->SubmitPacket(DbgHltPacket()) &&
+          pComm->Drain();
+    pTest->Check(ret && (status == WaitPacket::StatusMet), _T("wait mem, status %u"), status);
+    pTest->Check(pTest->GetSim()->IsHalted(), _T("CPU halted"));
+
+    cpuThread.Join();
+}
+
+/***************************************************************************************************
+** % Function:    TestProgram()
+*  % Description: Stores a program that writes a register and reads memory, runs it several times,
+*                 and checks its effects and the concatenated responses.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestProgram(
+    SimTest* pTest)  // connected test
+{
+    static const USHORT Addr     = 0x0300;
+    static const USHORT NumBytes = 0x10;
+    static const USHORT RunCnt   = 3;
+
+    BYTE* pMem = pTest->GetSim()->GetCpuMem();
+    FillTestData(&pMem[Addr], NumBytes, 0x33);
+
+    DbgProgram program;
+    pTest->Check(program.Append(CpuRegWrPacket(CpuRegAc, 0x5A)) &&
+                 program.Append(CpuMemRdPacket(Addr, NumBytes)) &&
+                 !program.Append(WaitPacket(WaitPacket::CondHalted, 0, 0, 0, 0)),
+                 _T("build program"));
+    pTest->Check(program.RspSize() == NumBytes, _T("program response size"));
+
+    BYTE rsp[RunCnt * NumBytes];
+    memset(&rsp[0], 0, sizeof(rsp));
+
+    // Storing the program doesn't run it.
+    BOOL ret = pTest->GetComm()->SubmitPacket(ProgWrPacket(program)) && pTest->GetComm()->Drain();
+    pTest->Check(ret && (pTest->GetSim()->GetCpuReg(CpuRegAc) != 0x5A), _T("store program"));
+
+    for (UINT vblank = 0; vblank <= 1; vblank++)
+    {
+        ret = pTest->GetComm()->SubmitPacket(ProgRunPacket(program, RunCnt, vblank), &rsp[0]) &&
+              pTest->GetComm()->Drain();
+        pTest->Check(ret, _T("run program, vblank %u"), vblank);
+        pTest->Check(pTest->GetSim()->GetCpuReg(CpuRegAc) == 0x5A, _T("register written"));
+
+        for (UINT i = 0; i < RunCnt; i++)
+        {
+            pTest->Check(memcmp(&rsp[i * NumBytes], &pMem[Addr], NumBytes) == 0,
+                         _T("run %u response, vblank %u"),
+                         i,
+                         vblank);
+        }
+
+        pMem[Addr] ^= 0xFF;
+    }
+}
+
+/***************************************************************************************************
+** % Function:    CheckMultiRead()
+*  % Description: Reads a list of ranges with one MultiReadPacket, and checks that the response is
+*                 the contents of each range in turn.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID CheckMultiRead(
+    SimTest*        pTest,      // connected test
+    const MemRange* pRanges,    // ranges to read
+    UINT            numRanges)  // number of ranges
+{
+    MultiReadPacket packet(pRanges, numRanges);
+
+    UINT rspBytes = 0;
+
+    for (UINT i = 0; i < numRanges; i++)
+    {
+        rspBytes += pRanges[i].numBytes;
+    }
+
+    pTest->Check(packet.ReturnBytesExpected() == rspBytes,
+                 _T("%u ranges, response size %u"),
+                 numRanges,
+                 packet.ReturnBytesExpected());
+
+    BYTE* pRsp = new BYTE[rspBytes];
+    memset(pRsp, 0, rspBytes);
+
+    BOOL ret = pTest->GetComm()->SubmitPacket(packet, pRsp) && pTest->GetComm()->Drain();
+
+    pTest->Check(ret, _T("read %u ranges"), numRanges);
+
+    const BYTE* pRangeRsp = pRsp;
+
+    for (UINT i = 0; i < numRanges; i++)
+    {
+        const BYTE* pMem    = (pRanges[i].space == MemSpaceCpu) ? pTest->GetSim()->GetCpuMem() :
+                                                                  pTest->GetSim()->GetPpuMem();
+        const UINT  memSize = (pRanges[i].space == MemSpaceCpu) ? HciSim::CpuMemSize :
+                                                                  HciSim::PpuMemSize;
+
+        BOOL match = TRUE;
+
+        for (UINT j = 0; j < pRanges[i].numBytes; j++)
+        {
+            match = match && (pRangeRsp[j] == pMem[(pRanges[i].addr + j) % memSize]);
+        }
+
+        pTest->Check(match,
+                     _T("range %u: space %u, 0x%04X, 0x%X bytes"),
+                     i,
+                     pRanges[i].space,
+                     pRanges[i].addr,
+                     pRanges[i].numBytes);
+
+        pRangeRsp += pRanges[i].numBytes;
+    }
+
+    delete [] pRsp;
+}
+
+/***************************************************************************************************
+** % Function:    TestMultiRead()
+*  % Description: Reads mixed CPU and PPU ranges of assorted sizes, including one that wraps at the
+*                 end of the CPU address space, and then MaxRanges ranges at once.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestMultiRead(
+    SimTest* pTest)  // connected test
+{
+    static const MemRange MixedRanges[] =
+    {
+        { MemSpaceCpu, 0x0200, 0x0010 },
+        { MemSpacePpu, 0x0100, 0x0020 },
+        { MemSpaceCpu, 0xFFF8, 0x0010 },
+        { MemSpacePpu, 0x3FFF, 0x0001 },
+        { MemSpaceCpu, 0x8000, 0x0300 },
+    };
+
+    FillTestData(pTest->GetSim()->GetCpuMem(), HciSim::CpuMemSize, 0x66);
+    FillTestData(pTest->GetSim()->GetPpuMem(), HciSim::PpuMemSize, 0x77);
+
+    CheckMultiRead(pTest, &MixedRanges[0], sizeof(MixedRanges) / sizeof(MixedRanges[0]));
+
+    MemRange ranges[MultiReadPacket::MaxRanges];
+
+    for (UINT i = 0; i < MultiReadPacket::MaxRanges; i++)
+    {
+        ranges[i].space    = (i & 1) ? MemSpacePpu : MemSpaceCpu;
+        ranges[i].addr     = static_cast<USHORT>(i * 0x81);
+        ranges[i].numBytes = static_cast<USHORT>(1 + (i % 8));
+    }
+
+    CheckMultiRead(pTest, &ranges[0], MultiReadPacket::MaxRanges);
+}
+
+/***************************************************************************************************
+** % Function:    TestMemCrc()
+*  % Description: Checks UpdateCrc() against the standard CRC-32 check value, and that the CRCs the
+*                 simulator computes match it: for the check string, for a whole PPU pattern table
+*                 before and after a bit flip, and for the largest CPU range.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestMemCrc(
+    SimTest* pTest)  // connected test
+{
+    static const BYTE   CheckData[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    static const UINT   CheckCrc    = 0xCBF43926;
+    static const USHORT CheckAddr   = 0x0400;
+    static const USHORT ChrBytes    = 0x2000;
+
+    SerialComm* pComm = pTest->GetComm();
+    BYTE*       pCpu  = pTest->GetSim()->GetCpuMem();
+    BYTE*       pPpu  = pTest->GetSim()->GetPpuMem();
+
+    BYTE rsp[MemCrcPacket::RspSize];
+
+    // Host CRC, in one call and chained.
+    pTest->Check(MemCrcPacket::UpdateCrc(0, &CheckData[0], sizeof(CheckData)) == CheckCrc,
+                 _T("check value"));
+    pTest->Check(MemCrcPacket::UpdateCrc(MemCrcPacket::UpdateCrc(0, &CheckData[0], 4),
+                                         &CheckData[4],
+                                         sizeof(CheckData) - 4) == CheckCrc,
+                 _T("chained check value"));
+
+    // Device CRC of the check string.
+    memcpy(&pCpu[CheckAddr], &CheckData[0], sizeof(CheckData));
+
+    BOOL ret = pComm->SubmitPacket(MemCrcPacket(MemSpaceCpu, CheckAddr, sizeof(CheckData)),
+                                   &rsp[0]) &&
+               pComm->Drain();
+    pTest->Check(ret && (MemCrcPacket::GetRspCrc(&rsp[0]) == CheckCrc),
+                 _T("device check value 0x%08X"),
+                 MemCrcPacket::GetRspCrc(&rsp[0]));
+
+    // A pattern table, then the same table with one bit flipped.
+    FillTestData(&pPpu[0], ChrBytes, 0x88);
+
+    BYTE* pExpected = new BYTE[HciSim::CpuMemSize];
+    memcpy(pExpected, &pPpu[0], ChrBytes);
+
+    ret = pComm->SubmitPacket(MemCrcPacket(MemSpacePpu, 0, ChrBytes), &rsp[0]) && pComm->Drain();
+    pTest->Check(ret && MemCrcPacket::RspMatches(&rsp[0], pExpected, ChrBytes), _T("PPU CRC"));
+
+    pPpu[0x1234] ^= 0x10;
+
+    ret = pComm->SubmitPacket(MemCrcPacket(MemSpacePpu, 0, ChrBytes), &rsp[0]) && pComm->Drain();
+    pTest->Check(ret && !MemCrcPacket::RspMatches(&rsp[0], pExpected, ChrBytes),
+                 _T("PPU CRC after a bit flip"));
+
+    // The largest range.
+    FillTestData(&pCpu[0], HciSim::CpuMemSize, 0x99);
+    memcpy(pExpected, &pCpu[0], HciSim::CpuMemSize);
+
+    ret = pComm->SubmitPacket(MemCrcPacket(MemSpaceCpu, 0, 0xFFFF), &rsp[0]) && pComm->Drain();
+    pTest->Check(ret && MemCrcPacket::RspMatches(&rsp[0], pExpected, 0xFFFF), _T("CPU CRC"));
+
+    delete [] pExpected;
+}
+
+/***************************************************************************************************
+** % Function:    TestCpuRegs()
+*  % Description: Writes every CPU register with one CpuRegsWrPacket and reads them back with one
+*                 CpuRegsRdPacket, checking both against the simulator, and that the read sees a
+*                 single-register write in between.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestCpuRegs(
+    SimTest* pTest)  // connected test
+{
+    static const BYTE Regs[CpuRegCnt] = { 0x34, 0x12, 0xA5, 0x5A, 0x0F, 0xE3, 0xFD };
+
+    SerialComm* pComm = pTest->GetComm();
+    HciSim*     pSim  = pTest->GetSim();
+
+    BYTE rsp[CpuRegCnt];
+    memset(&rsp[0], 0, sizeof(rsp));
+
+    BOOL ret = pComm->SubmitPacket(CpuRegsWrPacket(&Regs[0])) && pComm->Drain();
+    pTest->Check(ret, _T("write registers"));
+
+    for (UINT i = 0; i < CpuRegCnt; i++)
+    {
+        pTest->Check(pSim->GetCpuReg(i) == Regs[i],
+                     _T("register %u written, 0x%02X"),
+                     i,
+                     pSim->GetCpuReg(i));
+    }
+
+    ret = pComm->SubmitPacket(CpuRegWrPacket(CpuRegX, 0x77)) &&
+          pComm->SubmitPacket(CpuRegsRdPacket(), &rsp[0]) &&
+          pComm->Drain();
+    pTest->Check(ret, _T("read registers"));
+
+    for (UINT i = 0; i < CpuRegCnt; i++)
+    {
+        const BYTE expected = (i == CpuRegX) ? 0x77 : Regs[i];
+
+        pTest->Check((rsp[i] == expected) && (rsp[i] == pSim->GetCpuReg(i)),
+                     _T("register %u read, 0x%02X"),
+                     i,
+                     rsp[i]);
+    }
+}
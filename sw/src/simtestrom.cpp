@@ -0,0 +1,441 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/simtestrom.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  simtest tests of ROM images: parsing and loading.
+***************************************************************************************************/
+
+#include "inesrom.h"
+#include "romloader.h"
+#include "simtest.h"
+
+/***************************************************************************************************
+** % Function:    BuildImage()
+*  % Description: Builds an iNES image from a header and bodyBytes bytes of test data.
+*  % Returns:     Image size, in bytes.
+***************************************************************************************************/
+static UINT BuildImage(
+    BYTE*       pImage,     // receives the image
+    const BYTE* pHeader,    // header, INesRom::HeaderSize bytes
+    UINT        bodyBytes)  // bytes following the header
+{
+    memcpy(pImage, pHeader, INesRom::HeaderSize);
+    FillTestData(pImage + INesRom::HeaderSize, bodyBytes, 0xDD);
+
+    return INesRom::HeaderSize + bodyBytes;
+}
+
+/***************************************************************************************************
+** % Function:    CheckParseFails()
+*  % Description: Checks that an image is rejected with the expected result, and that nothing of it
+*                 is left visible afterwards.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID CheckParseFails(
+    SimTest*     pTest,     // test to record the result in
+    const BYTE*  pImage,    // image to parse
+    UINT         size,      // image size, in bytes
+    INesResult   expected,  // expected result
+    const TCHAR* pCase)     // what is wrong with the image, for messages
+{
+    INesRom rom;
+
+    const INesResult result = rom.Parse(pImage, size);
+
+    pTest->Check((result == expected) && !rom.HeaderData() && !rom.PrgRomData() &&
+                 (rom.PrgRomSize() == 0) && (rom.ChrRomSize() == 0),
+                 _T("%s: result %u"),
+                 pCase,
+                 result);
+}
+
+/***************************************************************************************************
+** % Function:    TestINesRom()
+*  % Description: Parses iNES, archaic iNES and NES 2.0 images and checks the decoded header and
+*                 section views, then checks that bad headers, PRG ROM size 0 and truncated images
+*                 are rejected.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestINesRom(
+    SimTest* pTest)  // test (the link isn't used)
+{
+    static const UINT MaxImageSize = INesRom::HeaderSize + INesRom::TrainerDataSize + 0x10000;
+
+    // iNES 1.0: trainer, 2 PRG banks, 1 CHR bank, vertical, battery, mapper 0x13, PAL.
+    static const BYTE INesHeader[INesRom::HeaderSize] =
+    {
+        'N', 'E', 'S', 0x1A, 0x02, 0x01, 0x37, 0x10, 0x00, 0x01, 0, 0, 0, 0, 0, 0
+    };
+
+    // Archaic iNES: junk in bytes 7-15, so byte 7's mapper bits are ignored.  1 PRG bank, CHR RAM.
+    static const BYTE ArchaicHeader[INesRom::HeaderSize] =
+    {
+        'N', 'E', 'S', 0x1A, 0x01, 0x00, 0x20, 'D', 'i', 's', 'k', 'D', 'u', 'd', 'e', '!'
+    };
+
+    // NES 2.0: mapper 0x234, submapper 5, PRG ROM 3 * 2^14 bytes (exponent-multiplier form),
+    // 1 CHR bank, 8KB PRG NVRAM, 8KB CHR RAM, Dendy timing, 1 miscellaneous ROM.
+    static const BYTE Nes20Header[INesRom::HeaderSize] =
+    {
+        'N', 'E', 'S', 0x1A, 0x39, 0x01, 0x40, 0x38, 0x52, 0x0F, 0x70, 0x07, 0x03, 0x00, 0x01, 0x02
+    };
+
+    BYTE* pImage = new BYTE[MaxImageSize];
+    BYTE  header[INesRom::HeaderSize];
+
+    INesRom rom;
+
+    // iNES 1.0.
+    UINT size = BuildImage(pImage, &INesHeader[0], INesRom::TrainerDataSize + 0xA000);
+
+    pTest->Check(rom.Parse(pImage, size) == INES_RESULT_SUCCESS, _T("parse iNES"));
+    pTest->Check((rom.GetFormat() == INesFormatINes) && (rom.GetMapper() == 0x13) &&
+                 (rom.GetMirroring() == INesMirroringVertical) && rom.HasBattery() &&
+                 (rom.GetTiming() == INesTimingPal) && (rom.GetPrgRamSize() == 0) &&
+                 (rom.GetPrgNvramSize() == 0x2000) && (rom.GetChrRamSize() == 0),
+                 _T("iNES header fields"));
+    pTest->Check((rom.HeaderData() == pImage) &&
+                 (rom.TrainerData() == pImage + 0x10) && (rom.TrainerSize() == 0x200) &&
+                 (rom.PrgRomData() == pImage + 0x210) && (rom.PrgRomSize() == 0x8000) &&
+                 (rom.ChrRomData() == pImage + 0x8210) && (rom.ChrRomSize() == 0x2000) &&
+                 !rom.MiscRomData(),
+                 _T("iNES sections"));
+
+    // Archaic iNES.
+    size = BuildImage(pImage, &ArchaicHeader[0], 0x4000);
+
+    pTest->Check(rom.Parse(pImage, size) == INES_RESULT_SUCCESS, _T("parse archaic iNES"));
+    pTest->Check((rom.GetFormat() == INesFormatArchaic) && (rom.GetMapper() == 0x02) &&
+                 (rom.GetMirroring() == INesMirroringHorizontal) && !rom.HasBattery() &&
+                 (rom.PrgRomSize() == 0x4000) && !rom.ChrRomData() &&
+                 (rom.GetChrRamSize() == 0x2000) && !rom.TrainerData(),
+                 _T("archaic iNES header fields"));
+
+    // NES 2.0, with 0x10 bytes of miscellaneous ROM after CHR ROM.
+    size = BuildImage(pImage, &Nes20Header[0], 0xC000 + 0x2000 + 0x10);
+
+    pTest->Check(rom.Parse(pImage, size) == INES_RESULT_SUCCESS, _T("parse NES 2.0"));
+    pTest->Check((rom.GetFormat() == INesFormatNes20) && (rom.GetMapper() == 0x234) &&
+                 (rom.GetSubmapper() == 5) && (rom.GetPrgNvramSize() == 0x2000) &&
+                 (rom.GetPrgRamSize() == 0) && (rom.GetChrRamSize() == 0x2000) &&
+                 (rom.GetTiming() == INesTimingDendy) && (rom.GetMiscRomCnt() == 1) &&
+                 (rom.GetExpansionDevice() == 2),
+                 _T("NES 2.0 header fields"));
+    pTest->Check((rom.PrgRomData() == pImage + 0x10) && (rom.PrgRomSize() == 0xC000) &&
+                 (rom.ChrRomData() == pImage + 0xC010) && (rom.ChrRomSize() == 0x2000) &&
+                 (rom.MiscRomData() == pImage + 0xE010) && (rom.MiscRomSize() == 0x10),
+                 _T("NES 2.0 sections"));
+
+    // Bad headers.
+    size = BuildImage(pImage, &INesHeader[0], INesRom::TrainerDataSize + 0xA000);
+
+    CheckParseFails(pTest, pImage, INesRom::HeaderSize - 1, INES_RESULT_INVALID_HEADER,
+                    _T("short header"));
+
+    pImage[3] = 0x1B;
+    CheckParseFails(pTest, pImage, size, INES_RESULT_INVALID_HEADER, _T("bad magic"));
+
+    memcpy(header, &INesHeader[0], INesRom::HeaderSize);
+    header[4] = 0;
+    BuildImage(pImage, &header[0], INesRom::TrainerDataSize + 0xA000);
+    CheckParseFails(pTest, pImage, size, INES_RESULT_INVALID_HEADER, _T("PRG ROM size 0"));
+
+    memcpy(header, &Nes20Header[0], INesRom::HeaderSize);
+    header[4] = 0x74;  // 2^29 bytes
+    BuildImage(pImage, &header[0], 0xE010);
+    CheckParseFails(pTest, pImage, size, INES_RESULT_INVALID_HEADER, _T("NES 2.0 PRG ROM 2^29"));
+
+    // Truncated images: one byte short of the CHR ROM, of the PRG ROM, and of the trainer.
+    size = BuildImage(pImage, &INesHeader[0], INesRom::TrainerDataSize + 0xA000);
+
+    CheckParseFails(pTest, pImage, size - 1, INES_RESULT_TRUNCATED, _T("short CHR ROM"));
+    CheckParseFails(pTest, pImage, 0x820F, INES_RESULT_TRUNCATED, _T("short PRG ROM"));
+    CheckParseFails(pTest, pImage, 0x20F, INES_RESULT_TRUNCATED, _T("short trainer"));
+
+    // A file that can't be opened.
+    pTest->Check(rom.Open(_T("no_such_rom.nes")) == INES_RESULT_OPEN_FAILED, _T("open failure"));
+
+    delete [] pImage;
+}
+
+/***************************************************************************************************
+** % Function:    CheckRomLoad()
+*  % Description: Loads an image with a RomLoader, and checks the result, the number of ROM bytes
+*                 sent, and that the simulator's PRG ROM and CHR ROM match the image.
+*  % Returns:     N/A
+***************************************************************************************************/
+static VOID CheckRomLoad(
+    SimTest*       pTest,        // connected test
+    RomBlockCache* pBlockCache,  // block CRC cache (may be NULL)
+    const INesRom& rom,          // image to load
+    UINT           sentBytes,    // ROM bytes the load should send
+    const TCHAR*   pCase)        // what the load is checking, for messages
+{
+    RomLoader loader(pTest->GetComm(), pBlockCache);
+
+    const RomLoadResult result = loader.Load(rom, RomLoadFlagVerify, NULL, NULL);
+
+    pTest->Check(result == ROM_LOAD_RESULT_SUCCESS, _T("%s: result %u"), pCase, result);
+    pTest->Check(loader.GetTotalBytes() == sentBytes,
+                 _T("%s: sent 0x%X bytes, expected 0x%X"),
+                 pCase,
+                 loader.GetTotalBytes(),
+                 sentBytes);
+    pTest->Check((memcmp(&pTest->GetSim()->GetCpuMem()[0x8000],
+                         rom.PrgRomData(),
+                         rom.PrgRomSize()) == 0) &&
+                 (memcmp(pTest->GetSim()->GetPpuMem(), rom.ChrRomData(), rom.ChrRomSize()) == 0),
+                 _T("%s: ROM contents"),
+                 pCase);
+    pTest->Check(!pBlockCache || pBlockCache->valid, _T("%s: cache valid"), pCase);
+}
+
+/***************************************************************************************************
+** % Function:    TestRomDelta()
+*  % Description: Loads a ROM image, then reloads edited copies of it, checking that only changed
+*                 blocks are sent: with the cache (checking that its CRCs are the ones used), with
+*                 the cache gone stale because the board's memory changed behind its back, and
+*                 without a cache.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestRomDelta(
+    SimTest* pTest)  // connected test
+{
+    static const UINT BlockSize = RomBlockCache::BlockSize;
+    static const UINT PrgBytes  = 2 * INesRom::PrgRomBankSize;
+    static const UINT ChrBytes  = INesRom::ChrRomBankSize;
+
+    // 2 PRG banks, 1 CHR bank, mapper 0.
+    static const BYTE Header[INesRom::HeaderSize] =
+    {
+        'N', 'E', 'S', 0x1A, 0x02, 0x01, 0x00, 0x00, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+
+    BYTE* pImage = new BYTE[INesRom::HeaderSize + PrgBytes + ChrBytes];
+    UINT  size   = BuildImage(pImage, &Header[0], PrgBytes + ChrBytes);
+
+    BYTE* pPrg = pImage + INesRom::HeaderSize;
+    BYTE* pChr = pPrg + PrgBytes;
+
+    RomBlockCache cache;
+    memset(&cache, 0, sizeof(cache));
+
+    INesRom rom;
+    pTest->Check(rom.Parse(pImage, size) == INES_RESULT_SUCCESS, _T("parse image"));
+
+    // First load: the cache is empty, and the board holds none of the image.
+    CheckRomLoad(pTest, &cache, rom, PrgBytes + ChrBytes, _T("first load"));
+
+    // Two bytes of one PRG block and one byte each of two CHR blocks change.
+    pPrg[0x1000] ^= 0xFF;
+    pPrg[0x13FF] ^= 0xFF;
+    pChr[0x0000] ^= 0xFF;
+    pChr[0x1FFF] ^= 0xFF;
+
+    CheckRomLoad(pTest, &cache, rom, 3 * BlockSize, _T("edited reload"));
+    CheckRomLoad(pTest, &cache, rom, 0, _T("unchanged reload"));
+
+    // The cache is trusted over the board: a block the cache gets wrong is resent.
+    cache.chrRomCrcs[5] ^= 0x01;
+
+    CheckRomLoad(pTest, &cache, rom, BlockSize, _T("cached CRCs used"));
+
+    // The board's memory changes behind the cache's back: the cache predicts nothing to send, the
+    // region CRC says otherwise, and the board's block CRCs find the changed block.
+    pTest->GetSim()->GetCpuMem()[0x8000 + 0x6000] ^= 0x01;
+
+    CheckRomLoad(pTest, &cache, rom, BlockSize, _T("stale cache"));
+
+    // Without a cache, the board's block CRCs are always used.
+    pPrg[0x7FFF] ^= 0xFF;
+
+    CheckRomLoad(pTest, NULL, rom, BlockSize, _T("no cache"));
+
+    delete [] pImage;
+}
+
+/***************************************************************************************************
+** % Function:    TestReconnect()
+*  % Description: Loads and runs a ROM image over a framed link at the fastest rate, then ends the
+*                 session, and checks that it left the CPU running and the link where the next
+*                 session connects: DefaultBaudRate, unframed.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestReconnect(
+    SimTest* pTest)  // test (its link isn't used; the sessions get their own simulator)
+{
+    // 1 PRG bank, 1 CHR bank, mapper 0.
+    static const BYTE Header[INesRom::HeaderSize] =
+    {
+        'N', 'E', 'S', 0x1A, 0x01, 0x01, 0x00, 0x00, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+
+    static const UINT RomBytes = INesRom::PrgRomBankSize + INesRom::ChrRomBankSize;
+
+    const UINT defaultBaudRate = SetBaudPacket::GetBaudRate(SetBaudPacket::BaudSelDefault);
+
+    BYTE* pImage = new BYTE[INesRom::HeaderSize + RomBytes];
+    UINT  size   = BuildImage(pImage, &Header[0], RomBytes);
+
+    INesRom rom;
+    pTest->Check(rom.Parse(pImage, size) == INES_RESULT_SUCCESS, _T("parse image"));
+
+    HciSim* pSim = new HciSim();
+    pSim->Open(HciSim::GetPortName(), defaultBaudRate);
+
+    // First session: load and run.  Ending it restores the link settings.
+    SerialComm* pSerialComm = new SerialComm();
+
+    BOOL ret = pSerialComm->Init(new SimLink(pSim)) &&
+               pSerialComm->NegotiateBaudRate(SerialComm::DefaultMaxBaudRate) &&
+               pSerialComm->SetFramedMode(TRUE);
+
+    if (pTest->Check(ret && (pSerialComm->GetBaudRate() > defaultBaudRate),
+                     _T("first session: connect framed")))
+    {
+        RomLoader loader(pSerialComm);
+
+        const RomLoadResult result = loader.Load(rom, RomLoadFlagRun, NULL, NULL);
+
+        pTest->Check(result == ROM_LOAD_RESULT_SUCCESS,
+                     _T("first session: load result %u"),
+                     result);
+    }
+
+    delete pSerialComm;
+
+    pTest->Check(!pSim->IsHalted(), _T("first session: CPU left running"));
+
+    // Second session: a debugger halts the running CPU at the default rate, unframed, and then
+    // connects as usual.  Bytes sent at any other rate or unframed into framed mode would be lost.
+    DbgHltPacket dbgHltPkt;
+
+    pSim->Write(dbgHltPkt.HeaderData(), dbgHltPkt.HeaderSize(), 0);
+
+    pTest->Check(pSim->IsHalted(), _T("second session: CPU halted"));
+
+    {
+        SerialComm serialComm;
+
+        pTest->Check(serialComm.Init(new SimLink(pSim)) &&
+                     (serialComm.GetBaudRate() == defaultBaudRate) &&
+                     !serialComm.IsFramedMode(),
+                     _T("second session: connect"));
+    }
+
+    delete pSim;
+    delete [] pImage;
+}
+
+/***************************************************************************************************
+** % Function:    TestRomThread()
+*  % Description: Loads a ROM file on RomLoader's load thread, polling its progress until it is
+*                 done, and checks that progress never goes backwards and that the final byte
+*                 count, result and simulator memory are right.  Also checks that a missing file is
+*                 reported without starting a load.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID TestRomThread(
+    SimTest* pTest)  // connected test
+{
+    static const UINT PrgBytes  = 2 * INesRom::PrgRomBankSize;
+    static const UINT ChrBytes  = INesRom::ChrRomBankSize;
+    static const UINT TimeoutMs = 10000;
+
+    // 2 PRG banks, 1 CHR bank, mapper 0.
+    static const BYTE Header[INesRom::HeaderSize] =
+    {
+        'N', 'E', 'S', 0x1A, 0x02, 0x01, 0x00, 0x00, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+
+    TCHAR romPath[SimTest::MaxPathLen];
+    TCHAR missingPath[SimTest::MaxPathLen];
+
+    if (!pTest->MakeTempPath(_T("thread.nes"), &romPath[0], SimTest::MaxPathLen) ||
+        !pTest->MakeTempPath(_T("missing.nes"), &missingPath[0], SimTest::MaxPathLen))
+    {
+        return;
+    }
+
+    BYTE* pImage = new BYTE[INesRom::HeaderSize + PrgBytes + ChrBytes];
+    UINT  size   = BuildImage(pImage, &Header[0], PrgBytes + ChrBytes);
+
+    FILE* pFile = _tfopen(&romPath[0], _T("wb"));
+
+    pTest->Check(pFile && (fwrite(pImage, 1, size, pFile) == size), _T("write ROM file"));
+
+    if (pFile)
+    {
+        fclose(pFile);
+    }
+
+    RomLoader loader(pTest->GetComm());
+
+    RomLoadResult result = loader.StartLoadFile(&missingPath[0], RomLoadFlagVerify);
+    pTest->Check(result == ROM_LOAD_RESULT_OPEN_FAILED, _T("missing file: result %u"), result);
+
+    result = loader.StartLoadFile(&romPath[0], RomLoadFlagVerify);
+    pTest->Check(result == ROM_LOAD_RESULT_SUCCESS, _T("start load: result %u"), result);
+
+    if (result == ROM_LOAD_RESULT_SUCCESS)
+    {
+        // Poll as a UI would, until the load is done or has clearly hung.
+        const DWORD startMs   = GetTimeMs();
+        UINT        bytesDone = 0;
+        BOOL        inOrder   = TRUE;
+
+        while (!loader.IsLoadDone() && (GetTimeMs() - startMs < TimeoutMs))
+        {
+            const UINT polledBytes = loader.GetBytesDone();
+
+            inOrder   = inOrder && (polledBytes >= bytesDone) &&
+                        (polledBytes <= loader.GetTotalBytes());
+            bytesDone = polledBytes;
+
+            Sleep(1);
+        }
+
+        pTest->Check(loader.IsLoadDone(), _T("load done within %u ms"), TimeoutMs);
+        pTest->Check(inOrder, _T("progress in order"));
+
+        result = loader.FinishLoad();
+
+        pTest->Check(result == ROM_LOAD_RESULT_SUCCESS, _T("finish load: result %u"), result);
+        pTest->Check((loader.GetBytesDone() == PrgBytes + ChrBytes) &&
+                     (loader.GetTotalBytes() == PrgBytes + ChrBytes),
+                     _T("sent 0x%X of 0x%X bytes"),
+                     loader.GetBytesDone(),
+                     loader.GetTotalBytes());
+        pTest->Check((memcmp(&pTest->GetSim()->GetCpuMem()[0x8000],
+                             pImage + INesRom::HeaderSize,
+                             PrgBytes) == 0) &&
+                     (memcmp(pTest->GetSim()->GetPpuMem(),
+                             pImage + INesRom::HeaderSize + PrgBytes,
+                             ChrBytes) == 0),
+                     _T("ROM contents"));
+    }
+
+    _tremove(&romPath[0]);
+
+    delete [] pImage;
+}
@@ -0,0 +1,266 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/thread.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  Thread, Mutex and Event class implementation.
+***************************************************************************************************/
+
+#ifndef _WIN32
+#include <errno.h>
+#include <time.h>
+#endif
+
+#include "thread.h"
+
+/***************************************************************************************************
+** % Method:      Thread::Thread()
+*  % Description: Thread constructor.
+***************************************************************************************************/
+Thread::Thread()
+    :
+    m_pfnThreadProc(NULL),
+    m_pContext(NULL),
+    m_running(FALSE)
+#ifdef _WIN32
+    ,
+    m_hThread(NULL)
+#endif
+{
+}
+
+/***************************************************************************************************
+** % Method:      Thread::~Thread()
+*  % Description: Thread destructor.  The thread must have been joined.
+***************************************************************************************************/
+Thread::~Thread()
+{
+    assert(!m_running);
+}
+
+/***************************************************************************************************
+** % Method:      Thread::Start()
+*  % Description: Starts a new thread running pfnThreadProc(pContext).
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL Thread::Start(
+    ThreadProc pfnThreadProc,  // function to run on the new thread
+    VOID*      pContext)       // context passed to pfnThreadProc
+{
+    assert(!m_running);
+
+    m_pfnThreadProc = pfnThreadProc;
+    m_pContext      = pContext;
+
+#ifdef _WIN32
+    m_hThread = CreateThread(NULL, 0, ThreadEntry, this, 0, NULL);
+    m_running = (m_hThread != NULL);
+#else
+    m_running = (pthread_create(&m_thread, NULL, ThreadEntry, this) == 0);
+#endif
+
+    return m_running;
+}
+
+/***************************************************************************************************
+** % Method:      Thread::Join()
+*  % Description: Waits for the thread function to return.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID Thread::Join()
+{
+    if (m_running)
+    {
+#ifdef _WIN32
+        WaitForSingleObject(m_hThread, INFINITE);
+        CloseHandle(m_hThread);
+        m_hThread = NULL;
+#else
+        pthread_join(m_thread, NULL);
+#endif
+
+        m_running = FALSE;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      Thread::ThreadEntry()
+*  % Description: Platform thread entry point; forwards to the Thread object's function.
+***************************************************************************************************/
+#ifdef _WIN32
+DWORD WINAPI Thread::ThreadEntry(
+    LPVOID pParam)  // Thread object
+{
+    Thread* pThread = static_cast<Thread*>(pParam);
+    pThread->m_pfnThreadProc(pThread->m_pContext);
+
+    return 0;
+}
+#else
+VOID* Thread::ThreadEntry(
+    VOID* pParam)  // Thread object
+{
+    Thread* pThread = static_cast<Thread*>(pParam);
+    pThread->m_pfnThreadProc(pThread->m_pContext);
+
+    return NULL;
+}
+#endif
+
+/***************************************************************************************************
+** % Method:      Mutex::Mutex()
+*  % Description: Mutex constructor.
+***************************************************************************************************/
+Mutex::Mutex()
+{
+#ifdef _WIN32
+    InitializeCriticalSection(&m_criticalSection);
+#else
+    pthread_mutex_init(&m_mutex, NULL);
+#endif
+}
+
+/***************************************************************************************************
+** % Method:      Mutex::~Mutex()
+*  % Description: Mutex destructor.
+***************************************************************************************************/
+Mutex::~Mutex()
+{
+#ifdef _WIN32
+    DeleteCriticalSection(&m_criticalSection);
+#else
+    pthread_mutex_destroy(&m_mutex);
+#endif
+}
+
+/***************************************************************************************************
+** % Method:      Mutex::Lock()
+*  % Description: Acquires the lock, waiting for another thread to release it if necessary.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID Mutex::Lock()
+{
+#ifdef _WIN32
+    EnterCriticalSection(&m_criticalSection);
+#else
+    pthread_mutex_lock(&m_mutex);
+#endif
+}
+
+/***************************************************************************************************
+** % Method:      Mutex::Unlock()
+*  % Description: Releases the lock.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID Mutex::Unlock()
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&m_criticalSection);
+#else
+    pthread_mutex_unlock(&m_mutex);
+#endif
+}
+
+/***************************************************************************************************
+** % Method:      Event::Event()
+*  % Description: Event constructor.  The event starts out reset.
+***************************************************************************************************/
+Event::Event()
+{
+#ifdef _WIN32
+    m_hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+    m_signaled = FALSE;
+#endif
+}
+
+/***************************************************************************************************
+** % Method:      Event::~Event()
+*  % Description: Event destructor.
+***************************************************************************************************/
+Event::~Event()
+{
+#ifdef _WIN32
+    CloseHandle(m_hEvent);
+#else
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+#endif
+}
+
+/***************************************************************************************************
+** % Method:      Event::Set()
+*  % Description: Signals the event.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID Event::Set()
+{
+#ifdef _WIN32
+    SetEvent(m_hEvent);
+#else
+    pthread_mutex_lock(&m_mutex);
+    m_signaled = TRUE;
+    pthread_cond_signal(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+#endif
+}
+
+/***************************************************************************************************
+** % Method:      Event::Wait()
+*  % Description: Waits for the event to be signaled, and resets it.
+*  % Returns:     TRUE if the event was signaled before timeoutMs elapsed, FALSE otherwise.
+***************************************************************************************************/
+BOOL Event::Wait(
+    UINT timeoutMs)  // maximum time to wait
+{
+#ifdef _WIN32
+    return (WaitForSingleObject(m_hEvent, timeoutMs) == WAIT_OBJECT_0);
+#else
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+
+    deadline.tv_sec  += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec  += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&m_mutex);
+
+    INT ret = 0;
+    while (!m_signaled && (ret != ETIMEDOUT))
+    {
+        ret = pthread_cond_timedwait(&m_cond, &m_mutex, &deadline);
+    }
+
+    BOOL signaled = m_signaled;
+    m_signaled    = FALSE;
+
+    pthread_mutex_unlock(&m_mutex);
+
+    return signaled;
+#endif
+}
@@ -0,0 +1,125 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/thread.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  Thread, Mutex and Event class header.  Thin wrappers over the Win32 and pthreads primitives used
+*  by the background serial reader.
+***************************************************************************************************/
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "util.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+typedef VOID (*ThreadProc)(VOID* pContext);
+
+/***************************************************************************************************
+** % Class:       Thread
+*  % Description: Runs a function on a new thread.
+***************************************************************************************************/
+class Thread
+{
+public:
+    Thread();
+    ~Thread();
+
+    BOOL Start(ThreadProc pfnThreadProc, VOID* pContext);
+    VOID Join();
+
+private:
+    Thread& operator=(const Thread&);
+    Thread(const Thread&);
+
+#ifdef _WIN32
+    static DWORD WINAPI ThreadEntry(LPVOID pParam);
+#else
+    static VOID* ThreadEntry(VOID* pParam);
+#endif
+
+    ThreadProc m_pfnThreadProc;  // function run by the thread
+    VOID*      m_pContext;       // context passed to m_pfnThreadProc
+    BOOL       m_running;        // TRUE between a successful Start() and Join()
+
+#ifdef _WIN32
+    HANDLE     m_hThread;        // win32 thread handle
+#else
+    pthread_t  m_thread;         // pthreads thread id
+#endif
+};
+
+/***************************************************************************************************
+** % Class:       Mutex
+*  % Description: Non-recursive mutual exclusion lock.
+***************************************************************************************************/
+class Mutex
+{
+public:
+    Mutex();
+    ~Mutex();
+
+    VOID Lock();
+    VOID Unlock();
+
+private:
+    Mutex& operator=(const Mutex&);
+    Mutex(const Mutex&);
+
+#ifdef _WIN32
+    CRITICAL_SECTION m_criticalSection;  // win32 lock
+#else
+    pthread_mutex_t  m_mutex;            // pthreads lock
+#endif
+};
+
+/***************************************************************************************************
+** % Class:       Event
+*  % Description: Auto-reset event.  Set() wakes one waiter, or the next thread to call Wait() if
+*                 none is waiting.
+***************************************************************************************************/
+class Event
+{
+public:
+    Event();
+    ~Event();
+
+    VOID Set();
+    BOOL Wait(UINT timeoutMs);
+
+private:
+    Event& operator=(const Event&);
+    Event(const Event&);
+
+#ifdef _WIN32
+    HANDLE          m_hEvent;    // win32 auto-reset event
+#else
+    pthread_mutex_t m_mutex;     // protects m_signaled
+    pthread_cond_t  m_cond;      // signaled when m_signaled is set
+    BOOL            m_signaled;  // TRUE if Set() has not yet been consumed by Wait()
+#endif
+};
+
+#endif // THREAD_H
@@ -0,0 +1,71 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/transport.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  Transport class implementation.
+***************************************************************************************************/
+
+#include "hcisim.h"
+#include "posixserialtransport.h"
+#include "transport.h"
+#include "win32serialtransport.h"
+
+/***************************************************************************************************
+** % Method:      Transport::Create()
+*  % Description: Factory method for the transport used to reach the specified port.  The special
+*                 port name "sim" selects the in-process HCI simulator; anything else is a serial
+*                 port on the host platform.
+*  % Returns:     New (unopened) Transport object.
+***************************************************************************************************/
+Transport* Transport::Create(
+    const TCHAR* pPortName)  // port name that will be passed to Open()
+{
+    if (_tcscmp(pPortName, HciSim::GetPortName()) == 0)
+    {
+        return new HciSim();
+    }
+
+#ifdef _WIN32
+    return new Win32SerialTransport();
+#else
+    return new PosixSerialTransport();
+#endif
+}
+
+/***************************************************************************************************
+** % Method:      Transport::EnumeratePorts()
+*  % Description: Lists the serial ports on the host platform that could have an NES FPGA attached.
+*                 The simulator is never included.
+*  % Returns:     Number of port names stored in pPortNames.
+***************************************************************************************************/
+UINT Transport::EnumeratePorts(
+    TCHAR (*pPortNames)[MaxPortNameLen],  // receives the port names
+    UINT  maxPorts)                       // capacity of pPortNames
+{
+#ifdef _WIN32
+    return Win32SerialTransport::EnumeratePorts(pPortNames, maxPorts);
+#else
+    return PosixSerialTransport::EnumeratePorts(pPortNames, maxPorts);
+#endif
+}
+
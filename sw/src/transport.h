@@ -0,0 +1,87 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/transport.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  Transport class header.
+***************************************************************************************************/
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "util.h"
+
+// Conditions for Transport::WaitForIo().
+enum TransportIo
+{
+    TransportIoRead  = 0x1, // received data is available
+    TransportIoWrite = 0x2, // Write() can accept more data
+};
+
+/***************************************************************************************************
+** % Class:       Transport
+*  % Description: Abstract byte stream connection to the NES FPGA's host communication interface.
+*                 SerialComm layers the debug protocol on top of a Transport; concrete subclasses
+*                 provide the platform serial port implementations and the HciSim device model.
+***************************************************************************************************/
+class Transport
+{
+public:
+    static const UINT MaxPortNameLen = 128;  // longest port name, including the terminator
+
+    static Transport* Create(const TCHAR* pPortName);
+
+    // Lists the serial ports on the host platform that could have an NES FPGA attached.  Returns
+    // the number of names stored, at most maxPorts.
+    static UINT EnumeratePorts(TCHAR (*pPortNames)[MaxPortNameLen], UINT maxPorts);
+
+    virtual ~Transport() {};
+
+    virtual BOOL Open(const TCHAR* pPortName, UINT baudRate) = 0;
+    virtual VOID Close() = 0;
+
+    // Changes the baud rate of an open transport, after any data already written has been sent.
+    virtual BOOL SetBaudRate(UINT baudRate) = 0;
+
+    // Write/Read return the number of bytes transferred, which is less than numBytes only if
+    // timeoutMs elapses first.  A timeoutMs of 0 transfers only what can be done immediately.
+    virtual UINT Write(const BYTE* pData, UINT numBytes, UINT timeoutMs) = 0;
+    virtual UINT Read(BYTE* pData, UINT numBytes, UINT timeoutMs) = 0;
+
+    // Blocks until any of the TransportIo conditions in ioFlags holds, or until timeoutMs
+    // elapses.  Returns TRUE if the transport became ready.  Reading and writing may be done from
+    // different threads.
+    virtual BOOL WaitForIo(UINT ioFlags, UINT timeoutMs) = 0;
+
+    // Discard any data buffered in either direction.
+    virtual VOID Purge() = 0;
+
+protected:
+    Transport() {};
+
+private:
+    Transport& operator=(const Transport&);
+    Transport(const Transport&);
+};
+
+#endif // TRANSPORT_H
+
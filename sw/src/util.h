@@ -28,12 +28,15 @@
 #ifndef UTIL_H
 #define UTIL_H
 
-#include <windows.h>
-#include <tchar.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#include "platform.h"
 
 #if _DEBUG
 
+#ifdef _WIN32
+
 /***************************************************************************************************
 ** % Function:    Assert
 *  % Description: Displays a message box with relevant assert data then issues a debug break.
@@ -53,6 +56,23 @@ static inline VOID Assert(
     DebugBreak();
 }
 
+#else // _WIN32
+
+/***************************************************************************************************
+** % Function:    Assert
+*  % Description: Prints relevant assert data to stderr then aborts.
+***************************************************************************************************/
+static inline VOID Assert(
+    const CHAR* pExpr,  // expression string
+    const CHAR* pFile,  // file string
+    UINT        line)   // line number
+{
+    fprintf(stderr, "Assertion failed:\t(%s)\nFile:\t\t%s\nLine:\t\t%d\n", pExpr, pFile, line);
+    abort();
+}
+
+#endif // _WIN32
+
 #define assert(exp) (VOID)((exp) || (Assert(#exp, __FILE__, __LINE__), 0))
 
 #else
@@ -61,6 +81,13 @@ static inline VOID Assert(
 
 #endif // DEBUG
 
+// Compile-time assertion, for use in function bodies.  StaticAssertion<false> is never defined, so
+// a false expression fails to compile.  (Use sizeof(StaticAssertion<exp>) in class scope.)
+template <bool> struct StaticAssertion;
+template <> struct StaticAssertion<true> { static VOID Check() {} };
+
+#define STATIC_ASSERT(exp) StaticAssertion<(exp)>::Check()
+
 #ifdef  _UNICODE
 
 /***************************************************************************************************
@@ -90,6 +117,7 @@ static inline CHAR* CreateAsciiString(
 static inline VOID DestroyAsciiString(
     const CHAR* pIn)
 {
+    UNREFERENCED_PARAMETER(pIn);
     delete [] pIn;
 }
 
@@ -120,6 +148,7 @@ static inline TCHAR* CreateTcharString(
 static inline VOID DestroyTcharString(
     const TCHAR* pIn)
 {
+    UNREFERENCED_PARAMETER(pIn);
     delete [] pIn;
 }
 
@@ -134,7 +163,7 @@ static inline CHAR* CreateAsciiString(
     const TCHAR* pIn)
 {
     // CHAR/TCHAR are equivalent for non-unicode builds.
-    return pIn;
+    return const_cast<CHAR*>(pIn);
 }
 
 /***************************************************************************************************
@@ -145,6 +174,7 @@ static inline CHAR* CreateAsciiString(
 static inline VOID DestroyAsciiString(
     const CHAR* pIn)
 {
+    UNREFERENCED_PARAMETER(pIn);
 }
 
 /***************************************************************************************************
@@ -156,7 +186,7 @@ static inline TCHAR* CreateTcharString(
     const CHAR* pIn)
 {
     // CHAR/TCHAR are equivalent for non-unicode builds.
-    return pIn;
+    return const_cast<TCHAR*>(pIn);
 }
 
 /***************************************************************************************************
@@ -167,9 +197,25 @@ static inline TCHAR* CreateTcharString(
 static inline VOID DestroyTcharString(
     const TCHAR* pIn)
 {
+    UNREFERENCED_PARAMETER(pIn);
 }
 
 #endif // _UNICODE
 
+/***************************************************************************************************
+** % Function:    ReportError
+*  % Description: Reports an error to the user: a message box on Windows, stderr elsewhere.
+*  % Returns:     N/A
+***************************************************************************************************/
+static inline VOID ReportError(
+    const TCHAR* pMsg)  // error message
+{
+#ifdef _WIN32
+    MessageBox(NULL, pMsg, _T("NesDbg"), MB_OK);
+#else
+    fprintf(stderr, "NesDbg: %s\n", pMsg);
+#endif
+}
+
 #endif // UTIL_H
 
@@ -0,0 +1,482 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/win32serialtransport.cpp
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  Win32SerialTransport class implementation.
+***************************************************************************************************/
+
+#ifdef _WIN32
+
+#include "win32serialtransport.h"
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::Win32SerialTransport()
+*  % Description: Win32SerialTransport constructor.
+***************************************************************************************************/
+Win32SerialTransport::Win32SerialTransport()
+    :
+    m_hSerialComm(INVALID_HANDLE_VALUE),
+    m_writePending(FALSE),
+    m_waitPending(FALSE),
+    m_commEventMask(0)
+{
+    memset(&m_readOverlapped, 0, sizeof(m_readOverlapped));
+    memset(&m_writeOverlapped, 0, sizeof(m_writeOverlapped));
+    memset(&m_waitOverlapped, 0, sizeof(m_waitOverlapped));
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::~Win32SerialTransport()
+*  % Description: Win32SerialTransport destructor.
+***************************************************************************************************/
+Win32SerialTransport::~Win32SerialTransport()
+{
+    Close();
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::Open()
+*  % Description: Opens the specified COM port and configures it for the NES FPGA: 8 data bits, odd
+*                 parity, 1 stop bit.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL Win32SerialTransport::Open(
+    const TCHAR* pPortName,  // port name (e.g., "COM5")
+    UINT         baudRate)   // baud rate
+{
+    BOOL ret = TRUE;
+
+    // COM10 and up can only be opened through the device namespace.
+    TCHAR devicePath[MaxPortNameLen + 4];
+    _stprintf_s(&devicePath[0],
+                MaxPortNameLen + 4,
+                (pPortName[0] == _T('\\')) ? _T("%s") : _T("\\\\.\\%s"),
+                pPortName);
+
+    if (ret)
+    {
+        m_hSerialComm = CreateFile(&devicePath[0],
+                                   GENERIC_READ | GENERIC_WRITE,
+                                   0,
+                                   0,
+                                   OPEN_EXISTING,
+                                   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+                                   0);
+
+        ret = (m_hSerialComm != INVALID_HANDLE_VALUE);
+    }
+
+    if (ret)
+    {
+        // Manual reset events, so a completed operation stays signaled until the next one starts.
+        m_readOverlapped.hEvent  = CreateEvent(NULL, TRUE, FALSE, NULL);
+        m_writeOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        m_waitOverlapped.hEvent  = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+        ret = m_readOverlapped.hEvent && m_writeOverlapped.hEvent && m_waitOverlapped.hEvent;
+    }
+
+    DCB serialConfig = {0};
+    if (ret)
+    {
+        serialConfig.DCBlength = sizeof(DCB);
+
+        ret = GetCommState(m_hSerialComm, &serialConfig);
+    }
+
+    if (ret)
+    {
+        serialConfig.BaudRate = baudRate;
+        serialConfig.ByteSize = 8;
+        serialConfig.StopBits = ONESTOPBIT;
+        serialConfig.Parity   = ODDPARITY;
+
+        ret = SetCommState(m_hSerialComm, &serialConfig);
+    }
+
+    if (ret)
+    {
+        // MAXDWORD interval with zero totals makes ReadFile return immediately with whatever is
+        // buffered.  Read/Write deadlines are enforced by waiting on the overlapped events.
+        COMMTIMEOUTS timeouts = {0};
+        timeouts.ReadIntervalTimeout = MAXDWORD;
+
+        ret = SetCommTimeouts(m_hSerialComm, &timeouts) &&
+              SetCommMask(m_hSerialComm, EV_RXCHAR);
+    }
+
+    if (!ret)
+    {
+        Close();
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::Close()
+*  % Description: Closes the COM port, if open.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID Win32SerialTransport::Close()
+{
+    if (m_hSerialComm != INVALID_HANDLE_VALUE)
+    {
+        // Give the last write a chance to reach the driver before tearing it down.
+        if (m_writePending)
+        {
+            CompleteWrite(WriteDrainTimeoutMs);
+        }
+
+        CancelPendingIo();
+
+        CloseHandle(m_hSerialComm);
+        m_hSerialComm = INVALID_HANDLE_VALUE;
+    }
+
+    OVERLAPPED* overlapped[] = { &m_readOverlapped, &m_writeOverlapped, &m_waitOverlapped };
+    for (UINT i = 0; i < sizeof(overlapped) / sizeof(overlapped[0]); i++)
+    {
+        if (overlapped[i]->hEvent)
+        {
+            CloseHandle(overlapped[i]->hEvent);
+            overlapped[i]->hEvent = NULL;
+        }
+    }
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::SetBaudRate()
+*  % Description: Changes the COM port baud rate once all previously written data has been
+*                 transmitted.
+*  % Returns:     TRUE on success, FALSE otherwise.
+***************************************************************************************************/
+BOOL Win32SerialTransport::SetBaudRate(
+    UINT baudRate)  // new baud rate
+{
+    BOOL ret = TRUE;
+
+    // Let the driver finish sending data written at the old rate.
+    if (m_writePending)
+    {
+        ret = CompleteWrite(WriteDrainTimeoutMs);
+    }
+
+    if (ret)
+    {
+        ret = FlushFileBuffers(m_hSerialComm);
+    }
+
+    DCB serialConfig = {0};
+    if (ret)
+    {
+        serialConfig.DCBlength = sizeof(DCB);
+
+        ret = GetCommState(m_hSerialComm, &serialConfig);
+    }
+
+    if (ret)
+    {
+        serialConfig.BaudRate = baudRate;
+
+        ret = SetCommState(m_hSerialComm, &serialConfig);
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::Write()
+*  % Description: Transmits up to numBytes through the COM port, waiting at most timeoutMs.  Data
+*                 is handed to the driver with overlapped writes of up to TxBufSize bytes; the last
+*                 write may still be in flight when this returns.
+*  % Returns:     Number of bytes written.
+***************************************************************************************************/
+UINT Win32SerialTransport::Write(
+    const BYTE* pData,      // data to transmit
+    UINT        numBytes,   // number of bytes to transmit
+    UINT        timeoutMs)  // maximum time to wait for the write to complete
+{
+    const DWORD startMs      = GetTimeMs();
+    UINT        bytesWritten = 0;
+
+    while (bytesWritten < numBytes)
+    {
+        // Only one write may be outstanding at a time.
+        if (m_writePending && !CompleteWrite(RemainingMs(startMs, timeoutMs)))
+        {
+            break;
+        }
+
+        UINT chunkSize = numBytes - bytesWritten;
+        if (chunkSize > TxBufSize)
+        {
+            chunkSize = TxBufSize;
+        }
+
+        memcpy(&m_txBuf[0], pData + bytesWritten, chunkSize);
+
+        if (!WriteFile(m_hSerialComm, &m_txBuf[0], chunkSize, NULL, &m_writeOverlapped) &&
+            (GetLastError() != ERROR_IO_PENDING))
+        {
+            break;
+        }
+
+        m_writePending = TRUE;
+        bytesWritten  += chunkSize;
+    }
+
+    return bytesWritten;
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::Read()
+*  % Description: Receives up to numBytes from the COM port, waiting at most timeoutMs for them to
+*                 arrive.
+*  % Returns:     Number of bytes read.
+***************************************************************************************************/
+UINT Win32SerialTransport::Read(
+    BYTE* pData,      // where to store received data
+    UINT  numBytes,   // number of bytes to receive
+    UINT  timeoutMs)  // maximum time to wait for the data
+{
+    const DWORD startMs   = GetTimeMs();
+    UINT        bytesRead = 0;
+
+    while (bytesRead < numBytes)
+    {
+        // With the MAXDWORD read interval this completes immediately with the buffered data.
+        DWORD chunkSize = 0;
+
+        if ((!ReadFile(m_hSerialComm, pData + bytesRead, numBytes - bytesRead, NULL,
+                       &m_readOverlapped) &&
+             (GetLastError() != ERROR_IO_PENDING)) ||
+            !GetOverlappedResult(m_hSerialComm, &m_readOverlapped, &chunkSize, TRUE))
+        {
+            break;
+        }
+
+        bytesRead += chunkSize;
+
+        if (bytesRead < numBytes)
+        {
+            UINT remainingMs = RemainingMs(startMs, timeoutMs);
+
+            if ((remainingMs == 0) || !WaitForIo(TransportIoRead, remainingMs))
+            {
+                break;
+            }
+        }
+    }
+
+    return bytesRead;
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::WaitForIo()
+*  % Description: Waits for received data (EV_RXCHAR) and/or for the outstanding write to
+*                 complete, as selected by ioFlags.  Read waits touch only the read side state and
+*                 write waits only the write side, so a reader thread and a writer thread may wait
+*                 concurrently.
+*  % Returns:     TRUE if the port became ready before timeoutMs elapsed, FALSE otherwise.
+***************************************************************************************************/
+BOOL Win32SerialTransport::WaitForIo(
+    UINT ioFlags,    // TransportIo conditions to wait for
+    UINT timeoutMs)  // maximum time to wait
+{
+    const BOOL waitRead  = (ioFlags & TransportIoRead) != 0;
+    const BOOL waitWrite = (ioFlags & TransportIoWrite) != 0;
+
+    if (waitWrite && !m_writePending)
+    {
+        return TRUE;
+    }
+
+    if (!waitRead)
+    {
+        return CompleteWrite(timeoutMs);
+    }
+
+    // EV_RXCHAR only reports characters that arrive after the wait is armed, so check what the
+    // driver has already buffered both before and after arming it.
+    DWORD   commErrors;
+    COMSTAT commStat;
+
+    if (ClearCommError(m_hSerialComm, &commErrors, &commStat) && (commStat.cbInQue > 0))
+    {
+        return TRUE;
+    }
+
+    if (!m_waitPending)
+    {
+        if (WaitCommEvent(m_hSerialComm, &m_commEventMask, &m_waitOverlapped))
+        {
+            return TRUE;
+        }
+        else if (GetLastError() != ERROR_IO_PENDING)
+        {
+            return FALSE;
+        }
+
+        m_waitPending = TRUE;
+
+        if (ClearCommError(m_hSerialComm, &commErrors, &commStat) && (commStat.cbInQue > 0))
+        {
+            return TRUE;
+        }
+    }
+
+    HANDLE hEvents[] = { m_waitOverlapped.hEvent, m_writeOverlapped.hEvent };
+    DWORD  ret       = WaitForMultipleObjects((waitWrite) ? 2 : 1, hEvents, FALSE, timeoutMs);
+
+    if (ret == WAIT_OBJECT_0)
+    {
+        DWORD unused;
+        GetOverlappedResult(m_hSerialComm, &m_waitOverlapped, &unused, FALSE);
+        m_waitPending = FALSE;
+    }
+
+    return (ret == WAIT_OBJECT_0) || (ret == WAIT_OBJECT_0 + 1);
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::Purge()
+*  % Description: Discards any data buffered by the driver in either direction.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID Win32SerialTransport::Purge()
+{
+    PurgeComm(m_hSerialComm, PURGE_RXABORT | PURGE_RXCLEAR | PURGE_TXABORT | PURGE_TXCLEAR);
+
+    // PURGE_TXABORT terminates the outstanding write; reap it.
+    if (m_writePending)
+    {
+        CompleteWrite(INFINITE);
+    }
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::CompleteWrite()
+*  % Description: Waits for the outstanding overlapped write to complete.
+*  % Returns:     TRUE if the write completed successfully before timeoutMs elapsed, FALSE
+*                 otherwise.
+***************************************************************************************************/
+BOOL Win32SerialTransport::CompleteWrite(
+    UINT timeoutMs)  // maximum time to wait
+{
+    assert(m_writePending);
+
+    BOOL ret = (WaitForSingleObject(m_writeOverlapped.hEvent, timeoutMs) == WAIT_OBJECT_0);
+
+    if (ret)
+    {
+        DWORD bytesWritten = 0;
+
+        ret = GetOverlappedResult(m_hSerialComm, &m_writeOverlapped, &bytesWritten, FALSE);
+        m_writePending = FALSE;
+    }
+
+    return ret;
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::CancelPendingIo()
+*  % Description: Cancels outstanding overlapped operations and waits for them to finish, so their
+*                 OVERLAPPED structures and buffers can be released.
+*  % Returns:     N/A
+***************************************************************************************************/
+VOID Win32SerialTransport::CancelPendingIo()
+{
+    DWORD unused;
+
+    CancelIo(m_hSerialComm);
+
+    if (m_writePending)
+    {
+        GetOverlappedResult(m_hSerialComm, &m_writeOverlapped, &unused, TRUE);
+        m_writePending = FALSE;
+    }
+
+    if (m_waitPending)
+    {
+        GetOverlappedResult(m_hSerialComm, &m_waitOverlapped, &unused, TRUE);
+        m_waitPending = FALSE;
+    }
+}
+
+/***************************************************************************************************
+** % Method:      Win32SerialTransport::EnumeratePorts()
+*  % Description: Lists the COM ports currently present, from the SERIALCOMM device map.  Windows
+*                 gives a USB serial adapter the same COM number each time it is plugged in, so a
+*                 board keeps its name across replugs.
+*  % Returns:     Number of port names stored in pPortNames.
+***************************************************************************************************/
+UINT Win32SerialTransport::EnumeratePorts(
+    TCHAR (*pPortNames)[MaxPortNameLen],  // receives the port names
+    UINT  maxPorts)                       // capacity of pPortNames
+{
+    UINT portCnt = 0;
+    HKEY hKey;
+
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE,
+                     _T("HARDWARE\\DEVICEMAP\\SERIALCOMM"),
+                     0,
+                     KEY_READ,
+                     &hKey) == ERROR_SUCCESS)
+    {
+        for (DWORD valueIdx = 0; portCnt < maxPorts; valueIdx++)
+        {
+            TCHAR valueName[MaxPortNameLen];
+            DWORD valueNameLen = MaxPortNameLen;
+            DWORD valueType    = 0;
+            DWORD dataSize     = (MaxPortNameLen - 1) * sizeof(TCHAR);
+
+            LONG result = RegEnumValue(hKey,
+                                       valueIdx,
+                                       &valueName[0],
+                                       &valueNameLen,
+                                       NULL,
+                                       &valueType,
+                                       reinterpret_cast<LPBYTE>(pPortNames[portCnt]),
+                                       &dataSize);
+
+            if (result == ERROR_NO_MORE_ITEMS)
+            {
+                break;
+            }
+
+            if ((result == ERROR_SUCCESS) && (valueType == REG_SZ))
+            {
+                // Registry strings aren't guaranteed to be terminated.
+                pPortNames[portCnt][dataSize / sizeof(TCHAR)] = 0;
+                portCnt++;
+            }
+        }
+
+        RegCloseKey(hKey);
+    }
+
+    return portCnt;
+}
+
+#endif // _WIN32
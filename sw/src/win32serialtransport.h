@@ -0,0 +1,81 @@
+/***************************************************************************************************
+** fpga_nes/sw/src/win32serialtransport.h
+*
+*  Copyright (c) 2012, Brian Bennett
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without modification, are permitted
+*  provided that the following conditions are met:
+*
+*  1. Redistributions of source code must retain the above copyright notice, this list of conditions
+*     and the following disclaimer.
+*  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+*     conditions and the following disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+*  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+*  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+*  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+*  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+*  WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*  Win32SerialTransport class header.
+***************************************************************************************************/
+
+#ifndef WIN32SERIALTRANSPORT_H
+#define WIN32SERIALTRANSPORT_H
+
+#ifdef _WIN32
+
+#include "transport.h"
+
+/***************************************************************************************************
+** % Class:       Win32SerialTransport
+*  % Description: Transport implementation for a Win32 COM port.  The port is opened for overlapped
+*                 I/O, so a write can be in flight while the caller is reading.
+***************************************************************************************************/
+class Win32SerialTransport : public Transport
+{
+public:
+    Win32SerialTransport();
+    virtual ~Win32SerialTransport();
+
+    virtual BOOL Open(const TCHAR* pPortName, UINT baudRate);
+    virtual VOID Close();
+    virtual BOOL SetBaudRate(UINT baudRate);
+
+    virtual UINT Write(const BYTE* pData, UINT numBytes, UINT timeoutMs);
+    virtual UINT Read(BYTE* pData, UINT numBytes, UINT timeoutMs);
+
+    virtual BOOL WaitForIo(UINT ioFlags, UINT timeoutMs);
+    virtual VOID Purge();
+
+    static UINT EnumeratePorts(TCHAR (*pPortNames)[MaxPortNameLen], UINT maxPorts);
+
+private:
+    Win32SerialTransport& operator=(const Win32SerialTransport&);
+    Win32SerialTransport(const Win32SerialTransport&);
+
+    BOOL CompleteWrite(UINT timeoutMs);
+    VOID CancelPendingIo();
+
+    static const UINT TxBufSize           = 0x1000;  // maximum size of a single overlapped write
+    static const UINT WriteDrainTimeoutMs = 1000;    // time allowed for the last write to finish
+
+    HANDLE     m_hSerialComm;          // win32 handle to debug serial port
+    OVERLAPPED m_readOverlapped;       // overlapped state for ReadFile
+    OVERLAPPED m_writeOverlapped;      // overlapped state for the outstanding WriteFile
+    OVERLAPPED m_waitOverlapped;       // overlapped state for the outstanding WaitCommEvent
+    BOOL       m_writePending;         // TRUE while a WriteFile is outstanding
+    BOOL       m_waitPending;          // TRUE while a WaitCommEvent is outstanding
+    DWORD      m_commEventMask;        // receives the events reported by WaitCommEvent
+    BYTE       m_txBuf[TxBufSize];     // data for the outstanding WriteFile
+};
+
+#endif // _WIN32
+
+#endif // WIN32SERIALTRANSPORT_H
+